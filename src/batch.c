@@ -0,0 +1,391 @@
+/*
+ * opt-65816 - Assembly code optimizer for the WDC 65816 processor.
+ *
+ * Description: Assembly code optimizer produced
+ * by the 816 Tiny C Compiler (816-tcc).
+ * This library is a C port of the 816-opt python tool.
+ *
+ * Author: kobenairb (kobenairb@gmail.com).
+ *
+ * Copyright (c) 2022.
+ *
+ * This project is released under the GNU Public License.
+ *
+ */
+
+#include "batch.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief Create an empty list of files.
+ * @return A structure (fileList).
+ */
+fileList newFileList(void)
+{
+    fileList list = { NULL, 0, 0, arenaNew() };
+
+    return list;
+}
+
+/**
+ * @brief Add a path to a list of files (the path is copied).
+ * @param list The fileList structure.
+ * @param path The path.
+ * @param len The length of the path.
+ */
+void pushFile(fileList *list, const char *path, const size_t len)
+{
+    if (list->used == list->size)
+    {
+        size_t size = list->size ? list->size * 2 : 64;
+        char **arr  = realloc(list->arr, size * sizeof(char *));
+
+        if (!arr)
+        {
+            perror("realloc-files");
+            exit(EXIT_FAILURE);
+        }
+        list->arr  = arr;
+        list->size = size;
+    }
+    list->arr[list->used++] = arenaStrdup(list->strings, path, len);
+}
+
+/**
+ * @brief Add the paths listed in a response file (one path per line,
+ * empty lines are ignored) to a list of files.
+ * @param list The fileList structure.
+ * @param path The path of the response file.
+ */
+void readResponseFile(fileList *list, const char *path)
+{
+    textBuffer text = loadText(path);
+    char *p         = text.data;
+    char *end       = text.data + text.len;
+
+    while (p < end)
+    {
+        char *eol = memchr(p, '\n', end - p);
+        if (!eol)
+            eol = end;
+        *eol = '\0';
+
+        char *name = trimWhiteSpace(p);
+        if (*name)
+            pushFile(list, name, strlen(name));
+        p = eol + 1;
+    }
+
+    freeText(text);
+}
+
+/**
+ * @brief Free a list of files.
+ * @param list The fileList structure.
+ */
+void freeFileList(fileList list)
+{
+    free(list.arr);
+    arenaFree(list.strings);
+}
+
+/**
+ * @brief Connect to the GNU make jobserver given in MAKEFLAGS
+ * ("--jobserver-auth=R,W", "--jobserver-auth=fifo:PATH" or the older
+ * "--jobserver-fds=R,W"). Without jobserver (or when make has not
+ * passed the descriptors: recipe without "+" or $(MAKE)), the jobs
+ * run without token.
+ * @return A structure (jobServer).
+ */
+jobServer jobServerOpen(void)
+{
+    jobServer js = { -1, -1, 0, 0 };
+
+    pthread_mutex_init(&js.lock, NULL);
+
+#ifndef _WIN32
+    const char *flags = getenv("MAKEFLAGS");
+    const char *auth  = NULL;
+
+    /* The last option wins */
+    for (const char *p = flags; p && (p = strstr(p, "--jobserver-")) != NULL; p++)
+        auth = p;
+    if (!auth || (auth = strchr(auth, '=')) == NULL)
+        return js;
+    auth += 1;
+
+    if (startWith(auth, "fifo:"))
+    {
+        char path[MAXLEN_LINE];
+        size_t len = strcspn(auth + 5, " ");
+
+        if (len == 0 || len >= sizeof(path))
+            return js;
+        memcpy(path, auth + 5, len);
+        path[len] = '\0';
+
+        if ((js.rfd = open(path, O_RDWR)) >= 0)
+        {
+            js.wfd  = js.rfd;
+            js.fifo = 1;
+        }
+        return js;
+    }
+
+    int rfd, wfd;
+    if (sscanf(auth, "%d,%d", &rfd, &wfd) == 2 && rfd >= 0 && wfd >= 0
+        && fcntl(rfd, F_GETFD) != -1 && fcntl(wfd, F_GETFD) != -1)
+    {
+        js.rfd = rfd;
+        js.wfd = wfd;
+    }
+#endif
+
+    return js;
+}
+
+/**
+ * @brief Wait for the right to run a job. The first job takes the
+ * implicit slot of the process, the others read a token from the jobserver.
+ * @param js The jobServer structure.
+ * @return The token to give back (see jobServerRelease function).
+ */
+int jobServerAcquire(jobServer *js)
+{
+    if (js->rfd < 0)
+        return JOB_TOKEN_NONE;
+
+    pthread_mutex_lock(&js->lock);
+    if (!js->implicitBusy)
+    {
+        js->implicitBusy = 1;
+        pthread_mutex_unlock(&js->lock);
+        return JOB_TOKEN_IMPLICIT;
+    }
+    pthread_mutex_unlock(&js->lock);
+
+#ifndef _WIN32
+    for (;;)
+    {
+        unsigned char token;
+        ssize_t n = read(js->rfd, &token, 1);
+
+        if (n == 1)
+            return token;
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            struct pollfd pfd = { js->rfd, POLLIN, 0 };
+            poll(&pfd, 1, -1);
+            continue;
+        }
+        break; // Broken jobserver: run without token
+    }
+#endif
+
+    return JOB_TOKEN_NONE;
+}
+
+/**
+ * @brief Give back the right to run a job (see jobServerAcquire function).
+ * @param js The jobServer structure.
+ * @param token The token.
+ */
+void jobServerRelease(jobServer *js, const int token)
+{
+    if (token == JOB_TOKEN_NONE)
+        return;
+
+    if (token == JOB_TOKEN_IMPLICIT)
+    {
+        pthread_mutex_lock(&js->lock);
+        js->implicitBusy = 0;
+        pthread_mutex_unlock(&js->lock);
+        return;
+    }
+
+#ifndef _WIN32
+    unsigned char c = (unsigned char)token;
+
+    while (write(js->wfd, &c, 1) < 0 && errno == EINTR)
+        ;
+#endif
+}
+
+/**
+ * @brief Disconnect from the jobserver.
+ * @param js The jobServer structure.
+ */
+void jobServerClose(jobServer *js)
+{
+#ifndef _WIN32
+    if (js->fifo)
+        close(js->rfd);
+#endif
+    pthread_mutex_destroy(&js->lock);
+}
+
+/**
+ * @brief Get the file name of a path.
+ * @param path The path.
+ * @return The file name (points into path).
+ */
+const char *baseName(const char *path)
+{
+    const char *name = path;
+
+    for (const char *p = path; *p; p++)
+    {
+        if (*p == '/' || *p == '\\')
+            name = p + 1;
+    }
+
+    return name;
+}
+
+/**
+ * @brief Record a file of a batch not optimized: the other files go on,
+ * and the tokens are given back (see optimizeBatch function).
+ * @param batch The batchJob structure.
+ * @param path The file (printed with errno).
+ */
+static void failFile(batchJob *batch, const char *path)
+{
+    perror(path);
+
+    pthread_mutex_lock(&batch->lock);
+    batch->failed += 1;
+    pthread_mutex_unlock(&batch->lock);
+}
+
+/**
+ * @brief Optimize one file of a batch (see poolRun function). The fatal
+ * errors (input unreadable, out of memory) only fail the file (see
+ * fatalCatch function).
+ * @param ctx The batchJob structure.
+ * @param job The index of the file.
+ */
+static void runFile(void *ctx, size_t job)
+{
+    batchJob *batch   = ctx;
+    const char *input = batch->inputs->arr[job];
+    int token         = jobServerAcquire(batch->js);
+    optStats stats    = { 0 };
+    optStats *ps      = batch->report ? &stats : NULL;
+    uint64_t start    = ps ? nowNs() : 0;
+    jmp_buf env;
+    jmp_buf *outer = fatalCatch(&env);
+
+    if (setjmp(env))
+    {
+        fatalCatch(outer);
+        failFile(batch, input);
+        if (ps)
+            freeStats(ps);
+        jobServerRelease(batch->js, token);
+        return;
+    }
+
+    asmFile file = tidyPath(input);
+    if (ps)
+        ps->tidy = nowNs() - start;
+    asmFile optAsm = optimizeCached(file, batch->cache, batch->verbose, 1, batch->level, ps);
+    fatalCatch(outer);
+
+    char output[MAXLEN_LINE];
+    if (batch->outdir)
+        snprintf(output, sizeof(output), "%s/%s", batch->outdir, baseName(input));
+    else
+        snprintf(output, sizeof(output), "%s", input);
+
+    start = ps ? nowNs() : 0;
+    if (writeAsm(&optAsm, output) != 0)
+    {
+        failFile(batch, output);
+    }
+    else if (ps)
+    {
+        ps->emit = nowNs() - start;
+        statsReport(batch->report, input, ps);
+    }
+    if (ps)
+        freeStats(ps);
+
+    freeAsmFile(optAsm);
+    jobServerRelease(batch->js, token);
+}
+
+/**
+ * @brief Optimize a list of files, each one is written with the same
+ * name in the output directory, or over itself without output directory
+ * (see writeAsm function). The files are optimized concurrently by a pool
+ * of threads, which takes jobserver tokens when run by make.
+ * @param inputs The input files.
+ * @param outdir The output directory (it must exist, NULL to rewrite the inputs).
+ * @param workers The number of threads (0 = one per CPU with a jobserver, 1 otherwise).
+ * @param cache The cache (NULL if none).
+ * @param verbose The level of verbosity (only used with a single thread,
+ * the messages of several files would be mixed).
+ * @param level The optimization level (see OPT_LEVEL_MAX).
+ * @param report The stream of the reports, one line per file (NULL if none,
+ * see statsReport function).
+ * @return 0, or 1 if a file could not be optimized (the others are).
+ */
+int optimizeBatch(const fileList *inputs, const char *outdir, size_t workers, optCache *cache, const size_t verbose,
+                   const int level, FILE *report)
+{
+    jobServer js = jobServerOpen();
+
+    /* Two inputs with the same name would write the same output */
+    strSet names = newStrSet();
+    for (size_t i = 0; i < inputs->used; i++)
+    {
+        const char *name = outdir ? baseName(inputs->arr[i]) : inputs->arr[i];
+        if (strSetHas(&names, name, strlen(name)))
+        {
+            fprintf(stderr, "%s: several inputs are named %s.\n", outdir ? outdir : "-i", name);
+            exit(EXIT_FAILURE);
+        }
+        strSetAdd(&names, name, strlen(name));
+    }
+    freeStrSet(names);
+
+    if (workers == 0)
+    {
+        workers = 1;
+#ifndef _WIN32
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (js.rfd >= 0 && cpus > 1)
+            workers = (size_t)cpus;
+#endif
+    }
+    if (workers > inputs->used)
+        workers = inputs->used ? inputs->used : 1;
+
+    batchJob batch = { inputs, outdir, &js, cache, workers == 1 ? verbose : 0, level, report, 0 };
+    pthread_mutex_init(&batch.lock, NULL);
+
+    if (workers > 1)
+    {
+        threadPool *pool = poolNew(workers - 1);
+        poolRun(pool, inputs->used, runFile, &batch);
+        poolFree(pool);
+    }
+    else
+    {
+        for (size_t i = 0; i < inputs->used; i++)
+            runFile(&batch, i);
+    }
+
+    jobServerClose(&js);
+    pthread_mutex_destroy(&batch.lock);
+
+    return batch.failed ? 1 : 0;
+}
@@ -0,0 +1,118 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "cache.h"
+#include "helpers.h"
+#include "optimizer.h"
+#include "output.h"
+#include "pool.h"
+
+/*!
+ * @brief Prefix of a response file argument (a file listing the inputs).
+ */
+#define RESPONSE_FILE_PREFIX '@'
+
+/*!
+ * @brief Token of a job running on the implicit slot of the process
+ * (see jobServerAcquire function).
+ */
+#define JOB_TOKEN_IMPLICIT -1
+/*!
+ * @brief Token of a job running without jobserver.
+ */
+#define JOB_TOKEN_NONE -2
+
+/**
+ * @struct fileList
+ * @brief The input files of a batch (see pushFile function).
+ * @var fileList::arr
+ * Member 'arr' contains the paths.
+ * @var fileList::used
+ * Member 'used' contains the number of paths.
+ * @var fileList::size
+ * Member 'size' contains the number of paths allocated.
+ * @var fileList::strings
+ * Member 'strings' contains the arena of the paths.
+ */
+typedef struct fileList
+{
+    char **arr;
+    size_t used;
+    size_t size;
+    arena *strings;
+} fileList;
+
+/**
+ * @struct jobServer
+ * @brief Client of the GNU make jobserver: one token is read from it
+ * for each file optimized beside the first one, so a batch never runs
+ * more jobs than make allows (see jobServerOpen function).
+ * @var jobServer::rfd
+ * Member 'rfd' contains the descriptor the tokens are read from (-1 if none).
+ * @var jobServer::wfd
+ * Member 'wfd' contains the descriptor the tokens are given back to.
+ * @var jobServer::fifo
+ * Member 'fifo' is set when the descriptor has been opened by us (named pipe).
+ * @var jobServer::implicitBusy
+ * Member 'implicitBusy' is set when a job runs on the implicit slot
+ * (the one make has given to the process itself).
+ * @var jobServer::lock
+ * Member 'lock' protects implicitBusy.
+ */
+typedef struct jobServer
+{
+    int rfd;
+    int wfd;
+    int fifo;
+    int implicitBusy;
+    pthread_mutex_t lock;
+} jobServer;
+
+/**
+ * @struct batchJob
+ * @brief The files of a batch and where to write them (see runFile function).
+ * @var batchJob::inputs
+ * Member 'inputs' contains the input files.
+ * @var batchJob::outdir
+ * Member 'outdir' contains the output directory (NULL to rewrite the inputs).
+ * @var batchJob::js
+ * Member 'js' contains the jobserver.
+ * @var batchJob::cache
+ * Member 'cache' contains the cache (NULL if none).
+ * @var batchJob::verbose
+ * Member 'verbose' contains the level of verbosity.
+ * @var batchJob::level
+ * Member 'level' contains the optimization level (see OPT_LEVEL_MAX).
+ * @var batchJob::report
+ * Member 'report' contains the stream of the reports (NULL if none).
+ * @var batchJob::failed
+ * Member 'failed' contains the number of files not optimized (see runFile function).
+ * @var batchJob::lock
+ * Member 'lock' protects failed.
+ */
+typedef struct batchJob
+{
+    const fileList *inputs;
+    const char *outdir;
+    jobServer *js;
+    optCache *cache;
+    size_t verbose;
+    int level;
+    FILE *report;
+    size_t failed;
+    pthread_mutex_t lock;
+} batchJob;
+
+fileList newFileList(void);
+void pushFile(fileList *list, const char *path, const size_t len);
+void readResponseFile(fileList *list, const char *path);
+void freeFileList(fileList list);
+jobServer jobServerOpen(void);
+int jobServerAcquire(jobServer *js);
+void jobServerRelease(jobServer *js, const int token);
+void jobServerClose(jobServer *js);
+const char *baseName(const char *path);
+int optimizeBatch(const fileList *inputs, const char *outdir, size_t workers, optCache *cache, const size_t verbose,
+                   const int level, FILE *report);
+
+#endif
@@ -0,0 +1,458 @@
+/*
+ * opt-65816 - Assembly code optimizer for the WDC 65816 processor.
+ *
+ * Description: Assembly code optimizer produced
+ * by the 816 Tiny C Compiler (816-tcc).
+ * This library is a C port of the 816-opt python tool.
+ *
+ * Author: kobenairb (kobenairb@gmail.com).
+ *
+ * Copyright (c) 2022.
+ *
+ * This project is released under the GNU Public License.
+ *
+ */
+
+#include "cache.h"
+#include "rules.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#else
+#include <utime.h>
+#endif
+
+/**
+ * @struct cacheEntry
+ * @brief A file of the cache directory (see cacheEvict function).
+ * @var cacheEntry::name
+ * Member 'name' contains the file name.
+ * @var cacheEntry::size
+ * Member 'size' contains the size of the file.
+ * @var cacheEntry::used
+ * Member 'used' contains the last use of the entry (modification time).
+ */
+typedef struct cacheEntry
+{
+    char *name;
+    size_t size;
+    time_t used;
+} cacheEntry;
+
+/**
+ * @brief Open a cache directory (created if needed).
+ * @param rules The name of the rule set enabled (outputs of different
+ * rule sets are stored under different keys).
+ * @param dir The cache directory.
+ * @param max The cap of the cache in MiB (0 for CACHE_MAX_DEFAULT).
+ * @return The cache, or NULL on error (errno is set).
+ */
+optCache *cacheOpenDir(const char *rules, const char *dir, const size_t max)
+{
+#ifdef _WIN32
+    if (_mkdir(dir) != 0 && errno != EEXIST)
+#else
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST)
+#endif
+        return NULL;
+
+    optCache *cache = calloc(1, sizeof(optCache));
+    if (!cache || (cache->dir = malloc(strlen(dir) + 1)) == NULL)
+    {
+        free(cache);
+        errno = ENOMEM;
+        return NULL;
+    }
+    strcpy(cache->dir, dir);
+    cache->rules = rules;
+    cache->max   = (max ? max : CACHE_MAX_DEFAULT) << 20;
+    cache->size  = SIZE_MAX;
+    pthread_mutex_init(&cache->lock, NULL);
+
+    return cache;
+}
+
+/**
+ * @brief Open the cache named by OPT816_CACHE_DIR (created if needed),
+ * capped by OPT816_CACHE_MAX.
+ * @param rules The name of the rule set enabled (see cacheOpenDir function).
+ * @return The cache, or NULL if OPT816_CACHE_DIR is not set.
+ */
+optCache *cacheOpen(const char *rules)
+{
+    const char *dir = getenv(CACHE_DIR_ENV);
+    const char *max = getenv(CACHE_MAX_ENV);
+
+    if (!dir || !*dir)
+        return NULL;
+
+    optCache *cache = cacheOpenDir(rules, dir, max && atol(max) > 0 ? (size_t)atol(max) : 0);
+    if (!cache)
+        fatalError(dir);
+
+    return cache;
+}
+
+/**
+ * @brief Hash a string into two 64-bit hashes (FNV-1a, and a
+ * multiply-rotate hash), so the 128-bit key is not a single FNV.
+ * @param h The hashes, updated.
+ * @param str The string.
+ * @param len The length of the string.
+ */
+static void hashBytes(uint64_t h[2], const char *str, const size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char c = (unsigned char)str[i];
+
+        h[0] = (h[0] ^ c) * 1099511628211ULL;
+        h[1] = (((h[1] << 5) | (h[1] >> 59)) ^ c) * 0x9E3779B97F4A7C15ULL;
+    }
+}
+
+/**
+ * @brief Compute the key of a tidied file: a hash of its lines,
+ * of the optimizer version and build, of the digest of its rules and
+ * sources (see rulesDigest), and of the rule set and level.
+ * @param cache The optCache structure.
+ * @param file The tidied file (see tidyText function).
+ * @param level The optimization level (see OPT_LEVEL_MAX).
+ * @param key The key (CACHE_KEY_LEN + 1 chars).
+ */
+void cacheKey(const optCache *cache, const asmFile *file, const int level, char *key)
+{
+    uint64_t h[2] = { 14695981039346656037ULL, 0x243F6A8885A308D3ULL };
+
+    hashBytes(h, BINVERSION "\n" BINDATE "\n", strlen(BINVERSION "\n" BINDATE "\n"));
+    hashBytes(h, rulesDigest, strlen(rulesDigest) + 1);
+    hashBytes(h, cache->rules, strlen(cache->rules) + 1);
+    if (level != OPT_LEVEL_DEFAULT) // The default level keeps its keys
+    {
+        char tag[16];
+
+        snprintf(tag, sizeof(tag), "-O%d", level);
+        hashBytes(h, tag, strlen(tag) + 1);
+    }
+    for (size_t i = 0; i < file->used; i++)
+    {
+        hashBytes(h, file->arr[i], strlen(file->arr[i]) + 1);
+    }
+
+    snprintf(key, CACHE_KEY_LEN + 1, "%016llx%016llx", (unsigned long long)h[0], (unsigned long long)h[1]);
+}
+
+/**
+ * @brief Read a whole file without exiting on error
+ * (an entry can be evicted by another process).
+ * @param path The path of the file.
+ * @param text The content (allocated, followed by a null terminator).
+ * @return 0, or -1 on error.
+ */
+static int readEntry(const char *path, textBuffer *text)
+{
+    FILE *fp = fopen(path, "rb");
+    struct stat st;
+
+    if (!fp)
+        return -1;
+    if (fstat(fileno(fp), &st) != 0 || (text->data = malloc((size_t)st.st_size + 1)) == NULL)
+    {
+        fclose(fp);
+        return -1;
+    }
+    text->len    = fread(text->data, 1, (size_t)st.st_size, fp);
+    text->mapped = 0;
+    fclose(fp);
+
+    if (text->len != (size_t)st.st_size)
+    {
+        free(text->data);
+        return -1;
+    }
+    text->data[text->len] = '\0';
+
+    return 0;
+}
+
+/**
+ * @brief Look for an output in the cache. The entry is marked as used
+ * (its modification time is the last use, see cacheEvict function).
+ * @param cache The optCache structure.
+ * @param key The key (see cacheKey function).
+ * @param out The output lines, when found (they point into out->text).
+ * @return 1 if found, 0 otherwise.
+ */
+int cacheLoad(optCache *cache, const char *key, asmFile *out)
+{
+    char path[MAXLEN_LINE];
+    textBuffer text;
+
+    snprintf(path, sizeof(path), "%s/%s", cache->dir, key);
+
+    /* "<magic> <length of the output>\n<output>" */
+    if (readEntry(path, &text) != 0)
+        return 0;
+
+    char *head = memchr(text.data, '\n', text.len);
+    size_t skip = head ? (size_t)(head - text.data) + 1 : 0;
+    if (!head || !startWith(text.data, CACHE_MAGIC " ")
+        || strtoul(text.data + sizeof(CACHE_MAGIC), NULL, 10) != text.len - skip)
+    {
+        free(text.data);
+        return 0;
+    }
+
+#ifndef _WIN32
+    utime(path, NULL);
+#endif
+
+    *out      = newAsmFile(1024);
+    out->text = text;
+
+    char *p   = text.data + skip;
+    char *end = text.data + text.len;
+    while (p < end)
+    {
+        char *eol = memchr(p, '\n', end - p);
+        if (!eol)
+            eol = end;
+        *eol = '\0';
+        pushSlice(out, p);
+        p = eol + 1;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Order the entries by last use (see cacheEvict function).
+ * @param a The first cacheEntry.
+ * @param b The second cacheEntry.
+ * @return < 0, 0 or > 0 (see qsort function).
+ */
+static int compareEntries(const void *a, const void *b)
+{
+    const cacheEntry *ea = a;
+    const cacheEntry *eb = b;
+
+    return (ea->used > eb->used) - (ea->used < eb->used);
+}
+
+/**
+ * @brief Checks if a file of the cache directory belongs to the cache:
+ * an entry (named by its key), or a temporary file left by this process
+ * (see cacheStore function). The other files are never evicted.
+ * @param name The file name.
+ * @return 1 if true, 0 otherwise.
+ */
+static int isCacheFile(const char *name)
+{
+    char own[32];
+    size_t k = 0;
+
+    while (k < CACHE_KEY_LEN && isxdigit((unsigned char)name[k]) && !isupper((unsigned char)name[k]))
+        k++;
+    if (k != CACHE_KEY_LEN)
+        return 0;
+    if (name[k] == '\0')
+        return 1;
+
+    snprintf(own, sizeof(own), ".%ld.", (long)getpid());
+    return startWith(name + k, own) && strlen(name) > 4 && strcmp(name + strlen(name) - 4, ".tmp") == 0;
+}
+
+/**
+ * @brief Measure the cache directory, and remove the entries used
+ * the least recently until it fits in 3/4 of the cap
+ * (the lock is held by the caller).
+ * @param cache The optCache structure.
+ */
+static void cacheEvict(optCache *cache)
+{
+    DIR *dir = opendir(cache->dir);
+    struct dirent *de;
+    cacheEntry *entries = NULL;
+    size_t used = 0, size = 0, total = 0;
+    char path[MAXLEN_LINE];
+
+    if (!dir)
+        return;
+
+    while ((de = readdir(dir)) != NULL)
+    {
+        struct stat st;
+
+        if (!isCacheFile(de->d_name))
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", cache->dir, de->d_name);
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+
+        if (used == size)
+        {
+            size          = size ? 2 * size : 256;
+            cacheEntry *e = realloc(entries, size * sizeof(cacheEntry));
+            if (!e)
+                break; // The lock is held: evict what has been listed
+            entries = e;
+        }
+        if ((entries[used].name = malloc(strlen(de->d_name) + 1)) == NULL)
+            break;
+        strcpy(entries[used].name, de->d_name);
+        entries[used].size = (size_t)st.st_size;
+        entries[used].used = st.st_mtime;
+        total += entries[used].size;
+        used += 1;
+    }
+    closedir(dir);
+
+    if (total > cache->max)
+    {
+        qsort(entries, used, sizeof(cacheEntry), compareEntries);
+        for (size_t i = 0; i < used && total > cache->max / 4 * 3; i++)
+        {
+            snprintf(path, sizeof(path), "%s/%s", cache->dir, entries[i].name);
+            if (unlink(path) == 0)
+                total -= entries[i].size;
+        }
+    }
+
+    for (size_t i = 0; i < used; i++)
+        free(entries[i].name);
+    free(entries);
+    cache->size = total;
+}
+
+/**
+ * @brief Store an output in the cache. The entry is written to a
+ * temporary file and renamed, so a reader never sees a partial entry.
+ * @param cache The optCache structure.
+ * @param key The key (see cacheKey function).
+ * @param file The output.
+ */
+void cacheStore(optCache *cache, const char *key, const asmFile *file)
+{
+    char path[MAXLEN_LINE], tmp[MAXLEN_LINE];
+    size_t len = 0;
+
+    for (size_t i = 0; i < file->used; i++)
+        len += strlen(file->arr[i]) + 1;
+
+    pthread_mutex_lock(&cache->lock);
+    size_t serial = cache->serial++;
+    pthread_mutex_unlock(&cache->lock);
+
+    snprintf(path, sizeof(path), "%s/%s", cache->dir, key);
+    snprintf(tmp, sizeof(tmp), "%s/%s.%ld.%lu.tmp", cache->dir, key, (long)getpid(), (unsigned long)serial);
+
+    /* The cache is best effort: a failed write is not an error */
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp)
+        return;
+    fprintf(fp, CACHE_MAGIC " %lu\n", (unsigned long)len);
+    for (size_t i = 0; i < file->used; i++)
+    {
+        fputs(file->arr[i], fp);
+        fputc('\n', fp);
+    }
+    if (fclose(fp) != 0 || rename(tmp, path) != 0)
+    {
+        unlink(tmp);
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    if (cache->size == SIZE_MAX || cache->size + len > cache->max)
+        cacheEvict(cache);
+    else
+        cache->size += len;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * @brief Close the cache, and print its counters.
+ * @param cache The optCache structure (can be NULL).
+ * @param verbose The level of verbosity (see verbosity function).
+ */
+void cacheClose(optCache *cache, const size_t verbose)
+{
+    if (!cache)
+        return;
+
+    if (verbose)
+        fprintf(stderr, "cache: %lu hits, %lu misses\n", cache->hits, cache->misses);
+
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->dir);
+    free(cache);
+}
+
+/**
+ * @brief Optimize a tidied file, through the cache when there is one:
+ * a known input costs one hash and one file read, no pass is run.
+ * @param file The tidied file (see tidyText function), released.
+ * @param cache The cache (can be NULL).
+ * @param verbose The level of verbosity (see verbosity function).
+ * @param jobs The number of threads (see optimizeAsm function).
+ * @param level The optimization level (see OPT_LEVEL_MAX).
+ * @param stats The report of the optimization (NULL if none).
+ * @return The optimized file.
+ */
+asmFile optimizeCached(asmFile file, optCache *cache, const size_t verbose, const size_t jobs, const int level,
+                       optStats *stats)
+{
+    char key[CACHE_KEY_LEN + 1];
+    asmFile optAsm;
+
+    if (stats)
+        stats->linesIn = file.used;
+
+    if (cache)
+    {
+        cacheKey(cache, &file, level, key);
+        if (cacheLoad(cache, key, &optAsm))
+        {
+            pthread_mutex_lock(&cache->lock);
+            cache->hits += 1;
+            pthread_mutex_unlock(&cache->lock);
+
+            freeAsmFile(file);
+            if (stats)
+            {
+                stats->cached   = 1;
+                stats->linesOut = optAsm.used;
+            }
+            return optAsm;
+        }
+    }
+
+    uint64_t start = stats ? nowNs() : 0;
+    strSet bss     = storeBss(file);
+    if (stats)
+        stats->bss = nowNs() - start;
+    optAsm = optimizeAsm(file, &bss, verbose, jobs, level, stats);
+    freeStrSet(bss);
+
+    if (stats)
+        stats->linesOut = optAsm.used;
+
+    if (cache)
+    {
+        cacheStore(cache, key, &optAsm);
+
+        pthread_mutex_lock(&cache->lock);
+        cache->misses += 1;
+        pthread_mutex_unlock(&cache->lock);
+    }
+
+    return optAsm;
+}
@@ -0,0 +1,74 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "helpers.h"
+#include "optimizer.h"
+
+/*!
+ * @brief Environment variable naming the cache directory (no cache if unset).
+ */
+#define CACHE_DIR_ENV "OPT816_CACHE_DIR"
+/*!
+ * @brief Environment variable giving the size cap of the cache (in MiB).
+ */
+#define CACHE_MAX_ENV "OPT816_CACHE_MAX"
+/*!
+ * @brief Default size cap of the cache (in MiB).
+ */
+#define CACHE_MAX_DEFAULT 256
+/*!
+ * @brief Length of a cache key (hexadecimal digits).
+ */
+#define CACHE_KEY_LEN 32
+/*!
+ * @brief First word of a cache entry.
+ */
+#define CACHE_MAGIC "opt65816-cache"
+
+/**
+ * @struct optCache
+ * @brief Content-addressed cache of optimized files, one file per entry
+ * named by the hash of the tidied input (see cacheKey function).
+ * @var optCache::dir
+ * Member 'dir' contains the cache directory.
+ * @var optCache::rules
+ * Member 'rules' names the rule set enabled (part of the key).
+ * @var optCache::max
+ * Member 'max' contains the size cap of the directory (in bytes).
+ * @var optCache::size
+ * Member 'size' contains the size of the directory (SIZE_MAX until
+ * it has been scanned, see cacheEvict function).
+ * @var optCache::hits
+ * Member 'hits' contains the number of outputs read from the cache.
+ * @var optCache::misses
+ * Member 'misses' contains the number of outputs computed.
+ * @var optCache::serial
+ * Member 'serial' numbers the temporary files of the process.
+ * @var optCache::lock
+ * Member 'lock' protects the fields above (the cache is shared by threads).
+ */
+typedef struct optCache
+{
+    char *dir;
+    const char *rules;
+    size_t max;
+    size_t size;
+    size_t hits;
+    size_t misses;
+    size_t serial;
+    pthread_mutex_t lock;
+} optCache;
+
+optCache *cacheOpenDir(const char *rules, const char *dir, const size_t max);
+optCache *cacheOpen(const char *rules);
+void cacheKey(const optCache *cache, const asmFile *file, const int level, char *key);
+int cacheLoad(optCache *cache, const char *key, asmFile *out);
+void cacheStore(optCache *cache, const char *key, const asmFile *file);
+void cacheClose(optCache *cache, const size_t verbose);
+asmFile optimizeCached(asmFile file, optCache *cache, const size_t verbose, const size_t jobs, const int level,
+                       optStats *stats);
+
+#endif
@@ -0,0 +1,2622 @@
+/*
+ * opt-65816 - Assembly code optimizer for the WDC 65816 processor.
+ *
+ * Description: Assembly code optimizer produced
+ * by the 816 Tiny C Compiler (816-tcc).
+ * This library is a C port of the 816-opt python tool.
+ *
+ * Author: kobenairb (kobenairb@gmail.com).
+ *
+ * Copyright (c) 2022.
+ *
+ * This project is released under the GNU Public License.
+ *
+ */
+
+#include "flow.h"
+
+/*!
+ * @brief Longest anonymous label resolved ("+++"): the branches to
+ * longer ones leave the graph.
+ */
+#define ANON_MAX 8
+
+/*!
+ * @brief Width of a block not reached yet (see flowWidths function).
+ */
+#define BITS_TOP 0xff
+
+/*!
+ * @brief Width kept by a block (see flowWidths function).
+ */
+#define BITS_ENTRY 1
+
+/**
+ * @enum jumpKind
+ * @brief How the last line of a block leaves it.
+ */
+typedef enum jumpKind
+{
+    JUMP_NONE = 0, /*!< Runs into the next line */
+    JUMP_COND,     /*!< Branches to its target, or runs into the next line */
+    JUMP_ALWAYS,   /*!< Branches to its target */
+    JUMP_EXIT      /*!< Leaves the graph (return, indirect jump, ...) */
+} jumpKind;
+
+/**
+ * @enum effectKind
+ * @brief What a line does to the pseudo-registers (see lineEffect).
+ */
+typedef enum effectKind
+{
+    FX_NONE = 0, /*!< Nothing read, nothing written in full */
+    FX_USE,      /*!< Reads its pseudo-registers */
+    FX_KILL,     /*!< Writes the two bytes of its pseudo-register */
+    FX_USE_ALL,  /*!< May read any pseudo-register */
+    FX_KILL_ALL  /*!< Writes every pseudo-register before reading any */
+} effectKind;
+
+/**
+ * @struct lineEffect
+ * @brief The effect of a line on the pseudo-registers.
+ * @var lineEffect::kind
+ * Member 'kind' contains the effect (see effectKind).
+ * @var lineEffect::preg
+ * Member 'preg' contains the pseudo-registers read or written, as
+ * indexes of the live sets (-1 if none).
+ */
+typedef struct lineEffect
+{
+    unsigned char kind;
+    int preg[2];
+} lineEffect;
+
+/**
+ * @brief Length of the anonymous label of a line ("++" in "++ dex").
+ * @param file The asmFile structure.
+ * @param i The index of the line.
+ * @return The length, 0 if the line is not an anonymous label.
+ */
+static size_t anonymousLabel(const asmFile *file, const size_t i)
+{
+    if (file->ins[i].kind != LINE_ANONYMOUS)
+        return 0;
+
+    const char *a = file->arr[i];
+    size_t k      = 1;
+
+    while (a[k] == a[0])
+        k++;
+
+    return k;
+}
+
+/**
+ * @brief Checks if a line holds an instruction, known or not.
+ * @param file The asmFile structure.
+ * @param i The index of the line.
+ * @return 1 if true, 0 otherwise.
+ */
+static int hasInstruction(const asmFile *file, const size_t i)
+{
+    if (file->ins[i].kind == LINE_INSTRUCTION)
+        return 1;
+
+    return file->ins[i].kind == LINE_ANONYMOUS && file->arr[i][anonymousLabel(file, i)] == ' ';
+}
+
+/**
+ * @brief How a line alters the control flow.
+ * @param file The asmFile structure.
+ * @param i The index of the line.
+ * @return The jumpKind.
+ */
+static jumpKind jumpOf(const asmFile *file, const size_t i)
+{
+    const asmLine *ins = &file->ins[i];
+
+    switch (ins->mnemonic)
+    {
+    case MN_BCC:
+    case MN_BCS:
+    case MN_BEQ:
+    case MN_BMI:
+    case MN_BNE:
+    case MN_BPL:
+    case MN_BVC:
+    case MN_BVS:
+        return JUMP_COND;
+    case MN_BRA:
+    case MN_BRL:
+        return JUMP_ALWAYS;
+    case MN_JMP:
+    case MN_JML:
+        return ins->mode == MODE_ABSOLUTE ? JUMP_ALWAYS : JUMP_EXIT;
+    case MN_RTI:
+    case MN_RTL:
+    case MN_RTS:
+    case MN_STP:
+        return JUMP_EXIT;
+    case MN_NONE:
+        /* An unknown instruction looking like a jump or a branch */
+        if (!hasInstruction(file, i))
+            return JUMP_NONE;
+        const char *p = file->arr[i] + anonymousLabel(file, i);
+        p += *p == ' ';
+        return *p == 'j' || *p == 'b' ? JUMP_EXIT : JUMP_NONE;
+    default:
+        return JUMP_NONE;
+    }
+}
+
+/**
+ * @brief Find the lines branched to by the jumps and branches (the
+ * anonymous labels are resolved as the assembler does: "-" is the
+ * closest one before, "+" the closest one after).
+ * @param file The asmFile structure.
+ * @param labels The labelTable structure.
+ * @param jump The jumpKind of each line.
+ * @param target The target of each line (-1 if none or unknown).
+ */
+static void jumpTargets(const asmFile *file, const labelTable *labels, const unsigned char *jump, long *target)
+{
+    long anon[2][ANON_MAX + 1]; // Closest "-" and "+" labels, by length
+    size_t n = file->used;
+
+    for (size_t k = 0; k <= ANON_MAX; k++)
+        anon[0][k] = anon[1][k] = -1;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t k = anonymousLabel(file, i);
+
+        if (k && k <= ANON_MAX && file->arr[i][0] == '-')
+            anon[0][k] = (long)i;
+
+        target[i] = -1;
+        if (jump[i] != JUMP_COND && jump[i] != JUMP_ALWAYS)
+            continue;
+
+        const char *op = file->arr[i] + file->ins[i].operand;
+        size_t len     = file->ins[i].len - file->ins[i].operand;
+
+        if (len > 0 && len <= ANON_MAX && (op[0] == '+' || op[0] == '-') && strspn(op, op[0] == '+' ? "+" : "-") == len)
+        {
+            if (op[0] == '-')
+                target[i] = anon[0][len];
+            else
+                target[i] = -2; // Resolved below, backward
+        }
+        else if (len > 0 && op[0] != '+' && op[0] != '-')
+        {
+            long line = findLabel(labels, file, op, len);
+            if (line >= 0 && nextLabel(labels, (size_t)line) < 0) // Defined once
+                target[i] = line;
+        }
+    }
+
+    for (size_t i = n; i-- > 0;)
+    {
+        if (target[i] == -2)
+            target[i] = anon[1][file->ins[i].len - file->ins[i].operand];
+
+        size_t k = anonymousLabel(file, i);
+
+        if (k && k <= ANON_MAX && file->arr[i][0] == '+')
+            anon[1][k] = (long)i;
+    }
+}
+
+/**
+ * @brief Build the control flow graph of a file. A block starts at a
+ * label and after a jump, a branch or a return; it runs into the next
+ * one and/or branches to the block of its target. A jump which is not
+ * resolved (indirect, label defined twice or not in the file) leaves
+ * the graph, as do the returns and the end of the file.
+ * @param file The asmFile structure.
+ * @param labels The labelTable structure.
+ * @return A structure (flowGraph).
+ */
+flowGraph buildFlow(const asmFile *file, const labelTable *labels)
+{
+    flowGraph flow      = { NULL, 0, NULL };
+    size_t n            = file->used;
+    long *target        = malloc((n + 1) * sizeof(long));
+    unsigned char *jump = malloc(n + 1);
+
+    flow.block = malloc((n + 1) * sizeof(size_t));
+
+    if (target == NULL || jump == NULL || flow.block == NULL)
+    {
+        fatalError("malloc-flow");
+    }
+
+    /* A block starts at a label, or after a line leaving the previous one */
+    for (size_t i = 0; i < n; i++)
+    {
+        jump[i] = (unsigned char)jumpOf(file, i);
+        if (i == 0 || file->ins[i].kind == LINE_LABEL || file->ins[i].kind == LINE_ANONYMOUS || jump[i - 1] != JUMP_NONE)
+            flow.count++;
+        flow.block[i] = flow.count - 1;
+    }
+
+    jumpTargets(file, labels, jump, target);
+
+    flow.blocks = malloc((flow.count + 1) * sizeof(flowBlock));
+    if (flow.blocks == NULL)
+    {
+        fatalError("malloc-flow");
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (i == 0 || flow.block[i] != flow.block[i - 1])
+            flow.blocks[flow.block[i]].from = i;
+        flow.blocks[flow.block[i]].to = i + 1;
+    }
+
+    for (size_t b = 0; b < flow.count; b++)
+    {
+        flowBlock *blk = &flow.blocks[b];
+        size_t last    = blk->to - 1;
+        jumpKind kind  = (jumpKind)jump[last];
+
+        blk->next   = kind == JUMP_NONE || kind == JUMP_COND ? (long)b + 1 : -1;
+        blk->target = -1;
+        blk->exit   = kind == JUMP_EXIT;
+
+        if (blk->next == (long)flow.count)
+        {
+            blk->next = -1;
+            blk->exit = 1;
+        }
+        if (kind == JUMP_COND || kind == JUMP_ALWAYS)
+        {
+            if (target[last] < 0)
+                blk->exit = 1;
+            else
+                blk->target = (long)flow.block[target[last]];
+        }
+    }
+
+    free(target);
+    free(jump);
+
+    return flow;
+}
+
+/**
+ * @brief Free pointers.
+ * @param flow flowGraph structure.
+ */
+void freeFlow(flowGraph flow)
+{
+    free(flow.blocks);
+    free(flow.block);
+}
+
+/**
+ * @brief Read the immediate operand of an instruction ("#$20", "#32").
+ * @param a The operand.
+ * @return The value, -1 if not a number.
+ */
+static long immediateValue(const char *a)
+{
+    char *end;
+    long v;
+
+    if (a[0] != '#')
+        return -1;
+    if (a[1] == '$')
+        v = strtol(a + 2, &end, 16);
+    else if (isdigit((unsigned char)a[1]))
+        v = strtol(a + 1, &end, 10);
+    else
+        return -1;
+
+    return *end == '\0' ? v : -1;
+}
+
+/**
+ * @brief Read the operand of a mode switch (rep/sep #imm).
+ * @param file The asmFile structure.
+ * @param i The index of the line (a rep or a sep).
+ * @return The bits of the status register switched, -1 if unknown.
+ */
+static long switchBits(const asmFile *file, const size_t i)
+{
+    const asmLine *ins = &file->ins[i];
+
+    return ins->mode == MODE_IMMEDIATE ? immediateValue(file->arr[i] + ins->operand) : -1;
+}
+
+/**
+ * @brief Get the argument of a directive, whatever its case
+ * (".accu 16" -> "16").
+ * @param a The line.
+ * @param name The directive (lowercase).
+ * @return The argument, NULL if the line is not the directive.
+ */
+static const char *directiveArg(const char *a, const char *name)
+{
+    size_t k = 0;
+
+    for (; name[k]; k++)
+    {
+        if (tolower((unsigned char)a[k]) != name[k])
+            return NULL;
+    }
+    if (a[k] != '\0' && a[k] != ' ')
+        return NULL;
+    while (a[k] == ' ')
+        k++;
+
+    return a + k;
+}
+
+/**
+ * @brief Find the lines between .if and .endif (they may not be
+ * assembled: a mode switch there is not followed).
+ * @param file The asmFile structure.
+ * @return 1 for each line inside, 0 otherwise (to be freed).
+ */
+static char *conditionalLines(const asmFile *file)
+{
+    char *cond = malloc(file->used + 1);
+    int depth  = 0;
+
+    if (cond == NULL)
+    {
+        fatalError("malloc-flow");
+    }
+
+    for (size_t i = 0; i < file->used; i++)
+    {
+        const char *a = file->arr[i];
+
+        if (file->ins[i].kind == LINE_DIRECTIVE && directiveArg(a, ".endif") && depth > 0)
+            depth--;
+        cond[i] = depth > 0;
+        if (file->ins[i].kind == LINE_DIRECTIVE && tolower((unsigned char)a[1]) == 'i' && tolower((unsigned char)a[2]) == 'f')
+            depth++;
+    }
+
+    return cond;
+}
+
+/**
+ * @brief Set the widths switched by a line.
+ * @param w The cpuWidths structure.
+ * @param bits The bits switched (0x20 the accumulator, 0x10 the index registers).
+ * @param width The width set.
+ */
+static void setWidths(cpuWidths *w, const long bits, const unsigned char width)
+{
+    if (bits & 0x20)
+        w->m = width;
+    if (bits & 0x10)
+        w->x = width;
+}
+
+/**
+ * @brief Checks if both widths switched by a line are already set.
+ * @param w The cpuWidths structure.
+ * @param bits The bits switched.
+ * @param width The width set.
+ * @return 1 if true, 0 otherwise.
+ */
+static int hasWidths(const cpuWidths *w, const long bits, const unsigned char width)
+{
+    return (!(bits & 0x20) || w->m == width) && (!(bits & 0x10) || w->x == width);
+}
+
+/**
+ * @brief Follow the widths the assembler assumes: the .accu and .index
+ * directives, then the mode switches (as WLA-DX does).
+ * @param file The asmFile structure.
+ * @param cond The lines between .if and .endif (see conditionalLines function).
+ * @param lex The widths before each line.
+ */
+static void lexicalWidths(const asmFile *file, const char *cond, cpuWidths *lex)
+{
+    cpuWidths w = { BITS_UNKNOWN, BITS_UNKNOWN };
+
+    for (size_t i = 0; i < file->used; i++)
+    {
+        const asmLine *ins = &file->ins[i];
+        const char *arg;
+
+        lex[i] = w;
+        if (ins->kind == LINE_DIRECTIVE)
+        {
+            if ((arg = directiveArg(file->arr[i], ".accu")) != NULL)
+                w.m = atoi(arg) == 8 ? 8 : atoi(arg) == 16 ? 16 : BITS_UNKNOWN;
+            else if ((arg = directiveArg(file->arr[i], ".index")) != NULL)
+                w.x = atoi(arg) == 8 ? 8 : atoi(arg) == 16 ? 16 : BITS_UNKNOWN;
+        }
+        else if (ins->mnemonic == MN_REP || ins->mnemonic == MN_SEP)
+        {
+            long bits = switchBits(file, i);
+
+            if (bits < 0)
+                w.m = w.x = BITS_UNKNOWN;
+            else
+                setWidths(&w, bits, cond[i] ? BITS_UNKNOWN : ins->mnemonic == MN_REP ? 16 : 8);
+        }
+    }
+}
+
+/**
+ * @brief Follow the widths of the processor over a line. An immediate
+ * operand is assembled for a width (the one the assembler assumes, or
+ * its suffix): the code is right only if the processor has it.
+ * @param file The asmFile structure.
+ * @param i The index of the line.
+ * @param lex The widths the assembler assumes before the line.
+ * @param cond 1 if the line is between .if and .endif.
+ * @param w The widths, before then after the line.
+ */
+static void stepWidths(const asmFile *file, const size_t i, const cpuWidths *lex, const int cond, cpuWidths *w)
+{
+    const asmLine *ins = &file->ins[i];
+    unsigned char imm  = ins->width == WIDTH_B ? 8 : ins->width == WIDTH_W ? 16 : BITS_UNKNOWN;
+
+    switch (ins->mnemonic)
+    {
+    case MN_REP:
+    case MN_SEP:
+    {
+        long bits = switchBits(file, i);
+
+        if (bits < 0)
+            w->m = w->x = BITS_UNKNOWN;
+        else
+            setWidths(w, bits, cond ? BITS_UNKNOWN : ins->mnemonic == MN_REP ? 16 : 8);
+        break;
+    }
+    case MN_ADC:
+    case MN_AND:
+    case MN_BIT:
+    case MN_CMP:
+    case MN_EOR:
+    case MN_LDA:
+    case MN_ORA:
+    case MN_SBC:
+        if (ins->mode == MODE_IMMEDIATE && !cond && (imm || lex->m))
+            w->m = imm ? imm : lex->m;
+        break;
+    case MN_CPX:
+    case MN_CPY:
+    case MN_LDX:
+    case MN_LDY:
+        if (ins->mode == MODE_IMMEDIATE && !cond && (imm || lex->x))
+            w->x = imm ? imm : lex->x;
+        break;
+    case MN_PLP:
+    case MN_RTI:
+    case MN_XCE:
+    case MN_JSR:
+    case MN_JSL:
+    case MN_BRK:
+    case MN_COP:
+        w->m = w->x = BITS_UNKNOWN;
+        break;
+    case MN_NONE:
+        if (hasInstruction(file, i))
+            w->m = w->x = BITS_UNKNOWN;
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Meet the widths of two paths.
+ * @param a The widths of a path (updated).
+ * @param b The widths of another path.
+ * @return 1 if a has changed, 0 otherwise.
+ */
+static int meetWidths(cpuWidths *a, const cpuWidths *b)
+{
+    cpuWidths old = *a;
+
+    if (a->m == BITS_TOP || b->m == BITS_TOP)
+        a->m = a->m == BITS_TOP ? b->m : a->m;
+    else if (a->m != b->m)
+        a->m = BITS_UNKNOWN;
+    if (a->x == BITS_TOP || b->x == BITS_TOP)
+        a->x = a->x == BITS_TOP ? b->x : a->x;
+    else if (a->x != b->x)
+        a->x = BITS_UNKNOWN;
+
+    return a->m != old.m || a->x != old.x;
+}
+
+/**
+ * @brief Follow the widths of the accumulator and of the index
+ * registers over the graph, starting from the .accu and .index
+ * directives. The widths at a label are the ones of every path
+ * reaching it; a named label may also be reached from code out of the
+ * graph (a call), with the widths the assembler assumes there, as is
+ * the first instruction of the file.
+ * @param file The asmFile structure.
+ * @param flow The flowGraph structure.
+ * @param cpu The widths of the processor before each line.
+ * @param lex The widths the assembler assumes before each line.
+ */
+void flowWidths(const asmFile *file, const flowGraph *flow, cpuWidths *cpu, cpuWidths *lex)
+{
+    char *cond      = conditionalLines(file);
+    cpuWidths *out  = malloc((flow->count + 1) * sizeof(cpuWidths));
+    cpuWidths *in   = malloc((flow->count + 1) * sizeof(cpuWidths));
+    size_t *work    = malloc((flow->count + 1) * sizeof(size_t));
+    char *queued    = malloc(flow->count + 1);
+    size_t top      = 0;
+
+    if (out == NULL || in == NULL || work == NULL || queued == NULL)
+    {
+        fatalError("malloc-flow");
+    }
+
+    lexicalWidths(file, cond, lex);
+
+    /* What each block does to the widths: BITS_ENTRY where it keeps them */
+    for (size_t b = 0; b < flow->count; b++)
+    {
+        const flowBlock *blk = &flow->blocks[b];
+
+        out[b] = (cpuWidths){ BITS_ENTRY, BITS_ENTRY };
+        for (size_t i = blk->from; i < blk->to; i++)
+            stepWidths(file, i, &lex[i], cond[i], &out[b]);
+
+        in[b] = (cpuWidths){ BITS_TOP, BITS_TOP };
+        if (file->ins[blk->from].kind == LINE_LABEL)
+            in[b] = lex[blk->from];
+    }
+
+    /* The file is entered at its first instruction, after the directives */
+    if (flow->count)
+    {
+        size_t i = 0;
+
+        while (i < flow->blocks[0].to && !hasInstruction(file, i))
+            i++;
+        in[0] = lex[i < file->used ? i : 0];
+    }
+
+    /* Forward, the first block first */
+    for (size_t b = flow->count; b-- > 0;)
+    {
+        work[top++] = b;
+        queued[b]   = 1;
+    }
+    while (top)
+    {
+        size_t b           = work[--top];
+        const flowBlock *blk = &flow->blocks[b];
+        cpuWidths exit     = in[b];
+        long succ[2]       = { blk->next, blk->target };
+
+        queued[b] = 0;
+        if (in[b].m == BITS_TOP)
+            continue;
+        if (out[b].m != BITS_ENTRY)
+            exit.m = out[b].m;
+        if (out[b].x != BITS_ENTRY)
+            exit.x = out[b].x;
+
+        for (int k = 0; k < 2; k++)
+        {
+            if (succ[k] >= 0 && meetWidths(&in[succ[k]], &exit) && !queued[succ[k]])
+            {
+                queued[succ[k]] = 1;
+                work[top++]     = (size_t)succ[k];
+            }
+        }
+    }
+
+    /* The widths before each line, a block never reached knows none */
+    for (size_t b = 0; b < flow->count; b++)
+    {
+        const flowBlock *blk = &flow->blocks[b];
+        cpuWidths w          = in[b];
+
+        if (w.m == BITS_TOP)
+            w = (cpuWidths){ BITS_UNKNOWN, BITS_UNKNOWN };
+        for (size_t i = blk->from; i < blk->to; i++)
+        {
+            cpu[i] = w;
+            stepWidths(file, i, &lex[i], cond[i], &w);
+        }
+    }
+
+    free(cond);
+    free(out);
+    free(in);
+    free(work);
+    free(queued);
+}
+
+/**
+ * @brief Checks if a line reads the N and Z flags (a branch on them, or
+ * an instruction not known).
+ * @param file The asmFile structure.
+ * @param i The index of the line.
+ * @return 1 if true, 0 otherwise.
+ */
+static int readsNZ(const asmFile *file, const size_t i)
+{
+    switch (file->ins[i].mnemonic)
+    {
+    case MN_BEQ:
+    case MN_BNE:
+    case MN_BMI:
+    case MN_BPL:
+    case MN_PHP:
+        return 1;
+    case MN_NONE:
+        return hasInstruction(file, i);
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Checks if a line sets the N and Z flags from its result.
+ * @param file The asmFile structure.
+ * @param i The index of the line.
+ * @return 1 if true, 0 otherwise.
+ */
+static int setsNZ(const asmFile *file, const size_t i)
+{
+    switch (file->ins[i].mnemonic)
+    {
+    case MN_ADC:
+    case MN_AND:
+    case MN_ASL:
+    case MN_CMP:
+    case MN_CPX:
+    case MN_CPY:
+    case MN_DEC:
+    case MN_DEX:
+    case MN_DEY:
+    case MN_EOR:
+    case MN_INC:
+    case MN_INX:
+    case MN_INY:
+    case MN_LDA:
+    case MN_LDX:
+    case MN_LDY:
+    case MN_LSR:
+    case MN_ORA:
+    case MN_PLA:
+    case MN_PLB:
+    case MN_PLD:
+    case MN_PLX:
+    case MN_PLY:
+    case MN_ROL:
+    case MN_ROR:
+    case MN_SBC:
+    case MN_TAX:
+    case MN_TAY:
+    case MN_TDC:
+    case MN_TSC:
+    case MN_TSX:
+    case MN_TXA:
+    case MN_TXY:
+    case MN_TYA:
+    case MN_TYX:
+    case MN_XBA:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Find where the N and Z flags are read before being set again,
+ * across the blocks (a block leaving the graph may have them read).
+ * @param file The asmFile structure.
+ * @param flow The flowGraph structure.
+ * @return 1 for each line whose flags are read after it, 0 otherwise
+ * (to be freed).
+ */
+static char *flagsLive(const asmFile *file, const flowGraph *flow)
+{
+    char *nz   = malloc(file->used + 1);
+    char *gen  = malloc(flow->count + 1);
+    char *kill = malloc(flow->count + 1);
+    char *in   = calloc(flow->count + 1, 1);
+    int changed = 1;
+
+    if (nz == NULL || gen == NULL || kill == NULL || in == NULL)
+    {
+        fatalError("malloc-flow");
+    }
+
+    for (size_t b = 0; b < flow->count; b++)
+    {
+        gen[b] = kill[b] = 0;
+        for (size_t i = flow->blocks[b].to; i-- > flow->blocks[b].from;)
+        {
+            if (readsNZ(file, i))
+            {
+                gen[b]  = 1;
+                kill[b] = 0;
+            }
+            else if (setsNZ(file, i))
+            {
+                gen[b]  = 0;
+                kill[b] = 1;
+            }
+        }
+    }
+
+    /* Backward, a loop needs one more sweep */
+    while (changed)
+    {
+        changed = 0;
+        for (size_t b = flow->count; b-- > 0;)
+        {
+            const flowBlock *blk = &flow->blocks[b];
+            int out = blk->exit || (blk->next >= 0 && in[blk->next]) || (blk->target >= 0 && in[blk->target]);
+            char v  = (char)(gen[b] || (out && !kill[b]));
+
+            changed |= v != in[b];
+            in[b] = v;
+        }
+    }
+
+    for (size_t b = 0; b < flow->count; b++)
+    {
+        const flowBlock *blk = &flow->blocks[b];
+        int live = blk->exit || (blk->next >= 0 && in[blk->next]) || (blk->target >= 0 && in[blk->target]);
+
+        for (size_t i = blk->to; i-- > blk->from;)
+        {
+            nz[i] = (char)live;
+            if (readsNZ(file, i))
+                live = 1;
+            else if (setsNZ(file, i))
+                live = 0;
+        }
+    }
+
+    free(gen);
+    free(kill);
+    free(in);
+
+    return nz;
+}
+
+/*!
+ * @brief Number of memory locations whose value is followed at once
+ * (see valueState).
+ */
+#define VALUE_SLOTS 32
+
+/*!
+ * @brief Value not known (see regValue).
+ */
+#define VALUE_UNKNOWN (-1)
+
+/**
+ * @enum valueClass
+ * @brief Where a value is read from: the locations of a class may
+ * overlap, not the ones of two classes.
+ */
+typedef enum valueClass
+{
+    VAL_IMMEDIATE = 0, /*!< #n, never written */
+    VAL_PREG,          /*!< A pseudo-register, written by its name only */
+    VAL_STACK,         /*!< n,s, moved by the pushes and the pulls */
+    VAL_GLOBAL         /*!< A label, written by the stores but never read from the
+                            table (an interrupt handler may change it) */
+} valueClass;
+
+/**
+ * @struct valueSlot
+ * @brief A memory location (or an immediate) whose value is known.
+ * @var valueSlot::key
+ * Member 'key' contains the operand (the label of a stack slot, NULL
+ * if none, see stackSlot function).
+ * @var valueSlot::len
+ * Member 'len' contains the length of the key.
+ * @var valueSlot::width
+ * Member 'width' contains the width suffix of the access (see opWidth).
+ * @var valueSlot::cls
+ * Member 'cls' contains the valueClass.
+ * @var valueSlot::preg
+ * Member 'preg' contains the pseudo-register id (see PREG_ID).
+ * @var valueSlot::bits
+ * Member 'bits' contains the width of the value (8 or 16).
+ * @var valueSlot::value
+ * Member 'value' contains the value number (VALUE_UNKNOWN if none).
+ * @var valueSlot::num
+ * Member 'num' contains the sum of the numbers of a stack slot.
+ * @var valueSlot::depth
+ * Member 'depth' contains the bytes pushed when a stack slot was
+ * accessed (see valueState::depth).
+ * @var valueSlot::store
+ * Member 'store' contains the line storing to a stack slot not read
+ * since, -1 if none.
+ */
+typedef struct valueSlot
+{
+    const char *key;
+    unsigned int len;
+    unsigned char width;
+    unsigned char cls;
+    short preg;
+    unsigned char bits;
+    int value;
+    long num;
+    long depth;
+    long store;
+} valueSlot;
+
+/**
+ * @struct regValue
+ * @brief The value of a register.
+ * @var regValue::value
+ * Member 'value' contains the value number (VALUE_UNKNOWN if none).
+ * @var regValue::bits
+ * Member 'bits' contains the width it was set with (8 or 16).
+ */
+typedef struct regValue
+{
+    int value;
+    unsigned char bits;
+} regValue;
+
+/**
+ * @struct valueState
+ * @brief The values known at a line of a block (see markLoads function):
+ * two locations with the same value number hold the same bytes.
+ * @var valueState::reg
+ * Member 'reg' contains the values of the accumulator, X and Y.
+ * @var valueState::slot
+ * Member 'slot' contains the locations known.
+ * @var valueState::used
+ * Member 'used' contains the number of locations known.
+ * @var valueState::next
+ * Member 'next' contains the next value number.
+ * @var valueState::depth
+ * Member 'depth' contains the bytes pushed since the stack pointer was
+ * last known: 1,s is 3,s after a pha in 16 bits.
+ * @var valueState::frame
+ * Member 'frame' contains the line of a frame adjustment read last
+ * (see stepFrame function), 0 if none.
+ * @var valueState::base
+ * Member 'base' contains the depth when the stack pointer was read.
+ * @var valueState::delta
+ * Member 'delta' contains the number added to it.
+ */
+typedef struct valueState
+{
+    regValue reg[3];
+    valueSlot slot[VALUE_SLOTS];
+    size_t used;
+    int next;
+    long depth;
+    int frame;
+    long base;
+    long delta;
+} valueState;
+
+/**
+ * @brief Read the operand of a stack slot ("-2 + __main_locals + 1,s"):
+ * numbers added or subtracted, and one label added at most.
+ * @param op The operand.
+ * @param len The length of the operand.
+ * @param loc The location (its key, len and num are set).
+ * @return 1 if read, 0 otherwise.
+ */
+static int stackSlot(const char *op, const size_t len, valueSlot *loc)
+{
+    const char *p   = op;
+    const char *end = op + len - 2; // Without ",s"
+
+    loc->key = NULL;
+    loc->len = 0;
+    loc->num = 0;
+
+    while (p < end)
+    {
+        long sign = 1;
+        char *q;
+
+        if (p != op)
+        {
+            if (end - p < 4 || p[0] != ' ' || (p[1] != '+' && p[1] != '-') || p[2] != ' ')
+                return 0;
+            sign = p[1] == '-' ? -1 : 1;
+            p += 3;
+        }
+        else if (*p == '-')
+        {
+            sign = -1;
+            p++;
+        }
+
+        if (isdigit((unsigned char)*p) || (*p == '$' && isxdigit((unsigned char)p[1])))
+        {
+            long v = *p == '$' ? strtol(p + 1, &q, 16) : strtol(p, &q, 10);
+
+            if (q > end)
+                return 0;
+            loc->num += sign * v;
+            p = q;
+        }
+        else if ((isalpha((unsigned char)*p) || *p == '_') && !loc->key && sign > 0)
+        {
+            loc->key = p;
+            while (p < end && (isalnum((unsigned char)*p) || *p == '_'))
+                p++;
+            loc->len = (unsigned int)(p - loc->key);
+        }
+        else
+            return 0;
+    }
+
+    return p == end && p != op;
+}
+
+/**
+ * @brief Find the location read or written by a line, if its value may
+ * be followed: an immediate, a pseudo-register, a stack slot or a label.
+ * @param file The asmFile structure.
+ * @param i The index of the line.
+ * @param depth The bytes pushed before the line (see valueState).
+ * @param loc The location found (its value is not set).
+ * @return 1 if found, 0 otherwise.
+ */
+static int locationOf(const asmFile *file, const size_t i, const long depth, valueSlot *loc)
+{
+    const asmLine *ins = &file->ins[i];
+    const char *op     = file->arr[i] + ins->operand;
+
+    if (ins->operand == ins->len || strchr(op, ';'))
+        return 0;
+
+    loc->key   = op;
+    loc->len   = ins->len - ins->operand;
+    loc->width = ins->width;
+    loc->preg  = ins->preg;
+    loc->bits  = BITS_UNKNOWN;
+    loc->num   = 0;
+    loc->depth = depth;
+    loc->store = -1;
+
+    switch (ins->mode)
+    {
+    case MODE_IMMEDIATE:
+        loc->cls   = VAL_IMMEDIATE;
+        loc->width = WIDTH_NONE; // Only the encoding
+        return 1;
+    case MODE_STACK:
+        loc->cls = VAL_STACK;
+        return stackSlot(op, loc->len, loc);
+    case MODE_ABSOLUTE:
+        if (ins->preg != PREG_NONE)
+        {
+            loc->cls = VAL_PREG;
+            return 1;
+        }
+        /* A number may be a hardware register, read twice on purpose */
+        if (ins->flags & LF_PSEUDO || !(isalpha((unsigned char)op[0]) || op[0] == '_'))
+            return 0;
+        loc->cls = VAL_GLOBAL;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Checks if two accesses are to the same location: the stack
+ * slots are compared where the stack pointer was last known.
+ * @param s A valueSlot structure.
+ * @param loc Another one.
+ * @return 1 if true, 0 otherwise.
+ */
+static int sameLocation(const valueSlot *s, const valueSlot *loc)
+{
+    if (s->cls != loc->cls || s->len != loc->len || (s->len && memcmp(s->key, loc->key, s->len) != 0))
+        return 0;
+
+    return s->cls == VAL_STACK ? s->num - s->depth == loc->num - loc->depth : s->width == loc->width;
+}
+
+/**
+ * @brief Checks if two accesses may touch the same bytes: the same
+ * pseudo-register, any two labels, or two stack slots whose bytes meet
+ * (or with two labels, whose numbers are not known).
+ * @param s A valueSlot structure.
+ * @param loc Another one (its bits are set, BITS_UNKNOWN if not known).
+ * @return 1 if true, 0 otherwise.
+ */
+static int mayOverlap(const valueSlot *s, const valueSlot *loc)
+{
+    if (s->cls != loc->cls)
+        return 0;
+
+    switch (s->cls)
+    {
+    case VAL_IMMEDIATE:
+        return 0;
+    case VAL_PREG:
+        return s->preg == loc->preg;
+    case VAL_STACK:
+    {
+        long a = s->num - s->depth;
+        long b = loc->num - loc->depth;
+
+        if (s->len != loc->len || (s->len && memcmp(s->key, loc->key, s->len) != 0) || s->bits == BITS_UNKNOWN
+            || loc->bits == BITS_UNKNOWN)
+            return 1;
+        return a < b + loc->bits / 8 && b < a + s->bits / 8;
+    }
+    default:
+        return 1;
+    }
+}
+
+/**
+ * @brief Find the value of a location.
+ * @param st The valueState structure.
+ * @param loc The location.
+ * @param bits The width read.
+ * @return The value number, VALUE_UNKNOWN if none.
+ */
+static int findValue(const valueState *st, const valueSlot *loc, const unsigned char bits)
+{
+    for (size_t k = 0; k < st->used; k++)
+    {
+        const valueSlot *s = &st->slot[k];
+
+        if (s->value != VALUE_UNKNOWN && s->bits == bits && sameLocation(s, loc))
+            return s->value;
+    }
+
+    return VALUE_UNKNOWN;
+}
+
+/**
+ * @brief Record the value of a location (all of them are forgotten when
+ * there is no room left).
+ * @param st The valueState structure.
+ * @param loc The location.
+ * @param bits The width of the value.
+ * @param value The value number.
+ */
+static void addValue(valueState *st, const valueSlot *loc, const unsigned char bits, const int value)
+{
+    if (st->used == VALUE_SLOTS)
+        st->used = 0;
+
+    st->slot[st->used]       = *loc;
+    st->slot[st->used].bits  = bits;
+    st->slot[st->used].value = value;
+    st->used++;
+}
+
+/**
+ * @brief Forget the locations a write may change (see mayOverlap
+ * function), every location if the one written is not known.
+ * @param st The valueState structure.
+ * @param loc The location written, NULL if not known.
+ */
+static void forgetValues(valueState *st, const valueSlot *loc)
+{
+    size_t used = 0;
+
+    for (size_t k = 0; k < st->used; k++)
+    {
+        const valueSlot *s = &st->slot[k];
+
+        if (loc ? !mayOverlap(s, loc) : s->cls == VAL_IMMEDIATE)
+            st->slot[used++] = *s;
+    }
+    st->used = used;
+}
+
+/**
+ * @brief Forget the slots of the stack (the stack pointer is not known
+ * anymore).
+ * @param st The valueState structure.
+ */
+static void forgetStack(valueState *st)
+{
+    size_t used = 0;
+
+    for (size_t k = 0; k < st->used; k++)
+    {
+        if (st->slot[k].cls != VAL_STACK)
+            st->slot[used++] = st->slot[k];
+    }
+    st->used  = used;
+    st->depth = 0;
+}
+
+/**
+ * @brief Pull bytes off the stack: the slots accessed while more was
+ * pushed may be below the stack pointer now, written by an interrupt.
+ * @param st The valueState structure.
+ * @param depth The bytes pushed after the pull (see valueState).
+ */
+static void pullStack(valueState *st, const long depth)
+{
+    size_t used = 0;
+
+    for (size_t k = 0; k < st->used; k++)
+    {
+        const valueSlot *s = &st->slot[k];
+
+        if (s->cls != VAL_STACK || s->depth <= depth)
+            st->slot[used++] = *s;
+    }
+    st->used  = used;
+    st->depth = depth;
+}
+
+/**
+ * @brief The stack slots a line may read are still needed: their
+ * stores are not removed.
+ * @param st The valueState structure.
+ * @param loc The location read (its bits are set), NULL if not known.
+ */
+static void readStack(valueState *st, const valueSlot *loc)
+{
+    for (size_t k = 0; k < st->used; k++)
+    {
+        valueSlot *s = &st->slot[k];
+
+        if (s->cls == VAL_STACK && (!loc || mayOverlap(s, loc)))
+            s->store = -1;
+    }
+}
+
+/**
+ * @brief Forget everything (a call, an instruction not known, ...).
+ * @param st The valueState structure.
+ */
+static void forgetAll(valueState *st)
+{
+    for (int r = 0; r < 3; r++)
+        st->reg[r].value = VALUE_UNKNOWN;
+    st->used  = 0;
+    st->depth = 0;
+    st->frame = 0;
+}
+
+/**
+ * @brief Give a new value to a register.
+ * @param st The valueState structure.
+ * @param r The register (0 the accumulator, 1 X, 2 Y).
+ * @param bits Its width, BITS_UNKNOWN if not known.
+ */
+static void newValue(valueState *st, const int r, const unsigned char bits)
+{
+    st->reg[r].value = bits == BITS_UNKNOWN ? VALUE_UNKNOWN : st->next++;
+    st->reg[r].bits  = bits;
+}
+
+/**
+ * @brief Copy the value of a register to another one (tax, txy, ...): it
+ * is kept if both have the width it was set with (the accumulator and
+ * the index registers the same one).
+ * @param st The valueState structure.
+ * @param to The register written.
+ * @param from The register read.
+ * @param w The widths before the line.
+ */
+static void copyValue(valueState *st, const int to, const int from, const cpuWidths *w)
+{
+    unsigned char bits = to ? w->x : w->m;
+
+    if (bits != BITS_UNKNOWN && ((to && from) || w->m == w->x) && st->reg[from].bits == bits)
+        st->reg[to] = st->reg[from];
+    else
+        newValue(st, to, bits);
+}
+
+/**
+ * @brief Follow a frame adjustment of tcc (tsa, clc, adc #n, tas or
+ * tsa, sec, sbc #n, tas), one line at a time.
+ * @param file The asmFile structure.
+ * @param i The index of the line.
+ * @param w The widths before the line.
+ * @param st The valueState structure (frame is the line read, 0 if the
+ * line is not the next one of an adjustment).
+ * @return 1 if the stack pointer is set by the adjustment, 0 otherwise.
+ */
+static int stepFrame(const asmFile *file, const size_t i, const cpuWidths *w, valueState *st)
+{
+    const asmLine *ins = &file->ins[i];
+    int frame          = st->frame;
+    long v;
+
+    st->frame = 0;
+    switch (ins->mnemonic)
+    {
+    case MN_TSC:
+        st->frame = 1;
+        st->base  = st->depth;
+        st->delta = 0;
+        return 0;
+    case MN_CLC:
+    case MN_SEC:
+        if (frame == 1)
+            st->frame = ins->mnemonic == MN_CLC ? 2 : 3;
+        return 0;
+    case MN_ADC:
+    case MN_SBC:
+        if (frame == (ins->mnemonic == MN_ADC ? 2 : 3) && w->m == 16 && ins->mode == MODE_IMMEDIATE
+            && (v = immediateValue(file->arr[i] + ins->operand)) >= 0)
+        {
+            st->delta = ins->mnemonic == MN_ADC ? v : -v;
+            st->frame = 4;
+        }
+        return 0;
+    case MN_TCS:
+        if (frame != 1 && frame != 4)
+            return 0;
+        /* The stack pointer is the one read plus delta */
+        if (st->base - st->delta < st->depth)
+            pullStack(st, st->base - st->delta);
+        else
+            st->depth = st->base - st->delta;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Checks if a line stores a register (sta, stx, sty or stz).
+ * @param ins The asmLine structure.
+ * @return 1 if true, 0 otherwise.
+ */
+static int isStore(const asmLine *ins)
+{
+    return ins->mnemonic == MN_STA || ins->mnemonic == MN_STX || ins->mnemonic == MN_STY || ins->mnemonic == MN_STZ;
+}
+
+/*!
+ * @brief The transfers from a register to another (see markLoads function).
+ */
+static const char *const transfers[3][3] = { { NULL, "tax", "tay" }, { "txa", NULL, "txy" }, { "tya", "tyx", NULL } };
+
+/**
+ * @brief Follow a line which is not a load (see markLoads function).
+ * @param file The asmFile structure.
+ * @param i The index of the line.
+ * @param w The widths before the line.
+ * @param st The valueState structure.
+ * @param dead The lines removed (the stores to a stack slot written
+ * again before it is read are marked).
+ * @return The number of stores marked.
+ */
+static size_t stepValues(const asmFile *file, const size_t i, const cpuWidths *w, valueState *st, char *dead)
+{
+    const asmLine *ins = &file->ins[i];
+    valueSlot loc;
+    int known = locationOf(file, i, st->depth, &loc);
+    size_t removed = 0;
+
+    if (ins->kind == LINE_DIRECTIVE || isLongCall(ins))
+    {
+        forgetAll(st);
+        return 0;
+    }
+    if (stepFrame(file, i, w, st))
+        return 0;
+
+    /* Any other access to the stack, or through a pointer, may read a slot */
+    if (ins->mode == MODE_STACK_IND_Y
+        || (!isStore(ins) && ins->mnemonic != MN_PEA && ins->mnemonic != MN_PER && ins->mode != MODE_IMPLIED
+            && ins->mode != MODE_ACCUMULATOR && ins->mode != MODE_IMMEDIATE && !(ins->mode == MODE_ABSOLUTE && known)))
+        readStack(st, NULL);
+
+    switch (ins->mnemonic)
+    {
+    case MN_STA:
+    case MN_STX:
+    case MN_STY:
+    case MN_STZ:
+    {
+        int r              = ins->mnemonic == MN_STX ? 1 : ins->mnemonic == MN_STY ? 2 : 0;
+        unsigned char bits = r ? w->x : w->m;
+        int value          = VALUE_UNKNOWN;
+
+        if (!known || loc.cls == VAL_IMMEDIATE)
+        {
+            forgetValues(st, NULL);
+            break;
+        }
+        loc.bits = bits;
+        if (loc.cls == VAL_STACK && bits != BITS_UNKNOWN)
+        {
+            /* The store not read since is overwritten */
+            for (size_t k = 0; k < st->used; k++)
+            {
+                const valueSlot *s = &st->slot[k];
+
+                if (s->cls == VAL_STACK && s->store >= 0 && s->bits <= bits && sameLocation(s, &loc))
+                {
+                    dead[s->store] = 1;
+                    removed++;
+                }
+            }
+            loc.store = (long)i;
+        }
+        forgetValues(st, &loc);
+        if (bits == BITS_UNKNOWN)
+            break;
+        if (ins->mnemonic == MN_STZ)
+        {
+            valueSlot zero = { "#0", 2, WIDTH_NONE, VAL_IMMEDIATE, PREG_NONE, 0, 0, 0, 0, -1 };
+
+            value = findValue(st, &zero, bits);
+            if (value == VALUE_UNKNOWN)
+                addValue(st, &zero, bits, value = st->next++);
+        }
+        else if (st->reg[r].bits == bits)
+            value = st->reg[r].value;
+        /* A stack slot is kept for its store, even if its value is not known */
+        if ((value != VALUE_UNKNOWN && loc.cls != VAL_GLOBAL) || loc.store >= 0)
+            addValue(st, &loc, bits, value);
+        break;
+    }
+    case MN_ASL:
+    case MN_DEC:
+    case MN_INC:
+    case MN_LSR:
+    case MN_ROL:
+    case MN_ROR:
+    case MN_TRB:
+    case MN_TSB:
+        if (ins->mode == MODE_IMPLIED || ins->mode == MODE_ACCUMULATOR)
+            newValue(st, 0, w->m);
+        else
+            forgetValues(st, known && loc.cls != VAL_IMMEDIATE ? &loc : NULL);
+        break;
+    case MN_ADC:
+    case MN_AND:
+    case MN_EOR:
+    case MN_ORA:
+    case MN_SBC:
+    case MN_TDC:
+    case MN_TSC:
+    case MN_XBA:
+        newValue(st, 0, w->m);
+        break;
+    case MN_PLA:
+        newValue(st, 0, w->m);
+        readStack(st, NULL);
+        if (w->m == BITS_UNKNOWN)
+            forgetStack(st);
+        else
+            pullStack(st, st->depth - w->m / 8);
+        break;
+    case MN_DEX:
+    case MN_INX:
+    case MN_TSX:
+        newValue(st, 1, w->x);
+        break;
+    case MN_PLX:
+    case MN_PLY:
+    {
+        int r = ins->mnemonic == MN_PLX ? 1 : 2;
+
+        newValue(st, r, w->x);
+        readStack(st, NULL);
+        if (w->x == BITS_UNKNOWN)
+            forgetStack(st);
+        else
+            pullStack(st, st->depth - w->x / 8);
+        break;
+    }
+    case MN_DEY:
+    case MN_INY:
+        newValue(st, 2, w->x);
+        break;
+    case MN_TAX:
+        copyValue(st, 1, 0, w);
+        break;
+    case MN_TAY:
+        copyValue(st, 2, 0, w);
+        break;
+    case MN_TXA:
+        copyValue(st, 0, 1, w);
+        break;
+    case MN_TYA:
+        copyValue(st, 0, 2, w);
+        break;
+    case MN_TXY:
+        copyValue(st, 2, 1, w);
+        break;
+    case MN_TYX:
+        copyValue(st, 1, 2, w);
+        break;
+    case MN_PHB:
+    case MN_PHK:
+    case MN_PHP:
+        st->depth += 1;
+        break;
+    case MN_PEA:
+    case MN_PEI:
+    case MN_PER:
+    case MN_PHD:
+        st->depth += 2;
+        break;
+    case MN_PHA:
+        if (w->m == BITS_UNKNOWN)
+            forgetStack(st);
+        else
+            st->depth += w->m / 8;
+        break;
+    case MN_PHX:
+    case MN_PHY:
+        if (w->x == BITS_UNKNOWN)
+            forgetStack(st);
+        else
+            st->depth += w->x / 8;
+        break;
+    case MN_TCS:
+    case MN_TXS:
+        forgetStack(st);
+        break;
+    case MN_PLP:
+        /* The widths may change: the index registers lose their high byte */
+        st->reg[1].value = st->reg[2].value = VALUE_UNKNOWN;
+        readStack(st, NULL);
+        pullStack(st, st->depth - 1);
+        break;
+    case MN_REP:
+    case MN_SEP:
+    {
+        long bits = switchBits(file, i);
+
+        if (bits < 0 || bits & 0x10)
+            st->reg[1].value = st->reg[2].value = VALUE_UNKNOWN;
+        break;
+    }
+    case MN_BCC:
+    case MN_BCS:
+    case MN_BEQ:
+    case MN_BMI:
+    case MN_BNE:
+    case MN_BPL:
+    case MN_BVC:
+    case MN_BVS:
+    case MN_BIT:
+    case MN_CLC:
+    case MN_CLD:
+    case MN_CLI:
+    case MN_CLV:
+    case MN_CMP:
+    case MN_CPX:
+    case MN_CPY:
+    case MN_NOP:
+    case MN_SEC:
+    case MN_SED:
+    case MN_SEI:
+        break;
+    default:
+        /* Calls, jumps, block moves, pulls of the banks, ... */
+        if (hasInstruction(file, i))
+            forgetAll(st);
+        break;
+    }
+
+    return removed;
+}
+
+/**
+ * @brief Follow the values of the accumulator and of the index
+ * registers through the blocks, and on into a block run into after a
+ * branch (value numbering): a load of a value
+ * a register already holds is removed when the flags it sets are not
+ * read, or turned into a transfer (tax, tyx, ...) when another register
+ * holds it with the same width. The values are immediates,
+ * pseudo-registers and stack slots, not labels (the variables the
+ * interrupt handlers update, the hardware registers given a name by
+ * .define); the pseudo-registers are only written by their name, and the functions called do not keep them
+ * (see effectOf function). The stack slots are followed through the
+ * pushes, the pulls and the frame adjustments of tcc, and a store to a
+ * slot written again in the block before it is read is removed.
+ * @param file The asmFile structure (the transfers are written in place).
+ * @param flow The flowGraph structure.
+ * @param cpu The widths of the processor before each line.
+ * @param dead The lines removed.
+ * @param trace The traces of the lines (a line rewritten is not clean).
+ * @param rules The counters of the rules (NULL if none).
+ * @return The number of loads rewritten (the ones removed are marked).
+ */
+static size_t markLoads(asmFile *file, const flowGraph *flow, const cpuWidths *cpu, char *dead, lineTrace *trace,
+                        ruleStats *rules)
+{
+    uint64_t start = rules ? nowNs() : 0;
+    size_t loads = 0, known = 0, moved = 0, stores = 0, removed = 0;
+    char *nz      = flagsLive(file, flow);
+    valueState st;
+
+    st.next = 0;
+
+    for (size_t b = 0; b < flow->count; b++)
+    {
+        const flowBlock *blk = &flow->blocks[b];
+
+        /* A block without label is only run into from the previous one */
+        if (b == 0 || file->ins[blk->from].kind == LINE_LABEL || file->ins[blk->from].kind == LINE_ANONYMOUS
+            || flow->blocks[b - 1].next != (long)b)
+            forgetAll(&st);
+        else
+            readStack(&st, NULL); // The slots may be read after the branch
+        for (size_t i = blk->from; i < blk->to; i++)
+        {
+            const asmLine *ins = &file->ins[i];
+            int r              = ins->mnemonic == MN_LDA ? 0 : ins->mnemonic == MN_LDX ? 1 : ins->mnemonic == MN_LDY ? 2 : -1;
+            valueSlot loc;
+
+            if (dead[i]) // A frame rewritten (see markFrames function)
+                continue;
+            if (r < 0)
+            {
+                if (ins->mode == MODE_STACK && isStore(ins))
+                    stores++;
+                removed += stepValues(file, i, &cpu[i], &st, dead);
+                continue;
+            }
+
+            unsigned char bits = r ? cpu[i].x : cpu[i].m;
+
+            st.frame = 0;
+            int found = bits != BITS_UNKNOWN && locationOf(file, i, st.depth, &loc);
+
+            if (!found || loc.cls == VAL_GLOBAL)
+            {
+                if (!found && ins->mode != MODE_IMMEDIATE)
+                    readStack(&st, NULL);
+                newValue(&st, r, bits);
+                continue;
+            }
+            loads++;
+            loc.bits = bits;
+
+            int value = findValue(&st, &loc, bits);
+
+            if (value == VALUE_UNKNOWN)
+            {
+                readStack(&st, &loc);
+                addValue(&st, &loc, bits, value = st.next++);
+            }
+            else if (st.reg[r].value == value && st.reg[r].bits == bits)
+            {
+                if (!nz[i])
+                {
+                    dead[i] = 1;
+                    known++;
+                }
+                else
+                    readStack(&st, &loc);
+                continue;
+            }
+            else
+            {
+                int o;
+
+                for (o = 0; o < 3; o++)
+                {
+                    if (o != r && st.reg[o].value == value && st.reg[o].bits == bits && ((o && r) || cpu[i].m == cpu[i].x))
+                    {
+                        setLine(file, i, transfers[o][r]);
+                        trace[i].src = -1;
+                        moved++;
+                        break;
+                    }
+                }
+                if (o == 3)
+                    readStack(&st, &loc);
+            }
+            st.reg[r].value = value;
+            st.reg[r].bits  = bits;
+        }
+    }
+
+    free(nz);
+
+    if (rules)
+    {
+        rules->attempts[RULE_LOAD_KNOWN] += loads;
+        rules->hits[RULE_LOAD_KNOWN] += known;
+        rules->attempts[RULE_LOAD_TRANSFER] += loads;
+        rules->hits[RULE_LOAD_TRANSFER] += moved;
+        rules->attempts[RULE_STACK_DEAD] += stores;
+        rules->hits[RULE_STACK_DEAD] += removed;
+        rules->ns[RULE_LOAD_KNOWN] += nowNs() - start;
+    }
+
+    return moved;
+}
+
+/**
+ * @enum frameForm
+ * @brief A way to move the stack pointer (see frameCosts).
+ */
+typedef enum frameForm
+{
+    FRAME_NONE = 0, /*!< No line, the stack pointer stays */
+    FRAME_PULL,     /*!< pla in 16 bits, repeated */
+    FRAME_PUSH,     /*!< pha in 16 bits, repeated */
+    FRAME_ADJUST,   /*!< tsa, clc, adc #n, tas (or sec, sbc #n) */
+    FRAME_FORMS
+} frameForm;
+
+/**
+ * @struct frameCost
+ * @brief The cost of a way to move the stack pointer.
+ * @var frameCost::line
+ * Member 'line' contains the line repeated (NULL if none).
+ * @var frameCost::cycles
+ * Member 'cycles' contains the cycles of a line repeated, or of all
+ * the lines.
+ * @var frameCost::bytes
+ * Member 'bytes' contains the bytes of a line repeated, or of all the
+ * lines.
+ * @var frameCost::step
+ * Member 'step' contains the bytes a line repeated pulls (pushes if
+ * negative), 0 if the lines are written once for any number.
+ */
+typedef struct frameCost
+{
+    const char *line;
+    unsigned int cycles;
+    unsigned int bytes;
+    int step;
+} frameCost;
+
+/*!
+ * @brief The cost of each frameForm (see markFrames function).
+ */
+static const frameCost frameCosts[FRAME_FORMS] = {
+    [FRAME_NONE]   = { NULL, 0, 0, 0 },
+    [FRAME_PULL]   = { "pla", 5, 1, 2 },
+    [FRAME_PUSH]   = { "pha", 4, 1, -2 },
+    [FRAME_ADJUST] = { NULL, 9, 6, 0 },
+};
+
+/**
+ * @struct frameTotal
+ * @brief The cost of lines moving the stack pointer.
+ * @var frameTotal::delta
+ * Member 'delta' contains the bytes pulled (pushed if negative).
+ * @var frameTotal::cycles
+ * Member 'cycles' contains the cycles.
+ * @var frameTotal::bytes
+ * Member 'bytes' contains the bytes.
+ * @var frameTotal::lines
+ * Member 'lines' contains the number of lines.
+ */
+typedef struct frameTotal
+{
+    long delta;
+    unsigned long cycles;
+    unsigned long bytes;
+    size_t lines;
+} frameTotal;
+
+/**
+ * @struct frameDefine
+ * @brief A number given a name by .define (see markFrames function).
+ * @var frameDefine::name
+ * Member 'name' contains the name.
+ * @var frameDefine::len
+ * Member 'len' contains the length of the name.
+ * @var frameDefine::value
+ * Member 'value' contains the number.
+ */
+typedef struct frameDefine
+{
+    const char *name;
+    size_t len;
+    long value;
+} frameDefine;
+
+/**
+ * @brief Get the cost of a frameForm moving the stack pointer by a
+ * number of bytes.
+ * @param form The frameForm.
+ * @param delta The bytes pulled (pushed if negative).
+ * @param total The cost (set).
+ * @return 1 if the form moves the stack pointer by delta, 0 otherwise.
+ */
+static int formCost(const frameForm form, const long delta, frameTotal *total)
+{
+    const frameCost *c = &frameCosts[form];
+    long count;
+
+    total->delta = delta;
+    switch (form)
+    {
+    case FRAME_NONE:
+        count = delta == 0 ? 0 : -1;
+        break;
+    case FRAME_ADJUST:
+        count = 1;
+        break;
+    default:
+        count = delta % c->step == 0 && delta / c->step > 0 ? delta / c->step : -1;
+        break;
+    }
+    if (count < 0)
+        return 0;
+
+    total->cycles = (unsigned long)count * c->cycles;
+    total->bytes  = (unsigned long)count * c->bytes;
+    total->lines  = c->step ? (size_t)count : form == FRAME_ADJUST ? 4 : 0;
+
+    return 1;
+}
+
+/**
+ * @brief Read a number: a decimal or hexadecimal one, or a name given
+ * by .define before.
+ * @param a The number.
+ * @param defs The names given.
+ * @param count The number of names given.
+ * @param v The number read.
+ * @return 1 if read, 0 otherwise.
+ */
+static int frameNumber(const char *a, const frameDefine *defs, const size_t count, long *v)
+{
+    char *end;
+    size_t len;
+
+    if (a[0] == '$')
+        *v = strtol(a + 1, &end, 16);
+    else if (isdigit((unsigned char)a[0]))
+        *v = strtol(a, &end, 10);
+    else
+    {
+        len = strlen(a);
+        for (size_t k = count; k-- > 0;)
+        {
+            if (defs[k].len == len && memcmp(defs[k].name, a, len) == 0)
+            {
+                *v = defs[k].value;
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    return end != a && *end == '\0';
+}
+
+/**
+ * @brief Read a frame adjustment of tcc (tsa, clc, adc #n, tas or tsa,
+ * sec, sbc #n, tas), in 16 bits (the immediate is assembled so: the
+ * processor has the width, see stepWidths function).
+ * @param file The asmFile structure.
+ * @param i The index of its first line.
+ * @param cpu The widths of the processor before each line.
+ * @param lex The widths the assembler assumes before each line.
+ * @param defs The names given by .define.
+ * @param count The number of names given.
+ * @param delta The bytes pulled (pushed if negative).
+ * @return 1 if read, 0 otherwise.
+ */
+static int frameAdjust(const asmFile *file, const size_t i, const cpuWidths *cpu, const cpuWidths *lex,
+                       const frameDefine *defs, const size_t count, long *delta)
+{
+    const asmLine *ins = &file->ins[i];
+    long v;
+
+    if (i + 4 > file->used || ins[0].mnemonic != MN_TSC || ins[3].mnemonic != MN_TCS
+        || !((ins[1].mnemonic == MN_CLC && ins[2].mnemonic == MN_ADC) || (ins[1].mnemonic == MN_SEC && ins[2].mnemonic == MN_SBC))
+        || ins[2].mode != MODE_IMMEDIATE || ins[2].width != WIDTH_NONE || cpu[i + 2].m == 8 || lex[i + 2].m != 16
+        || !frameNumber(file->arr[i + 2] + ins[2].operand + 1, defs, count, &v))
+        return 0;
+
+    *delta = ins[2].mnemonic == MN_ADC ? v : -v;
+    return 1;
+}
+
+/**
+ * @brief Read the lines moving the stack pointer at a line: a pla in 16
+ * bits, a frame adjustment, or one between ".ifgr name 0" and .endif
+ * (the epilogue and the prologue of a function, assembled if the number
+ * is greater than 0).
+ * @param file The asmFile structure.
+ * @param i The index of the line.
+ * @param cpu The widths of the processor before each line.
+ * @param lex The widths the assembler assumes before each line.
+ * @param defs The names given by .define.
+ * @param count The number of names given.
+ * @param part The lines read and their cost (set).
+ * @return 1 if the lines set the accumulator to the stack pointer, 0 if
+ * not, -1 if the line is not one of them.
+ */
+static int framePart(const asmFile *file, const size_t i, const cpuWidths *cpu, const cpuWidths *lex,
+                     const frameDefine *defs, const size_t count, frameTotal *part)
+{
+    const asmLine *ins = &file->ins[i];
+    const char *arg;
+    long delta, v;
+
+    /* Its width is the one of the adjustment after it (a run ends with one) */
+    if (ins->mnemonic == MN_PLA && cpu[i].m != 8)
+    {
+        formCost(FRAME_PULL, 2, part);
+        return 0;
+    }
+    if (frameAdjust(file, i, cpu, lex, defs, count, &delta))
+    {
+        formCost(FRAME_ADJUST, delta, part);
+        return 1;
+    }
+    if (ins->kind != LINE_DIRECTIVE || (arg = directiveArg(file->arr[i], ".ifgr")) == NULL || i + 6 > file->used
+        || file->ins[i + 5].kind != LINE_DIRECTIVE || !directiveArg(file->arr[i + 5], ".endif")
+        || !frameAdjust(file, i + 1, cpu, lex, defs, count, &delta))
+        return -1;
+
+    const char *sp = strchr(arg, ' ');
+    char name[64];
+
+    if (sp == NULL || strcmp(sp, " 0") != 0 || (size_t)(sp - arg) >= sizeof(name))
+        return -1;
+    memcpy(name, arg, sp - arg);
+    name[sp - arg] = '\0';
+    if (!frameNumber(name, defs, count, &v))
+        return -1;
+
+    if (v > 0)
+        formCost(FRAME_ADJUST, delta, part);
+    else
+        formCost(FRAME_NONE, 0, part);
+    part->lines = 6;
+
+    return v > 0;
+}
+
+/**
+ * @brief Rewrite the runs of lines moving the stack pointer (the
+ * cleanups after the calls, the epilogues and the prologues of the
+ * functions) with the form costing the fewest cycles, then bytes (see
+ * frameCosts): two adjustments become one, an adjustment of 2 bytes a
+ * pla or a pha, and the cleanup before an epilogue is added to it. The
+ * accumulator and the flags a frame adjustment leaves are not read (tcc
+ * returns in tcc__r0), so a run ending with a pla is cut before it.
+ * Run before the other passes, whose lines removed it does not skip.
+ * @param file The asmFile structure (the lines are rewritten in place).
+ * @param cpu The widths of the processor before each line.
+ * @param lex The widths the assembler assumes before each line.
+ * @param dead The lines removed.
+ * @param trace The traces of the lines (a line rewritten is not clean).
+ * @param rules The counters of the rules (NULL if none).
+ * @return The number of lines rewritten (the ones removed are marked).
+ */
+static size_t markFrames(asmFile *file, const cpuWidths *cpu, const cpuWidths *lex, char *dead, lineTrace *trace,
+                         ruleStats *rules)
+{
+    uint64_t start = rules ? nowNs() : 0;
+    size_t runs = 0, merged = 0, moved = 0;
+    frameDefine *defs = NULL;
+    size_t count = 0, size = 0;
+
+    for (size_t i = 0; i < file->used; i++)
+    {
+        const char *arg;
+
+        if (file->ins[i].kind == LINE_DIRECTIVE && (arg = directiveArg(file->arr[i], ".define")) != NULL)
+        {
+            const char *sp = strchr(arg, ' ');
+            long v;
+
+            if (sp == NULL || !frameNumber(sp + 1, NULL, 0, &v))
+                continue;
+            if (count == size)
+            {
+                size = size ? size * 2 : 64;
+                defs = realloc(defs, size * sizeof(frameDefine));
+                if (defs == NULL)
+                {
+                    fatalError("malloc-flow");
+                }
+            }
+            defs[count++] = (frameDefine){ arg, (size_t)(sp - arg), v };
+            continue;
+        }
+
+        /* The run, up to the last adjustment */
+        frameTotal run = { 0, 0, 0, 0 }, total = { 0, 0, 0, 0 }, part;
+        size_t j = i;
+        int sets;
+
+        while (j < file->used && (sets = framePart(file, j, cpu, lex, defs, count, &part)) >= 0)
+        {
+            total.delta += part.delta;
+            total.cycles += part.cycles;
+            total.bytes += part.bytes;
+            total.lines += part.lines;
+            j += part.lines;
+            if (sets)
+                run = total;
+        }
+        if (run.lines == 0)
+        {
+            i = j > i ? j - 1 : i;
+            continue;
+        }
+        runs++;
+
+        size_t end = i + run.lines;
+        frameTotal best = run, cost;
+        frameForm form  = FRAME_FORMS;
+
+        for (int f = 0; f < FRAME_FORMS; f++)
+        {
+            if (formCost(f, run.delta, &cost) && cost.lines <= run.lines
+                && (cost.cycles < best.cycles || (cost.cycles == best.cycles && cost.bytes < best.bytes)))
+            {
+                best = cost;
+                form = f;
+            }
+        }
+        if (form == FRAME_FORMS)
+        {
+            i = end - 1;
+            continue;
+        }
+
+        for (size_t k = 0; k < best.lines; k++)
+        {
+            char line[32];
+
+            if (frameCosts[form].line)
+                setLine(file, i + k, frameCosts[form].line);
+            else
+            {
+                const char *adjust[4] = { "tsa", run.delta > 0 ? "clc" : "sec", line, "tas" };
+
+                snprintf(line, sizeof(line), "%s #%ld", run.delta > 0 ? "adc" : "sbc", labs(run.delta));
+                setLine(file, i + k, adjust[k]);
+            }
+            trace[i + k].src = -1;
+        }
+        for (size_t k = i + best.lines; k < end; k++)
+            dead[k] = 1;
+        merged++;
+        moved += best.lines;
+        i = end - 1;
+    }
+
+    free(defs);
+
+    if (rules)
+    {
+        rules->attempts[RULE_FRAME_MERGE] += runs;
+        rules->hits[RULE_FRAME_MERGE] += merged;
+        rules->ns[RULE_FRAME_MERGE] += nowNs() - start;
+    }
+
+    return moved;
+}
+
+/**
+ * @brief Get the index of a pseudo-register in the live sets, the
+ * first time it is seen gives it the next one.
+ * @param dense The index of each id (-1 if none yet).
+ * @param count The number of indexes given.
+ * @param preg The pseudo-register id (see PREG_ID).
+ * @return The index.
+ */
+static int pregIndex(int *dense, int *count, const int preg)
+{
+    if (dense[preg] < 0)
+        dense[preg] = (*count)++;
+
+    return dense[preg];
+}
+
+/**
+ * @brief The effect of a line on the pseudo-registers. Only the exact
+ * operands are followed (see asmLine::preg), any other mention of a
+ * pseudo-register may read them all. As the redundant stores assume,
+ * the functions called (not the tcc__ helpers) do not read the
+ * pseudo-registers, and their values are lost across the call.
+ * @param file The asmFile structure.
+ * @param i The index of the line.
+ * @param w The widths before the line (see flowWidths function).
+ * @param dense The index of each pseudo-register id (see pregIndex function).
+ * @param count The number of indexes given.
+ * @return The lineEffect structure.
+ */
+static lineEffect effectOf(const asmFile *file, const size_t i, const cpuWidths *w, int *dense, int *count)
+{
+    const asmLine *ins = &file->ins[i];
+    lineEffect fx      = { FX_NONE, { -1, -1 } };
+
+    if (isLongCall(ins))
+    {
+        fx.kind = startWith(file->arr[i] + ins->operand, "tcc__") ? FX_USE_ALL : FX_KILL_ALL;
+        return fx;
+    }
+
+    switch (ins->mnemonic)
+    {
+    case MN_JSR:
+    case MN_JSL:
+    case MN_BRK:
+    case MN_COP:
+    case MN_MVN:
+    case MN_MVP:
+    case MN_TCD:
+    case MN_PLD:
+        fx.kind = FX_USE_ALL;
+        return fx;
+    default:
+        break;
+    }
+
+    if (!(ins->flags & LF_PSEUDO))
+        return fx;
+    if (ins->preg == PREG_NONE || ins->mnemonic == MN_NONE)
+    {
+        fx.kind = FX_USE_ALL;
+        return fx;
+    }
+
+    int store = ins->mnemonic == MN_STA || ins->mnemonic == MN_STZ || ins->mnemonic == MN_STX || ins->mnemonic == MN_STY;
+    int wide  = ins->mnemonic == MN_STA || ins->mnemonic == MN_STZ ? w->m == 16 : w->x == 16;
+
+    switch (ins->mode)
+    {
+    case MODE_ABSOLUTE:
+        if (store)
+        {
+            /* A store in 8 bits writes one byte: the other one may be read */
+            if (wide && ins->width == WIDTH_B)
+            {
+                fx.kind    = FX_KILL;
+                fx.preg[0] = pregIndex(dense, count, ins->preg);
+            }
+            return fx;
+        }
+        /* fall through */
+    case MODE_INDIRECT:
+    case MODE_INDIRECT_Y:
+        fx.kind    = FX_USE;
+        fx.preg[0] = pregIndex(dense, count, ins->preg);
+        return fx;
+    case MODE_IND_LONG:
+    case MODE_IND_LONG_Y:
+        /* A long pointer: tcc__rN and tcc__rNh */
+        if (PREG_HIGH(ins->preg))
+        {
+            fx.kind = FX_USE_ALL;
+            return fx;
+        }
+        fx.kind    = FX_USE;
+        fx.preg[0] = pregIndex(dense, count, ins->preg);
+        fx.preg[1] = pregIndex(dense, count, ins->preg + 2);
+        return fx;
+    default:
+        fx.kind = FX_USE_ALL;
+        return fx;
+    }
+}
+
+/**
+ * @brief Apply the effect of a line to the live pseudo-registers
+ * (backward: the set after the line becomes the set before it).
+ * @param fx The lineEffect structure.
+ * @param live The live set.
+ * @param words The number of words of the set.
+ */
+static void transfer(const lineEffect *fx, uint64_t *live, const size_t words)
+{
+    switch (fx->kind)
+    {
+    case FX_USE:
+        for (int k = 0; k < 2; k++)
+        {
+            if (fx->preg[k] >= 0)
+                live[fx->preg[k] / 64] |= (uint64_t)1 << (fx->preg[k] % 64);
+        }
+        break;
+    case FX_KILL:
+        live[fx->preg[0] / 64] &= ~((uint64_t)1 << (fx->preg[0] % 64));
+        break;
+    case FX_USE_ALL:
+        memset(live, 0xff, words * sizeof(uint64_t));
+        break;
+    case FX_KILL_ALL:
+        memset(live, 0, words * sizeof(uint64_t));
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Add a line before the summary of the lines after it: the
+ * pseudo-registers they read before writing them (gen), and the ones
+ * they write (kill). A block then moves a live set as its lines do:
+ * before = gen | (after & ~kill).
+ * @param fx The lineEffect structure.
+ * @param gen The pseudo-registers read.
+ * @param kill The pseudo-registers written.
+ * @param words The number of words of the sets.
+ */
+static void summarize(const lineEffect *fx, uint64_t *gen, uint64_t *kill, const size_t words)
+{
+    switch (fx->kind)
+    {
+    case FX_USE:
+        for (int k = 0; k < 2; k++)
+        {
+            if (fx->preg[k] >= 0)
+            {
+                gen[fx->preg[k] / 64] |= (uint64_t)1 << (fx->preg[k] % 64);
+                kill[fx->preg[k] / 64] &= ~((uint64_t)1 << (fx->preg[k] % 64));
+            }
+        }
+        break;
+    case FX_KILL:
+        gen[fx->preg[0] / 64] &= ~((uint64_t)1 << (fx->preg[0] % 64));
+        kill[fx->preg[0] / 64] |= (uint64_t)1 << (fx->preg[0] % 64);
+        break;
+    case FX_USE_ALL:
+        memset(gen, 0xff, words * sizeof(uint64_t));
+        memset(kill, 0, words * sizeof(uint64_t));
+        break;
+    case FX_KILL_ALL:
+        memset(gen, 0, words * sizeof(uint64_t));
+        memset(kill, 0xff, words * sizeof(uint64_t));
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief The pseudo-registers live at the end of a block: the ones live
+ * at the start of its successors, all of them if it leaves the graph.
+ * @param flow The flowGraph structure.
+ * @param b The index of the block.
+ * @param in The live sets at the start of the blocks.
+ * @param live The live set computed.
+ * @param words The number of words of a set.
+ */
+static void liveOut(const flowGraph *flow, const size_t b, const uint64_t *in, uint64_t *live, const size_t words)
+{
+    const flowBlock *blk = &flow->blocks[b];
+
+    memset(live, blk->exit ? 0xff : 0, words * sizeof(uint64_t));
+    for (size_t w = 0; w < words; w++)
+    {
+        if (blk->next >= 0)
+            live[w] |= in[(size_t)blk->next * words + w];
+        if (blk->target >= 0)
+            live[w] |= in[(size_t)blk->target * words + w];
+    }
+}
+
+/**
+ * @brief Mark the stores to a pseudo-register which no path reads
+ * before it is written again, or before a function call. A store is
+ * removed only when it writes the whole pseudo-register (a 16 bits
+ * accumulator or index register, see flowWidths function).
+ * @param file The asmFile structure.
+ * @param flow The flowGraph structure.
+ * @param cpu The widths of the processor before each line.
+ * @param dead The lines removed.
+ * @param rules The counters of the rules (NULL if none).
+ * @return The number of stores marked.
+ */
+static size_t markDeadStores(const asmFile *file, const flowGraph *flow, const cpuWidths *cpu, char *dead, ruleStats *rules)
+{
+    uint64_t start = rules ? nowNs() : 0;
+    size_t n       = file->used;
+    size_t stores = 0, removed = 0;
+    lineEffect *fx = malloc(n * sizeof(lineEffect));
+    int maxId      = 0;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        if (file->ins[i].preg > maxId)
+            maxId = file->ins[i].preg;
+    }
+
+    int *dense = malloc(((size_t)maxId + 3) * sizeof(int));
+    int count  = 0;
+
+    if (fx == NULL || dense == NULL)
+    {
+        fatalError("malloc-flow");
+    }
+    for (int k = 0; k < maxId + 3; k++)
+        dense[k] = -1;
+
+    for (size_t i = 0; i < n; i++)
+    {
+        fx[i] = dead[i] ? (lineEffect){ FX_NONE, { -1, -1 } } : effectOf(file, i, &cpu[i], dense, &count);
+        stores += fx[i].kind == FX_KILL;
+    }
+
+    if (stores)
+    {
+        size_t words   = ((size_t)count + 63) / 64;
+        uint64_t *gen  = calloc(flow->count * words, sizeof(uint64_t));
+        uint64_t *kill = calloc(flow->count * words, sizeof(uint64_t));
+        uint64_t *in   = calloc(flow->count * words, sizeof(uint64_t));
+        uint64_t *live = malloc(words * sizeof(uint64_t));
+
+        if (gen == NULL || kill == NULL || in == NULL || live == NULL)
+        {
+            fatalError("malloc-flow");
+        }
+
+        for (size_t b = 0; b < flow->count; b++)
+        {
+            for (size_t i = flow->blocks[b].to; i-- > flow->blocks[b].from;)
+                summarize(&fx[i], &gen[b * words], &kill[b * words], words);
+        }
+
+        /* The predecessors of each block, revisited when its start changes */
+        size_t *first = calloc(flow->count + 1, sizeof(size_t));
+        size_t *pred  = malloc((2 * flow->count + 1) * sizeof(size_t));
+        size_t *work  = malloc((flow->count + 1) * sizeof(size_t));
+        char *queued  = malloc(flow->count + 1);
+        size_t top    = flow->count;
+
+        if (first == NULL || pred == NULL || work == NULL || queued == NULL)
+        {
+            fatalError("malloc-flow");
+        }
+
+        for (size_t b = 0; b < flow->count; b++)
+        {
+            if (flow->blocks[b].next >= 0)
+                first[flow->blocks[b].next + 1]++;
+            if (flow->blocks[b].target >= 0)
+                first[flow->blocks[b].target + 1]++;
+        }
+        for (size_t b = 0; b < flow->count; b++)
+        {
+            first[b + 1] += first[b];
+            work[b] = first[b];
+        }
+        for (size_t b = 0; b < flow->count; b++)
+        {
+            if (flow->blocks[b].next >= 0)
+                pred[work[flow->blocks[b].next]++] = b;
+            if (flow->blocks[b].target >= 0)
+                pred[work[flow->blocks[b].target]++] = b;
+        }
+
+        /* Every block once, the last one first so most blocks see their
+            successors done, then the predecessors of the blocks changed */
+        for (size_t b = 0; b < flow->count; b++)
+        {
+            work[b]   = b;
+            queued[b] = 1;
+        }
+        while (top)
+        {
+            size_t b    = work[--top];
+            int changed = 0;
+
+            queued[b] = 0;
+            liveOut(flow, b, in, live, words);
+            for (size_t w = 0; w < words; w++)
+            {
+                uint64_t v = gen[b * words + w] | (live[w] & ~kill[b * words + w]);
+
+                changed |= v != in[b * words + w];
+                in[b * words + w] = v;
+            }
+            for (size_t k = first[b]; changed && k < first[b + 1]; k++)
+            {
+                if (!queued[pred[k]])
+                {
+                    queued[pred[k]] = 1;
+                    work[top++]     = pred[k];
+                }
+            }
+        }
+        free(first);
+        free(pred);
+        free(work);
+        free(queued);
+
+        for (size_t b = 0; b < flow->count; b++)
+        {
+            liveOut(flow, b, in, live, words);
+            for (size_t i = flow->blocks[b].to; i-- > flow->blocks[b].from;)
+            {
+                if (fx[i].kind == FX_KILL && !(live[fx[i].preg[0] / 64] & ((uint64_t)1 << (fx[i].preg[0] % 64))))
+                {
+                    dead[i] = 1;
+                    removed++;
+                }
+                transfer(&fx[i], live, words);
+            }
+        }
+
+        free(gen);
+        free(kill);
+        free(in);
+        free(live);
+    }
+
+    free(fx);
+    free(dense);
+
+    if (rules)
+    {
+        rules->attempts[RULE_STORE_DEAD] += stores;
+        rules->hits[RULE_STORE_DEAD] += removed;
+        rules->ns[RULE_STORE_DEAD] += nowNs() - start;
+    }
+
+    return removed;
+}
+
+/**
+ * @brief The widths a line depends on.
+ * @param file The asmFile structure.
+ * @param i The index of the line.
+ * @return The bits of the status register (0x20 the accumulator, 0x10
+ * the index registers).
+ */
+static int widthDeps(const asmFile *file, const size_t i)
+{
+    const asmLine *ins = &file->ins[i];
+    int indexed        = ins->mode == MODE_INDEXED_X || ins->mode == MODE_INDEXED_Y || ins->mode == MODE_INDIRECT_X
+                  || ins->mode == MODE_INDIRECT_Y || ins->mode == MODE_STACK_IND_Y || ins->mode == MODE_IND_LONG_Y;
+
+    if (ins->kind == LINE_EMPTY)
+        return 0;
+    if (!hasInstruction(file, i))
+        return 0x30;
+
+    switch (ins->mnemonic)
+    {
+    case MN_CLC:
+    case MN_CLD:
+    case MN_CLI:
+    case MN_CLV:
+    case MN_NOP:
+    case MN_PEA:
+    case MN_PEI:
+    case MN_PER:
+    case MN_PHB:
+    case MN_PHD:
+    case MN_PHK:
+    case MN_PLB:
+    case MN_PLD:
+    case MN_SEC:
+    case MN_SED:
+    case MN_SEI:
+    case MN_TCD:
+    case MN_TCS:
+    case MN_TDC:
+    case MN_TSC:
+    case MN_XBA:
+        return 0;
+    case MN_CPX:
+    case MN_CPY:
+    case MN_DEX:
+    case MN_DEY:
+    case MN_INX:
+    case MN_INY:
+    case MN_LDX:
+    case MN_LDY:
+    case MN_PHX:
+    case MN_PHY:
+    case MN_PLX:
+    case MN_PLY:
+    case MN_STX:
+    case MN_STY:
+    case MN_TAX:
+    case MN_TAY:
+    case MN_TSX:
+    case MN_TXS:
+    case MN_TXY:
+    case MN_TYX:
+        return 0x10;
+    case MN_ADC:
+    case MN_AND:
+    case MN_ASL:
+    case MN_BIT:
+    case MN_CMP:
+    case MN_DEC:
+    case MN_EOR:
+    case MN_INC:
+    case MN_LDA:
+    case MN_LSR:
+    case MN_ORA:
+    case MN_PHA:
+    case MN_PLA:
+    case MN_ROL:
+    case MN_ROR:
+    case MN_SBC:
+    case MN_STA:
+    case MN_STZ:
+    case MN_TRB:
+    case MN_TSB:
+        return indexed ? 0x30 : 0x20;
+    default:
+        return 0x30;
+    }
+}
+
+/**
+ * @brief Mark the mode switches (rep/sep) which change nothing:
+ * - a switch to the widths the processor has on every path, and the
+ *   assembler assumes;
+ * - a switch undone by the next one, the lines between not depending
+ *   on the widths (pea, pei, ...): both go, so the runs of 8 bits
+ *   pushes around 16 bits ones are switched once;
+ * - a switch overridden by the next one before a line depends on it.
+ * The widths after the lines removed are the ones before (for the
+ * processor and for the assembler, see flowWidths function).
+ * @param file The asmFile structure.
+ * @param flow The flowGraph structure.
+ * @param cpu The widths of the processor before each line (updated).
+ * @param lex The widths the assembler assumes before each line (updated).
+ * @param dead The lines removed.
+ * @param rules The counters of the rules (NULL if none).
+ * @return The number of switches marked.
+ */
+static size_t markSwitches(const asmFile *file, const flowGraph *flow, cpuWidths *cpu, cpuWidths *lex, char *dead,
+                           ruleStats *rules)
+{
+    uint64_t start = rules ? nowNs() : 0;
+    char *cond     = conditionalLines(file);
+    size_t switches = 0, removed = 0;
+
+    for (size_t b = 0; b < flow->count; b++)
+    {
+        const flowBlock *blk = &flow->blocks[b];
+
+        for (size_t i = blk->from; i < blk->to; i++)
+        {
+            const asmLine *ins = &file->ins[i];
+
+            if ((ins->mnemonic != MN_REP && ins->mnemonic != MN_SEP) || cond[i] || dead[i])
+                continue;
+
+            long bits           = switchBits(file, i);
+            unsigned char width = ins->mnemonic == MN_REP ? 16 : 8;
+
+            if (bits <= 0 || (bits & ~0x30))
+                continue;
+            switches++;
+
+            if (hasWidths(&cpu[i], bits, width) && hasWidths(&lex[i], bits, width))
+            {
+                dead[i] = 1;
+                removed++;
+                continue;
+            }
+
+            /* The next switch, if no line depends on this one before */
+            size_t j = i + 1;
+            while (j < blk->to && file->ins[j].mnemonic != MN_REP && file->ins[j].mnemonic != MN_SEP
+                   && !(widthDeps(file, j) & bits))
+                j++;
+            if (j == blk->to || (file->ins[j].mnemonic != MN_REP && file->ins[j].mnemonic != MN_SEP) || cond[j])
+                continue;
+
+            long next           = switchBits(file, j);
+            unsigned char after = file->ins[j].mnemonic == MN_REP ? 16 : 8;
+
+            if (next < 0 || (next & bits) != bits)
+                continue;
+
+            if (next == bits && after != width && hasWidths(&cpu[i], bits, after) && hasWidths(&lex[i], bits, after))
+            {
+                dead[i] = dead[j] = 1;
+                removed += 2;
+                continue;
+            }
+            dead[i] = 1;
+            removed++;
+            if (bits & 0x20)
+            {
+                cpu[j].m = cpu[i].m;
+                lex[j].m = lex[i].m;
+            }
+            if (bits & 0x10)
+            {
+                cpu[j].x = cpu[i].x;
+                lex[j].x = lex[i].x;
+            }
+        }
+    }
+
+    free(cond);
+
+    if (rules)
+    {
+        rules->attempts[RULE_MODE_SWITCH] += switches;
+        rules->hits[RULE_MODE_SWITCH] += removed;
+        rules->ns[RULE_MODE_SWITCH] += nowNs() - start;
+    }
+
+    return removed;
+}
+
+/**
+ * @brief Remove the lines the control flow graph shows useless: the
+ * moves of the stack pointer merged (see markFrames function), the
+ * loads of a value already in a register (see markLoads function), the
+ * stores no path reads (see markDeadStores function), and the mode
+ * switches which change nothing (see markSwitches function). The graph
+ * and the widths are charged to the dead stores.
+ * @param file The asmFile structure (compacted in place).
+ * @param labels The labelTable structure of the file (see buildLabels function).
+ * @param trace The traces of the lines (compacted the same way, the
+ * lines around a line removed are not clean anymore).
+ * @param rules The counters of the rules (NULL if none).
+ * @return The number of lines removed or rewritten.
+ */
+size_t optimizeFlow(asmFile *file, const labelTable *labels, lineTrace *trace, ruleStats *rules)
+{
+    uint64_t start = rules ? nowNs() : 0;
+    size_t n       = file->used;
+
+    if (n == 0)
+        return 0;
+
+    flowGraph flow = buildFlow(file, labels);
+    cpuWidths *cpu = malloc(n * sizeof(cpuWidths));
+    cpuWidths *lex = malloc(n * sizeof(cpuWidths));
+    char *dead     = calloc(n, 1);
+
+    if (cpu == NULL || lex == NULL || dead == NULL)
+    {
+        fatalError("malloc-flow");
+    }
+
+    flowWidths(file, &flow, cpu, lex);
+    if (rules)
+        rules->ns[RULE_STORE_DEAD] += nowNs() - start;
+
+    size_t moved = markFrames(file, cpu, lex, dead, trace, rules);
+
+    moved += markLoads(file, &flow, cpu, dead, trace, rules);
+    markDeadStores(file, &flow, cpu, dead, rules);
+    markSwitches(file, &flow, cpu, lex, dead, rules);
+
+    /* Compact the lines, the padding after them stays empty */
+    size_t used = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (dead[i])
+            continue;
+        file->arr[used] = file->arr[i];
+        file->ins[used] = file->ins[i];
+        trace[used]     = trace[i];
+        used++;
+    }
+    for (size_t i = used; i < n; i++)
+    {
+        file->arr[i] = NULL;
+        memset(&file->ins[i], 0, sizeof(asmLine));
+    }
+    file->used = used;
+
+    free(cpu);
+    free(lex);
+    free(dead);
+    freeFlow(flow);
+
+    return n - used + moved;
+}
@@ -0,0 +1,74 @@
+#ifndef FLOW_H
+#define FLOW_H
+
+#include "optimizer.h"
+
+/**
+ * @struct flowBlock
+ * @brief A basic block: lines entered at the first one only, and left
+ * at the last one only (see buildFlow function).
+ * @var flowBlock::from
+ * Member 'from' contains the index of the first line.
+ * @var flowBlock::to
+ * Member 'to' contains the index of the line after the last one.
+ * @var flowBlock::next
+ * Member 'next' contains the block run into after the last line,
+ * -1 if none.
+ * @var flowBlock::target
+ * Member 'target' contains the block branched to by the last line,
+ * -1 if none.
+ * @var flowBlock::exit
+ * Member 'exit' is 1 if the block may be left for code out of the
+ * graph (return, indirect jump, unknown label, end of the file).
+ */
+typedef struct flowBlock
+{
+    size_t from;
+    size_t to;
+    long next;
+    long target;
+    int exit;
+} flowBlock;
+
+/**
+ * @struct flowGraph
+ * @brief The control flow graph of an asmFile.
+ * @var flowGraph::blocks
+ * Member 'blocks' contains the blocks, in line order.
+ * @var flowGraph::count
+ * Member 'count' contains the number of blocks.
+ * @var flowGraph::block
+ * Member 'block' contains, for each line, the index of its block.
+ */
+typedef struct flowGraph
+{
+    flowBlock *blocks;
+    size_t count;
+    size_t *block;
+} flowGraph;
+
+/*!
+ * @brief Width of a register not known (see cpuWidths).
+ */
+#define BITS_UNKNOWN 0
+
+/**
+ * @struct cpuWidths
+ * @brief The widths of the registers, in bits (8, 16 or BITS_UNKNOWN).
+ * @var cpuWidths::m
+ * Member 'm' contains the width of the accumulator.
+ * @var cpuWidths::x
+ * Member 'x' contains the width of the index registers.
+ */
+typedef struct cpuWidths
+{
+    unsigned char m;
+    unsigned char x;
+} cpuWidths;
+
+flowGraph buildFlow(const asmFile *file, const labelTable *labels);
+void freeFlow(flowGraph flow);
+void flowWidths(const asmFile *file, const flowGraph *flow, cpuWidths *cpu, cpuWidths *lex);
+size_t optimizeFlow(asmFile *file, const labelTable *labels, lineTrace *trace, ruleStats *rules);
+
+#endif
@@ -15,6 +15,67 @@
 
 #include "helpers.h"
 
+#include <errno.h>
+#include <pthread.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*!
+ * @brief Per thread jump buffer of fatalError (see fatalCatch function).
+ */
+static pthread_key_t fatalKey;
+
+/*!
+ * @brief Creation of fatalKey, once.
+ */
+static pthread_once_t fatalOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Create the per thread key of fatalError.
+ */
+static void fatalKeyCreate(void)
+{
+    pthread_key_create(&fatalKey, NULL);
+}
+
+/**
+ * @brief Catch the fatal errors of the calling thread (see fatalError
+ * function): they jump to the buffer instead of exiting.
+ * @param env The jump buffer, NULL to exit on fatal errors again.
+ * @return The previous jump buffer (NULL if none), to restore when done.
+ */
+jmp_buf *fatalCatch(jmp_buf *env)
+{
+    pthread_once(&fatalOnce, fatalKeyCreate);
+
+    jmp_buf *outer = pthread_getspecific(fatalKey);
+    pthread_setspecific(fatalKey, env);
+
+    return outer;
+}
+
+/**
+ * @brief Report an error the optimizer cannot recover from (out of
+ * memory, no thread). The process exits, unless the calling thread
+ * catches the errors (see fatalCatch function).
+ * @param what The name of the failed operation (printed with errno).
+ */
+void fatalError(const char *what)
+{
+    pthread_once(&fatalOnce, fatalKeyCreate);
+
+    jmp_buf *env = pthread_getspecific(fatalKey);
+    if (env)
+        longjmp(*env, 1);
+
+    perror(what);
+    exit(EXIT_FAILURE);
+}
+
 /**
  * @brief Free pointers.
  * @param s dynArray structure.
@@ -207,23 +268,26 @@ char *sliceStr(char *str, int slice_from, int slice_to)
  * @param str The string.
  * @param orig The substring to replace.
  * @param rep The substring to replace with.
- * @return The modified string.
+ * @return The modified string (allocated, to be freed by the caller).
  */
 char *replaceStr(char *str, char *orig, char *rep)
 {
-    static char buffer[MAXLEN_LINE];
-    char *p;
-    size_t orig_len = strlen(orig);
-    size_t rep_len = strlen(rep);
+    char *p = strstr(str, orig);
+    size_t orig_len = p ? strlen(orig) : 0;
+    size_t rep_len = p ? strlen(rep) : 0;
+    size_t len = strlen(str);
 
-    if (!(p = strstr(str, orig)))
-        return str;
+    /* Lines have no length limit, each result has its own buffer */
+    char *buffer = malloc(len - orig_len + rep_len + 1);
+    if (!buffer)
+        fatalError("malloc-replace");
 
-    memcpy(buffer, str, p - str);
-    buffer[p - str] = '\0';
+    if (!p)
+        return strcpy(buffer, str);
 
-    strcpy(buffer + (p - str), rep);
-    strcat(buffer + (p - str + rep_len), p + orig_len);
+    memcpy(buffer, str, p - str);
+    memcpy(buffer + (p - str), rep, rep_len);
+    strcpy(buffer + (p - str) + rep_len, p + orig_len);
 
     return buffer;
 }
@@ -262,8 +326,77 @@ char *splitStr(char *str, char *sep, size_t pos)
     return NULL;
 }
 
+/*!
+ * @brief Registry of the compiled regular expressions.
+ * Each pattern is compiled once and reused until regexRegistryFree().
+ */
+static regexEntry regexRegistry[MAX_REGEX];
+
+/*!
+ * @brief Number of patterns stored in the registry.
+ */
+static size_t regexRegistryUsed = 0;
+
+/*!
+ * @brief Lock of the registry (the optimizer can run in several threads).
+ */
+static pthread_mutex_t regexRegistryLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Find a compiled regex in the registry (compile it
+ * and store it if it's not already there).
+ * @param regex The POSIX regex.
+ * @return The compiled regex.
+ */
+regex_t *regexRegister(const char *regex)
+{
+    pthread_mutex_lock(&regexRegistryLock);
+    for (size_t i = 0; i < regexRegistryUsed; i++)
+    {
+        if (regexRegistry[i].pattern == regex || matchStr(regexRegistry[i].pattern, regex))
+        {
+            pthread_mutex_unlock(&regexRegistryLock);
+            return &regexRegistry[i].compiled;
+        }
+    }
+
+    if (regexRegistryUsed == MAX_REGEX)
+    {
+        fprintf(stderr, "Too many regular expressions (max: %d).\n", MAX_REGEX);
+        exit(EXIT_FAILURE);
+    }
+
+    regexEntry *entry = &regexRegistry[regexRegistryUsed];
+
+    if (regcomp(&entry->compiled, regex, REG_EXTENDED))
+    {
+        fprintf(stderr, "Could not compile regular expression.\n");
+        exit(EXIT_FAILURE);
+    }
+    entry->pattern = regex;
+    regexRegistryUsed += 1;
+    pthread_mutex_unlock(&regexRegistryLock);
+
+    return &entry->compiled;
+}
+
+/**
+ * @brief Free all the compiled regex of the registry.
+ */
+void regexRegistryFree(void)
+{
+    pthread_mutex_lock(&regexRegistryLock);
+    for (size_t i = 0; i < regexRegistryUsed; i++)
+    {
+        regfree(&regexRegistry[i].compiled);
+    }
+    regexRegistryUsed = 0;
+    pthread_mutex_unlock(&regexRegistryLock);
+}
+
 /**
  * @brief Wrapper to match groups with regex.
+ * The regex is compiled only once (see regexRegister function).
  * @param string The string.
  * @param regex The POSIX regex.
  * @param maxGroups The maximum number of groups to match.
@@ -276,27 +409,17 @@ dynArray regexMatchGroups(char *string, char *regex, const size_t maxGroups)
         https://gist.github.com/ianmackinnon/3294587
     */
 
-    regex_t regexCompiled;
+    regex_t *regexCompiled = regexRegister(regex);
     regmatch_t groupArray[maxGroups];
 
     dynArray regexgroup;
     regexgroup.used = 0;
 
-    int re = regcomp(&regexCompiled, regex, REG_EXTENDED);
-
-    if (re)
-    {
-        fprintf(stderr, "Could not compile regular expression.\n");
-        exit(EXIT_FAILURE);
-    };
-
-    re = regexec(&regexCompiled, string, maxGroups, groupArray, 0);
+    int re = regexec(regexCompiled, string, maxGroups, groupArray, 0);
 
     if (!re)
     {
         size_t len, g;
-        char *stringCopy = malloc(strlen(string) + 1);
-        strcpy(stringCopy, string);
 
         regexgroup.arr = malloc(maxGroups * sizeof(char *));
 
@@ -311,27 +434,22 @@ dynArray regexMatchGroups(char *string, char *regex, const size_t maxGroups)
 
             /* allocate storage for line */
             regexgroup.arr[regexgroup.used] = malloc(len + 1);
-            memcpy(regexgroup.arr[regexgroup.used], stringCopy + groupArray[g].rm_so, len);
+            memcpy(regexgroup.arr[regexgroup.used], string + groupArray[g].rm_so, len);
             regexgroup.arr[regexgroup.used][len] = '\0';
             regexgroup.used += 1;
         }
 
-        free(stringCopy);
-        regfree(&regexCompiled);
-
         return regexgroup;
     }
     else if (re == REG_NOMATCH)
     {
-        regfree(&regexCompiled);
-
         regexgroup.arr = NULL;
         return regexgroup;
     }
     else
     {
         char msgbuf[100];
-        regerror(re, &regexCompiled, msgbuf, sizeof(msgbuf));
+        regerror(re, regexCompiled, msgbuf, sizeof(msgbuf));
         fprintf(stderr, "Regex match failed: %s\n", msgbuf);
         exit(EXIT_FAILURE);
     }
@@ -350,8 +468,7 @@ dynArray pushToArray(dynArray text_opt, char *str)
 
     if ((text_opt.arr[text_opt.used] = malloc(len + 1)) == NULL)
     {
-        perror("malloc-lines");
-        exit(EXIT_FAILURE);
+        fatalError("malloc-lines");
     }
 
     strcpy(text_opt.arr[text_opt.used], str);
@@ -362,3 +479,369 @@ dynArray pushToArray(dynArray text_opt, char *str)
 
     return updatedDynArray;
 }
+
+/**
+ * @brief Load the whole content of a file in memory.
+ * A regular file is memory-mapped (private copy-on-write mapping,
+ * so lines can be cut in place), a stream (stdin) is read
+ * in large chunks into a growable buffer.
+ * @param path The file path, NULL for stdin.
+ * @return A structure (textBuffer).
+ */
+textBuffer loadText(const char *path)
+{
+    textBuffer text = { NULL, 0, 0 };
+    FILE *fp        = path ? fopen(path, "rb") : stdin;
+
+    if (!fp)
+    {
+        fatalError(path);
+    }
+
+#ifndef _WIN32
+    struct stat st;
+    long page = sysconf(_SC_PAGESIZE);
+
+    /* The byte after the content must be in the last mapped page */
+    if (path && fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+        && page > 0 && st.st_size % page != 0)
+    {
+        void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(fp), 0);
+        if (map != MAP_FAILED)
+        {
+            text.data   = map;
+            text.len    = st.st_size;
+            text.mapped = 1;
+            fclose(fp);
+
+            return text;
+        }
+    }
+#endif
+
+    size_t size = READ_CHUNK;
+    size_t n;
+
+    if ((text.data = malloc(size + 1)) == NULL)
+    {
+        if (fp != stdin)
+            fclose(fp);
+        fatalError("malloc-text");
+    }
+
+    while ((n = fread(text.data + text.len, 1, size - text.len, fp)) > 0)
+    {
+        text.len += n;
+        if (text.len == size)
+        {
+            void *tmp = realloc(text.data, 2 * size + 1);
+            if (!tmp)
+            {
+                /* The caller may catch the error (see fatalCatch function) */
+                free(text.data);
+                if (fp != stdin)
+                    fclose(fp);
+                fatalError("realloc-text");
+            }
+            text.data = tmp;
+            size *= 2;
+        }
+    }
+    if (ferror(fp))
+    {
+        int err = errno;
+
+        free(text.data);
+        if (fp != stdin)
+            fclose(fp);
+        errno = err;
+        fatalError(path ? path : "stdin");
+    }
+    text.data[text.len] = '\0';
+
+    if (fp != stdin)
+        fclose(fp);
+
+    return text;
+}
+
+/**
+ * @brief Release the content of a file (see loadText function).
+ * @param text The textBuffer structure.
+ */
+void freeText(textBuffer text)
+{
+#ifndef _WIN32
+    if (text.mapped)
+    {
+        munmap(text.data, text.len);
+        return;
+    }
+#endif
+    free(text.data);
+}
+
+/**
+ * @brief Hash a string (FNV-1a).
+ * @param str The string.
+ * @param len The length of the string.
+ * @return The hash.
+ */
+size_t hashStr(const char *str, const size_t len)
+{
+    size_t h = (size_t)2166136261u;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)str[i];
+        h *= (size_t)16777619u;
+    }
+
+    return h;
+}
+
+/**
+ * @brief Create an empty arena.
+ * @return The arena.
+ */
+arena *arenaNew(void)
+{
+    arena *a = calloc(1, sizeof(arena));
+
+    if (!a)
+    {
+        fatalError("malloc-arena");
+    }
+
+    return a;
+}
+
+/**
+ * @brief Allocate memory from the arena.
+ * @param a The arena.
+ * @param size The number of bytes.
+ * @return The memory (valid until the arena is reset or freed).
+ */
+char *arenaAlloc(arena *a, const size_t size)
+{
+    arenaChunk *c = a->head;
+
+    if (!c || c->size - c->used < size)
+    {
+        size_t csize = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+
+        if ((c = malloc(sizeof(arenaChunk) + csize)) == NULL)
+        {
+            fatalError("malloc-arena");
+        }
+        c->next = a->head;
+        c->used = 0;
+        c->size = csize;
+        a->head = c;
+        a->chunks += 1;
+    }
+
+    char *p = c->data + c->used;
+    c->used += size;
+
+    return p;
+}
+
+/**
+ * @brief Copy a string into the arena.
+ * @param a The arena.
+ * @param str The string.
+ * @param len The length of the string.
+ * @return The copy (null terminated).
+ */
+char *arenaStrdup(arena *a, const char *str, const size_t len)
+{
+    char *p = arenaAlloc(a, len + 1);
+
+    memcpy(p, str, len);
+    p[len] = '\0';
+
+    return p;
+}
+
+/**
+ * @brief Checks if the string has been allocated by the arena.
+ * @param a The arena (can be NULL).
+ * @param p The string.
+ * @return 1 (true) or 0 (false).
+ */
+int arenaOwns(const arena *a, const char *p)
+{
+    for (const arenaChunk *c = a ? a->head : NULL; c; c = c->next)
+    {
+        if (p >= c->data && p < c->data + c->used)
+            return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Release all the strings of the arena at once
+ * (the current chunk is kept for the next strings).
+ * @param a The arena.
+ */
+void arenaReset(arena *a)
+{
+    if (!a->head)
+        return;
+
+    arenaChunk *c = a->head->next;
+    while (c)
+    {
+        arenaChunk *next = c->next;
+        free(c);
+        c = next;
+    }
+    a->head->next = NULL;
+    a->head->used = 0;
+}
+
+/**
+ * @brief Move all the strings of an arena into another one
+ * (no copy, the chunks are moved). The emptied arena is freed.
+ * @param a The arena receiving the strings.
+ * @param from The arena to empty (can be NULL).
+ */
+void arenaAdopt(arena *a, arena *from)
+{
+    if (!from)
+        return;
+
+    /* Keep the current chunk of a in front, so it is still filled first */
+    arenaChunk *last = from->head;
+    while (last && last->next)
+        last = last->next;
+
+    if (last)
+    {
+        if (a->head)
+        {
+            last->next    = a->head->next;
+            a->head->next = from->head;
+        }
+        else
+        {
+            a->head = from->head;
+        }
+        a->chunks += from->chunks;
+    }
+    free(from);
+}
+
+/**
+ * @brief Free the arena and all its strings.
+ * @param a The arena (can be NULL).
+ */
+void arenaFree(arena *a)
+{
+    if (!a)
+        return;
+
+    arenaReset(a);
+    free(a->head);
+    free(a);
+}
+
+/**
+ * @brief Create an empty set of strings.
+ * @return A structure (strSet).
+ */
+strSet newStrSet(void)
+{
+    strSet set;
+
+    set.mask    = 15;
+    set.used    = 0;
+    set.strings = arenaNew();
+
+    if ((set.keys = calloc(set.mask + 1, sizeof(char *))) == NULL)
+    {
+        fatalError("malloc-set");
+    }
+
+    return set;
+}
+
+/**
+ * @brief Find the bucket of a string.
+ * @param keys The buckets.
+ * @param mask The number of buckets - 1.
+ * @param str The string.
+ * @param len The length of the string.
+ * @return The bucket holding the string, or the empty bucket where it goes.
+ */
+static size_t strSetSlot(char *const *keys, const size_t mask, const char *str, const size_t len)
+{
+    size_t b = hashStr(str, len) & mask;
+
+    while (keys[b] && !(strncmp(keys[b], str, len) == 0 && keys[b][len] == '\0'))
+    {
+        b = (b + 1) & mask;
+    }
+
+    return b;
+}
+
+/**
+ * @brief Add a string to the set (the string is copied).
+ * @param set The strSet structure.
+ * @param str The string.
+ * @param len The length of the string.
+ */
+void strSetAdd(strSet *set, const char *str, const size_t len)
+{
+    /* Keep the load factor under 1/2 */
+    if (2 * (set->used + 1) > set->mask + 1)
+    {
+        size_t mask = 2 * set->mask + 1;
+        char **keys = calloc(mask + 1, sizeof(char *));
+
+        if (!keys)
+        {
+            fatalError("malloc-set");
+        }
+        for (size_t b = 0; b <= set->mask; b++)
+        {
+            if (set->keys[b])
+                keys[strSetSlot(keys, mask, set->keys[b], strlen(set->keys[b]))] = set->keys[b];
+        }
+        free(set->keys);
+        set->keys = keys;
+        set->mask = mask;
+    }
+
+    size_t b = strSetSlot(set->keys, set->mask, str, len);
+    if (!set->keys[b])
+    {
+        set->keys[b] = arenaStrdup(set->strings, str, len);
+        set->used += 1;
+    }
+}
+
+/**
+ * @brief Checks if the string is in the set.
+ * @param set The strSet structure.
+ * @param str The string.
+ * @param len The length of the string.
+ * @return 1 (true) or 0 (false).
+ */
+int strSetHas(const strSet *set, const char *str, const size_t len)
+{
+    return set->keys[strSetSlot(set->keys, set->mask, str, len)] != NULL;
+}
+
+/**
+ * @brief Free pointers.
+ * @param set strSet structure.
+ */
+void freeStrSet(strSet set)
+{
+    free(set.keys);
+    arenaFree(set.strings);
+}
@@ -3,6 +3,7 @@
 
 #include <ctype.h>
 #include <regex.h>
+#include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,6 +13,21 @@
  */
 #define MAXLEN_LINE 10240
 
+/*!
+ * @brief Size of the first chunk read from a stream (see loadText function).
+ */
+#define READ_CHUNK 65536
+
+/*!
+ * @brief Size of an arena chunk (see arenaAlloc function).
+ */
+#define ARENA_CHUNK 65536
+
+/*!
+ * @brief Max number of compiled regex kept in the registry.
+ */
+#define MAX_REGEX 32
+
 /**
  * @struct dynArray
  * @brief Structure to store an array of string
@@ -28,6 +44,96 @@ typedef struct dynArray
     size_t used;
 } dynArray;
 
+/**
+ * @struct regexEntry
+ * @brief Structure to store a compiled regex
+ * and the pattern it comes from.
+ * @var regexEntry::pattern
+ * Member 'pattern' contains the POSIX regex (the key).
+ * @var regexEntry::compiled
+ * Member 'compiled' contains the compiled regex.
+ */
+typedef struct regexEntry
+{
+    const char *pattern;
+    regex_t compiled;
+} regexEntry;
+
+/**
+ * @struct textBuffer
+ * @brief Structure to store the whole content of a file.
+ * @var textBuffer::data
+ * Member 'data' contains the content, followed by at least
+ * one writable byte (a null terminator can be put after the last line).
+ * @var textBuffer::len
+ * Member 'len' contains the length of the content.
+ * @var textBuffer::mapped
+ * Member 'mapped' is 1 if the file is memory-mapped, 0 if it is allocated.
+ */
+typedef struct textBuffer
+{
+    char *data;
+    size_t len;
+    int mapped;
+} textBuffer;
+
+/**
+ * @struct arenaChunk
+ * @brief A block of memory of an arena.
+ * @var arenaChunk::next
+ * Member 'next' contains the previous chunk of the arena.
+ * @var arenaChunk::used
+ * Member 'used' contains the number of bytes handed out.
+ * @var arenaChunk::size
+ * Member 'size' contains the number of bytes of the chunk.
+ * @var arenaChunk::data
+ * Member 'data' contains the memory.
+ */
+typedef struct arenaChunk
+{
+    struct arenaChunk *next;
+    size_t used;
+    size_t size;
+    char data[];
+} arenaChunk;
+
+/**
+ * @struct arena
+ * @brief Bump allocator: strings are never freed one by one,
+ * the whole arena is reset or freed at once.
+ * @var arena::head
+ * Member 'head' contains the current chunk.
+ * @var arena::chunks
+ * Member 'chunks' contains the number of chunks allocated so far.
+ */
+typedef struct arena
+{
+    arenaChunk *head;
+    size_t chunks;
+} arena;
+
+/**
+ * @struct strSet
+ * @brief Hash set of strings (open addressing, linear probing).
+ * @var strSet::keys
+ * Member 'keys' contains the buckets (NULL for an empty bucket).
+ * @var strSet::mask
+ * Member 'mask' contains the number of buckets - 1 (power of 2).
+ * @var strSet::used
+ * Member 'used' contains the number of strings in the set.
+ * @var strSet::strings
+ * Member 'strings' contains the arena of the strings.
+ */
+typedef struct strSet
+{
+    char **keys;
+    size_t mask;
+    size_t used;
+    arena *strings;
+} strSet;
+
+jmp_buf *fatalCatch(jmp_buf *env);
+void fatalError(const char *what);
 void freedynArray(dynArray s);
 int matchStr(const char *str1, const char *str2);
 int startWith(const char *source, const char *prefix);
@@ -39,7 +145,23 @@ char *trimWhiteSpace(char *str);
 char *sliceStr(char *str, int slice_from, int slice_to);
 char *replaceStr(char *str, char *orig, char *rep);
 char *splitStr(char *str, char *sep, size_t pos);
+regex_t *regexRegister(const char *regex);
+void regexRegistryFree(void);
 dynArray regexMatchGroups(char *source, char *regex, const size_t maxGroups);
 dynArray pushToArray(dynArray text_opt, char *str);
+textBuffer loadText(const char *path);
+void freeText(textBuffer text);
+size_t hashStr(const char *str, const size_t len);
+arena *arenaNew(void);
+char *arenaAlloc(arena *a, const size_t size);
+char *arenaStrdup(arena *a, const char *str, const size_t len);
+int arenaOwns(const arena *a, const char *p);
+void arenaReset(arena *a);
+void arenaAdopt(arena *a, arena *from);
+void arenaFree(arena *a);
+strSet newStrSet(void);
+void strSetAdd(strSet *set, const char *str, const size_t len);
+int strSetHas(const strSet *set, const char *str, const size_t len);
+void freeStrSet(strSet set);
 
 #endif
@@ -13,8 +13,85 @@
  *
  */
 
+#include "batch.h"
+#include "cache.h"
 #include "helpers.h"
+#include "opt65816.h"
 #include "optimizer.h"
+#include "output.h"
+#include "server.h"
+#include "stream.h"
+
+/**
+ * @brief Print the usage and exit.
+ * @param name The name of the program.
+ */
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage:\n");
+    fprintf(stderr, "  - %s [-j N] [-O N] [--stats=json] <filename> [-o <outfile>]\n", name);
+    fprintf(stderr, "  - <stdin> | %s [-j N] [-O N] [--stats=json]\n", name);
+    fprintf(stderr, "  - %s [-j N] [-O N] [--stats=json] -o <outdir> <filename|@listfile>...\n", name);
+    fprintf(stderr, "  - %s [-j N] [-O N] [--stats=json] -i <filename|@listfile>...\n", name);
+    fprintf(stderr, "  - %s [-O N] --stream [<filename>]\n", name);
+    fprintf(stderr, "  - %s [-O N] --serve <socket>\n", name);
+    fprintf(stderr, "  - %s --client <socket> [-o <outdir|outfile> | -i] [<filename|@listfile>...]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Optimize a file (or stdin) to stdout or to an output file,
+ * through the library (see opt65816.h).
+ * @param path The file path, NULL for stdin.
+ * @param outfile The output file (NULL for stdout).
+ * @param jobs The number of threads (0 = default).
+ * @param verbose The level of verbosity (see verbosity function).
+ * @param level The optimization level (see opt65816_set_level function).
+ * @param report The stream of the report (NULL if none, see opt65816_set_stats function).
+ */
+static void optimizeFile(const char *path, const char *outfile, const size_t jobs, const size_t verbose,
+                         const int level, FILE *report)
+{
+    opt65816_ctx *ctx = opt65816_new();
+    const char *dir   = getenv(CACHE_DIR_ENV);
+    const char *max   = getenv(CACHE_MAX_ENV);
+    char *out;
+    size_t outlen;
+    int ret;
+
+    if (!ctx)
+    {
+        fprintf(stderr, "%s\n", opt65816_strerror(OPT65816_ENOMEM));
+        exit(EXIT_FAILURE);
+    }
+    opt65816_set_jobs(ctx, jobs ? jobs : 1);
+    opt65816_set_verbose(ctx, verbose);
+    opt65816_set_level(ctx, level);
+    opt65816_set_stats(ctx, report);
+    if (dir && *dir && opt65816_set_cache(ctx, dir, max && atol(max) > 0 ? (size_t)atol(max) : 0) != OPT65816_OK)
+    {
+        perror(dir);
+        exit(EXIT_FAILURE);
+    }
+
+    textBuffer text = loadText(path);
+    ret             = opt65816_optimize(ctx, text.data, text.len, &out, &outlen);
+    freeText(text);
+
+    if (ret != OPT65816_OK)
+    {
+        fprintf(stderr, "%s: %s\n", path ? path : "stdin", opt65816_strerror(ret));
+        exit(EXIT_FAILURE);
+    }
+    if (outfile ? writeText(out, outlen, outfile) != 0 : emitText(fileno(stdout), out, outlen) != 0)
+    {
+        perror(outfile ? outfile : "stdout");
+        exit(EXIT_FAILURE);
+    }
+
+    free(out);
+    opt65816_free(ctx);
+}
 
 /**
  * @brief The main function. Accept an ASM file
@@ -28,6 +105,17 @@ int main(int argc, char **argv)
     /* -------------------------------- */
     /*      Parse the arguments         */
     /* -------------------------------- */
+    size_t jobs        = 0;    // Number of threads (-j N, 0 = default)
+    int level          = 0;    // Optimization level (-O N, 0 = default)
+    const char *outdir = NULL; // Output directory or file (-o PATH)
+    int inplace        = 0;    // Rewrite the inputs (-i)
+    int listed         = 0;    // Inputs given by a response file (@file)
+    const char *serve  = NULL; // Socket to serve (--serve PATH)
+    const char *client = NULL; // Socket of the server (--client PATH)
+    int stream         = 0;    // Bounded memory mode (--stream)
+    FILE *report       = NULL; // Report of the rules (--stats=json)
+    fileList inputs    = newFileList();
+
     for (size_t i = 1; i < (size_t)argc; i++)
     {
         if (argv[i][0] == '-')
@@ -37,36 +125,202 @@ int main(int argc, char **argv)
                 PrintVersion();
                 exit(0);
             }
+            if (matchStr(argv[i], "--stream")) // bounded memory mode
+            {
+                stream = 1;
+                continue;
+            }
+            if (!strncmp(argv[i], "--stats", 7)) // report of the rules
+            {
+                if (!matchStr(argv[i], "--stats=json"))
+                {
+                    fprintf(stderr, "--stats expects a format (--stats=json).\n");
+                    exit(EXIT_FAILURE);
+                }
+                report = stderr;
+                continue;
+            }
+            if (matchStr(argv[i], "--serve") || matchStr(argv[i], "--client")) // optimizer server
+            {
+                if (i + 1 == (size_t)argc)
+                {
+                    fprintf(stderr, "%s expects the path of a socket.\n", argv[i]);
+                    exit(EXIT_FAILURE);
+                }
+                if (argv[i][2] == 's')
+                    serve = argv[++i];
+                else
+                    client = argv[++i];
+                continue;
+            }
+            if (argv[i][1] == 'j') // number of threads
+            {
+                const char *n = argv[i][2] ? argv[i] + 2 : (i + 1 < (size_t)argc ? argv[++i] : "");
+                char *end;
+                long value = strtol(n, &end, 10);
+
+                if (!*n || *end || value < 1)
+                {
+                    fprintf(stderr, "-j expects a number of threads (1 or more).\n");
+                    exit(EXIT_FAILURE);
+                }
+                jobs = (size_t)value;
+                continue;
+            }
+            if (argv[i][1] == 'O') // optimization level
+            {
+                const char *n = argv[i][2] ? argv[i] + 2 : (i + 1 < (size_t)argc ? argv[++i] : "");
+                char *end;
+                long value = strtol(n, &end, 10);
+
+                if (!*n || *end || value < 1 || value > OPT_LEVEL_MAX)
+                {
+                    fprintf(stderr, "-O expects an optimization level (1 to %d).\n", OPT_LEVEL_MAX);
+                    exit(EXIT_FAILURE);
+                }
+                level = (int)value;
+                continue;
+            }
+            if (argv[i][1] == 'o') // output directory or file
+            {
+                outdir = argv[i][2] ? argv[i] + 2 : (i + 1 < (size_t)argc ? argv[++i] : "");
+                if (!*outdir)
+                {
+                    fprintf(stderr, "-o expects an output directory or file.\n");
+                    exit(EXIT_FAILURE);
+                }
+                continue;
+            }
+            if (matchStr(argv[i], "-i")) // in-place
+            {
+                inplace = 1;
+                continue;
+            }
         }
+        if (argv[i][0] == RESPONSE_FILE_PREFIX) // list of inputs
+        {
+            readResponseFile(&inputs, argv[i] + 1);
+            listed = 1;
+            continue;
+        }
+        pushFile(&inputs, argv[i], strlen(argv[i]));
+    }
+    if (inplace && (outdir || !inputs.used))
+    {
+        fprintf(stderr, "usage: %s [-j N] -i <filename|@listfile>...\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    /* -o is an output file for a single input, unless it is a directory */
+    const char *outfile = NULL;
+    if (outdir && inputs.used <= 1 && !listed && !isDirectory(outdir))
+    {
+        outfile = outdir;
+        outdir  = NULL;
+    }
+
+    /* The report is the only output on stderr */
+    if (report && (serve || client || stream))
+    {
+        fprintf(stderr, "--stats=json is not available with --serve, --client and --stream.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* The server optimizes at its own level */
+    if (level && client)
+    {
+        fprintf(stderr, "-O is not available with --client (see --serve).\n");
+        exit(EXIT_FAILURE);
     }
+    if (!level)
+        level = OPT_LEVEL_DEFAULT;
+
     /* -------------------------------- */
     /*       Enable verbosity level     */
     /* -------------------------------- */
-    size_t verbose = verbosity();
+    size_t verbose = report ? 0 : verbosity();
 
     /* -------------------------------- */
-    /*       Store trimmed file         */
+    /*    Optimize through a server     */
     /* -------------------------------- */
-    dynArray file = tidyFile(argc, argv);
+    if (client)
+    {
+        /* Without output, a single input is printed (as without server) */
+        if (!outdir && !outfile && !inplace && inputs.used > 1)
+            usage(argv[0]);
+
+        int ret = clientOptimize(client, &inputs, outdir, outfile, inplace);
+        if (ret >= 0)
+        {
+            freeFileList(inputs);
+            return ret;
+        }
+        if (verbose)
+            fprintf(stderr, "%s: no server, optimizing locally\n", client);
+    }
 
     /* -------------------------------- */
-    /*      Store BSS instuctions       */
+    /*  Optimize a file (libopt65816)   */
     /* -------------------------------- */
-    dynArray bss = storeBss(file);
+    if (!serve && !outdir && !inplace && !stream)
+    {
+        if (inputs.used > 1)
+            usage(argv[0]);
+        optimizeFile(inputs.used ? inputs.arr[0] : NULL, outfile, jobs, verbose, level, report);
 
+        freeFileList(inputs);
+        return 0;
+    }
+
+    /* -------------------------------- */
+    /*       Compile regex once         */
+    /* -------------------------------- */
+    compileRegex();
+
+    /* -------------------------------- */
+    /*   Cache (OPT816_CACHE_DIR)       */
     /* -------------------------------- */
-    /*       ASM Optimization           */
+    optCache *cache = cacheOpen(RULESET);
+
+    /* -------------------------------- */
+    /*  Keep the optimizer resident     */
     /* -------------------------------- */
-    dynArray optAsm = optimizeAsm(file, bss, verbose);
+    if (serve)
+        serveOptimizer(serve, cache, level);
 
-    for (size_t i = 0; i < optAsm.used; i++)
+    /* -------------------------------- */
+    /*     Batch mode (-o DIR, -i)      */
+    /* -------------------------------- */
+    int ret = 0;
+    if (outdir || inplace)
     {
-        fprintf(stdout, "%s\n", optAsm.arr[i]);
+        if (!inputs.used)
+        {
+            fprintf(stderr, "usage: %s [-j N] -o <outdir> <filename|@listfile>...\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        ret = optimizeBatch(&inputs, outdir, jobs, cache, verbose, level, report);
+    }
+
+    /* -------------------------------- */
+    /*   Stream mode (--stream)         */
+    /* -------------------------------- */
+    else
+    {
+        if (inputs.used > 1 || outfile)
+        {
+            fprintf(stderr, "usage: %s --stream [<filename>]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        optimizeStream(inputs.used ? inputs.arr[0] : NULL, cache, verbose, level);
     }
 
     /* -------------------------------- */
     /*       Free pointers              */
     /* -------------------------------- */
-    freedynArray(bss);
-    freedynArray(optAsm);
+    freeFileList(inputs);
+    cacheClose(cache, verbose);
+    regexRegistryFree();
+
+    return ret;
 }
@@ -0,0 +1,310 @@
+/*
+ * opt-65816 - Assembly code optimizer for the WDC 65816 processor.
+ *
+ * Description: Assembly code optimizer produced
+ * by the 816 Tiny C Compiler (816-tcc).
+ * This library is a C port of the 816-opt python tool.
+ *
+ * Author: kobenairb (kobenairb@gmail.com).
+ *
+ * Copyright (c) 2022.
+ *
+ * This project is released under the GNU Public License.
+ *
+ */
+
+#include "opt65816.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <setjmp.h>
+
+#include "cache.h"
+#include "helpers.h"
+#include "optimizer.h"
+#include "output.h"
+#include "stats.h"
+
+#if OPT65816_LEVEL_MAX != OPT_LEVEL_MAX
+#error "OPT65816_LEVEL_MAX differs from OPT_LEVEL_MAX"
+#endif
+
+/**
+ * @struct opt65816_ctx
+ * @brief The options of the optimizer (see opt65816_new function).
+ * @var opt65816_ctx::jobs
+ * Member 'jobs' contains the number of threads of a call (see optimizeAsm function).
+ * @var opt65816_ctx::verbose
+ * Member 'verbose' contains the level of verbosity (messages on stderr).
+ * @var opt65816_ctx::level
+ * Member 'level' contains the optimization level (see OPT_LEVEL_MAX).
+ * @var opt65816_ctx::cache
+ * Member 'cache' contains the cache (NULL if none).
+ * @var opt65816_ctx::report
+ * Member 'report' contains the stream of the reports (NULL if none).
+ */
+struct opt65816_ctx
+{
+    size_t jobs;
+    size_t verbose;
+    int level;
+    optCache *cache;
+    FILE *report;
+};
+
+/*!
+ * @brief Number of contexts alive: the regex registry is shared by all
+ * of them, compiled with the first one and freed with the last one.
+ */
+static size_t contexts = 0;
+
+/*!
+ * @brief Lock of the number of contexts.
+ */
+static pthread_mutex_t contextsLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Create an optimizer context (one thread, no message, no cache,
+ * the rules of 816-opt only).
+ * @return The context, or NULL if out of memory.
+ */
+opt65816_ctx *opt65816_new(void)
+{
+    opt65816_ctx *ctx = calloc(1, sizeof(opt65816_ctx));
+
+    if (!ctx)
+        return NULL;
+    ctx->jobs  = 1;
+    ctx->level = OPT_LEVEL_DEFAULT;
+
+    pthread_mutex_lock(&contextsLock);
+    if (contexts++ == 0)
+        compileRegex();
+    pthread_mutex_unlock(&contextsLock);
+
+    return ctx;
+}
+
+/**
+ * @brief Set the number of threads optimizing each call
+ * (the output is the same whatever the number of threads).
+ * @param ctx The context.
+ * @param jobs The number of threads (1 or more).
+ * @return OPT65816_OK or OPT65816_EINVAL.
+ */
+int opt65816_set_jobs(opt65816_ctx *ctx, size_t jobs)
+{
+    if (!ctx || jobs < 1)
+        return OPT65816_EINVAL;
+    ctx->jobs = jobs;
+
+    return OPT65816_OK;
+}
+
+/**
+ * @brief Set the level of verbosity: the passes and their
+ * optimizations are reported on stderr (see verbosity function).
+ * @param ctx The context.
+ * @param verbose The level of verbosity (0 for none).
+ * @return OPT65816_OK or OPT65816_EINVAL.
+ */
+int opt65816_set_verbose(opt65816_ctx *ctx, size_t verbose)
+{
+    if (!ctx)
+        return OPT65816_EINVAL;
+    ctx->verbose = verbose;
+
+    return OPT65816_OK;
+}
+
+/**
+ * @brief Set the optimization level: 1 applies the rules of 816-opt (the
+ * output of the python tool), 2 also applies the rules added since (see
+ * the levels of rules.opt).
+ * @param ctx The context.
+ * @param level The level (1 to OPT65816_LEVEL_MAX).
+ * @return OPT65816_OK or OPT65816_EINVAL.
+ */
+int opt65816_set_level(opt65816_ctx *ctx, int level)
+{
+    if (!ctx || level < 1 || level > OPT_LEVEL_MAX)
+        return OPT65816_EINVAL;
+    ctx->level = level;
+
+    return OPT65816_OK;
+}
+
+/**
+ * @brief Keep the optimized buffers in a cache directory, shared with
+ * the command line (see cacheOpenDir function).
+ * @param ctx The context.
+ * @param dir The cache directory (created if needed), NULL for no cache.
+ * @param max The cap of the cache in MiB (0 for the default).
+ * @return OPT65816_OK, OPT65816_EINVAL or OPT65816_EIO.
+ */
+int opt65816_set_cache(opt65816_ctx *ctx, const char *dir, size_t max)
+{
+    optCache *cache = NULL;
+
+    if (!ctx || (dir && !*dir))
+        return OPT65816_EINVAL;
+    if (dir && (cache = cacheOpenDir(RULESET, dir, max)) == NULL)
+        return errno == ENOMEM ? OPT65816_ENOMEM : OPT65816_EIO;
+
+    cacheClose(ctx->cache, ctx->verbose);
+    ctx->cache = cache;
+
+    return OPT65816_OK;
+}
+
+/**
+ * @brief Report each optimization as one line of JSON: the lines, the
+ * time of each phase and pass, the attempts, hits and time of each rule
+ * (see statsReport function). The output is not changed.
+ * @param ctx The context.
+ * @param report The stream of the reports, NULL for none.
+ * @return OPT65816_OK or OPT65816_EINVAL.
+ */
+int opt65816_set_stats(opt65816_ctx *ctx, FILE *report)
+{
+    if (!ctx)
+        return OPT65816_EINVAL;
+    ctx->report = report;
+
+    return OPT65816_OK;
+}
+
+/**
+ * @brief Optimize a text. The fatal errors of the optimizer (out of
+ * memory, no thread), in the pool threads too, come back here (see
+ * fatalCatch function).
+ * @param ctx The context.
+ * @param text The text (owned by the function).
+ * @param optAsm The optimized file.
+ * @param stats The report of the call (NULL if none).
+ * @return 0, or -1 on error.
+ */
+static int optimizeText(const opt65816_ctx *ctx, textBuffer *text, asmFile *optAsm, optStats *stats)
+{
+    jmp_buf env;
+    jmp_buf *outer = fatalCatch(&env);
+
+    if (setjmp(env))
+    {
+        fatalCatch(outer);
+        if (text->data)
+            freeText(*text);
+        text->data = NULL;
+        return -1;
+    }
+
+    uint64_t start = stats ? nowNs() : 0;
+    asmFile file   = tidyText(*text);
+    text->data     = NULL; // Owned by the file from now on
+    if (stats)
+        stats->tidy = nowNs() - start;
+    *optAsm = optimizeCached(file, ctx->cache, ctx->verbose, ctx->jobs, ctx->level, stats);
+    fatalCatch(outer);
+
+    return 0;
+}
+
+/**
+ * @brief Optimize a buffer of assembly code. On error, the text and
+ * the lines are released, but not the memory held by the pass
+ * interrupted.
+ * @param ctx The context.
+ * @param in The assembly code (lines ended by '\n').
+ * @param len The length of the assembly code.
+ * @param out The optimized code (null-terminated, released with free),
+ * NULL on error.
+ * @param outlen The length of the optimized code.
+ * @return OPT65816_OK, OPT65816_EINVAL or OPT65816_ENOMEM.
+ */
+int opt65816_optimize(opt65816_ctx *ctx, const char *in, size_t len, char **out, size_t *outlen)
+{
+    optStats stats = { 0 };
+    optStats *ps   = ctx && ctx->report ? &stats : NULL;
+    asmFile optAsm;
+
+    if (!ctx || (!in && len) || !out || !outlen)
+        return OPT65816_EINVAL;
+    *out    = NULL;
+    *outlen = 0;
+
+    /* Lines are cut in place (see tidyText function) */
+    textBuffer text = { malloc(len + 1), len, 0 };
+    if (!text.data)
+        return OPT65816_ENOMEM;
+    if (len)
+        memcpy(text.data, in, len);
+    text.data[len] = '\0';
+
+    if (optimizeText(ctx, &text, &optAsm, ps) != 0)
+    {
+        if (ps)
+            freeStats(ps);
+        return OPT65816_ENOMEM;
+    }
+
+    uint64_t start = ps ? nowNs() : 0;
+    *out           = joinAsm(&optAsm, outlen);
+    freeAsmFile(optAsm);
+    if (ps)
+    {
+        ps->emit = nowNs() - start;
+        statsReport(ctx->report, NULL, ps);
+        freeStats(ps);
+    }
+
+    return *out ? OPT65816_OK : OPT65816_ENOMEM;
+}
+
+/**
+ * @brief Release an optimizer context.
+ * @param ctx The context (can be NULL).
+ */
+void opt65816_free(opt65816_ctx *ctx)
+{
+    if (!ctx)
+        return;
+
+    cacheClose(ctx->cache, ctx->verbose);
+    free(ctx);
+
+    pthread_mutex_lock(&contextsLock);
+    if (--contexts == 0)
+        regexRegistryFree();
+    pthread_mutex_unlock(&contextsLock);
+}
+
+/**
+ * @brief Describe a return code.
+ * @param code The return code.
+ * @return The description.
+ */
+const char *opt65816_strerror(int code)
+{
+    switch (code)
+    {
+    case OPT65816_OK:
+        return "done";
+    case OPT65816_EINVAL:
+        return "invalid argument";
+    case OPT65816_ENOMEM:
+        return "out of memory";
+    case OPT65816_EIO:
+        return "cannot create the cache directory";
+    default:
+        return "unknown error";
+    }
+}
+
+/**
+ * @brief Get the version of the library.
+ * @return The version.
+ */
+const char *opt65816_version(void)
+{
+    return BINVERSION;
+}
@@ -0,0 +1,71 @@
+#ifndef OPT65816_H
+#define OPT65816_H
+
+/*
+ * libopt65816 - the optimizer as a library: a buffer of 816-tcc
+ * assembly in, the optimized buffer out, no file, no process.
+ *
+ * The functions are reentrant: several contexts can be used at the
+ * same time from different threads, and a context can be shared by
+ * threads once its options are set.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+ * @brief Symbols exported by the shared library.
+ */
+#if defined(__GNUC__) && !defined(_WIN32)
+#define OPT65816_API __attribute__((visibility("default")))
+#else
+#define OPT65816_API
+#endif
+
+/*!
+ * @brief Return code: done.
+ */
+#define OPT65816_OK 0
+/*!
+ * @brief Return code: invalid argument.
+ */
+#define OPT65816_EINVAL -1
+/*!
+ * @brief Return code: out of memory (or no thread can be started).
+ */
+#define OPT65816_ENOMEM -2
+/*!
+ * @brief Return code: the cache directory cannot be created (errno is set).
+ */
+#define OPT65816_EIO -3
+
+/*!
+ * @brief Highest optimization level (see opt65816_set_level function).
+ */
+#define OPT65816_LEVEL_MAX 2
+
+/**
+ * @brief The optimizer context (opaque), holding the options.
+ */
+typedef struct opt65816_ctx opt65816_ctx;
+
+OPT65816_API opt65816_ctx *opt65816_new(void);
+OPT65816_API int opt65816_set_jobs(opt65816_ctx *ctx, size_t jobs);
+OPT65816_API int opt65816_set_verbose(opt65816_ctx *ctx, size_t verbose);
+OPT65816_API int opt65816_set_level(opt65816_ctx *ctx, int level);
+OPT65816_API int opt65816_set_cache(opt65816_ctx *ctx, const char *dir, size_t max);
+OPT65816_API int opt65816_set_stats(opt65816_ctx *ctx, FILE *report);
+OPT65816_API int opt65816_optimize(opt65816_ctx *ctx, const char *in, size_t len, char **out, size_t *outlen);
+OPT65816_API void opt65816_free(opt65816_ctx *ctx);
+OPT65816_API const char *opt65816_strerror(int code);
+OPT65816_API const char *opt65816_version(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
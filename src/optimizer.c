@@ -14,6 +14,11 @@
  */
 
 #include "optimizer.h"
+#include "flow.h"
+#include "rules.h"
+#include "scan.h"
+
+#include <errno.h>
 
 /**
  * @brief Checks if OPT816_QUIET is set.
@@ -36,145 +41,238 @@ void PrintVersion(void)
     printf("built: %s\n", BINDATE);
 }
 
+/*!
+ * @brief The fixed patterns used by optimizeAsm (see compileRegex function).
+ */
+static char *const fixedRegex[] = {
+    STORE_A_TO_PSEUDO_LOW,
+    LOAD_A_FROM_PSEUDO,
+    LOAD_A_FROM_R_PSEUDO,
+    LOAD_A_LONG_X,
+};
+
 /**
- * @brief Checks if it touches the accumulator register.
- * @param a The asm instruction.
- * @return 1 (true) or 0 (false).
+ * @brief Compile all the fixed patterns once,
+ * before running any optimization pass.
  */
-int changeAccu(const char *a)
+void compileRegex(void)
 {
-    if (strlen(a) > 2 && ((a[2] == 'a' && !startWith(a, "pha") && !startWith(a, "sta")) || (strlen(a) == 5 && endWith(a, " a"))))
-        return 1;
+    for (size_t i = 0; i < sizeof(fixedRegex) / sizeof(fixedRegex[0]); i++)
+    {
+        regexRegister(fixedRegex[i]);
+    }
+}
 
-    return 0;
+/**
+ * @brief Checks if the line is a store (accu/x/y/zero) to a pseudo-register.
+ * Same as matching STORE_AXYZ_TO_PSEUDO.
+ * @param ins The parsed line.
+ * @return 1 (true) or 0 (false).
+ */
+int isStoreToPseudo(const asmLine *ins)
+{
+    return (ins->mnemonic == MN_STA || ins->mnemonic == MN_STX || ins->mnemonic == MN_STY || ins->mnemonic == MN_STZ)
+           && ins->width == WIDTH_B && ins->mode == MODE_ABSOLUTE && ins->preg != PREG_NONE;
 }
 
 /**
- * @brief Check if the line alters the control flow.
- * @param a The asm instruction.
+ * @brief Checks if the line is exactly "<mn>.b tcc__<preg>".
+ * @param ins The parsed line.
+ * @param mn The instruction.
+ * @param preg The pseudo-register id.
  * @return 1 (true) or 0 (false).
  */
-int isControl(const char *a)
+int isPseudoOp(const asmLine *ins, const mnemonic mn, const short preg)
 {
-    const char *p = a;
+    return ins->mnemonic == mn && ins->width == WIDTH_B && ins->mode == MODE_ABSOLUTE && ins->preg == preg;
+}
 
-    while (*p != '\0' && isspace((unsigned char)*p))
-    {
-        p++;
-    }
+/**
+ * @brief Checks if the line is a long call ("jsr.l <something>").
+ * @param ins The parsed line.
+ * @return 1 (true) or 0 (false).
+ */
+int isLongCall(const asmLine *ins)
+{
+    return ins->mnemonic == MN_JSR && ins->width == WIDTH_L && ins->mode != MODE_IMPLIED;
+}
 
-    if (*p == '\0')
-    {
+/**
+ * @brief Checks if the line contains a load (x/y)
+ * from the given pseudo-register.
+ * Same as matching "ld([xy]).b tcc__<reg>" without a regex.
+ * @param a The asm instruction.
+ * @param ins The parsed line.
+ * @param reg The pseudo-register (without the "tcc__" prefix).
+ * @return The hardware register ('x' or 'y') or 0 if no match.
+ */
+char loadXYFromPseudo(const char *a, const asmLine *ins, const char *reg)
+{
+    if ((ins->mnemonic != MN_LDX && ins->mnemonic != MN_LDY) || ins->width != WIDTH_B)
         return 0;
-    }
-
-    switch (*p)
-    {
-    case 'j':
-    case 'b':
-    case '-':
-    case '+':
-        return 1;
-    }
 
-    if (endWith(a, ":"))
-    {
-        return 1;
-    }
+    if (startWith(a + ins->operand, "tcc__") && startWith(a + ins->operand + 5, reg))
+        return a[2];
 
     return 0;
 }
 
 /**
- * @brief Create an array of strings from a file
-    without comment and leading/trailing white spaces.
-    Accept an ASM file as argument or stdin.
- * @param argc The number of arguments provided.
- * @param argv The arguments provided.
- * @return A structure (dynArray).
+ * @brief Number of lines the rules may read around a line,
+ * before the line is actually tried (see optimizeAsm function).
+ * The unbounded scans extend it while they run.
+ * @param file The asm file.
+ * @param i The index of the line.
+ * @param lo The number of lines read before the line.
+ * @return The number of lines read after the line.
  */
-dynArray tidyFile(const int argc, char **argv)
+static size_t ruleReach(const asmFile *file, const size_t i, size_t *lo)
 {
-    char buf[MAXLEN_LINE];
-    size_t nptrs = 10;
-    size_t len;
-    dynArray file;
-    file.used = 0;
+    const asmLine *ins = &file->ins[i];
+    size_t reach       = rulesReach(ins->mnemonic); // The rules of rules.opt
+
+    *lo = 0;
 
-    if (argc > 2)
+    switch (ins->mnemonic)
     {
-        fprintf(stderr, "usage:\n");
-        fprintf(stderr, "  - %s <filename>\n", argv[0]);
-        fprintf(stderr, "  - <stdin> | %s\n", argv[0]);
-        exit(EXIT_FAILURE);
+    case MN_STA:
+    case MN_STX:
+    case MN_STY:
+    case MN_STZ:
+        return max(reach, isStoreToPseudo(ins) ? STORE_REACH - 1 : 1); // Redundant stores lookahead
+    case MN_LDA:
+    case MN_LDX:
+    case MN_LDY:
+        return max(reach, 7); // Far store pattern
+    case MN_ADC:
+        return max(reach, 3);
+    case MN_JMP:
+        if (ins->width == WIDTH_W && ins->mode != MODE_IMPLIED)
+        {
+            *lo = 32; // jmp.w -> bra window
+            return max(reach, 31);
+        }
+        return reach;
+    default:
+        return reach;
     }
+}
+
+/**
+ * @brief Checks if trying the rules on a line can be skipped,
+ * because no rule matched it in the previous pass and none of
+ * the lines read at that time has changed (or moved).
+ * @param trace The traces of the lines of the current pass.
+ * @param seams Prefix count of the lines which are not the next
+ * line of their predecessor in the previous pass.
+ * @param n The index of the line.
+ * @param used The number of lines in the current pass.
+ * @param prevUsed The number of lines in the previous pass.
+ * @return 1 (true) or 0 (false).
+ */
+static int isClean(const lineTrace *trace, const size_t *seams, const size_t n, const size_t used,
+                   const size_t prevUsed)
+{
+    const long src = trace[n].src;
+    size_t a, b;
 
-    FILE *fp = argc > 1 ? fopen(argv[1], "r") : stdin;
+    if (src < 0)
+        return 0;
 
-    if (!fp)
+    /* The window touches the start of the file */
+    if ((size_t)src < trace[n].lo)
+    {
+        if ((size_t)src != n)
+            return 0;
+        a = 0;
+    }
+    else
     {
-        perror(argv[1]);
-        exit(EXIT_FAILURE);
+        if (n < trace[n].lo)
+            return 0;
+        a = n - trace[n].lo;
     }
 
-    if ((file.arr = malloc(nptrs * sizeof(char *))) == NULL)
+    /* The window touches the end of the file */
+    if ((size_t)src + trace[n].hi >= prevUsed)
+    {
+        if (used - n != prevUsed - (size_t)src)
+            return 0;
+        b = used - 1;
+    }
+    else
     {
-        perror("malloc-lines");
-        exit(EXIT_FAILURE);
+        b = n + trace[n].hi;
+        if (b >= used)
+            return 0;
     }
 
-    while (fgets(buf, MAXLEN_LINE, fp))
+    return trace[a].src >= 0 && seams[b + 1] == seams[a + 1];
+}
+
+/**
+ * @brief Add a trace, growing the array if needed.
+ * @param trace The array of traces.
+ * @param size The number of traces allocated.
+ * @param n The index of the trace.
+ * @param t The trace.
+ */
+static void pushTrace(lineTrace **trace, size_t *size, const size_t n, const lineTrace t)
+{
+    if (n >= *size)
     {
-        buf[(len = strcspn(buf, "\n"))] = 0;
+        size_t nsize = *size ? *size * 2 : 16;
+        while (nsize <= n)
+            nsize *= 2;
 
-        if (!startWith(buf, ASM_COMMENT))
+        void *tmp = realloc(*trace, nsize * sizeof(lineTrace));
+        if (!tmp)
         {
-            if (file.used == nptrs)
-            {
-                void *tmp = realloc(file.arr, (2 * nptrs) * sizeof(char *));
-                if (!tmp)
-                {
-                    perror("realloc-lines");
-                    break;
-                }
-                file.arr = tmp;
-                nptrs *= 2;
-            }
-            if (!(file.arr[file.used] = malloc(len + 1)))
-            {
-                perror("malloc-lines[used]");
-                break;
-            }
-            memcpy(file.arr[file.used], trimWhiteSpace(buf), len + 1);
-            file.used += 1;
+            fatalError("realloc-trace");
         }
+        *trace = tmp;
+        *size  = nsize;
     }
-    if (fp != stdin)
-        fclose(fp);
+    (*trace)[n] = t;
+}
+
+/**
+ * @brief Create an array of strings from a file
+    without comment and leading/trailing white spaces.
+ * @param path The file path, NULL for stdin.
+ * @return A structure (asmFile).
+ */
+asmFile tidyPath(const char *path)
+{
+    return tidyText(loadText(path));
+}
+
+/**
+ * @brief Create an array of strings from a loaded file
+    without comment and leading/trailing white spaces.
+ * @param text The content of the file (owned by the asmFile returned).
+ * @return A structure (asmFile).
+ */
+asmFile tidyText(textBuffer text)
+{
+    /* Lines are cut in place: no copy, no length limit */
+    asmFile file = scanText(text.data, text.len, scanSupported());
+    file.text    = text;
 
-    // dynArray r = { lines, used };
     return file;
 }
 
 /**
- * @brief Create an array of string to store
+ * @brief Create a set of strings to store
     block bss instructions (first word only).
  * @param file The parsed asm file provided as a structure.
- * @return A structure (dynArray).
+ * @return A structure (strSet).
  */
-dynArray storeBss(dynArray file)
+strSet storeBss(const asmFile file)
 {
 
     size_t bss_on = 0;
-    size_t len;
-    dynArray bss;
-    bss.used = 0;
-
-    if ((bss.arr = malloc(file.used * sizeof(char *))) == NULL)
-    {
-        perror("malloc-lines");
-        exit(EXIT_FAILURE);
-    }
+    strSet bss    = newStrSet();
 
     for (size_t i = 0; i < file.used; i++)
     {
@@ -190,17 +288,8 @@ dynArray storeBss(dynArray file)
         }
         if (!matchStr(file.arr[i], BSS_SECTION_START) && bss_on)
         {
-            len = strlen(file.arr[i]);
-
-            if ((bss.arr[bss.used] = malloc(len + 1)) == NULL)
-            {
-                perror("malloc-lines");
-                exit(EXIT_FAILURE);
-            }
-            memcpy(bss.arr[bss.used], file.arr[i], len + 1);
             // Get the first word only.
-            strtok(bss.arr[bss.used], " ");
-            bss.used += 1;
+            strSetAdd(&bss, file.arr[i], strcspn(file.arr[i], " "));
         }
     }
 
@@ -208,289 +297,279 @@ dynArray storeBss(dynArray file)
 }
 
 /**
- * @brief Optimize ASM code.
- * @param file The asm file cleaned (see tidyFile function).
- * @param bss The bss section (only forst words).
- * @param verbose The level of verbosity (see verbosity function).
+ * @brief Run one optimization pass on a range of lines
+ * (see optimizeAsm function). The rules read the whole file of the
+ * pass, so the result does not depend on how the file is split.
+ * @param in The file of the pass and its indexes (read only).
+ * @param chunk The range of lines, and the lines written for it.
  */
-dynArray optimizeAsm(dynArray file, const dynArray bss, const size_t verbose)
+static void optimizeChunk(const passInput *in, passChunk *chunk)
 {
+    const asmFile file       = in->file;
+    const strSet *bss        = in->bss;
+    const labelTable labels  = *in->labels;
+    const pregTable *pregs   = in->pregs;
+    const lineTrace *trace   = in->trace;
+    const size_t *seams      = in->seams;
+    const size_t prevUsed    = in->prevUsed;
+    asmFile text_opt         = chunk->out;
+    lineTrace *traceOpt      = chunk->trace;
+    size_t traceOpt_size     = chunk->trace_size;
+    unsigned int opted       = 0;
+    unsigned int moved       = 0; // Lines reordered
+    size_t visits = 0, saved = 0; // Lines tried / skipped
+    size_t i                 = chunk->from;
+    size_t mark              = 0; // First line written by the last rule matched
+    dynArray r1;                  // Store regexMatchGroups structs
+    char snp_buf1[MAXLEN_LINE]; // Store snprintf buffers
+    ruleClock clock = { in->stats ? &chunk->rules : NULL, -1, 0 };
+
+    while (i < chunk->to)
+    {
+        const asmLine *ins = &file.ins[i];
 
-    size_t totalopt = 0;  // Total number of optimizations performed
-    int opted       = -1; // Have we Optimized in this pass
-    size_t opass    = 0;  // Optimization pass counter
-    dynArray r, r1;       // Store regexMatchGroups structs
-    char snp_buf1[MAXLEN_LINE],
-        snp_buf2[MAXLEN_LINE]; // Store snprintf buffers
-    dynArray text_opt;
+        ruleStop(&clock);
 
-    while (opted)
-    {
-        if ((text_opt.arr = malloc(file.used * sizeof(char *))) == NULL)
+        while (mark < text_opt.used)
         {
-            perror("malloc-lines");
-            exit(EXIT_FAILURE);
+            pushTrace(&traceOpt, &traceOpt_size, mark, (lineTrace){ -1, 0, 0 });
+            mark += 1;
         }
 
-        text_opt.used = 0;
-        opass += 1;
-        opted    = 0;
-        size_t i = 0;
+        if (isClean(trace, seams, i, file.used, prevUsed))
+        {
+            copyLine(&text_opt, &file, i);
+            pushTrace(&traceOpt, &traceOpt_size, mark, (lineTrace){ (long)i, trace[i].lo, trace[i].hi });
+            mark += 1;
+            saved += 1;
 
-        if (verbose)
-            fprintf(stderr, "optimization pass %lu: ", opass);
+            i++;
+            continue;
+        }
+
+        size_t lo, hi = ruleReach(&file, i, &lo);
+        size_t matched; // Lines replaced by a rule of rules.opt
+        visits += 1;
 
-        while (i < file.used)
+        switch (ins->mnemonic)
         {
-            if (startWith(file.arr[i], "st"))
+        case MN_STA:
+        case MN_STX:
+        case MN_STY:
+        case MN_STZ:
+            /* Stores (accu/x/y/zero) to pseudo-registers */
+            if (isStoreToPseudo(ins))
             {
-                /* Eliminate redundant stores */
-                r = regexMatchGroups(file.arr[i], STORE_AXYZ_TO_PSEUDO, 3);
-                if (r.arr != NULL)
+                const char *reg = file.arr[i] + ins->operand + 5; // Without "tcc__"
+                const char *hwreg = file.arr[i] + 2;
+                size_t doopt = 0;
+
+                ruleTry(&clock, RULE_STORE_REDUNDANT);
+                /* Eliminate redundant stores: the first line after the store
+                    altering the control flow, or using the pseudo register
+                    (also as a pointer), decides */
+                size_t reach = in->level >= 2 ? file.used : STORE_REACH;
+                size_t j     = nextPregUse(pregs, i);
+                if (nextPregPointer(pregs, i) < j)
+                    j = nextPregPointer(pregs, i);
+                if (j < file.used && j - i < reach)
                 {
-                    size_t doopt = 0;
-                    for (size_t j = (i + 1); j < (size_t)min(file.used, (i + 30)); j++)
-                    {
-                        snprintf(snp_buf1, sizeof(snp_buf1), "st([axyz]).b tcc__%s$", r.arr[2]);
-                        r1 = regexMatchGroups(file.arr[j], snp_buf1, 2);
-                        if (r1.arr != NULL)
-                        {
-
-                            freedynArray(r1);
-
-                            doopt = 1;
-                            break;
-                        }
-                        /* Before function call (will be clobbered anyway) */
-                        if (startWith(file.arr[j], "jsr.l ") && !startWith(file.arr[j], "jsr.l tcc__"))
-                        {
-
-                            doopt = 1;
-                            break;
-                        }
-                        /* Cases in which we don't pursue optimization further
-                            #1 Branch or other use of the pseudo register */
-                        snprintf(snp_buf1, sizeof(snp_buf1), "tcc__%s", r.arr[2]);
-                        if (isControl(file.arr[j]) || isInText(file.arr[j], snp_buf1))
-                        {
-
-                            break;
-                        }
-                        /* #2 Use as a pointer */
-                        snprintf(snp_buf1, sizeof(snp_buf1), "[tcc__%s", r.arr[2]);
-                        char *ss_buffer = sliceStr(snp_buf1, 0, strlen(snp_buf1) - 1); // Remove the last char
-                        if (endWith(r.arr[2], "h") && isInText(file.arr[j], ss_buffer))
-                        {
-
-                            free(ss_buffer);
-
-                            break;
-                        }
-                        free(ss_buffer);
-                    }
-                    freedynArray(r);
-                    if (doopt)
+                    /* Another store, or a function call (will be clobbered anyway) */
+                    if ((isStoreToPseudo(&file.ins[j]) && file.ins[j].preg == ins->preg)
+                        || (isLongCall(&file.ins[j]) && !startWith(file.arr[j] + file.ins[j].operand, "tcc__")))
                     {
-                        i += 1; // Skip redundant store
-                        opted += 1;
-                        continue;
+                        doopt = 1;
                     }
                 }
+                if (j - i < reach && j - i > hi)
+                    hi = j - i; // Beyond the horizon of 816-opt
+                if (doopt)
+                {
+                    i += 1; // Skip redundant store
+                    ruleHit(&clock, RULE_STORE_REDUNDANT);
+                    opted += 1;
+                    continue;
+                }
+
                 /* Stores (x/y) to pseudo-registers */
-                r = regexMatchGroups(file.arr[i], STORE_XY_TO_PSEUDO, 3);
-                if (r.arr != NULL)
+                if (ins->mnemonic == MN_STX || ins->mnemonic == MN_STY)
                 {
+                    ruleTry(&clock, RULE_STXY_PUSH_CALL);
                     /* Store hwreg to preg, push preg,
                         function call -> push hwreg, function call */
-                    snprintf(snp_buf1, sizeof(snp_buf1), "pei (tcc__%s)",
-                             r.arr[2]);
-                    if (matchStr(file.arr[i + 1], snp_buf1) && startWith(file.arr[i + 2], "jsr.l "))
+                    int pushPreg = file.ins[i + 1].mnemonic == MN_PEI && file.ins[i + 1].width == WIDTH_NONE && file.ins[i + 1].mode == MODE_INDIRECT && file.ins[i + 1].preg == ins->preg;
+                    if (pushPreg && isLongCall(&file.ins[i + 2]))
                     {
 
-                        snprintf(snp_buf1, sizeof(snp_buf1), "ph%s", r.arr[1]);
-                        text_opt = pushToArray(text_opt, snp_buf1);
-
-                        freedynArray(r);
+                        snprintf(snp_buf1, sizeof(snp_buf1), "ph%c", *hwreg);
+                        pushLine(&text_opt, snp_buf1);
 
                         i += 2;
+                        ruleHit(&clock, RULE_STXY_PUSH_CALL);
                         opted += 1;
                         continue;
                     }
+                    ruleTry(&clock, RULE_STXY_PUSH);
                     /* Store hwreg to preg, push preg -> store hwreg to preg,
                         push hwreg (shorter) */
-                    if (matchStr(file.arr[i + 1], snp_buf1))
+                    if (pushPreg)
                     {
 
-                        text_opt = pushToArray(text_opt, file.arr[i]);
+                        copyLine(&text_opt, &file, i);
 
-                        snprintf(snp_buf1, sizeof(snp_buf1), "ph%s", r.arr[1]);
-                        text_opt = pushToArray(text_opt, snp_buf1);
-
-                        freedynArray(r);
+                        snprintf(snp_buf1, sizeof(snp_buf1), "ph%c", *hwreg);
+                        pushLine(&text_opt, snp_buf1);
 
                         i += 2;
+                        ruleHit(&clock, RULE_STXY_PUSH);
                         opted += 1;
                         continue;
                     }
+                    ruleTry(&clock, RULE_STXY_LOAD);
                     /* Store hwreg to preg, load hwreg from preg -> store hwreg to
                        preg, transfer hwreg/hwreg (shorter) */
-                    snprintf(snp_buf1, sizeof(snp_buf1), "lda.b tcc__%s",
-                             r.arr[2]);
-                    snprintf(snp_buf2, sizeof(snp_buf2),
-                             "lda.b tcc__%s ; DON'T OPTIMIZE", r.arr[2]);
-                    if (matchStr(file.arr[i + 1], snp_buf1) || matchStr(file.arr[i + 1], snp_buf2))
+                    snprintf(snp_buf1, sizeof(snp_buf1),
+                             "lda.b tcc__%s ; DON'T OPTIMIZE", reg);
+                    if (isPseudoOp(&file.ins[i + 1], MN_LDA, ins->preg) || (file.ins[i + 1].mnemonic == MN_LDA && matchStr(file.arr[i + 1], snp_buf1)))
                     {
 
-                        text_opt = pushToArray(text_opt, file.arr[i]);
-
-                        snprintf(snp_buf1, sizeof(snp_buf1), "t%sa",
-                                 r.arr[1]); // FIXME: shouldn't this be marked as
-                                            // DON'T OPTIMIZE again?
-                        text_opt = pushToArray(text_opt, snp_buf1);
+                        copyLine(&text_opt, &file, i);
 
-                        freedynArray(r);
+                        snprintf(snp_buf1, sizeof(snp_buf1), "t%ca",
+                                 *hwreg); // FIXME: shouldn't this be marked as
+                                          // DON'T OPTIMIZE again?
+                        pushLine(&text_opt, snp_buf1);
 
                         i += 2;
+                        ruleHit(&clock, RULE_STXY_LOAD);
                         opted += 1;
                         continue;
                     }
-                    freedynArray(r);
                 }
+
                 /* Stores (accu only) to pseudo-registers */
-                r = regexMatchGroups(file.arr[i], STORE_A_TO_PSEUDO, 2);
-                if (r.arr != NULL)
+                if (ins->mnemonic == MN_STA)
                 {
+                    const asmLine *next = &file.ins[i + 1];
+
+                    ruleTry(&clock, RULE_STA_LOAD);
                     /* Store preg followed by load preg */
-                    snprintf(snp_buf1, sizeof(snp_buf1), "lda.b tcc__%s",
-                             r.arr[1]);
-                    if (matchStr(file.arr[i + 1], snp_buf1))
+                    if (isPseudoOp(next, MN_LDA, ins->preg))
                     {
 
-                        text_opt = pushToArray(text_opt, file.arr[i]);
-
-                        freedynArray(r);
+                        copyLine(&text_opt, &file, i);
 
                         i += 2; // Omit load
+                        ruleHit(&clock, RULE_STA_LOAD);
                         opted += 1;
                         continue;
                     }
+                    ruleTry(&clock, RULE_STA_LDXY_LOAD);
                     /* Store preg followed by load preg with ldx/ldy in between */
-                    if ((startWith(file.arr[i + 1], "ldx") || startWith(file.arr[i + 1], "ldy")) && matchStr(file.arr[i + 2], snp_buf1))
+                    if ((next->mnemonic == MN_LDX || next->mnemonic == MN_LDY) && isPseudoOp(&file.ins[i + 2], MN_LDA, ins->preg))
                     {
 
-                        text_opt = pushToArray(text_opt, file.arr[i]);
-                        text_opt = pushToArray(text_opt, file.arr[i + 1]);
-
-                        freedynArray(r);
+                        copyLine(&text_opt, &file, i);
+                        copyLine(&text_opt, &file, i + 1);
 
                         i += 3; // Omit load
+                        ruleHit(&clock, RULE_STA_LDXY_LOAD);
                         opted += 1;
                         continue;
                     }
+                    ruleTry(&clock, RULE_STA_PUSH_CALL);
                     /* Store accu to preg, push preg, function call -> push accu,
                         function call */
-                    snprintf(snp_buf1, sizeof(snp_buf1), "pei (tcc__%s)",
-                             r.arr[1]);
-                    if (matchStr(file.arr[i + 1], snp_buf1) && startWith(file.arr[i + 2], "jsr.l "))
+                    int pushPreg = next->mnemonic == MN_PEI && next->width == WIDTH_NONE && next->mode == MODE_INDIRECT && next->preg == ins->preg;
+                    if (pushPreg && isLongCall(&file.ins[i + 2]))
                     {
 
-                        text_opt = pushToArray(text_opt, "pha");
-
-                        freedynArray(r);
+                        pushLine(&text_opt, "pha");
 
                         i += 2;
+                        ruleHit(&clock, RULE_STA_PUSH_CALL);
                         opted += 1;
                         continue;
                     }
+                    ruleTry(&clock, RULE_STA_PUSH);
                     /* Store accu to preg, push preg -> store accu to preg,
                         push accu (shorter) */
-                    if (matchStr(file.arr[i + 1], snp_buf1))
+                    if (pushPreg)
                     {
 
-                        text_opt = pushToArray(text_opt, file.arr[i]);
-                        text_opt = pushToArray(text_opt, "pha");
-
-                        freedynArray(r);
+                        copyLine(&text_opt, &file, i);
+                        pushLine(&text_opt, "pha");
 
                         i += 2;
+                        ruleHit(&clock, RULE_STA_PUSH);
                         opted += 1;
                         continue;
                     }
+                    ruleTry(&clock, RULE_STA_PUSH_SWAP);
                     /* Store accu to preg1, push preg2, push preg1 -> store accu to
                        preg1, push preg2, push accu */
-                    else if (startWith(file.arr[i + 1], "pei ") && matchStr(file.arr[i + 2], snp_buf1))
+                    if (next->mnemonic == MN_PEI && next->width == WIDTH_NONE && next->mode != MODE_IMPLIED && file.ins[i + 2].mnemonic == MN_PEI && file.ins[i + 2].width == WIDTH_NONE && file.ins[i + 2].mode == MODE_INDIRECT && file.ins[i + 2].preg == ins->preg)
                     {
 
-                        text_opt = pushToArray(text_opt, file.arr[i + 1]);
-                        text_opt = pushToArray(text_opt, file.arr[i]);
-                        text_opt = pushToArray(text_opt, "pha");
-
-                        freedynArray(r);
+                        copyLine(&text_opt, &file, i + 1);
+                        copyLine(&text_opt, &file, i);
+                        pushLine(&text_opt, "pha");
 
                         i += 3;
+                        ruleHit(&clock, RULE_STA_PUSH_SWAP);
                         opted += 1;
                         continue;
                     }
                     /* Convert incs/decs on pregs incs/decs on hwregs */
-                    size_t cont        = 0;
-                    const char *crem[] = { "inc", "dec" };
-                    for (size_t k = 0; k < sizeof(crem) / sizeof(const char *); k++)
+                    size_t cont = 0;
+                    const mnemonic crem[] = { MN_INC, MN_DEC };
+                    for (size_t k = 0; k < sizeof(crem) / sizeof(crem[0]); k++)
                     {
-                        snprintf(snp_buf1, sizeof(snp_buf1), "%s.b tcc__%s",
-                                 crem[k], r.arr[1]);
-                        if (matchStr(file.arr[i + 1], snp_buf1))
+                        if (isPseudoOp(next, crem[k], ins->preg))
                         {
 
+                            ruleTry(&clock, RULE_STA_CREMENT_2);
                             /* Store to preg followed by crement on preg */
-                            if (matchStr(file.arr[i + 2], snp_buf1) && startWith(file.arr[i + 3], "lda"))
+                            if (isPseudoOp(&file.ins[i + 2], crem[k], ins->preg) && file.ins[i + 3].mnemonic == MN_LDA)
                             {
 
                                 /* Store to preg followed by two crements on preg
                                     increment the accu first, then store it to preg
                                  */
                                 snprintf(snp_buf1, sizeof(snp_buf1), "%s a",
-                                         crem[k]);
-                                text_opt = pushToArray(text_opt, snp_buf1);
-                                text_opt = pushToArray(text_opt, snp_buf1);
-                                snprintf(snp_buf1, sizeof(snp_buf1),
-                                         "sta.b tcc__%s", r.arr[1]);
-                                text_opt = pushToArray(text_opt, snp_buf1);
+                                         mnemonicName(crem[k]));
+                                pushLine(&text_opt, snp_buf1);
+                                pushLine(&text_opt, snp_buf1);
+                                copyLine(&text_opt, &file, i);
 
                                 /* A subsequent load can be omitted (the right value
                                  * is already in the accu) */
-                                snprintf(snp_buf1, sizeof(snp_buf1),
-                                         "lda.b tcc__%s", r.arr[1]);
-                                if (matchStr(file.arr[i + 3], snp_buf1))
+                                if (isPseudoOp(&file.ins[i + 3], MN_LDA, ins->preg))
                                     i += 4;
                                 else
                                     i += 3;
 
-                                freedynArray(r);
-
+                                ruleHit(&clock, RULE_STA_CREMENT_2);
                                 opted += 1;
                                 cont += 1;
                                 break;
                             }
-                            else if (startWith(file.arr[i + 2], "lda"))
+                            ruleTry(&clock, RULE_STA_CREMENT);
+                            if (file.ins[i + 2].mnemonic == MN_LDA)
                             {
 
                                 snprintf(snp_buf1, sizeof(snp_buf1), "%s a",
-                                         crem[k]);
-                                text_opt = pushToArray(text_opt, snp_buf1);
+                                         mnemonicName(crem[k]));
+                                pushLine(&text_opt, snp_buf1);
 
-                                snprintf(snp_buf1, sizeof(snp_buf1),
-                                         "sta.b tcc__%s", r.arr[1]);
-                                text_opt = pushToArray(text_opt, snp_buf1);
+                                copyLine(&text_opt, &file, i);
 
-                                snprintf(snp_buf1, sizeof(snp_buf1),
-                                         "lda.b tcc__%s", r.arr[1]);
-                                if (matchStr(file.arr[i + 2], snp_buf1))
+                                if (isPseudoOp(&file.ins[i + 2], MN_LDA, ins->preg))
                                     i += 3;
                                 else
                                     i += 2;
 
-                                freedynArray(r);
-
+                                ruleHit(&clock, RULE_STA_CREMENT);
                                 opted += 1;
                                 cont += 1;
                                 break;
@@ -500,148 +579,139 @@ dynArray optimizeAsm(dynArray file, const dynArray bss, const size_t verbose)
                     if (cont)
                         continue;
 
-                    r1 = regexMatchGroups(file.arr[i + 1], "lda.b tcc__([rf][0-9]{0,})",
-                                          2);
-                    if (r1.arr != NULL)
+                    ruleTry(&clock, RULE_STA_LOAD_LOGIC);
+                    if (next->mnemonic == MN_LDA && next->width == WIDTH_B && (next->flags & LF_PSEUDO))
                     {
-
-                        char *ss_buffer = sliceStr(file.arr[i + 2], 0, 3);
-                        if (matchStr(ss_buffer, "and") || matchStr(ss_buffer, "ora"))
+                        r1 = regexMatchGroups(file.arr[i + 1], LOAD_A_FROM_PSEUDO, 2);
+                        if (r1.arr != NULL)
                         {
 
-                            /* Store to preg1, load from preg2, and/or preg1 ->
-                             * store to preg1, and/or preg2 */
-                            snprintf(snp_buf1, sizeof(snp_buf1), ".b tcc__%s",
-                                     r.arr[1]);
-                            if (endWith(file.arr[i + 2], snp_buf1))
+                            mnemonic mn = file.ins[i + 2].mnemonic;
+                            if (mn == MN_AND || mn == MN_ORA)
                             {
 
-                                text_opt = pushToArray(text_opt, file.arr[i]);
+                                /* Store to preg1, load from preg2, and/or preg1 ->
+                                 * store to preg1, and/or preg2 */
+                                snprintf(snp_buf1, sizeof(snp_buf1), ".b tcc__%s",
+                                         reg);
+                                if (endWith(file.arr[i + 2], snp_buf1))
+                                {
 
-                                snprintf(snp_buf1, sizeof(snp_buf1), "%s.b tcc__%s",
-                                         ss_buffer, r1.arr[1]);
-                                text_opt = pushToArray(text_opt, snp_buf1);
+                                    copyLine(&text_opt, &file, i);
 
-                                free(ss_buffer);
-                                freedynArray(r);
-                                freedynArray(r1);
+                                    snprintf(snp_buf1, sizeof(snp_buf1), "%s.b tcc__%s",
+                                             mnemonicName(mn), r1.arr[1]);
+                                    pushLine(&text_opt, snp_buf1);
 
-                                i += 3;
-                                opted += 1;
-                                continue;
+                                    freedynArray(r1);
+
+                                    i += 3;
+                                    ruleHit(&clock, RULE_STA_LOAD_LOGIC);
+                                    opted += 1;
+                                    continue;
+                                }
                             }
+                            freedynArray(r1);
                         }
-                        free(ss_buffer);
-                        freedynArray(r1);
                     }
 
+                    ruleTry(&clock, RULE_STA_SEP_LOAD);
                     /* Store to preg, switch to 8 bits, load from preg => skip the
                      * load */
-                    snprintf(snp_buf1, sizeof(snp_buf1), "lda.b tcc__%s",
-                             r.arr[1]);
-                    if (matchStr(file.arr[i + 1], "sep #$20") && matchStr(file.arr[i + 2], snp_buf1))
+                    if (matchStr(file.arr[i + 1], "sep #$20") && isPseudoOp(&file.ins[i + 2], MN_LDA, ins->preg))
                     {
 
-                        text_opt = pushToArray(text_opt, file.arr[i]);
-                        text_opt = pushToArray(text_opt, file.arr[i + 1]);
-
-                        freedynArray(r);
+                        copyLine(&text_opt, &file, i);
+                        copyLine(&text_opt, &file, i + 1);
 
                         i += 3; // Skip load
+                        ruleHit(&clock, RULE_STA_SEP_LOAD);
                         opted += 1;
                         continue;
                     }
 
+                    ruleTry(&clock, RULE_STA_TWICE);
                     /* Two stores to preg without control flow or other uses of preg
                      * => skip first store
                      */
-                    snprintf(snp_buf1, sizeof(snp_buf1), "tcc__%s", r.arr[1]);
-                    if (!isControl(file.arr[i + 1]) && !isInText(file.arr[i + 1], snp_buf1))
+                    snprintf(snp_buf1, sizeof(snp_buf1), "tcc__%s", reg);
+                    int usePreg = (next->flags & LF_PSEUDO) && isInText(file.arr[i + 1], snp_buf1);
+                    if (!(next->flags & LF_CONTROL) && !usePreg)
                     {
 
                         if (matchStr(file.arr[i + 2], file.arr[i]))
                         {
 
-                            text_opt = pushToArray(text_opt, file.arr[i + 1]);
-                            text_opt = pushToArray(text_opt, file.arr[i + 2]);
-
-                            freedynArray(r);
+                            copyLine(&text_opt, &file, i + 1);
+                            copyLine(&text_opt, &file, i + 2);
 
                             i += 3; // Skip first store
+                            ruleHit(&clock, RULE_STA_TWICE);
                             opted += 1;
                             continue;
                         }
                     }
 
+                    ruleTry(&clock, RULE_STA_LOAD_XY);
                     /* Store hwreg to preg, load hwreg from preg -> store hwreg to
                        preg, transfer hwreg/hwreg (shorter) */
-                    snprintf(snp_buf1, sizeof(snp_buf1), "ld([xy]).b tcc__%s",
-                             r.arr[1]);
-                    r1 = regexMatchGroups(file.arr[i + 1], snp_buf1, 2);
-                    if (r1.arr != NULL)
+                    char hwload = loadXYFromPseudo(file.arr[i + 1], next, reg);
+                    if (hwload)
                     {
 
-                        text_opt = pushToArray(text_opt, file.arr[i]);
-
-                        snprintf(snp_buf1, sizeof(snp_buf1), "ta%s", r1.arr[1]);
-                        text_opt = pushToArray(text_opt, snp_buf1);
+                        copyLine(&text_opt, &file, i);
 
-                        freedynArray(r);
-                        freedynArray(r1);
+                        snprintf(snp_buf1, sizeof(snp_buf1), "ta%c", hwload);
+                        pushLine(&text_opt, snp_buf1);
 
                         i += 2;
+                        ruleHit(&clock, RULE_STA_LOAD_XY);
                         opted += 1;
                         continue;
                     }
 
+                    ruleTry(&clock, RULE_STA_SKIP_LOAD);
                     /* Store accu to preg then load accu from preg,
                         with something in-between that does not alter */
-                    snprintf(snp_buf1, sizeof(snp_buf1), "tcc__%s", r.arr[1]);
-
-                    if (!(isControl(file.arr[i + 1]) || changeAccu(file.arr[i + 1]) || isInText(file.arr[i + 1], snp_buf1)))
+                    if (!((next->flags & LF_CONTROL) || (next->flags & LF_CHANGES_ACCU) || usePreg))
                     {
 
-                        snprintf(snp_buf1, sizeof(snp_buf1), "lda.b tcc__%s",
-                                 r.arr[1]);
-                        if (matchStr(file.arr[i + 2], snp_buf1))
+                        if (isPseudoOp(&file.ins[i + 2], MN_LDA, ins->preg))
                         {
 
-                            text_opt = pushToArray(text_opt, file.arr[i]);
-                            text_opt = pushToArray(text_opt, file.arr[i + 1]);
-
-                            freedynArray(r);
+                            copyLine(&text_opt, &file, i);
+                            copyLine(&text_opt, &file, i + 1);
 
                             i += 3; // Skip load
+                            ruleHit(&clock, RULE_STA_SKIP_LOAD);
                             opted += 1;
                             continue;
                         }
                     }
 
+                    ruleTry(&clock, RULE_STA_CLC_ADC);
                     /* Store preg1, clc, load preg2,
                         add preg1 -> store preg1, clc, add preg2 */
-                    if (matchStr(file.arr[i + 1], "clc"))
+                    if (matchStr(file.arr[i + 1], "clc") && file.ins[i + 2].mnemonic == MN_LDA && file.ins[i + 2].width == WIDTH_B)
                     {
 
-                        r1 = regexMatchGroups(file.arr[i + 2], "lda.b tcc__(r[0-9]{0,})",
-                                              2);
+                        r1 = regexMatchGroups(file.arr[i + 2], LOAD_A_FROM_R_PSEUDO, 2);
                         if (r1.arr != NULL)
                         {
-                            snprintf(snp_buf1, sizeof(snp_buf1), "adc.b tcc__%s",
-                                     r.arr[1]);
-                            if (matchStr(file.arr[i + 3], snp_buf1))
+                            if (isPseudoOp(&file.ins[i + 3], MN_ADC, ins->preg))
                             {
 
-                                text_opt = pushToArray(text_opt, file.arr[i]);
-                                text_opt = pushToArray(text_opt, file.arr[i + 1]);
+                                copyLine(&text_opt, &file, i);
+                                copyLine(&text_opt, &file, i + 1);
 
                                 snprintf(snp_buf1, sizeof(snp_buf1),
                                          "adc.b tcc__%s", r1.arr[1]);
-                                text_opt = pushToArray(text_opt, snp_buf1);
+                                pushLine(&text_opt, snp_buf1);
 
-                                freedynArray(r);
                                 freedynArray(r1);
 
                                 i += 4; // Skip load
+                                ruleHit(&clock, RULE_STA_CLC_ADC);
                                 opted += 1;
                                 continue;
                             }
@@ -649,520 +719,607 @@ dynArray optimizeAsm(dynArray file, const dynArray bss, const size_t verbose)
                         }
                     }
 
+                    ruleTry(&clock, RULE_STA_ASL);
                     /* Store accu to preg, asl preg => asl accu, store accu to preg
                         FIXME: is this safe? can we rely on code not making
                        assumptions about the contents of the accu after the shift?
                      */
-                    snprintf(snp_buf1, sizeof(snp_buf1), "asl.b tcc__%s",
-                             r.arr[1]);
-                    if (matchStr(file.arr[i + 1], snp_buf1))
+                    if (isPseudoOp(next, MN_ASL, ins->preg))
                     {
 
-                        text_opt = pushToArray(text_opt, "asl a");
-                        text_opt = pushToArray(text_opt, file.arr[i]);
-
-                        freedynArray(r);
+                        pushLine(&text_opt, "asl a");
+                        copyLine(&text_opt, &file, i);
 
                         i += 2;
+                        ruleHit(&clock, RULE_STA_ASL);
                         opted += 1;
                         continue;
                     }
-                    freedynArray(r);
                 }
+            }
 
-                r = regexMatchGroups(file.arr[i], "sta (.{0,}),s$", 2);
-                if (r.arr != NULL)
+            ruleTry(&clock, RULE_STACK_STA_LOAD);
+            /* Store accu to stack followed by load accu from stack */
+            if (ins->mnemonic == MN_STA && ins->width == WIDTH_NONE && ins->mode == MODE_STACK)
+            {
+                if (file.ins[i + 1].mnemonic == MN_LDA && file.ins[i + 1].width == WIDTH_NONE && matchStr(file.arr[i + 1] + file.ins[i + 1].operand, file.arr[i] + ins->operand))
                 {
-                    snprintf(snp_buf1, sizeof(snp_buf1), "lda %s,s", r.arr[1]);
-                    if (matchStr(file.arr[i + 1], snp_buf1))
-                    {
-
-                        text_opt = pushToArray(text_opt, file.arr[i]);
 
-                        freedynArray(r);
+                    copyLine(&text_opt, &file, i);
 
-                        i += 2; // Omit load
-                        opted += 1;
-                        continue;
-                    }
-                    freedynArray(r);
+                    i += 2; // Omit load
+                    ruleHit(&clock, RULE_STACK_STA_LOAD);
+                    opted += 1;
+                    continue;
                 }
-            } // End of startWith(file.arr[i], "st")
+            }
+            break; // End of stores
 
-            if (startWith(file.arr[i], "ld"))
+        case MN_LDA:
+        case MN_LDX:
+        case MN_LDY:
+
+            ruleTry(&clock, RULE_LDX0_LONG);
+            if (ins->mnemonic == MN_LDX && isInText(file.arr[i], "ldx #0"))
             {
 
-                r = regexMatchGroups(file.arr[i], "ldx #0", 1);
-                if (r.arr != NULL)
+                r1 = regexMatchGroups(file.arr[i], LOAD_A_LONG_X, 2);
+                if (r1.arr != NULL && !endWith(file.arr[i + 3], ",x"))
                 {
 
-                    r1 = regexMatchGroups(file.arr[i], "lda.l (.{0,}),x$", 2);
-                    if (r1.arr != NULL && !endWith(file.arr[i + 3], ",x"))
-                    {
-
-                        snprintf(snp_buf1, sizeof(snp_buf1), "lda.l %s",
-                                 r1.arr[1]);
-                        text_opt = pushToArray(text_opt, snp_buf1);
+                    snprintf(snp_buf1, sizeof(snp_buf1), "lda.l %s",
+                             r1.arr[1]);
+                    pushLine(&text_opt, snp_buf1);
 
-                        freedynArray(r1);
-                        freedynArray(r);
+                    freedynArray(r1);
 
-                        i += 2;
-                        opted += 1;
-                        continue;
-                    }
-                    else if (r1.arr != NULL)
-                    {
+                    i += 2;
+                    ruleHit(&clock, RULE_LDX0_LONG);
+                    opted += 1;
+                    continue;
+                }
+                else if (r1.arr != NULL)
+                {
 
-                        snprintf(snp_buf1, sizeof(snp_buf1), "lda.l %s", r1.arr[1]);
-                        text_opt = pushToArray(text_opt, snp_buf1);
+                    snprintf(snp_buf1, sizeof(snp_buf1), "lda.l %s", r1.arr[1]);
+                    pushLine(&text_opt, snp_buf1);
 
-                        text_opt = pushToArray(text_opt, file.arr[i + 2]);
+                    copyLine(&text_opt, &file, i + 2);
 
-                        char *rs_buffer = replaceStr(file.arr[i + 3], ",x", "");
-                        text_opt        = pushToArray(text_opt, rs_buffer);
+                    pushReplaced(&text_opt, file.arr[i + 3], ",x", "");
 
-                        freedynArray(r1);
-                        freedynArray(r);
+                    freedynArray(r1);
 
-                        i += 4;
-                        opted += 1;
-                        continue;
-                    }
-                    freedynArray(r);
+                    i += 4;
+                    ruleHit(&clock, RULE_LDX0_LONG);
+                    opted += 1;
+                    continue;
                 }
+            }
 
-                if (startWith(file.arr[i], "lda.w #") && matchStr(file.arr[i + 1], "sta.b tcc__r9") && startWith(file.arr[i + 2], "lda.w #") && matchStr(file.arr[i + 3], "sta.b tcc__r9h") && matchStr(file.arr[i + 4], "sep #$20") && startWith(file.arr[i + 5], "lda.b ") && matchStr(file.arr[i + 6], "sta.b [tcc__r9]") && matchStr(file.arr[i + 7], "rep #$20"))
+            if (ins->mnemonic == MN_LDA && ins->width == WIDTH_W && ins->mode == MODE_IMMEDIATE)
+            {
+                ruleTry(&clock, RULE_LDA_FAR_STORE);
+                if (matchStr(file.arr[i + 1], "sta.b tcc__r9") && startWith(file.arr[i + 2], "lda.w #") && matchStr(file.arr[i + 3], "sta.b tcc__r9h") && matchStr(file.arr[i + 4], "sep #$20") && startWith(file.arr[i + 5], "lda.b ") && matchStr(file.arr[i + 6], "sta.b [tcc__r9]") && matchStr(file.arr[i + 7], "rep #$20"))
                 {
 
-                    text_opt = pushToArray(text_opt, "sep #$20");
-                    text_opt = pushToArray(text_opt, file.arr[i + 5]);
+                    pushLine(&text_opt, "sep #$20");
+                    copyLine(&text_opt, &file, i + 5);
 
-                    char *ss_buffer  = sliceStr(file.arr[i + 2], 7, strlen(file.arr[i + 2]));
-                    char *ss_buffer2 = sliceStr(file.arr[i], 7, strlen(file.arr[i]));
                     snprintf(snp_buf1, sizeof(snp_buf1), "sta.l %lu",
-                             atol(ss_buffer) * 65536 + atol(ss_buffer2));
-                    text_opt = pushToArray(text_opt, snp_buf1);
-
-                    text_opt = pushToArray(text_opt, "rep #$20");
+                             atol(file.arr[i + 2] + 7) * 65536 + atol(file.arr[i] + 7));
+                    pushLine(&text_opt, snp_buf1);
 
-                    free(ss_buffer);
-                    free(ss_buffer2);
+                    pushLine(&text_opt, "rep #$20");
 
                     i += 8;
+                    ruleHit(&clock, RULE_LDA_FAR_STORE);
                     opted += 1;
                     continue;
                 }
 
+                ruleTry(&clock, RULE_LDA0_STZ);
                 if (matchStr(file.arr[i], "lda.w #0"))
                 {
 
-                    if (startWith(file.arr[i + 1], "sta.b ") && startWith(file.arr[i + 2], "lda"))
+                    if (file.ins[i + 1].mnemonic == MN_STA && file.ins[i + 1].width == WIDTH_B && file.ins[i + 1].mode != MODE_IMPLIED && file.ins[i + 2].mnemonic == MN_LDA)
                     {
 
-                        char *rs_buffer = replaceStr(file.arr[i + 1], "sta.", "stz.");
-                        text_opt        = pushToArray(text_opt, rs_buffer);
+                        pushReplaced(&text_opt, file.arr[i + 1], "sta.", "stz.");
 
                         i += 2;
+                        ruleHit(&clock, RULE_LDA0_STZ);
                         opted += 1;
                         continue;
                     }
                 }
-                else if (startWith(file.arr[i], "lda.w #"))
+                else
                 {
 
-                    if (matchStr(file.arr[i + 1], "sep #$20") && startWith(file.arr[i + 2], "sta ") && matchStr(file.arr[i + 3], "rep #$20") && startWith(file.arr[i + 4], "lda"))
+                    ruleTry(&clock, RULE_LDA_SEP_STA);
+                    if (matchStr(file.arr[i + 1], "sep #$20") && startWith(file.arr[i + 2], "sta ") && matchStr(file.arr[i + 3], "rep #$20") && file.ins[i + 4].mnemonic == MN_LDA)
                     {
 
-                        text_opt = pushToArray(text_opt, "sep #$20");
+                        pushLine(&text_opt, "sep #$20");
 
-                        char *rs_buffer = replaceStr(file.arr[i], "lda.w", "lda.b");
-                        text_opt        = pushToArray(text_opt, rs_buffer);
+                        pushReplaced(&text_opt, file.arr[i], "lda.w", "lda.b");
 
-                        text_opt = pushToArray(text_opt, file.arr[i + 2]);
-                        text_opt = pushToArray(text_opt, file.arr[i + 3]);
+                        copyLine(&text_opt, &file, i + 2);
+                        copyLine(&text_opt, &file, i + 3);
 
                         i += 4;
+                        ruleHit(&clock, RULE_LDA_SEP_STA);
                         opted += 1;
                         continue;
                     }
                 }
+            }
 
-                if (startWith(file.arr[i], "lda.b") && !isControl(file.arr[i + 1]) && !isInText(file.arr[i + 1], "a") && startWith(file.arr[i + 2], "lda.b"))
-                {
-
-                    text_opt = pushToArray(text_opt, file.arr[i + 1]);
-                    text_opt = pushToArray(text_opt, file.arr[i + 2]);
-
-                    i += 3;
-                    opted += 1;
-                    continue;
-                }
-
-                /* Don't write preg high back to stack if
-                    it hasn't been updated */
-                if (endWith(file.arr[i + 1], "h") && startWith(file.arr[i + 1], "sta.b tcc__r") && startWith(file.arr[i], "lda ") && endWith(file.arr[i], ",s"))
-                {
-
-                    char *local = sliceStr(file.arr[i], 4, strlen(file.arr[i]));
-                    char *reg   = sliceStr(file.arr[i + 1], 6, strlen(file.arr[i + 1]));
+            ruleTry(&clock, RULE_LDA_DEAD);
+            if (ins->mnemonic == MN_LDA && ins->width == WIDTH_B && !(file.ins[i + 1].flags & LF_CONTROL) && !isInText(file.arr[i + 1], "a") && file.ins[i + 2].mnemonic == MN_LDA && file.ins[i + 2].width == WIDTH_B)
+            {
 
-                    /* lda stack ; store high preg ; ...
-                        ; load high preg ; sta stack */
-                    size_t j = i + 2;
-                    while (j < (file.used - 2) && !isControl(file.arr[j]) && !isInText(file.arr[j], reg))
-                    {
+                copyLine(&text_opt, &file, i + 1);
+                copyLine(&text_opt, &file, i + 2);
 
-                        j += 1;
-                    }
-                    snprintf(snp_buf1, sizeof(snp_buf1), "lda.b %s", reg);
-                    snprintf(snp_buf2, sizeof(snp_buf2), "sta %s", local);
-                    if (matchStr(file.arr[j], snp_buf1) && matchStr(file.arr[j + 1], snp_buf2))
-                    {
-                        while (i < j)
-                        {
-                            text_opt = pushToArray(text_opt, file.arr[i]);
+                i += 3;
+                ruleHit(&clock, RULE_LDA_DEAD);
+                opted += 1;
+                continue;
+            }
 
-                            i += 1;
-                        }
+            ruleTry(&clock, RULE_PREG_HIGH_WRITEBACK);
+            /* Don't write preg high back to stack if
+                it hasn't been updated */
+            if (ins->mnemonic == MN_LDA && ins->width == WIDTH_NONE && ins->mode == MODE_STACK && file.ins[i + 1].mnemonic == MN_STA && file.ins[i + 1].width == WIDTH_B && startWith(file.arr[i + 1], "sta.b tcc__r") && endWith(file.arr[i + 1], "h"))
+            {
 
-                        free(reg);
-                        free(local);
+                const char *local = file.arr[i] + ins->operand;
+                const char *reg   = file.arr[i + 1] + file.ins[i + 1].operand;
 
-                        i += 2; // Skip load high preg ; sta stack
-                        opted += 1;
-                        continue;
-                    }
-                    free(reg);
-                    free(local);
-                }
-
-                /* Reorder copying of 32-bit value to preg if it looks as
-                    if that could allow further optimization.
-                    Looking for:
-                        lda something
-                        sta.b tcc_rX
-                        lda something
-                        sta.b tcc_rYh
-                        ...tcc_rX...
-                */
-                if (startWith(file.arr[i], "lda") && startWith(file.arr[i + 1], "sta.b tcc__r"))
+                /* lda stack ; store high preg ; ...
+                    ; load high preg ; sta stack */
+                size_t j = i + 2;
+                if (file.ins[i + 1].preg == PREG_NONE)
                 {
-
-                    char *reg = sliceStr(file.arr[i + 1], 6, strlen(file.arr[i + 1]));
-                    if (!endWith(reg, "h") && startWith(file.arr[i + 2], "lda") && !endWith(file.arr[i + 2], reg) && startWith(file.arr[i + 3], "sta.b tcc__r") && endWith(file.arr[i + 3], "h") && endWith(file.arr[i + 4], reg))
+                    while (j < (file.used - 2) && !(file.ins[j].flags & LF_CONTROL) && !((file.ins[j].flags & LF_PSEUDO) && isInText(file.arr[j], reg)))
                     {
 
-                        text_opt = pushToArray(text_opt, file.arr[i + 2]);
-                        text_opt = pushToArray(text_opt, file.arr[i + 3]);
-                        text_opt = pushToArray(text_opt, file.arr[i]);
-                        text_opt = pushToArray(text_opt, file.arr[i + 1]);
-
-                        free(reg);
-
-                        i += 4;
-                        // this is not an optimization per se, so we don't count it
-                        continue;
+                        j += 1;
                     }
-                    free(reg);
                 }
-
-                /* Compare optimizations inspired by optimore
-                    These opts simplify compare operations, which are monstrous because
-                    they have to take the long long case into account.
-                    We try to detect those cases by checking if a tya follows the
-                    comparison (not sure if this is reliable, but it passes the test suite)
-                */
-                if (matchStr(file.arr[i], "ldx #1") && startWith(file.arr[i + 1], "lda.b tcc__") && matchStr(file.arr[i + 2], "sec") && startWith(file.arr[i + 3], "sbc #") && matchStr(file.arr[i + 4], "tay") && matchStr(file.arr[i + 5], "beq +") && matchStr(file.arr[i + 6], "dex") && matchStr(file.arr[i + 7], "+") && startWith(file.arr[i + 8], "stx.b tcc__") && matchStr(file.arr[i + 9], "txa") && matchStr(file.arr[i + 10], "bne +") && startWith(file.arr[i + 11], "brl ") && matchStr(file.arr[i + 12], "+") && !matchStr(file.arr[i + 13], "tya"))
+                else if (j < file.used - 2)
                 {
-
-                    text_opt = pushToArray(text_opt, file.arr[i + 1]);
-
-                    char *ins = sliceStr(file.arr[i + 3], 5, strlen(file.arr[i + 1]));
-                    snprintf(snp_buf1, sizeof(snp_buf1), "cmp #%s", ins);
-                    text_opt = pushToArray(text_opt, snp_buf1);
-
-                    text_opt = pushToArray(text_opt, file.arr[i + 5]);
-                    text_opt = pushToArray(text_opt, file.arr[i + 11]); // brl
-                    text_opt = pushToArray(text_opt, file.arr[i + 12]); // +
-
-                    free(ins);
-
-                    i += 13;
-                    opted += 1;
-                    continue;
-                }
-
-                if (matchStr(file.arr[i], "ldx #1") && matchStr(file.arr[i + 1], "sec") && startWith(file.arr[i + 2], "sbc #") && matchStr(file.arr[i + 3], "tay") && matchStr(file.arr[i + 4], "beq +") && matchStr(file.arr[i + 5], "dex") && matchStr(file.arr[i + 6], "+") && startWith(file.arr[i + 7], "stx.b tcc__") && matchStr(file.arr[i + 8], "txa") && matchStr(file.arr[i + 9], "bne +") && startWith(file.arr[i + 10], "brl ") && matchStr(file.arr[i + 11], "+") && !matchStr(file.arr[i + 12], "tya"))
-                {
-
-                    char *ins = sliceStr(file.arr[i + 2], 5, strlen(file.arr[i + 2]));
-                    snprintf(snp_buf1, sizeof(snp_buf1), "cmp #%s", ins);
-                    text_opt = pushToArray(text_opt, snp_buf1);
-
-                    text_opt = pushToArray(text_opt, file.arr[i + 4]);
-                    text_opt = pushToArray(text_opt, file.arr[i + 10]); // brl
-                    text_opt = pushToArray(text_opt, file.arr[i + 11]); // +
-
-                    free(ins);
-
-                    i += 12;
-                    opted += 1;
-                    continue;
-                }
-
-                if (matchStr(file.arr[i], "ldx #1") && startWith(file.arr[i + 1], "lda.b tcc__r") && matchStr(file.arr[i + 2], "sec") && startWith(file.arr[i + 3], "sbc.b tcc__r") && matchStr(file.arr[i + 4], "tay") && matchStr(file.arr[i + 5], "beq +") && matchStr(file.arr[i + 6], "bcs ++") && matchStr(file.arr[i + 7], "+ dex") && matchStr(file.arr[i + 8], "++") && startWith(file.arr[i + 9], "stx.b tcc__r") && matchStr(file.arr[i + 10], "txa") && matchStr(file.arr[i + 11], "bne +") && startWith(file.arr[i + 12], "brl ") && matchStr(file.arr[i + 13], "+") && !matchStr(file.arr[i + 14], "tya"))
-                {
-
-                    text_opt = pushToArray(text_opt, file.arr[i + 1]);
-
-                    char *ins = sliceStr(file.arr[i + 3], 6, strlen(file.arr[i + 3]));
-                    snprintf(snp_buf1, sizeof(snp_buf1), "cmp.b %s", ins);
-                    text_opt = pushToArray(text_opt, snp_buf1);
-
-                    text_opt = pushToArray(text_opt, file.arr[i + 5]);
-                    text_opt = pushToArray(text_opt, "bcc +");
-                    text_opt = pushToArray(text_opt, "brl ++");
-                    text_opt = pushToArray(text_opt, "+");
-                    text_opt = pushToArray(text_opt, file.arr[i + 12]);
-                    text_opt = pushToArray(text_opt, "++");
-
-                    free(ins);
-
-                    i += 14;
-                    opted += 1;
-                    continue;
+                    j = nextPregUse(pregs, i + 1);
+                    if (j > file.used - 2)
+                        j = file.used - 2;
                 }
-
-                if (matchStr(file.arr[i], "ldx #1") && matchStr(file.arr[i + 1], "sec") && startWith(file.arr[i + 2], "sbc.w #") && matchStr(file.arr[i + 3], "tay") && matchStr(file.arr[i + 4], "bvc +") && matchStr(file.arr[i + 5], "eor #$8000") && matchStr(file.arr[i + 6], "+") && matchStr(file.arr[i + 7], "bmi +++") && matchStr(file.arr[i + 8], "++") && matchStr(file.arr[i + 9], "dex") && matchStr(file.arr[i + 10], "+++") && startWith(file.arr[i + 11], "stx.b tcc__r") && matchStr(file.arr[i + 12], "txa") && matchStr(file.arr[i + 13], "bne +") && startWith(file.arr[i + 14], "brl ") && matchStr(file.arr[i + 15], "+") && !matchStr(file.arr[i + 16], "tya"))
+                if (j + 1 - i > hi)
+                    hi = j + 1 - i;
+                if (file.ins[j].mnemonic == MN_LDA && file.ins[j].width == WIDTH_B && matchStr(file.arr[j] + file.ins[j].operand, reg)
+                    && file.ins[j + 1].mnemonic == MN_STA && file.ins[j + 1].width == WIDTH_NONE && matchStr(file.arr[j + 1] + file.ins[j + 1].operand, local))
                 {
+                    while (i < j)
+                    {
+                        copyLine(&text_opt, &file, i);
 
-                    text_opt = pushToArray(text_opt, file.arr[i + 1]);
-                    text_opt = pushToArray(text_opt, file.arr[i + 2]);
-                    text_opt = pushToArray(text_opt, file.arr[i + 4]);
-                    text_opt = pushToArray(text_opt, "eor #$8000");
-                    text_opt = pushToArray(text_opt, "+");
-                    text_opt = pushToArray(text_opt, "bmi +");
-                    text_opt = pushToArray(text_opt, file.arr[i + 14]);
-                    text_opt = pushToArray(text_opt, "+");
+                        i += 1;
+                    }
 
-                    i += 16;
+                    i += 2; // Skip load high preg ; sta stack
+                    ruleHit(&clock, RULE_PREG_HIGH_WRITEBACK);
                     opted += 1;
                     continue;
                 }
+            }
 
-                if (matchStr(file.arr[i], "ldx #1") && startWith(file.arr[i + 1], "lda.b tcc__r") && matchStr(file.arr[i + 2], "sec") && startWith(file.arr[i + 3], "sbc.b tcc__r") && matchStr(file.arr[i + 4], "tay") && matchStr(file.arr[i + 5], "bvc +") && matchStr(file.arr[i + 6], "eor #$8000") && matchStr(file.arr[i + 7], "+") && matchStr(file.arr[i + 8], "bmi +++") && matchStr(file.arr[i + 9], "++") && matchStr(file.arr[i + 10], "dex") && matchStr(file.arr[i + 11], "+++") && startWith(file.arr[i + 12], "stx.b tcc__r") && matchStr(file.arr[i + 13], "txa") && matchStr(file.arr[i + 14], "bne +") && startWith(file.arr[i + 15], "brl ") && matchStr(file.arr[i + 16], "+") && !matchStr(file.arr[i + 17], "tya"))
-                {
-
-                    text_opt = pushToArray(text_opt, file.arr[i + 1]);
-                    text_opt = pushToArray(text_opt, file.arr[i + 2]);
-                    text_opt = pushToArray(text_opt, file.arr[i + 3]);
-                    text_opt = pushToArray(text_opt, file.arr[i + 5]);
-                    text_opt = pushToArray(text_opt, file.arr[i + 6]);
-                    text_opt = pushToArray(text_opt, "+");
-                    text_opt = pushToArray(text_opt, "bmi +");
-                    text_opt = pushToArray(text_opt, file.arr[i + 15]);
-                    text_opt = pushToArray(text_opt, "+");
-
-                    i += 17;
-                    opted += 1;
-                    continue;
-                }
+            ruleTry(&clock, RULE_REORDER_32);
+            /* Reorder copying of 32-bit value to preg if it looks as
+                if that could allow further optimization.
+                Looking for:
+                    lda something
+                    sta.b tcc_rX
+                    lda something
+                    sta.b tcc_rYh
+                    ...tcc_rX...
+            */
+            if (ins->mnemonic == MN_LDA && file.ins[i + 1].mnemonic == MN_STA && file.ins[i + 1].width == WIDTH_B && startWith(file.arr[i + 1], "sta.b tcc__r"))
+            {
 
-                if (matchStr(file.arr[i], "ldx #1") && matchStr(file.arr[i + 1], "sec") && startWith(file.arr[i + 2], "sbc.b tcc__r") && matchStr(file.arr[i + 3], "tay") && matchStr(file.arr[i + 4], "bvc +") && matchStr(file.arr[i + 5], "eor #$8000") && matchStr(file.arr[i + 6], "+") && matchStr(file.arr[i + 7], "bmi +++") && matchStr(file.arr[i + 8], "++") && matchStr(file.arr[i + 9], "dex") && matchStr(file.arr[i + 10], "+++") && startWith(file.arr[i + 11], "stx.b tcc__r") && matchStr(file.arr[i + 12], "txa") && matchStr(file.arr[i + 13], "bne +") && startWith(file.arr[i + 14], "brl ") && matchStr(file.arr[i + 15], "+") && !matchStr(file.arr[i + 16], "tya"))
+                const char *reg = file.arr[i + 1] + 6;
+                if (!endWith(reg, "h") && file.ins[i + 2].mnemonic == MN_LDA && !endWith(file.arr[i + 2], reg) && startWith(file.arr[i + 3], "sta.b tcc__r") && endWith(file.arr[i + 3], "h") && endWith(file.arr[i + 4], reg))
                 {
 
-                    text_opt = pushToArray(text_opt, file.arr[i + 1]);
-                    text_opt = pushToArray(text_opt, file.arr[i + 2]);
-                    text_opt = pushToArray(text_opt, file.arr[i + 4]);
-                    text_opt = pushToArray(text_opt, file.arr[i + 5]);
-                    text_opt = pushToArray(text_opt, "+");
-                    text_opt = pushToArray(text_opt, "bmi +");
-                    text_opt = pushToArray(text_opt, file.arr[i + 14]);
-                    text_opt = pushToArray(text_opt, "+");
+                    copyLine(&text_opt, &file, i + 2);
+                    copyLine(&text_opt, &file, i + 3);
+                    copyLine(&text_opt, &file, i);
+                    copyLine(&text_opt, &file, i + 1);
 
-                    i += 16;
-                    opted += 1;
+                    i += 4;
+                    ruleHit(&clock, RULE_REORDER_32);
+                    // this is not an optimization per se, so we don't count it
+                    moved += 4;
                     continue;
                 }
-            } // End of startWith(file.arr[i], "ld")
-
-            if (matchStr(file.arr[i], "rep #$20") && matchStr(file.arr[i + 1], "sep #$20"))
-            {
-
-                i += 2;
-                opted += 1;
-                continue;
-            }
-
-            if (matchStr(file.arr[i], "sep #$20") && startWith(file.arr[i + 1], "lda #") && matchStr(file.arr[i + 2], "pha") && startWith(file.arr[i + 3], "lda #") && matchStr(file.arr[i + 4], "pha"))
-            {
-
-                char *token1, *token2;
-                token1 = splitStr(file.arr[i + 1], "#", 1);
-                snprintf(snp_buf1, sizeof(snp_buf1), "pea.w (%s * 256", token1);
-                token2 = splitStr(file.arr[i + 3], "#", 1);
-                snprintf(snp_buf2, sizeof(snp_buf2), "%s + %s)", snp_buf1, token2);
-                text_opt = pushToArray(text_opt, snp_buf2);
-                text_opt = pushToArray(text_opt, file.arr[i]);
-
-                i += 5;
-                opted += 1;
-                continue;
             }
+            break; // End of loads
 
-            r = regexMatchGroups(file.arr[i], "adc #(.{0,})$", 2);
-            if (r.arr != NULL)
+        case MN_ADC:
+            ruleTry(&clock, RULE_ADC_INC2);
+            if (ins->width == WIDTH_NONE && ins->mode == MODE_IMMEDIATE)
             {
+                const asmLine *next = &file.ins[i + 1];
 
-                r1 = regexMatchGroups(file.arr[i + 1], "sta.b (tcc__[fr][0-9]{0,})$", 2);
-                if (r1.arr != NULL)
+                if (next->mnemonic == MN_STA && next->width == WIDTH_B && next->mode == MODE_ABSOLUTE && next->preg != PREG_NONE && !PREG_HIGH(next->preg))
                 {
 
-                    snprintf(snp_buf1, sizeof(snp_buf1), "inc.b %s",
-                             r1.arr[1]);
-                    if (file.arr[i + 2] && file.arr[i + 3] && matchStr(file.arr[i + 2], snp_buf1) && matchStr(file.arr[i + 3], snp_buf1))
+                    if (isPseudoOp(&file.ins[i + 2], MN_INC, next->preg) && isPseudoOp(&file.ins[i + 3], MN_INC, next->preg))
                     {
 
                         snprintf(snp_buf1, sizeof(snp_buf1), "adc #%s + 2",
-                                 r.arr[1]);
-                        text_opt = pushToArray(text_opt, snp_buf1);
-                        text_opt = pushToArray(text_opt, file.arr[i + 1]);
-
-                        freedynArray(r1);
-                        freedynArray(r);
+                                 file.arr[i] + ins->operand + 1);
+                        pushLine(&text_opt, snp_buf1);
+                        copyLine(&text_opt, &file, i + 1);
 
                         i += 4;
+                        ruleHit(&clock, RULE_ADC_INC2);
                         opted += 1;
                         continue;
                     }
-
-                    freedynArray(r1);
-                }
-
-                freedynArray(r);
-            }
-
-            if (strlen(file.arr[i]) >= 6)
-            {
-                char *ss_buffer = sliceStr(file.arr[i], 0, 6);
-
-                if (matchStr(ss_buffer, "lda.l ") || matchStr(ss_buffer, "sta.l "))
-                {
-                    size_t cont      = 0;
-                    char *ss_buffer2 = sliceStr(file.arr[i], 2, strlen(file.arr[i]));
-
-                    for (size_t b = 0; b < bss.used; b++)
-                    {
-                        snprintf(snp_buf1, sizeof(snp_buf1), "a.l %s ",
-                                 bss.arr[b]);
-                        if (startWith(ss_buffer2, snp_buf1))
-                        {
-
-                            char *rs_buffer = replaceStr(file.arr[i], "a.l", "a.w");
-                            text_opt        = pushToArray(text_opt, rs_buffer);
-
-                            i += 1;
-                            opted += 1;
-                            cont = 1;
-                            break;
-                        }
-                    }
-                    free(ss_buffer2);
-                    if (cont)
-                    {
-                        free(ss_buffer);
-                        continue;
-                    }
                 }
-                free(ss_buffer);
             }
+            break;
 
-            if (startWith(file.arr[i], "jmp.w ") || startWith(file.arr[i], "bra __"))
+        case MN_JMP:
+        case MN_BRA:
+            ruleTry(&clock, RULE_BRANCH_NEXT);
+            if ((ins->mnemonic == MN_JMP && ins->width == WIDTH_W && ins->mode != MODE_IMPLIED) || startWith(file.arr[i], "bra __"))
             {
                 size_t j    = i + 1;
+                size_t end  = j + labelsAfter(&labels, i);
                 size_t cont = 0;
-                while (j < file.used && endWith(file.arr[j], ":"))
+                for (; j < end; j++)
                 {
-                    char *ss_buffer = sliceStr(file.arr[j], 0, strlen(file.arr[j]) - 1);
-                    if (endWith(file.arr[i], ss_buffer))
+                    size_t label_len = file.ins[j].len - 1;
+                    if (ins->len >= label_len && strncmp(file.arr[i] + ins->len - label_len, file.arr[j], label_len) == 0)
                     {
 
-                        free(ss_buffer);
                         i += 1; // Redundant branch, discard it.
+                        ruleHit(&clock, RULE_BRANCH_NEXT);
                         opted += 1;
                         cont = 1;
                         break;
                     }
-                    j += 1;
-
-                    free(ss_buffer);
-                    if (cont)
-                        continue;
                 }
+                if (cont)
+                    continue;
+                if (j - i > hi)
+                    hi = j - i;
             }
 
-            if (startWith(file.arr[i], "jmp.w "))
+            ruleTry(&clock, RULE_JMP_BRA);
+            if (ins->mnemonic == MN_JMP && ins->width == WIDTH_W && ins->mode != MODE_IMPLIED)
             {
 
                 /* Worst case is a 4-byte instruction, so if the jump target is closer
                     than 32 instructions, we can safely substitute a branch */
-                char *label = sliceStr(file.arr[i], 6, strlen(file.arr[i]));
-                snprintf(snp_buf1, sizeof(snp_buf1), "%s:", label);
-                size_t cont = 0;
-                for (size_t l = max(0, (i - 32)); l < (size_t)min(file.used, (i + 32)); l++)
+                const char *label = file.arr[i] + ins->operand;
+                size_t label_len  = ins->len - ins->operand;
+                size_t cont       = 0;
+                long from         = max(0, (i - 32));
+                long to           = min(file.used, (i + 32));
+                for (long l = findLabel(&labels, &file, label, label_len); l >= 0 && l < to; l = nextLabel(&labels, l))
                 {
-                    if (matchStr(file.arr[l], snp_buf1))
+                    if (l >= from)
                     {
 
-                        char *rs_buffer = replaceStr(file.arr[i], "jmp.w", "bra");
-                        text_opt        = pushToArray(text_opt, rs_buffer);
+                        pushReplaced(&text_opt, file.arr[i], "jmp.w", "bra");
 
                         i += 1;
+                        ruleHit(&clock, RULE_JMP_BRA);
                         opted += 1;
                         cont = 1;
                         break;
                     }
                 }
-                free(label);
                 if (cont)
                 {
                     continue;
                 }
             }
+            break;
 
-            text_opt = pushToArray(text_opt, file.arr[i]);
-
-            i++;
+        default:
+            break;
+        }
 
-        } // End of while (i < file.used)
+        /* The rules of rules.opt (compare optimizations inspired by optimore, ...) */
+        if ((matched = matchRules(&file, i, in->level, &text_opt, &clock)) > 0)
+        {
+            i += matched;
+            opted += 1;
+            continue;
+        }
 
-        /* Cleaning */
-        freedynArray(file);
-        if (opted > 0)
+        ruleTry(&clock, RULE_BSS_WORD);
+        /* Long addresses in the bss section => word addresses */
+        if ((ins->mnemonic == MN_LDA || ins->mnemonic == MN_STA) && ins->width == WIDTH_L && ins->mode != MODE_IMPLIED)
         {
-            if ((file.arr = malloc(text_opt.used * sizeof(char *))) == NULL)
+            const char *symbol = file.arr[i] + ins->operand;
+            size_t len         = strcspn(symbol, " ");
+
+            /* The symbol must be followed by a space ("a.l <symbol> ") */
+            if (symbol[len] == ' ' && strSetHas(bss, symbol, len))
             {
-                perror("malloc-lines");
-                exit(EXIT_FAILURE);
+
+                pushReplaced(&text_opt, file.arr[i], "a.l", "a.w");
+
+                i += 1;
+                ruleHit(&clock, RULE_BSS_WORD);
+                opted += 1;
+                continue;
             }
+        }
 
-            file.used = text_opt.used;
+        ruleStop(&clock);
+        copyLine(&text_opt, &file, i);
+        pushTrace(&traceOpt, &traceOpt_size, mark, (lineTrace){ (long)i, lo, hi });
+        mark += 1;
 
-            for (size_t i = 0; i < text_opt.used; i++)
-            {
+        i++;
 
-                size_t len = strlen(text_opt.arr[i]);
+    } // End of while (i < chunk->to)
+    ruleStop(&clock);
 
-                if ((file.arr[i] = malloc(len + 1)) == NULL)
-                {
-                    perror("malloc-lines");
-                    exit(EXIT_FAILURE);
-                }
+    while (mark < text_opt.used)
+    {
+        pushTrace(&traceOpt, &traceOpt_size, mark, (lineTrace){ -1, 0, 0 });
+        mark += 1;
+    }
+
+    chunk->out        = text_opt;
+    chunk->trace      = traceOpt;
+    chunk->trace_size = traceOpt_size;
+    chunk->opted      = opted;
+    chunk->moved      = moved;
+    chunk->visits     = visits;
+    chunk->saved      = saved;
+}
+
+/**
+ * @brief Run a chunk of the pass (see poolRun function).
+ * @param ctx The passJob structure.
+ * @param job The index of the chunk.
+ */
+static void runChunk(void *ctx, size_t job)
+{
+    const passJob *pj = ctx;
+
+    optimizeChunk(pj->in, &pj->chunks[job]);
+}
+
+/**
+ * @brief Split a file in chunks of about the same size, at named labels.
+ * No rule consumes a label line, so a pass always reaches the first line
+ * of each chunk as if the file were not split.
+ * @param file The asm file.
+ * @param count The wished number of chunks.
+ * @param chunks The chunks (count entries allocated).
+ * @return The number of chunks.
+ */
+static size_t splitChunks(const asmFile *file, const size_t count, passChunk *chunks)
+{
+    size_t n     = 0;
+    size_t from  = 0;
+    size_t least = file->used / count;
+
+    for (size_t i = 1; i < file->used && n + 1 < count; i++)
+    {
+        if (i - from >= least && file->ins[i].kind == LINE_LABEL)
+        {
+            chunks[n++].to = i;
+            chunks[n].from = i;
+            from           = i;
+        }
+    }
+    chunks[0].from = 0;
+    chunks[n++].to = file->used;
+
+    return n;
+}
+
+/**
+ * @brief Optimize ASM code.
+ * @param file The asm file cleaned (see tidyText function).
+ * @param bss The bss section (only first words, see storeBss function).
+ * @param verbose The level of verbosity (see verbosity function).
+ * @param jobs The number of threads (1 = serial), the output does not depend on it.
+ * @param level The optimization level (see OPT_LEVEL_MAX).
+ * @param stats The report of the passes and their rules (NULL if none).
+ */
+asmFile optimizeAsm(asmFile file, const strSet *bss, const size_t verbose, const size_t jobs, const int level,
+                    optStats *stats)
+{
+
+    size_t totalopt = 0;  // Total number of optimizations performed
+    int opted       = -1; // Have we Optimized in this pass
+    size_t moved    = 0;  // Lines reordered in this pass (-O2 goes on)
+    size_t opass    = 0;  // Optimization pass counter
+    asmFile text_opt;
+    arena *spare = NULL; // Arena of the next generation of lines
+
+    /* Worklist: a line is only tried again when a line read
+        by the rules around it has been rewritten */
+    size_t visits = 0, saved = 0; // Lines tried / skipped
+    size_t prevUsed   = 0;        // Lines in the previous pass
+    size_t trace_size = 0;        // Traces allocated
+    lineTrace *trace  = NULL;
+    size_t *seams;
+    labelTable labels;
+    int found = 0; // The labels of the next pass are built
+
+    /* The lines of the tidied file are parsed once (see pushSlice function) */
+    parseLines(&file);
+
+    pushTrace(&trace, &trace_size, file.used, (lineTrace){ -1, 0, 0 });
+    for (size_t n = 0; n < file.used; n++)
+        trace[n] = (lineTrace){ -1, 0, 0 };
+
+    /* Parallel passes: the chunks of a pass are optimized by the pool */
+    size_t nchunks     = jobs > 1 ? CHUNKS_PER_JOB * jobs : 1;
+    threadPool *pool   = jobs > 1 ? poolNew(jobs - 1) : NULL;
+    jmp_buf env;
+    jmp_buf *outer = NULL;
+
+    /* A fatal error the caller catches (see fatalCatch function) stops
+        the worker threads first, the others exit the process */
+    if (pool && (outer = fatalCatch(&env)) == NULL)
+        fatalCatch(NULL);
+    if (outer && setjmp(env))
+    {
+        int err = errno;
+
+        fatalCatch(outer);
+        poolFree(pool);
+        errno = err;
+        fatalError("optimize");
+    }
+
+    passChunk *chunks  = calloc(nchunks, sizeof(passChunk));
+
+    if (!chunks)
+    {
+        fatalError("malloc-chunks");
+    }
+
+    while (opted || moved)
+    {
+        opass += 1;
+        opted = 0;
+        moved = 0;
+
+        passStats *ps = stats ? statsPass(stats) : NULL;
+        uint64_t start = ps ? nowNs() : 0;
 
-                memcpy(file.arr[i], text_opt.arr[i], len + 1);
+        /* Where are the labels (jmp.w -> bra, redundant branches), unless
+            the dead stores of the previous pass have found them */
+        if (!found)
+            labels = buildLabels(&file);
+        found = 0;
+
+        if ((seams = malloc((file.used + 1) * sizeof(size_t))) == NULL)
+        {
+            fatalError("malloc-seams");
+        }
+        seams[0] = 0;
+        for (size_t n = 0; n < file.used; n++)
+        {
+            seams[n + 1] = seams[n] + (trace[n].src < 0 || (n > 0 && trace[n].src != trace[n - 1].src + 1));
+        }
+
+        /* Where are the pseudo-registers used next (redundant stores) */
+        pregTable pregs = buildPregs(&file);
+
+        if (verbose)
+            fprintf(stderr, "optimization pass %lu: ", opass);
+
+        passInput in = { file, bss, &labels, &pregs, trace, seams, prevUsed, level, ps != NULL };
+        size_t count = splitChunks(&file, nchunks, chunks);
+
+        for (size_t c = 0; c < count; c++)
+        {
+            chunks[c].out = newAsmFile(chunks[c].to - chunks[c].from);
+        }
+        chunks[0].out.strings = spare;
+
+        if (count > 1)
+        {
+            passJob pj = { &in, chunks };
+            poolRun(pool, count, runChunk, &pj);
+        }
+        else
+        {
+            optimizeChunk(&in, &chunks[0]);
+        }
+
+        /* Concatenate the chunks in order */
+        text_opt = chunks[0].out;
+        for (size_t c = 0; c < count; c++)
+        {
+            for (size_t n = 0; n < chunks[c].out.used; n++)
+            {
+                lineTrace t = chunks[c].trace[n];
+                pushTrace(&chunks[0].trace, &chunks[0].trace_size, (c ? text_opt.used : 0) + n, t);
+            }
+            if (c)
+            {
+                appendLines(&text_opt, &chunks[c].out);
+                freeAsmFile(chunks[c].out);
+            }
+            opted += chunks[c].opted;
+            moved += chunks[c].moved;
+            visits += chunks[c].visits;
+            saved += chunks[c].saved;
+            if (ps)
+            {
+                statsAdd(&ps->rules, &chunks[c].rules);
+                memset(&chunks[c].rules, 0, sizeof(ruleStats));
+            }
+        }
+        text_opt.text = file.text; // Input lines are carried by reference
+        file.text     = (textBuffer){ NULL, 0, 0 };
+
+        /* The traces of this pass are used by the next one */
+        lineTrace *tmp_trace = trace;
+        size_t tmp_size      = trace_size;
+        trace                = chunks[0].trace;
+        trace_size           = chunks[0].trace_size;
+        chunks[0].trace      = tmp_trace;
+        chunks[0].trace_size = tmp_size;
+        prevUsed             = file.used;
+        free(seams);
+        freeLabels(labels);
+        freePregs(pregs);
+
+        /* Cleaning: the lines still used are in text_opt (carried by
+            reference or copied to its arena), so the previous generation
+            is released at once */
+        spare = file.strings;
+        if (spare)
+            arenaReset(spare);
+        free(file.arr);
+        free(file.ins);
+        file = text_opt;
+
+        /* Once the rules are done, the stack pointer moves merged, the
+            loads of known values, the stores no path reads (stack slots
+            included) and the mode switches changing nothing (see
+            optimizeFlow function): the lines removed or rewritten are not
+            clean, and the labels move. At -O2 the lines reordered by the
+            rules are tried again first, so a second run of the optimizer
+            finds nothing left to do (816-opt stops on them) */
+        if (level < 2)
+            moved = 0;
+        if (level >= 2 && opted == 0 && moved == 0)
+        {
+            labels        = buildLabels(&file);
+            size_t killed = optimizeFlow(&file, &labels, trace, ps ? &ps->rules : NULL);
+            if (killed)
+            {
+                opted += (int)killed;
+                freeLabels(labels);
+                labels = buildLabels(&file);
             }
-            freedynArray(text_opt);
+            found = 1;
+        }
+
+        if (ps)
+        {
+            ps->linesIn  = prevUsed;
+            ps->linesOut = file.used;
+            ps->opted    = (size_t)opted;
+            ps->ns       = nowNs() - start;
+            statsAdd(&stats->rules, &ps->rules);
         }
 
         if (verbose)
@@ -1172,7 +1329,21 @@ dynArray optimizeAsm(dynArray file, const dynArray bss, const size_t verbose)
     }
 
     if (verbose)
+    {
         fprintf(stderr, "%lu optimizations performed in total\n", totalopt);
+        fprintf(stderr, "%lu line visits saved by the worklist (%lu performed)\n", saved, visits);
+    }
+
+    if (found)
+        freeLabels(labels);
+    for (size_t c = 0; c < nchunks; c++)
+        free(chunks[c].trace);
+    free(chunks);
+    free(trace);
+    arenaFree(spare);
+    if (outer)
+        fatalCatch(outer);
+    poolFree(pool);
 
-    return text_opt;
+    return file;
 }
@@ -2,10 +2,36 @@
 #define OPTIMIZER_H
 
 #include "helpers.h"
+#include "parser.h"
+#include "pool.h"
+#include "stats.h"
 
 #define BINVERSION __BUILD_VERSION
 #define BINDATE __BUILD_DATE
 
+/*!
+ * @brief Name of the rule set enabled (part of the cache key, see cacheKey function).
+ */
+#define RULESET "816-opt"
+
+/*!
+ * @brief Optimization level of the rules of 816-opt: the output is the
+ * output of the python tool.
+ */
+#define OPT_LEVEL_DEFAULT 1
+
+/*!
+ * @brief Highest optimization level: the rules not in 816-opt are
+ * enabled (see the levels of rules.opt).
+ */
+#define OPT_LEVEL_MAX 2
+
+/*!
+ * @brief Number of lines a redundant store looks ahead for the next store
+ * to its pseudo-register (the horizon of 816-opt, lifted from the level 2).
+ */
+#define STORE_REACH 30
+
 /*!
  * @brief Define comment for ASM files
  */
@@ -33,11 +59,156 @@
  * @brief Stores (accu only) to pseudo-registers
  */
 #define STORE_A_TO_PSEUDO "sta.b tcc__([rf][0-9]{0,}h{0,1})$"
+/*!
+ * @brief Stores (accu only) to pseudo-registers (low word only)
+ */
+#define STORE_A_TO_PSEUDO_LOW "sta.b (tcc__[fr][0-9]{0,})$"
+/*!
+ * @brief Loads (accu only) from pseudo-registers
+ */
+#define LOAD_A_FROM_PSEUDO "lda.b tcc__([rf][0-9]{0,})"
+/*!
+ * @brief Loads (accu only) from integer pseudo-registers
+ */
+#define LOAD_A_FROM_R_PSEUDO "lda.b tcc__(r[0-9]{0,})"
+/*!
+ * @brief Stores (accu only) to the stack
+ */
+#define STORE_A_TO_STACK "sta (.{0,}),s$"
+/*!
+ * @brief Loads (accu only) from long address indexed by x
+ */
+#define LOAD_A_LONG_X "lda.l (.{0,}),x$"
+/*!
+ * @brief Add immediate value to the accu
+ */
+#define ADC_IMMEDIATE "adc #(.{0,})$"
+
+/**
+ * @struct lineTrace
+ * @brief Where a line comes from, and which lines the rules
+ * have read when they were tried on it (see optimizeAsm function).
+ * @var lineTrace::src
+ * Member 'src' contains the index of the line in the previous pass
+ * when it was copied because no rule matched, -1 otherwise.
+ * @var lineTrace::lo
+ * Member 'lo' contains the number of lines read before the line.
+ * @var lineTrace::hi
+ * Member 'hi' contains the number of lines read after the line.
+ */
+typedef struct lineTrace
+{
+    long src;
+    unsigned int lo;
+    unsigned int hi;
+} lineTrace;
+
+/*!
+ * @brief Number of chunks per thread in a parallel pass
+ * (small chunks balance the load between the threads).
+ */
+#define CHUNKS_PER_JOB 4
+
+/**
+ * @struct passInput
+ * @brief The file of an optimization pass and its indexes,
+ * shared (read only) by the chunks of the pass.
+ * @var passInput::file
+ * Member 'file' contains the lines of the pass.
+ * @var passInput::bss
+ * Member 'bss' contains the bss symbols (see storeBss function).
+ * @var passInput::labels
+ * Member 'labels' contains the labels of the file (see buildLabels function).
+ * @var passInput::pregs
+ * Member 'pregs' contains the next uses of the pseudo-registers
+ * (see buildPregs function).
+ * @var passInput::trace
+ * Member 'trace' contains the traces of the lines (see lineTrace).
+ * @var passInput::seams
+ * Member 'seams' contains the number of seams before each line.
+ * @var passInput::prevUsed
+ * Member 'prevUsed' contains the number of lines of the previous pass.
+ * @var passInput::level
+ * Member 'level' contains the optimization level (see OPT_LEVEL_MAX).
+ * @var passInput::stats
+ * Member 'stats' is 1 if the rules are measured (see ruleClock).
+ */
+typedef struct passInput
+{
+    asmFile file;
+    const strSet *bss;
+    const labelTable *labels;
+    const pregTable *pregs;
+    const lineTrace *trace;
+    const size_t *seams;
+    size_t prevUsed;
+    int level;
+    int stats;
+} passInput;
+
+/**
+ * @struct passChunk
+ * @brief A range of lines optimized in a pass (see optimizeChunk function).
+ * @var passChunk::from
+ * Member 'from' contains the first line of the chunk.
+ * @var passChunk::to
+ * Member 'to' contains the line after the last line of the chunk.
+ * @var passChunk::out
+ * Member 'out' contains the lines written for the chunk.
+ * @var passChunk::trace
+ * Member 'trace' contains the traces of the lines written.
+ * @var passChunk::trace_size
+ * Member 'trace_size' contains the number of traces allocated.
+ * @var passChunk::opted
+ * Member 'opted' contains the number of optimizations performed.
+ * @var passChunk::moved
+ * Member 'moved' contains the number of lines reordered (not counted as optimizations).
+ * @var passChunk::visits
+ * Member 'visits' contains the number of lines tried.
+ * @var passChunk::saved
+ * Member 'saved' contains the number of lines skipped by the worklist.
+ * @var passChunk::rules
+ * Member 'rules' contains the counters of the rules (see passInput::stats).
+ */
+typedef struct passChunk
+{
+    size_t from;
+    size_t to;
+    asmFile out;
+    lineTrace *trace;
+    size_t trace_size;
+    unsigned int opted;
+    unsigned int moved;
+    size_t visits;
+    size_t saved;
+    ruleStats rules;
+} passChunk;
+
+/**
+ * @struct passJob
+ * @brief The chunks of a parallel pass (see runChunk function).
+ * @var passJob::in
+ * Member 'in' contains the input of the pass.
+ * @var passJob::chunks
+ * Member 'chunks' contains the chunks.
+ */
+typedef struct passJob
+{
+    const passInput *in;
+    passChunk *chunks;
+} passJob;
 
 int verbosity();
+void compileRegex(void);
 void PrintVersion(void);
-dynArray tidyFile(const int argc, char **argv);
-dynArray storeBss(dynArray file);
-dynArray optimizeAsm(dynArray file, dynArray bss, size_t verbose);
+int isStoreToPseudo(const asmLine *ins);
+int isPseudoOp(const asmLine *ins, const mnemonic mn, const short preg);
+int isLongCall(const asmLine *ins);
+char loadXYFromPseudo(const char *a, const asmLine *ins, const char *reg);
+asmFile tidyPath(const char *path);
+asmFile tidyText(textBuffer text);
+strSet storeBss(const asmFile file);
+asmFile optimizeAsm(asmFile file, const strSet *bss, const size_t verbose, const size_t jobs, const int level,
+                    optStats *stats);
 
 #endif
@@ -0,0 +1,285 @@
+/*
+ * opt-65816 - Assembly code optimizer for the WDC 65816 processor.
+ *
+ * Description: Assembly code optimizer produced
+ * by the 816 Tiny C Compiler (816-tcc).
+ * This library is a C port of the 816-opt python tool.
+ *
+ * Author: kobenairb (kobenairb@gmail.com).
+ *
+ * Copyright (c) 2022.
+ *
+ * This project is released under the GNU Public License.
+ *
+ */
+
+#include "output.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <process.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief Copy the lines of an asm file into one buffer, each line
+ * followed by its end of line.
+ * @param file The asm file.
+ * @param len The length of the buffer (without the null terminator).
+ * @return The buffer (null-terminated, to be freed by the caller),
+ * or NULL if it cannot be allocated.
+ */
+char *joinAsm(const asmFile *file, size_t *len)
+{
+    size_t total = 0;
+
+    for (size_t i = 0; i < file->used; i++)
+        total += strlen(file->arr[i]) + 1;
+
+    char *buf = malloc(total + 1);
+    char *p   = buf;
+    if (!buf)
+        return NULL;
+
+    for (size_t i = 0; i < file->used; i++)
+    {
+        size_t n = strlen(file->arr[i]);
+        memcpy(p, file->arr[i], n);
+        p[n] = '\n';
+        p += n + 1;
+    }
+    *p   = '\0';
+    *len = total;
+
+    return buf;
+}
+
+/**
+ * @brief Write a buffer to a descriptor (all of it).
+ * @param fd The descriptor.
+ * @param buf The buffer.
+ * @param len The length of the buffer.
+ * @return 0, or -1 on error (errno is set).
+ */
+int emitText(const int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+#ifdef _WIN32
+        int n = _write(fd, buf, (unsigned int)len);
+#else
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+#endif
+        if (n < 0)
+            return -1;
+        buf += n;
+        len -= (size_t)n;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Write the lines of an asm file to a descriptor, with as few
+ * system calls as possible. The lines are not copied: the null terminator
+ * of each line is replaced by its end of line, and the lines which follow
+ * each other in memory (the arena, the loaded file) are written as one
+ * block. The lines are not null-terminated anymore afterwards.
+ * @param fd The descriptor.
+ * @param file The asm file.
+ * @return 0, or -1 on error (errno is set).
+ */
+int emitAsm(const int fd, asmFile *file)
+{
+#ifndef _WIN32
+    struct iovec iov[EMIT_BLOCKS];
+    int blocks = 0;
+
+    /* The lengths are taken first: a line can be there twice */
+    size_t *lens = malloc((file->used + 1) * sizeof(size_t));
+    if (!lens)
+        return -1;
+    for (size_t i = 0; i < file->used; i++)
+        lens[i] = strlen(file->arr[i]);
+
+    for (size_t i = 0; i <= file->used; i++)
+    {
+        /* Flush when full, and after the last line */
+        if (blocks == EMIT_BLOCKS || (i == file->used && blocks > 0))
+        {
+            int b = 0;
+            while (b < blocks)
+            {
+                ssize_t n = writev(fd, iov + b, blocks - b);
+                if (n < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    free(lens);
+                    return -1;
+                }
+                /* Skip what has been written (short write) */
+                while (b < blocks && (size_t)n >= iov[b].iov_len)
+                    n -= iov[b++].iov_len;
+                if (b < blocks)
+                {
+                    iov[b].iov_base = (char *)iov[b].iov_base + n;
+                    iov[b].iov_len -= n;
+                }
+            }
+            blocks = 0;
+        }
+        if (i == file->used)
+            break;
+
+        char *line = file->arr[i];
+        size_t len = lens[i];
+
+        line[len] = '\n';
+        if (blocks > 0 && (char *)iov[blocks - 1].iov_base + iov[blocks - 1].iov_len == line)
+        {
+            iov[blocks - 1].iov_len += len + 1;
+        }
+        else
+        {
+            iov[blocks].iov_base = line;
+            iov[blocks].iov_len  = len + 1;
+            blocks += 1;
+        }
+    }
+    free(lens);
+
+    return 0;
+#else
+    /* No writev: one buffer, one write */
+    size_t len;
+    char *buf = joinAsm(file, &len);
+
+    if (!buf)
+        return -1;
+
+    int ret = emitText(fd, buf, len);
+    free(buf);
+
+    return ret;
+#endif
+}
+
+/**
+ * @brief Create the temporary file of an output file, next to it
+ * (see writeAsm function). An existing file keeps its permissions.
+ * @param path The path of the output file.
+ * @param tmp The path of the temporary file (MAXLEN_LINE chars).
+ * @param id A value unique to the call (threads write concurrently).
+ * @return The descriptor, or -1 on error (errno is set).
+ */
+static int openTemp(const char *path, char *tmp, const void *id)
+{
+    struct stat st;
+    int fd;
+
+    snprintf(tmp, MAXLEN_LINE, "%s.%ld.%lx.tmp", path, (long)getpid(), (unsigned long)(uintptr_t)id);
+
+#ifdef _WIN32
+    fd = _open(tmp, _O_WRONLY | _O_CREAT | _O_EXCL | _O_TEXT, _S_IREAD | _S_IWRITE);
+    (void)st;
+#else
+    fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd >= 0 && stat(path, &st) == 0)
+        fchmod(fd, st.st_mode & 07777);
+#endif
+
+    return fd;
+}
+
+/**
+ * @brief Close the temporary file of an output file and rename it
+ * over the output file, or remove it if it has not been written.
+ * @param fd The descriptor of the temporary file.
+ * @param tmp The path of the temporary file.
+ * @param path The path of the output file.
+ * @param written 0 if it has not been written.
+ * @return 0, or -1 on error (errno is set).
+ */
+static int closeTemp(const int fd, const char *tmp, const char *path, const int written)
+{
+    int done = close(fd) == 0 && written;
+
+#ifdef _WIN32
+    if (done)
+        remove(path); // rename does not replace a file
+#endif
+    if (done && rename(tmp, path) == 0)
+        return 0;
+
+    int err = errno;
+    unlink(tmp);
+    errno = err;
+
+    return -1;
+}
+
+/**
+ * @brief Write the lines of an asm file to a file, atomically: the lines
+ * are written to a temporary file (next to it) which is then renamed,
+ * so the file is never seen half written (and it can be the input file).
+ * An existing file keeps its permissions. The lines are not
+ * null-terminated anymore afterwards (see emitAsm function).
+ * @param file The asm file.
+ * @param path The path of the output file.
+ * @return 0, or -1 on error (errno is set).
+ */
+int writeAsm(asmFile *file, const char *path)
+{
+    char tmp[MAXLEN_LINE];
+    int fd = openTemp(path, tmp, file);
+
+    if (fd < 0)
+        return -1;
+
+    return closeTemp(fd, tmp, path, emitAsm(fd, file) == 0);
+}
+
+/**
+ * @brief Write a buffer to a file, atomically (see writeAsm function).
+ * @param buf The buffer.
+ * @param len The length of the buffer.
+ * @param path The path of the output file.
+ * @return 0, or -1 on error (errno is set).
+ */
+int writeText(const char *buf, const size_t len, const char *path)
+{
+    char tmp[MAXLEN_LINE];
+    int fd = openTemp(path, tmp, buf);
+
+    if (fd < 0)
+        return -1;
+
+    return closeTemp(fd, tmp, path, emitText(fd, buf, len) == 0);
+}
+
+/**
+ * @brief Tell if a path names a directory (an existing one, or any path
+ * ending with a slash).
+ * @param path The path.
+ * @return 1 if it is a directory, 0 otherwise.
+ */
+int isDirectory(const char *path)
+{
+    struct stat st;
+    size_t len = strlen(path);
+
+    if (len > 0 && (path[len - 1] == '/' || path[len - 1] == '\\'))
+        return 1;
+
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
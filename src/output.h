@@ -0,0 +1,19 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "helpers.h"
+#include "parser.h"
+
+/*!
+ * @brief Max number of blocks given to one writev call (see emitAsm function).
+ */
+#define EMIT_BLOCKS 1024
+
+char *joinAsm(const asmFile *file, size_t *len);
+int emitText(const int fd, const char *buf, size_t len);
+int emitAsm(const int fd, asmFile *file);
+int writeAsm(asmFile *file, const char *path);
+int writeText(const char *buf, const size_t len, const char *path);
+int isDirectory(const char *path);
+
+#endif
@@ -0,0 +1,859 @@
+/*
+ * opt-65816 - Assembly code optimizer for the WDC 65816 processor.
+ *
+ * Description: Assembly code optimizer produced
+ * by the 816 Tiny C Compiler (816-tcc).
+ * This library is a C port of the 816-opt python tool.
+ *
+ * Author: kobenairb (kobenairb@gmail.com).
+ *
+ * Copyright (c) 2022.
+ *
+ * This project is released under the GNU Public License.
+ *
+ */
+
+#include "parser.h"
+
+/*!
+ * @brief Names of the instructions (same order as the mnemonic enum).
+ */
+static const char *const mnemonicNames[MN_COUNT] = {
+    "", "adc", "and", "asl", "bcc", "bcs", "beq", "bit", "bmi", "bne", "bpl", "bra",
+    "brk", "brl", "bvc", "bvs", "clc", "cld", "cli", "clv", "cmp", "cop", "cpx", "cpy",
+    "dec", "dex", "dey", "eor", "inc", "inx", "iny", "jml", "jmp", "jsl", "jsr", "lda",
+    "ldx", "ldy", "lsr", "mvn", "mvp", "nop", "ora", "pea", "pei", "per", "pha", "phb",
+    "phd", "phk", "php", "phx", "phy", "pla", "plb", "pld", "plp", "plx", "ply", "rep",
+    "rol", "ror", "rti", "rtl", "rts", "sbc", "sec", "sed", "sei", "sep", "sta", "stp",
+    "stx", "sty", "stz", "tax", "tay", "tcd", "tcs", "tdc", "trb", "tsb", "tsc", "tsx",
+    "txa", "txs", "txy", "tya", "tyx", "wai", "wdm", "xba", "xce"
+};
+
+/**
+ * @struct mnemonicAlias
+ * @brief Alternative names accepted by WLA-DX.
+ */
+static const struct mnemonicAlias
+{
+    const char *name;
+    mnemonic mn;
+} mnemonicAliases[] = {
+    { "tas", MN_TCS }, { "tsa", MN_TSC }, { "tad", MN_TCD },
+    { "tda", MN_TDC }, { "swa", MN_XBA }, { "dea", MN_DEC },
+    { "ina", MN_INC },
+};
+
+/**
+ * @brief Get the name of an instruction.
+ * @param mn The instruction.
+ * @return The name (empty string for MN_NONE).
+ */
+const char *mnemonicName(const mnemonic mn)
+{
+    return mn < MN_COUNT ? mnemonicNames[mn] : "";
+}
+
+/**
+ * @brief Find the instruction from its 3 letters name.
+ * @param p The name (at least 3 characters).
+ * @return The instruction or MN_NONE.
+ */
+static mnemonic findMnemonic(const char *p)
+{
+    size_t lo = 1, hi = MN_COUNT;
+
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        int cmp    = strncmp(p, mnemonicNames[mid], 3);
+
+        if (cmp == 0)
+            return (mnemonic)mid;
+        if (cmp < 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    for (size_t i = 0; i < sizeof(mnemonicAliases) / sizeof(mnemonicAliases[0]); i++)
+    {
+        if (strncmp(p, mnemonicAliases[i].name, 3) == 0)
+            return mnemonicAliases[i].mn;
+    }
+
+    return MN_NONE;
+}
+
+/**
+ * @brief Find the addressing mode of an operand.
+ * @param mn The instruction.
+ * @param op The operand.
+ * @param len The length of the operand.
+ * @param core_from Where the address starts in the operand.
+ * @param core_to Where the address ends in the operand.
+ * @return The addressing mode.
+ */
+static addrMode findMode(const mnemonic mn, const char *op, size_t len, size_t *core_from, size_t *core_to)
+{
+    *core_from = 0;
+    *core_to   = len;
+
+    if (len == 0)
+        return MODE_IMPLIED;
+    if (len == 1 && op[0] == 'a')
+        return MODE_ACCUMULATOR;
+    if (op[0] == '#')
+        return MODE_IMMEDIATE;
+
+    switch (mn)
+    {
+    case MN_MVN:
+    case MN_MVP:
+        return MODE_BLOCK_MOVE;
+    case MN_PEA:
+    case MN_PER:
+    case MN_BCC:
+    case MN_BCS:
+    case MN_BEQ:
+    case MN_BMI:
+    case MN_BNE:
+    case MN_BPL:
+    case MN_BRA:
+    case MN_BRL:
+    case MN_BVC:
+    case MN_BVS:
+        return MODE_ABSOLUTE;
+    default:
+        break;
+    }
+
+    if (op[0] == '(' && len > 2)
+    {
+        *core_from = 1;
+        if (len > 5 && strcmp(op + len - 5, ",s),y") == 0)
+        {
+            *core_to = len - 5;
+            return MODE_STACK_IND_Y;
+        }
+        if (len > 4 && strcmp(op + len - 3, "),y") == 0)
+        {
+            *core_to = len - 3;
+            return MODE_INDIRECT_Y;
+        }
+        if (len > 4 && strcmp(op + len - 3, ",x)") == 0)
+        {
+            *core_to = len - 3;
+            return MODE_INDIRECT_X;
+        }
+        if (op[len - 1] == ')')
+        {
+            *core_to = len - 1;
+            return MODE_INDIRECT;
+        }
+        *core_from = 0;
+    }
+
+    if (op[0] == '[' && len > 2)
+    {
+        *core_from = 1;
+        if (len > 4 && strcmp(op + len - 3, "],y") == 0)
+        {
+            *core_to = len - 3;
+            return MODE_IND_LONG_Y;
+        }
+        if (op[len - 1] == ']')
+        {
+            *core_to = len - 1;
+            return MODE_IND_LONG;
+        }
+        *core_from = 0;
+    }
+
+    if (len > 2 && op[len - 2] == ',')
+    {
+        *core_to = len - 2;
+        switch (op[len - 1])
+        {
+        case 's':
+            return MODE_STACK;
+        case 'x':
+            return MODE_INDEXED_X;
+        case 'y':
+            return MODE_INDEXED_Y;
+        }
+        *core_to = len;
+    }
+
+    return MODE_ABSOLUTE;
+}
+
+/**
+ * @brief Parse a pseudo-register name (tcc__rN, tcc__rNh, tcc__fN, tcc__fNh).
+ * @param p The address.
+ * @param len The length of the address.
+ * @return The pseudo-register id (see PREG_ID) or PREG_NONE.
+ */
+static short parsePseudo(const char *p, size_t len)
+{
+    if (len < 6 || strncmp(p, "tcc__", 5) != 0 || (p[5] != 'r' && p[5] != 'f'))
+        return PREG_NONE;
+
+    int isf = p[5] == 'f';
+    int num = -1;
+    int high = 0;
+    size_t k = 6;
+
+    /* Leading zeros would make two different names share the same id */
+    if (k < len && p[k] == '0' && k + 1 < len && isdigit((unsigned char)p[k + 1]))
+        return PREG_NONE;
+
+    while (k < len && isdigit((unsigned char)p[k]))
+    {
+        num = (num < 0 ? 0 : num * 10) + (p[k] - '0');
+        if (num > 4000)
+            return PREG_NONE;
+        k++;
+    }
+    if (k < len && p[k] == 'h')
+    {
+        high = 1;
+        k++;
+    }
+    if (k != len)
+        return PREG_NONE;
+
+    return PREG_ID(isf, num, high);
+}
+
+/**
+ * @brief Checks if it touches the accumulator register.
+ * @param a The asm instruction.
+ * @return 1 (true) or 0 (false).
+ */
+int changeAccu(const char *a)
+{
+    if (strlen(a) > 2 && ((a[2] == 'a' && !startWith(a, "pha") && !startWith(a, "sta")) || (strlen(a) == 5 && endWith(a, " a"))))
+        return 1;
+
+    return 0;
+}
+
+/**
+ * @brief Check if the line alters the control flow.
+ * @param a The asm instruction.
+ * @return 1 (true) or 0 (false).
+ */
+int isControl(const char *a)
+{
+    const char *p = a;
+
+    while (*p != '\0' && isspace((unsigned char)*p))
+    {
+        p++;
+    }
+
+    if (*p == '\0')
+    {
+        return 0;
+    }
+
+    switch (*p)
+    {
+    case 'j':
+    case 'b':
+    case '-':
+    case '+':
+        return 1;
+    }
+
+    if (endWith(a, ":"))
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Build the parsed form of a line.
+ * @param text The line (trimmed).
+ * @param ins The parsed line.
+ */
+void parseLine(const char *text, asmLine *ins)
+{
+    size_t len = strlen(text);
+    const char *p;
+
+    memset(ins, 0, sizeof(*ins));
+    ins->len     = len;
+    ins->operand = len;
+
+    if (len == 0)
+    {
+        ins->kind = LINE_EMPTY;
+        return;
+    }
+
+    if (isControl(text))
+        ins->flags |= LF_CONTROL;
+    if (changeAccu(text))
+        ins->flags |= LF_CHANGES_ACCU;
+    if (strstr(text, "tcc__"))
+        ins->flags |= LF_PSEUDO;
+    if (text[len - 1] == ':')
+        ins->flags |= LF_COLON;
+
+    p = text;
+    if (text[0] == '.')
+    {
+        ins->kind = LINE_DIRECTIVE;
+        return;
+    }
+    if (text[0] == '+' || text[0] == '-')
+    {
+        ins->kind = LINE_ANONYMOUS;
+        while (*p == text[0])
+            p++;
+        if (*p != ' ')
+            return;
+        p++;
+    }
+    else if (text[len - 1] == ':')
+    {
+        ins->kind = LINE_LABEL;
+        return;
+    }
+    else
+    {
+        ins->kind = LINE_INSTRUCTION;
+    }
+
+    /* Mnemonic: 3 lowercase letters, optional width suffix, then a space or the end */
+    if (strlen(p) < 3 || !islower((unsigned char)p[0]) || !islower((unsigned char)p[1]) || !islower((unsigned char)p[2]))
+        return;
+
+    mnemonic mn     = findMnemonic(p);
+    opWidth width   = WIDTH_NONE;
+    const char *end = p + 3;
+
+    if (end[0] == '.' && end[1] != '\0' && (end[2] == '\0' || end[2] == ' '))
+    {
+        switch (end[1])
+        {
+        case 'b':
+            width = WIDTH_B;
+            break;
+        case 'w':
+            width = WIDTH_W;
+            break;
+        case 'l':
+            width = WIDTH_L;
+            break;
+        default:
+            return;
+        }
+        end += 2;
+    }
+    if (mn == MN_NONE || (*end != '\0' && *end != ' '))
+        return;
+
+    ins->mnemonic = mn;
+    ins->width    = width;
+    ins->operand  = *end == ' ' ? (end + 1) - text : end - text;
+
+    size_t op_len = len - ins->operand;
+    size_t core_from, core_to;
+
+    ins->mode = findMode(mn, text + ins->operand, op_len, &core_from, &core_to);
+
+    if (ins->flags & LF_PSEUDO)
+        ins->preg = parsePseudo(text + ins->operand + core_from, core_to - core_from);
+}
+
+/**
+ * @brief Create an empty asmFile.
+ * @param size The number of lines to allocate.
+ * @return A structure (asmFile).
+ */
+asmFile newAsmFile(size_t size)
+{
+    asmFile file;
+
+    file.used = 0;
+    file.size = size;
+    file.text    = (textBuffer){ NULL, 0, 0 };
+    file.strings = NULL;
+    file.arr  = calloc(size + LOOKAHEAD_PAD, sizeof(char *));
+    file.ins  = calloc(size + LOOKAHEAD_PAD, sizeof(asmLine));
+
+    if (file.arr == NULL || file.ins == NULL)
+    {
+        fatalError("malloc-lines");
+    }
+
+    return file;
+}
+
+/**
+ * @brief Free pointers (the lines, the loaded file and the arena).
+ * @param file asmFile structure.
+ */
+void freeAsmFile(asmFile file)
+{
+    free(file.arr);
+    free(file.ins);
+
+    if (file.text.data)
+        freeText(file.text);
+    arenaFree(file.strings);
+}
+
+/**
+ * @brief Make room for one more line (the padding stays empty).
+ * @param file The asmFile structure.
+ */
+static void growAsmFile(asmFile *file)
+{
+    if (file->used < file->size)
+        return;
+
+    size_t size = file->size ? 2 * file->size : 16;
+    char **arr  = realloc(file->arr, (size + LOOKAHEAD_PAD) * sizeof(char *));
+    asmLine *ins = realloc(file->ins, (size + LOOKAHEAD_PAD) * sizeof(asmLine));
+
+    if (arr == NULL || ins == NULL)
+    {
+        fatalError("realloc-lines");
+    }
+
+    memset(arr + file->size + LOOKAHEAD_PAD, 0, (size - file->size) * sizeof(char *));
+    memset(ins + file->size + LOOKAHEAD_PAD, 0, (size - file->size) * sizeof(asmLine));
+
+    file->arr  = arr;
+    file->ins  = ins;
+    file->size = size;
+}
+
+/**
+ * @brief Add a line to the asmFile (the line is copied
+ * into the arena of the file, and parsed).
+ * @param file The asmFile structure.
+ * @param str The line to add.
+ */
+void pushLine(asmFile *file, const char *str)
+{
+    growAsmFile(file);
+
+    if (!file->strings)
+        file->strings = arenaNew();
+
+    file->arr[file->used] = arenaStrdup(file->strings, str, strlen(str));
+    parseLine(file->arr[file->used], &file->ins[file->used]);
+
+    file->used++;
+}
+
+/**
+ * @brief Replace a line of the asmFile (the line is copied
+ * into the arena of the file, and parsed).
+ * @param file The asmFile structure.
+ * @param i The index of the line.
+ * @param str The new line.
+ */
+void setLine(asmFile *file, const size_t i, const char *str)
+{
+    if (!file->strings)
+        file->strings = arenaNew();
+
+    file->arr[i] = arenaStrdup(file->strings, str, strlen(str));
+    parseLine(file->arr[i], &file->ins[i]);
+}
+
+/**
+ * @brief Add a line which points into the loaded file
+ * (the line is not copied, see tidyText function). The line is not
+ * parsed either, until parseLines is called: an output read from the
+ * cache only needs the text.
+ * @param file The asmFile structure.
+ * @param str The line to add.
+ */
+void pushSlice(asmFile *file, char *str)
+{
+    growAsmFile(file);
+
+    file->arr[file->used] = str;
+
+    file->used++;
+}
+
+/**
+ * @brief Parse all the lines of a file (see pushSlice function).
+ * @param file The asmFile structure.
+ */
+void parseLines(asmFile *file)
+{
+    for (size_t i = 0; i < file->used; i++)
+    {
+        parseLine(file->arr[i], &file->ins[i]);
+    }
+}
+
+/**
+ * @brief Add a line of another asmFile (the parsed form is reused).
+ * The line is carried by reference, unless it belongs to the arena
+ * of the other asmFile: it is then copied into the arena of the file,
+ * so the other arena can be reset.
+ * @param file The asmFile structure.
+ * @param from The asmFile to copy from.
+ * @param i The index of the line to copy.
+ */
+void copyLine(asmFile *file, const asmFile *from, size_t i)
+{
+    growAsmFile(file);
+
+    if (from->strings != file->strings && arenaOwns(from->strings, from->arr[i]))
+    {
+        if (!file->strings)
+            file->strings = arenaNew();
+
+        file->arr[file->used] = arenaStrdup(file->strings, from->arr[i], from->ins[i].len);
+    }
+    else
+    {
+        file->arr[file->used] = from->arr[i];
+    }
+    file->ins[file->used] = from->ins[i];
+
+    file->used++;
+}
+
+/**
+ * @brief Add a line with the first occurrence of a substring
+ * replaced by another one (see replaceStr function).
+ * The line is built in the arena of the file, and parsed.
+ * @param file The asmFile structure.
+ * @param str The line.
+ * @param orig The substring to replace.
+ * @param rep The substring to replace with.
+ */
+void pushReplaced(asmFile *file, const char *str, const char *orig, const char *rep)
+{
+    const char *p = strstr(str, orig);
+
+    if (!p)
+    {
+        pushLine(file, str);
+        return;
+    }
+
+    size_t head     = p - str;
+    size_t orig_len = strlen(orig);
+    size_t rep_len  = strlen(rep);
+    size_t len      = strlen(str) - orig_len + rep_len;
+
+    growAsmFile(file);
+
+    if (!file->strings)
+        file->strings = arenaNew();
+
+    char *line = arenaAlloc(file->strings, len + 1);
+    memcpy(line, str, head);
+    memcpy(line + head, rep, rep_len);
+    strcpy(line + head + rep_len, p + orig_len);
+
+    file->arr[file->used] = line;
+    parseLine(line, &file->ins[file->used]);
+
+    file->used++;
+}
+
+/**
+ * @brief Move all the lines of an asmFile at the end of another one
+ * (the lines and their arena are moved, not copied).
+ * The emptied asmFile keeps its loaded file, if any.
+ * @param file The asmFile structure.
+ * @param from The asmFile to empty.
+ */
+void appendLines(asmFile *file, asmFile *from)
+{
+    for (size_t i = 0; i < from->used; i++)
+    {
+        growAsmFile(file);
+        file->arr[file->used] = from->arr[i];
+        file->ins[file->used] = from->ins[i];
+        file->used++;
+    }
+    from->used = 0;
+
+    if (!file->strings)
+        file->strings = from->strings;
+    else
+        arenaAdopt(file->strings, from->strings);
+    from->strings = NULL;
+}
+
+/**
+ * @brief Index the labels of an asmFile (the line without its
+ * trailing colon is the key).
+ * @param file The asmFile structure.
+ * @return A structure (labelTable).
+ */
+labelTable buildLabels(const asmFile *file)
+{
+    labelTable labels;
+    size_t count = 0;
+
+    for (size_t i = 0; i < file->used; i++)
+    {
+        if (file->ins[i].flags & LF_COLON)
+            count++;
+    }
+
+    size_t nbuckets = 16;
+    while (nbuckets < 2 * count)
+        nbuckets *= 2;
+
+    labels.mask    = nbuckets - 1;
+    labels.buckets = calloc(nbuckets, sizeof(size_t));
+    labels.next    = calloc(file->used + 1, sizeof(size_t));
+    labels.run     = calloc(file->used + 1, sizeof(size_t));
+
+    if (labels.buckets == NULL || labels.next == NULL || labels.run == NULL)
+    {
+        fatalError("malloc-labels");
+    }
+
+    /* Backward, so the chains are in line order */
+    for (size_t i = file->used; i-- > 0;)
+    {
+        if (!(file->ins[i].flags & LF_COLON))
+            continue;
+
+        labels.run[i] = labels.run[i + 1] + 1;
+
+        size_t len = file->ins[i].len - 1;
+        size_t b   = hashStr(file->arr[i], len) & labels.mask;
+
+        while (labels.buckets[b])
+        {
+            size_t k = labels.buckets[b] - 1;
+            if (file->ins[k].len == len + 1 && memcmp(file->arr[k], file->arr[i], len) == 0)
+            {
+                labels.next[i] = labels.buckets[b];
+                break;
+            }
+            b = (b + 1) & labels.mask;
+        }
+        labels.buckets[b] = i + 1;
+    }
+
+    return labels;
+}
+
+/**
+ * @brief Where is a label defined.
+ * @param labels The labelTable structure.
+ * @param file The asmFile the table was built from.
+ * @param name The label (without colon).
+ * @param len The length of the label.
+ * @return The index of the first line defining it, -1 if none.
+ */
+long findLabel(const labelTable *labels, const asmFile *file, const char *name, const size_t len)
+{
+    size_t b = hashStr(name, len) & labels->mask;
+
+    while (labels->buckets[b])
+    {
+        size_t k = labels->buckets[b] - 1;
+        if (file->ins[k].len == len + 1 && memcmp(file->arr[k], name, len) == 0)
+            return (long)k;
+        b = (b + 1) & labels->mask;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief The next line defining the same label.
+ * @param labels The labelTable structure.
+ * @param index The index of a line defining the label.
+ * @return The index of the next line, -1 if none.
+ */
+long nextLabel(const labelTable *labels, const size_t index)
+{
+    return (long)labels->next[index] - 1;
+}
+
+/**
+ * @brief Number of labels immediately following a line
+ * (they are the lines i + 1 to i + n).
+ * @param labels The labelTable structure.
+ * @param i The index of the line.
+ * @return The number of labels.
+ */
+size_t labelsAfter(const labelTable *labels, const size_t i)
+{
+    return labels->run[i + 1];
+}
+
+/**
+ * @brief Free pointers.
+ * @param labels labelTable structure.
+ */
+void freeLabels(labelTable labels)
+{
+    free(labels.buckets);
+    free(labels.next);
+    free(labels.run);
+}
+
+/**
+ * @brief Record a line mentioning the pseudo-registers named by the
+ * prefixes of a name ("r10h" names tcc__r, tcc__r1, tcc__r10 and tcc__r10h,
+ * see parsePseudo function).
+ * @param p The name, after "tcc__".
+ * @param last The last line recorded, by pseudo-register id.
+ * @param count The number of ids.
+ * @param pointer 1 to record the high words of the low words named.
+ * @param line The index of the line.
+ */
+static void markPregs(const char *p, unsigned int *last, const size_t count, const int pointer, const size_t line)
+{
+    if (*p != 'r' && *p != 'f')
+        return;
+
+    int isf = *p == 'f';
+    int num = -1;
+
+    for (size_t k = 1;; k++)
+    {
+        size_t id = (size_t)PREG_ID(isf, num, pointer);
+        if (id < count)
+            last[id] = (unsigned int)line;
+        if (!pointer && p[k] == 'h' && id + 2 < count)
+            last[id + 2] = (unsigned int)line;
+
+        if (!isdigit((unsigned char)p[k]) || num == 0) // No leading zeros
+            return;
+        num = (num < 0 ? 0 : num * 10) + (p[k] - '0');
+        if (num > 4000)
+            return;
+    }
+}
+
+/**
+ * @brief Index the next uses of the pseudo-registers of an asmFile,
+ * so the rules scanning forward for them read one entry instead.
+ * @param file The asmFile structure.
+ * @return A structure (pregTable).
+ */
+pregTable buildPregs(const asmFile *file)
+{
+    pregTable pregs;
+    size_t count = 1;
+
+    for (size_t i = 0; i < file->used; i++)
+    {
+        if ((size_t)file->ins[i].preg >= count)
+            count = (size_t)file->ins[i].preg + 1;
+    }
+
+    pregs.next        = malloc((file->used + 1) * sizeof(unsigned int));
+    pregs.pointer     = malloc((file->used + 1) * sizeof(unsigned int));
+    unsigned int *use = malloc(count * sizeof(unsigned int));
+    unsigned int *ptr = malloc(count * sizeof(unsigned int));
+
+    if (pregs.next == NULL || pregs.pointer == NULL || use == NULL || ptr == NULL)
+    {
+        fatalError("malloc-pregs");
+    }
+
+    unsigned int none = (unsigned int)file->used;
+    unsigned int flow = none;
+
+    for (size_t k = 0; k < count; k++)
+    {
+        use[k] = none;
+        ptr[k] = none;
+    }
+    pregs.next[file->used]    = none;
+    pregs.pointer[file->used] = none;
+
+    /* Backward, so each line sees the next ones */
+    for (size_t i = file->used; i-- > 0;)
+    {
+        const asmLine *ins = &file->ins[i];
+        short preg         = ins->preg;
+
+        if (preg != PREG_NONE)
+        {
+            pregs.next[i]    = use[preg] < flow ? use[preg] : flow;
+            pregs.pointer[i] = PREG_HIGH(preg) ? ptr[preg] : none;
+        }
+
+        if (ins->flags & LF_CONTROL)
+            flow = (unsigned int)i;
+        if (!(ins->flags & LF_PSEUDO))
+            continue;
+
+        /* The operand is a pseudo-register, maybe between brackets:
+            it is the only one of the line */
+        if (preg != PREG_NONE)
+        {
+            const char *p = file->arr[i] + ins->operand;
+            int bracket   = *p == '[';
+
+            p += (bracket || *p == '(') + 5; // Without "tcc__"
+            markPregs(p, use, count, 0, i);
+            if (bracket)
+                markPregs(p, ptr, count, 1, i);
+            continue;
+        }
+
+        for (const char *p = strstr(file->arr[i], "tcc__"); p; p = strstr(p + 5, "tcc__"))
+        {
+            markPregs(p + 5, use, count, 0, i);
+            if (p > file->arr[i] && p[-1] == '[')
+                markPregs(p + 5, ptr, count, 1, i);
+        }
+    }
+
+    free(use);
+    free(ptr);
+
+    return pregs;
+}
+
+/**
+ * @brief The next line altering the control flow or mentioning the
+ * pseudo-register of a line (see pregTable::next).
+ * @param pregs The pregTable structure.
+ * @param i The index of the line.
+ * @return The index of the next line, the number of lines if none.
+ */
+size_t nextPregUse(const pregTable *pregs, const size_t i)
+{
+    return pregs->next[i];
+}
+
+/**
+ * @brief The next line using the low word of the high word of a line
+ * as a pointer (see pregTable::pointer).
+ * @param pregs The pregTable structure.
+ * @param i The index of the line.
+ * @return The index of the next line, the number of lines if none.
+ */
+size_t nextPregPointer(const pregTable *pregs, const size_t i)
+{
+    return pregs->pointer[i];
+}
+
+/**
+ * @brief Free pointers.
+ * @param pregs pregTable structure.
+ */
+void freePregs(pregTable pregs)
+{
+    free(pregs.next);
+    free(pregs.pointer);
+}
@@ -0,0 +1,328 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#include "helpers.h"
+
+/*!
+ * @brief Number of empty lines kept after the last line
+ * of an asmFile, so the rules can look ahead without bound checks.
+ */
+#define LOOKAHEAD_PAD 32
+
+/**
+ * @enum lineKind
+ * @brief Kind of line.
+ */
+typedef enum lineKind
+{
+    LINE_NONE = 0,    /*!< Padding after the last line */
+    LINE_EMPTY,       /*!< Empty line */
+    LINE_INSTRUCTION, /*!< Instruction (known or unknown mnemonic) */
+    LINE_LABEL,       /*!< Named label ("name:") */
+    LINE_ANONYMOUS,   /*!< Anonymous label ("+", "--", "+ dex", ...) */
+    LINE_DIRECTIVE    /*!< Assembler directive (".ENDS", ".accu 16", ...) */
+} lineKind;
+
+/**
+ * @enum mnemonic
+ * @brief The 65816 instructions (and the aliases used by 816-tcc).
+ */
+typedef enum mnemonic
+{
+    MN_NONE = 0,
+    MN_ADC,
+    MN_AND,
+    MN_ASL,
+    MN_BCC,
+    MN_BCS,
+    MN_BEQ,
+    MN_BIT,
+    MN_BMI,
+    MN_BNE,
+    MN_BPL,
+    MN_BRA,
+    MN_BRK,
+    MN_BRL,
+    MN_BVC,
+    MN_BVS,
+    MN_CLC,
+    MN_CLD,
+    MN_CLI,
+    MN_CLV,
+    MN_CMP,
+    MN_COP,
+    MN_CPX,
+    MN_CPY,
+    MN_DEC,
+    MN_DEX,
+    MN_DEY,
+    MN_EOR,
+    MN_INC,
+    MN_INX,
+    MN_INY,
+    MN_JML,
+    MN_JMP,
+    MN_JSL,
+    MN_JSR,
+    MN_LDA,
+    MN_LDX,
+    MN_LDY,
+    MN_LSR,
+    MN_MVN,
+    MN_MVP,
+    MN_NOP,
+    MN_ORA,
+    MN_PEA,
+    MN_PEI,
+    MN_PER,
+    MN_PHA,
+    MN_PHB,
+    MN_PHD,
+    MN_PHK,
+    MN_PHP,
+    MN_PHX,
+    MN_PHY,
+    MN_PLA,
+    MN_PLB,
+    MN_PLD,
+    MN_PLP,
+    MN_PLX,
+    MN_PLY,
+    MN_REP,
+    MN_ROL,
+    MN_ROR,
+    MN_RTI,
+    MN_RTL,
+    MN_RTS,
+    MN_SBC,
+    MN_SEC,
+    MN_SED,
+    MN_SEI,
+    MN_SEP,
+    MN_STA,
+    MN_STP,
+    MN_STX,
+    MN_STY,
+    MN_STZ,
+    MN_TAX,
+    MN_TAY,
+    MN_TCD,
+    MN_TCS,
+    MN_TDC,
+    MN_TRB,
+    MN_TSB,
+    MN_TSC,
+    MN_TSX,
+    MN_TXA,
+    MN_TXS,
+    MN_TXY,
+    MN_TYA,
+    MN_TYX,
+    MN_WAI,
+    MN_WDM,
+    MN_XBA,
+    MN_XCE,
+    MN_COUNT
+} mnemonic;
+
+/**
+ * @enum opWidth
+ * @brief Width suffix of the instruction.
+ */
+typedef enum opWidth
+{
+    WIDTH_NONE = 0, /*!< No suffix */
+    WIDTH_B,        /*!< ".b" */
+    WIDTH_W,        /*!< ".w" */
+    WIDTH_L         /*!< ".l" */
+} opWidth;
+
+/**
+ * @enum addrMode
+ * @brief Addressing mode of the operand.
+ */
+typedef enum addrMode
+{
+    MODE_IMPLIED = 0,   /*!< No operand */
+    MODE_ACCUMULATOR,   /*!< a */
+    MODE_IMMEDIATE,     /*!< #n */
+    MODE_ABSOLUTE,      /*!< n (direct page, absolute, long or label) */
+    MODE_INDEXED_X,     /*!< n,x */
+    MODE_INDEXED_Y,     /*!< n,y */
+    MODE_STACK,         /*!< n,s */
+    MODE_STACK_IND_Y,   /*!< (n,s),y */
+    MODE_INDIRECT,      /*!< (n) */
+    MODE_INDIRECT_X,    /*!< (n,x) */
+    MODE_INDIRECT_Y,    /*!< (n),y */
+    MODE_IND_LONG,      /*!< [n] */
+    MODE_IND_LONG_Y,    /*!< [n],y */
+    MODE_BLOCK_MOVE     /*!< src,dst (mvn/mvp) */
+} addrMode;
+
+/*!
+ * @brief Line flags: the line alters the control flow (see isControl function).
+ */
+#define LF_CONTROL 0x01
+/*!
+ * @brief Line flags: the line touches the accumulator (see changeAccu function).
+ */
+#define LF_CHANGES_ACCU 0x02
+/*!
+ * @brief Line flags: the line mentions a pseudo-register ("tcc__").
+ */
+#define LF_PSEUDO 0x04
+/*!
+ * @brief Line flags: the line ends with a colon.
+ */
+#define LF_COLON 0x08
+
+/*!
+ * @brief No pseudo-register.
+ */
+#define PREG_NONE 0
+/*!
+ * @brief Build a pseudo-register id (tcc__rN, tcc__rNh, tcc__fN, tcc__fNh).
+ * num is -1 for a pseudo-register without number (tcc__r).
+ */
+#define PREG_ID(isf, num, high) ((short)(1 + ((((num) + 1) * 2 + (high)) * 2 + (isf))))
+/*!
+ * @brief Check if the pseudo-register is a high word (tcc__rNh).
+ */
+#define PREG_HIGH(id) ((((id) - 1) >> 1) & 1)
+/*!
+ * @brief The pseudo-register without its high suffix (tcc__rNh -> tcc__rN).
+ */
+#define PREG_LOW(id) ((short)((id) - (PREG_HIGH(id) << 1)))
+
+/**
+ * @struct asmLine
+ * @brief The parsed form of a line (built once, see parseLine function).
+ * @var asmLine::kind
+ * Member 'kind' contains the kind of line (see lineKind).
+ * @var asmLine::mnemonic
+ * Member 'mnemonic' contains the instruction (see mnemonic).
+ * @var asmLine::width
+ * Member 'width' contains the width suffix (see opWidth).
+ * @var asmLine::mode
+ * Member 'mode' contains the addressing mode (see addrMode).
+ * @var asmLine::flags
+ * Member 'flags' contains the LF_* flags.
+ * @var asmLine::preg
+ * Member 'preg' contains the pseudo-register id when the operand
+ * is exactly a pseudo-register (see PREG_ID), PREG_NONE otherwise.
+ * @var asmLine::operand
+ * Member 'operand' contains the offset of the operand in the line
+ * (the operand runs until the end of the line).
+ * @var asmLine::len
+ * Member 'len' contains the length of the line.
+ */
+typedef struct asmLine
+{
+    unsigned char kind;
+    unsigned char mnemonic;
+    unsigned char width;
+    unsigned char mode;
+    unsigned short flags;
+    short preg;
+    unsigned int operand;
+    unsigned int len;
+} asmLine;
+
+/**
+ * @struct asmFile
+ * @brief Structure to store the lines of an asm file
+ * with their parsed form.
+ * @var asmFile::arr
+ * Member 'arr' contains the array of lines.
+ * @var asmFile::ins
+ * Member 'ins' contains the parsed lines (same index as arr).
+ * @var asmFile::used
+ * Member 'used' contains the number of lines.
+ * @var asmFile::size
+ * Member 'size' contains the number of lines allocated
+ * (LOOKAHEAD_PAD not included).
+ * @var asmFile::text
+ * Member 'text' contains the loaded file, lines pushed with
+ * pushSlice point into it.
+ * @var asmFile::strings
+ * Member 'strings' contains the arena of the lines pushed with pushLine.
+ * Lines are never freed one by one (see freeAsmFile function).
+ */
+typedef struct asmFile
+{
+    char **arr;
+    asmLine *ins;
+    size_t used;
+    size_t size;
+    textBuffer text;
+    arena *strings;
+} asmFile;
+
+/**
+ * @struct labelTable
+ * @brief Hash table of the labels of an asmFile
+ * (lines ending with a colon, see buildLabels function).
+ * @var labelTable::buckets
+ * Member 'buckets' contains the index + 1 of the first line of each label
+ * (0 for an empty bucket, open addressing).
+ * @var labelTable::mask
+ * Member 'mask' contains the number of buckets - 1 (power of 2).
+ * @var labelTable::next
+ * Member 'next' contains, for each line, the index + 1 of the next line
+ * with the same label (0 if none).
+ * @var labelTable::run
+ * Member 'run' contains, for each line, the number of consecutive
+ * labels starting at this line.
+ */
+typedef struct labelTable
+{
+    size_t *buckets;
+    size_t mask;
+    size_t *next;
+    size_t *run;
+} labelTable;
+
+/**
+ * @struct pregTable
+ * @brief The next uses of the pseudo-registers in an asmFile
+ * (see buildPregs function).
+ * @var pregTable::next
+ * Member 'next' contains, for each line naming a pseudo-register
+ * (see asmLine::preg), the index of the next line altering the control
+ * flow or mentioning it (a line with "tcc__r1" mentions tcc__r1, as do
+ * the lines with "tcc__r1h" or "tcc__r10"), the number of lines if none.
+ * @var pregTable::pointer
+ * Member 'pointer' contains, for each line naming a high word (tcc__rNh),
+ * the index of the next line using its low word as a pointer
+ * ("[tcc__rN"), the number of lines if none.
+ */
+typedef struct pregTable
+{
+    unsigned int *next;
+    unsigned int *pointer;
+} pregTable;
+
+int changeAccu(const char *a);
+int isControl(const char *a);
+void parseLine(const char *text, asmLine *ins);
+const char *mnemonicName(const mnemonic mn);
+asmFile newAsmFile(size_t size);
+void freeAsmFile(asmFile file);
+void pushLine(asmFile *file, const char *str);
+void setLine(asmFile *file, const size_t i, const char *str);
+void pushSlice(asmFile *file, char *str);
+void parseLines(asmFile *file);
+void copyLine(asmFile *file, const asmFile *from, size_t i);
+void pushReplaced(asmFile *file, const char *str, const char *orig, const char *rep);
+void appendLines(asmFile *file, asmFile *from);
+labelTable buildLabels(const asmFile *file);
+long findLabel(const labelTable *labels, const asmFile *file, const char *name, const size_t len);
+long nextLabel(const labelTable *labels, const size_t index);
+size_t labelsAfter(const labelTable *labels, const size_t i);
+void freeLabels(labelTable labels);
+pregTable buildPregs(const asmFile *file);
+size_t nextPregUse(const pregTable *pregs, const size_t i);
+size_t nextPregPointer(const pregTable *pregs, const size_t i);
+void freePregs(pregTable pregs);
+
+#endif
@@ -0,0 +1,189 @@
+/*
+ * opt-65816 - Assembly code optimizer for the WDC 65816 processor.
+ *
+ * Description: Assembly code optimizer produced
+ * by the 816 Tiny C Compiler (816-tcc).
+ * This library is a C port of the 816-opt python tool.
+ *
+ * Author: kobenairb (kobenairb@gmail.com).
+ *
+ * Copyright (c) 2022.
+ *
+ * This project is released under the GNU Public License.
+ *
+ */
+
+#include "pool.h"
+
+#include <errno.h>
+
+/**
+ * @brief Run a job. Its fatal errors are caught (see fatalCatch
+ * function): the thread calling poolRun reports them.
+ * @param pool The threadPool structure.
+ * @param job The index of the job.
+ * @return 0, or the error number of the job failed.
+ */
+static int runJob(threadPool *pool, const size_t job)
+{
+    jmp_buf env;
+    jmp_buf *outer = fatalCatch(&env);
+
+    if (setjmp(env))
+    {
+        fatalCatch(outer);
+        return errno ? errno : ENOMEM;
+    }
+
+    pool->fn(pool->ctx, job);
+    fatalCatch(outer);
+
+    return 0;
+}
+
+/**
+ * @brief Run the available jobs (the lock is held on entry and on exit).
+ * @param pool The threadPool structure.
+ */
+static void runJobs(threadPool *pool)
+{
+    while (pool->next < pool->jobs)
+    {
+        size_t job = pool->next++;
+
+        pthread_mutex_unlock(&pool->lock);
+        int err = runJob(pool, job);
+        pthread_mutex_lock(&pool->lock);
+
+        if (err && !pool->err)
+            pool->err = err;
+
+        if (--pool->pending == 0)
+            pthread_cond_signal(&pool->done);
+    }
+}
+
+/**
+ * @brief Main loop of a worker thread.
+ * @param arg The threadPool structure.
+ * @return NULL.
+ */
+static void *worker(void *arg)
+{
+    threadPool *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stop)
+    {
+        if (pool->next < pool->jobs)
+            runJobs(pool);
+        else
+            pthread_cond_wait(&pool->work, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+/**
+ * @brief Start a pool of worker threads.
+ * @param count The number of worker threads (the thread calling
+ * poolRun also runs jobs).
+ * @return The pool.
+ */
+threadPool *poolNew(const size_t count)
+{
+    threadPool *pool = calloc(1, sizeof(threadPool));
+
+    if (pool && (pool->threads = calloc(count ? count : 1, sizeof(pthread_t))) == NULL)
+    {
+        free(pool);
+        pool = NULL;
+    }
+    if (!pool)
+    {
+        fatalError("malloc-pool");
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    int err = 0;
+    for (size_t i = 0; i < count && err == 0; i++)
+    {
+        if ((err = pthread_create(&pool->threads[i], NULL, worker, pool)) == 0)
+            pool->count += 1;
+    }
+    if (err != 0)
+    {
+        /* The caller may catch the error (see fatalCatch function) */
+        poolFree(pool);
+        errno = err;
+        fatalError("pthread_create");
+    }
+
+    return pool;
+}
+
+/**
+ * @brief Run fn(ctx, 0) ... fn(ctx, jobs - 1) on the pool
+ * and wait until they are all finished. A fatal error in a job is
+ * raised again in the calling thread (see fatalError function) once
+ * they are.
+ * @param pool The threadPool structure.
+ * @param jobs The number of jobs.
+ * @param fn The function running a job.
+ * @param ctx The argument given to fn.
+ */
+void poolRun(threadPool *pool, const size_t jobs, void (*fn)(void *ctx, size_t job), void *ctx)
+{
+    if (jobs == 0)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->fn      = fn;
+    pool->ctx     = ctx;
+    pool->jobs    = jobs;
+    pool->next    = 0;
+    pool->pending = jobs;
+    pthread_cond_broadcast(&pool->work);
+
+    runJobs(pool);
+    while (pool->pending > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+
+    int err   = pool->err;
+    pool->err = 0;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (err)
+    {
+        errno = err;
+        fatalError("pool-job");
+    }
+}
+
+/**
+ * @brief Stop the worker threads and free the pool.
+ * @param pool The threadPool structure (can be NULL).
+ */
+void poolFree(threadPool *pool)
+{
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->count; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads);
+    free(pool);
+}
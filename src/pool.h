@@ -0,0 +1,59 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "helpers.h"
+
+/**
+ * @struct threadPool
+ * @brief Pool of worker threads running the jobs of a parallel loop
+ * (see poolRun function).
+ * @var threadPool::threads
+ * Member 'threads' contains the worker threads.
+ * @var threadPool::count
+ * Member 'count' contains the number of worker threads.
+ * @var threadPool::lock
+ * Member 'lock' protects the fields below.
+ * @var threadPool::work
+ * Member 'work' is signaled when jobs are available (or on stop).
+ * @var threadPool::done
+ * Member 'done' is signaled when the last job is finished.
+ * @var threadPool::fn
+ * Member 'fn' contains the function running a job.
+ * @var threadPool::ctx
+ * Member 'ctx' contains the argument given to fn.
+ * @var threadPool::jobs
+ * Member 'jobs' contains the number of jobs of the current loop.
+ * @var threadPool::next
+ * Member 'next' contains the next job to hand out.
+ * @var threadPool::pending
+ * Member 'pending' contains the number of jobs not finished yet.
+ * @var threadPool::err
+ * Member 'err' contains the error number of the first job failed (0 if none).
+ * @var threadPool::stop
+ * Member 'stop' asks the worker threads to exit.
+ */
+typedef struct threadPool
+{
+    pthread_t *threads;
+    size_t count;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    void (*fn)(void *ctx, size_t job);
+    void *ctx;
+    size_t jobs;
+    size_t next;
+    size_t pending;
+    int err;
+    int stop;
+} threadPool;
+
+threadPool *poolNew(const size_t count);
+void poolRun(threadPool *pool, const size_t jobs, void (*fn)(void *ctx, size_t job), void *ctx);
+void poolFree(threadPool *pool);
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef RULES_H
+#define RULES_H
+
+#include "parser.h"
+#include "stats.h"
+
+/*
+ * The rules of a fixed shape are described in rules.opt, and compiled
+ * into build/rules.c at build time by tools/rulegen.c.
+ */
+
+extern const char *const rulesDigest;
+
+size_t rulesReach(const mnemonic mn);
+size_t matchRules(const asmFile *file, const size_t i, const int level, asmFile *out, ruleClock *clock);
+
+#endif
@@ -0,0 +1,360 @@
+/*
+ * opt-65816 - Assembly code optimizer for the WDC 65816 processor.
+ *
+ * Description: Assembly code optimizer produced
+ * by the 816 Tiny C Compiler (816-tcc).
+ * This library is a C port of the 816-opt python tool.
+ *
+ * Author: kobenairb (kobenairb@gmail.com).
+ *
+ * Copyright (c) 2022.
+ *
+ * This project is released under the GNU Public License.
+ *
+ */
+
+#include "scan.h"
+#include "optimizer.h"
+
+#include <stdint.h>
+
+#if defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+/*!
+ * @brief Names of the instruction sets (see scanName function).
+ */
+static const char *const scanNames[] = { "scalar", "sse2", "avx2" };
+
+/**
+ * @brief The best instruction set of the line scanner on this machine.
+ * @return The scanIsa.
+ */
+scanIsa scanSupported(void)
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return SCAN_AVX2;
+    return SCAN_SSE2;
+#else
+    return SCAN_SCALAR;
+#endif
+}
+
+/**
+ * @brief Get the name of an instruction set.
+ * @param isa The scanIsa.
+ * @return The name.
+ */
+const char *scanName(const scanIsa isa)
+{
+    return scanNames[isa];
+}
+
+/**
+ * @brief Cut the lines of a text one at a time (the reference of the
+ * other instruction sets).
+ * @param data The text.
+ * @param len The length of the text.
+ * @return A structure (asmFile).
+ */
+static asmFile scanScalar(char *data, const size_t len)
+{
+    asmFile file = newAsmFile(1024);
+    char *p      = data;
+    char *end = data + len;
+
+    while (p < end)
+    {
+        char *eol = memchr(p, '\n', end - p);
+        if (!eol)
+            eol = end;
+        *eol = '\0';
+
+        if (!startWith(p, ASM_COMMENT))
+        {
+            pushSlice(&file, trimWhiteSpace(p));
+        }
+        p = eol + 1;
+    }
+
+    return file;
+}
+
+#ifdef SCAN_X86
+
+/**
+ * @struct scanState
+ * @brief The line being cut by the vector scanners.
+ * @var scanState::file
+ * Member 'file' contains the lines cut.
+ * @var scanState::data
+ * Member 'data' contains the text.
+ * @var scanState::start
+ * Member 'start' contains the offset of the line.
+ * @var scanState::first
+ * Member 'first' contains the offset of its first byte which is not
+ * a white space, SIZE_MAX if none so far.
+ * @var scanState::last
+ * Member 'last' contains the offset of its last byte which is not
+ * a white space so far.
+ * @var scanState::nul
+ * Member 'nul' is 1 if the line has a NUL byte so far.
+ */
+typedef struct scanState
+{
+    asmFile *file;
+    char *data;
+    size_t start;
+    size_t first;
+    size_t last;
+    int nul;
+} scanState;
+
+/**
+ * @brief Cut the line ending at a newline (or at the end of the text),
+ * as scanScalar does.
+ * @param st The scanState structure.
+ * @param eol The offset of the end of the line.
+ */
+static inline void endLine(scanState *st, const size_t eol)
+{
+    char *line = st->data + st->start;
+
+    st->data[eol] = '\0';
+    if (*line != ASM_COMMENT[0]) // Same as startWith(line, ASM_COMMENT)
+    {
+        if (st->nul)
+            pushSlice(st->file, trimWhiteSpace(line)); // The line ends at the NUL byte
+        else if (st->first == SIZE_MAX)
+            pushSlice(st->file, st->data + eol); // Only spaces
+        else
+        {
+            st->data[st->last + 1] = '\0';
+            pushSlice(st->file, st->data + st->first);
+        }
+    }
+    st->start = eol + 1;
+    st->first = SIZE_MAX;
+    st->nul   = 0;
+}
+
+/**
+ * @brief Cut the lines ending in a block of 64 bytes, from its masks
+ * (one bit per byte).
+ * @param st The scanState structure.
+ * @param base The offset of the block.
+ * @param nl The newlines.
+ * @param text The bytes which are not white spaces (see isspace function).
+ * @param nul The NUL bytes.
+ */
+static inline void scanBlock(scanState *st, const size_t base, uint64_t nl, uint64_t text, uint64_t nul)
+{
+    while (nl)
+    {
+        unsigned int bit = (unsigned int)__builtin_ctzll(nl);
+        uint64_t upto    = bit == 63 ? ~(uint64_t)0 : ((uint64_t)2 << bit) - 1; // Up to the newline
+        uint64_t t       = text & upto;
+
+        if (t)
+        {
+            if (st->first == SIZE_MAX)
+                st->first = base + (size_t)__builtin_ctzll(t);
+            st->last = base + 63 - (size_t)__builtin_clzll(t);
+        }
+        if (nul & upto)
+            st->nul = 1;
+        endLine(st, base + bit);
+
+        text &= ~upto;
+        nul &= ~upto;
+        nl &= nl - 1;
+    }
+
+    /* The line goes on in the next block */
+    if (text)
+    {
+        if (st->first == SIZE_MAX)
+            st->first = base + (size_t)__builtin_ctzll(text);
+        st->last = base + 63 - (size_t)__builtin_clzll(text);
+    }
+    if (nul)
+        st->nul = 1;
+}
+
+/**
+ * @brief Compute the masks of 16 bytes (see scanBlock function).
+ * @param v The bytes.
+ * @param nl The newlines.
+ * @param text The bytes which are not white spaces.
+ * @param nul The NUL bytes.
+ */
+static inline void masksSse2(const __m128i v, unsigned int *nl, unsigned int *text, unsigned int *nul)
+{
+    /* ' ', or '\t' to '\r' (v - 9 <= 4 unsigned) */
+    __m128i ctl = _mm_sub_epi8(v, _mm_set1_epi8(9));
+    __m128i ws  = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                               _mm_cmpeq_epi8(_mm_min_epu8(ctl, _mm_set1_epi8(4)), ctl));
+
+    *nl   = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+    *text = ~(unsigned int)_mm_movemask_epi8(ws) & 0xffff;
+    *nul  = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+}
+
+/**
+ * @brief Cut the lines of a text 64 bytes at a time, with SSE2.
+ * @param st The scanState structure.
+ * @param p The block (64 bytes).
+ * @param base The offset of the block.
+ */
+static void blockSse2(scanState *st, const char *p, const size_t base)
+{
+    uint64_t nl = 0, text = 0, nul = 0;
+
+    for (int k = 0; k < 4; k++)
+    {
+        unsigned int n, t, z;
+
+        masksSse2(_mm_loadu_si128((const __m128i *)(p + 16 * k)), &n, &t, &z);
+        nl |= (uint64_t)n << (16 * k);
+        text |= (uint64_t)t << (16 * k);
+        nul |= (uint64_t)z << (16 * k);
+    }
+    scanBlock(st, base, nl, text, nul);
+}
+
+/**
+ * @brief Cut the lines of a text 64 bytes at a time, with AVX2.
+ * @param st The scanState structure.
+ * @param p The block (64 bytes).
+ * @param base The offset of the block.
+ */
+__attribute__((target("avx2"))) static void blockAvx2(scanState *st, const char *p, const size_t base)
+{
+    uint64_t nl = 0, text = 0, nul = 0;
+
+    for (int k = 0; k < 2; k++)
+    {
+        __m256i v   = _mm256_loadu_si256((const __m256i *)(p + 32 * k));
+        __m256i ctl = _mm256_sub_epi8(v, _mm256_set1_epi8(9));
+        __m256i ws  = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                                      _mm256_cmpeq_epi8(_mm256_min_epu8(ctl, _mm256_set1_epi8(4)), ctl));
+
+        nl |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))) << (32 * k);
+        text |= (uint64_t)(uint32_t)~_mm256_movemask_epi8(ws) << (32 * k);
+        nul |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256())) << (32 * k);
+    }
+    scanBlock(st, base, nl, text, nul);
+}
+
+/**
+ * @brief Count the newlines of a text, with SSE2.
+ * @param data The text.
+ * @param len The length of the text.
+ * @return The number of newlines.
+ */
+static size_t countSse2(const char *data, const size_t len)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t n = 0, b = 0;
+
+    /* A counter per byte (a match is -1), summed before it overflows */
+    while (b + 16 <= len)
+    {
+        __m128i acc = _mm_setzero_si128();
+
+        for (int k = 0; k < 255 && b + 16 <= len; k++, b += 16)
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + b)), nl));
+
+        acc = _mm_sad_epu8(acc, _mm_setzero_si128());
+        n += (size_t)_mm_cvtsi128_si32(acc) + (size_t)_mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+    }
+    for (; b < len; b++)
+        n += data[b] == '\n';
+
+    return n;
+}
+
+/**
+ * @brief Count the newlines of a text, with AVX2.
+ * @param data The text.
+ * @param len The length of the text.
+ * @return The number of newlines.
+ */
+__attribute__((target("avx2,popcnt"))) static size_t countAvx2(const char *data, const size_t len)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t n = 0, b = 0;
+
+    for (; b + 32 <= len; b += 32)
+        n += (size_t)__builtin_popcount((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(data + b)), nl)));
+    for (; b < len; b++)
+        n += data[b] == '\n';
+
+    return n;
+}
+
+/**
+ * @brief Cut the lines of a text 64 bytes at a time. The lines are
+ * counted first, so the file is allocated once.
+ * @param data The text.
+ * @param len The length of the text.
+ * @param isa SCAN_SSE2 or SCAN_AVX2.
+ * @return A structure (asmFile).
+ */
+static asmFile scanVector(char *data, const size_t len, const scanIsa isa)
+{
+    size_t lines = (isa == SCAN_AVX2 ? countAvx2(data, len) : countSse2(data, len)) + 1;
+    asmFile file = newAsmFile(lines);
+    scanState st = { &file, data, 0, SIZE_MAX, 0, 0 };
+    char tail[64];
+    size_t base = 0;
+
+    for (; base + 64 <= len; base += 64)
+    {
+        if (isa == SCAN_AVX2)
+            blockAvx2(&st, data + base, base);
+        else
+            blockSse2(&st, data + base, base);
+    }
+
+    /* The last bytes, padded with spaces (neither lines nor text) */
+    if (base < len)
+    {
+        memset(tail, ' ', sizeof(tail));
+        memcpy(tail, data + base, len - base);
+        if (isa == SCAN_AVX2)
+            blockAvx2(&st, tail, base);
+        else
+            blockSse2(&st, tail, base);
+    }
+
+    if (st.start < len)
+        endLine(&st, len);
+
+    return file;
+}
+
+#endif
+
+/**
+ * @brief Cut a text into lines without comment and leading/trailing
+ * white spaces, in place (see tidyText function).
+ * @param data The text (the byte after it is written).
+ * @param len The length of the text.
+ * @param isa The instruction set (see scanSupported function).
+ * @return A structure (asmFile), the lines point into the text.
+ */
+asmFile scanText(char *data, const size_t len, const scanIsa isa)
+{
+#ifdef SCAN_X86
+    if (isa != SCAN_SCALAR)
+        return scanVector(data, len, isa);
+#else
+    (void)isa;
+#endif
+    return scanScalar(data, len);
+}
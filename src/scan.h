@@ -0,0 +1,21 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include "parser.h"
+
+/**
+ * @enum scanIsa
+ * @brief The instruction sets of the line scanner (see scanText function).
+ */
+typedef enum scanIsa
+{
+    SCAN_SCALAR = 0, /*!< One line at a time (memchr, then trimWhiteSpace) */
+    SCAN_SSE2,       /*!< 64 bytes at a time, 16 per instruction */
+    SCAN_AVX2        /*!< 64 bytes at a time, 32 per instruction */
+} scanIsa;
+
+scanIsa scanSupported(void);
+const char *scanName(const scanIsa isa);
+asmFile scanText(char *data, const size_t len, const scanIsa isa);
+
+#endif
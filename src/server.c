@@ -0,0 +1,533 @@
+/*
+ * opt-65816 - Assembly code optimizer for the WDC 65816 processor.
+ *
+ * Description: Assembly code optimizer produced
+ * by the 816 Tiny C Compiler (816-tcc).
+ * This library is a C port of the 816-opt python tool.
+ *
+ * Author: kobenairb (kobenairb@gmail.com).
+ *
+ * Copyright (c) 2022.
+ *
+ * This project is released under the GNU Public License.
+ *
+ */
+
+#define _GNU_SOURCE // struct ucred (SO_PEERCRED)
+
+#include "server.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*!
+ * @brief Path of the socket served (removed when the server is stopped).
+ */
+static const char *servedPath;
+
+/*!
+ * @brief Cache of the server (NULL if none), shared by the connections.
+ */
+static optCache *servedCache;
+
+/*!
+ * @brief Optimization level of the server (see OPT_LEVEL_MAX).
+ */
+static int servedLevel;
+
+/**
+ * @brief Read from a descriptor until the end of the stream.
+ * @param fd The descriptor.
+ * @param text The content read (allocated, followed by a null terminator).
+ * @return 0, or -1 on error (errno is set).
+ */
+static int readAll(const int fd, textBuffer *text)
+{
+    size_t size = READ_CHUNK;
+    ssize_t n;
+
+    text->len    = 0;
+    text->mapped = 0;
+    if ((text->data = malloc(size + 1)) == NULL)
+        return -1;
+
+    while ((n = read(fd, text->data + text->len, size - text->len)) != 0)
+    {
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            free(text->data);
+            return -1;
+        }
+        text->len += n;
+        if (text->len == size)
+        {
+            void *tmp = realloc(text->data, 2 * size + 1);
+            if (!tmp)
+            {
+                free(text->data);
+                return -1;
+            }
+            text->data = tmp;
+            size *= 2;
+        }
+    }
+    text->data[text->len] = '\0';
+
+    return 0;
+}
+
+/**
+ * @brief Write a whole buffer to a descriptor.
+ * @param fd The descriptor.
+ * @param buf The buffer.
+ * @param len The length of the buffer.
+ * @return 0, or -1 on error (errno is set).
+ */
+static int writeAll(const int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Send the reply of a request failed.
+ * @param fd The connection.
+ * @param what What has failed.
+ * @param err The error number.
+ */
+static void replyError(const int fd, const char *what, const int err)
+{
+    char reply[MAXLEN_LINE];
+    int len = snprintf(reply, sizeof(reply), REPLY_ERROR " %s: %s\n", what, strerror(err));
+
+    writeAll(fd, reply, (size_t)len < sizeof(reply) ? (size_t)len : sizeof(reply) - 1);
+}
+
+/**
+ * @brief Optimize the text of a request. The fatal errors of the
+ * optimizer (out of memory, input unreadable) fail the request instead
+ * of stopping the server (see fatalCatch function).
+ * @param text The text (owned by the function), loaded from the input if any.
+ * @param input The path of the input (NULL if the text is given).
+ * @param optAsm The optimized file.
+ * @return 0, or -1 on error (errno is set).
+ */
+static int optimizeRequest(textBuffer *text, const char *input, asmFile *optAsm)
+{
+    jmp_buf env;
+    jmp_buf *outer = fatalCatch(&env);
+
+    if (setjmp(env))
+    {
+        int err = errno ? errno : ENOMEM;
+
+        fatalCatch(outer);
+        if (text->data)
+            freeText(*text);
+        text->data = NULL;
+        errno      = err;
+        return -1;
+    }
+
+    if (input)
+        *text = loadText(input);
+
+    asmFile file = tidyText(*text);
+    text->data   = NULL; // Owned by the file from now on
+    *optAsm      = optimizeCached(file, servedCache, 0, 1, servedLevel, NULL);
+    fatalCatch(outer);
+
+    return 0;
+}
+
+/**
+ * @brief Checks if the peer of a connection runs as the user of the
+ * server (the requests read and write files as the server).
+ * @param fd The connection.
+ * @return 1 (true) or 0 (false).
+ */
+static int trustedPeer(const int fd)
+{
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && cred.uid == geteuid();
+#else
+    (void)fd;
+    return 1;
+#endif
+}
+
+/**
+ * @brief Handle one connection: read the request until the client
+ * closes its side, optimize, reply, close.
+ * @param arg The connection (descriptor).
+ * @return NULL.
+ */
+static void *serveRequest(void *arg)
+{
+    const int fd = (int)(intptr_t)arg;
+    textBuffer text;
+
+    if (!trustedPeer(fd))
+    {
+        replyError(fd, "request", EACCES);
+        close(fd);
+        return NULL;
+    }
+
+    if (readAll(fd, &text) != 0)
+    {
+        replyError(fd, "request", errno);
+        close(fd);
+        return NULL;
+    }
+
+    char *eol = memchr(text.data, '\n', text.len);
+    size_t head = eol ? (size_t)(eol - text.data) : text.len;
+    text.data[head] = '\0';
+
+    if (matchStr(text.data, REQUEST_BUFFER))
+    {
+        /* The buffer follows the request line */
+        size_t skip = eol ? head + 1 : head;
+        memmove(text.data, text.data + skip, text.len - skip + 1);
+        text.len -= skip;
+
+        asmFile optAsm;
+
+        if (optimizeRequest(&text, NULL, &optAsm) != 0)
+        {
+            replyError(fd, REQUEST_BUFFER, errno);
+        }
+        else
+        {
+            if (writeAll(fd, REPLY_OK "\n", sizeof(REPLY_OK)) == 0)
+                emitAsm(fd, &optAsm);
+
+            freeAsmFile(optAsm);
+        }
+    }
+    else if (startWith(text.data, REQUEST_FILE " ") && strchr(text.data, '\t'))
+    {
+        char *input  = text.data + sizeof(REQUEST_FILE);
+        char *output = strchr(input, '\t');
+        struct stat st;
+        int err = 0;
+
+        *output++ = '\0';
+
+        /* The input is checked first for a precise reply */
+        if (stat(input, &st) != 0 || access(input, R_OK) != 0)
+            err = errno;
+        else if (!S_ISREG(st.st_mode))
+            err = EINVAL;
+
+        if (err)
+        {
+            replyError(fd, input, err);
+        }
+        else
+        {
+            textBuffer source = { NULL, 0, 0 };
+            asmFile optAsm;
+
+            if (optimizeRequest(&source, input, &optAsm) != 0)
+            {
+                replyError(fd, input, errno);
+            }
+            else
+            {
+                if (writeAsm(&optAsm, output) != 0)
+                    replyError(fd, output, errno);
+                else
+                    writeAll(fd, REPLY_OK "\n", sizeof(REPLY_OK));
+
+                freeAsmFile(optAsm);
+            }
+        }
+        freeText(text);
+    }
+    else
+    {
+        replyError(fd, text.data, EINVAL);
+        freeText(text);
+    }
+
+    close(fd);
+
+    return NULL;
+}
+
+/**
+ * @brief Remove the socket and exit (SIGINT, SIGTERM).
+ * @param sig The signal.
+ */
+static void stopServer(int sig)
+{
+    (void)sig;
+    unlink(servedPath);
+    _exit(0);
+}
+
+/**
+ * @brief Fill the address of a Unix domain socket.
+ * @param addr The address.
+ * @param socketPath The path of the socket.
+ */
+static void socketAddress(struct sockaddr_un *addr, const char *socketPath)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+
+    if (strlen(socketPath) >= sizeof(addr->sun_path))
+    {
+        fprintf(stderr, "%s: socket path too long.\n", socketPath);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(addr->sun_path, socketPath);
+}
+
+/**
+ * @brief Connect to a server.
+ * @param socketPath The path of the socket.
+ * @return The connection, or -1 if no server is listening.
+ */
+static int connectServer(const char *socketPath)
+{
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    socketAddress(&addr, socketPath);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * @brief Keep the optimizer resident and serve the requests sent on
+ * a Unix domain socket (see clientOptimize function), each connection
+ * is handled by its own thread. Never returns.
+ * @param socketPath The path of the socket.
+ * @param cache The cache (NULL if none).
+ * @param level The optimization level of the requests (see OPT_LEVEL_MAX).
+ */
+void serveOptimizer(const char *socketPath, optCache *cache, const int level)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    socketAddress(&addr, socketPath);
+
+    if ((fd = connectServer(socketPath)) >= 0)
+    {
+        fprintf(stderr, "%s: a server is already running.\n", socketPath);
+        exit(EXIT_FAILURE);
+    }
+    unlink(socketPath); // Stale socket
+
+    /* Only the user of the server can connect (see trustedPeer function) */
+    mode_t mask = umask(0177);
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+        || listen(fd, SOMAXCONN) != 0)
+    {
+        perror(socketPath);
+        exit(EXIT_FAILURE);
+    }
+    umask(mask);
+
+    servedPath  = socketPath;
+    servedCache = cache;
+    servedLevel = level;
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, stopServer);
+    signal(SIGTERM, stopServer);
+
+    if (verbosity())
+        fprintf(stderr, "serving on %s\n", socketPath);
+
+    for (;;)
+    {
+        int conn = accept(fd, NULL, NULL);
+        pthread_t thread;
+
+        if (conn < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            perror("accept");
+            exit(EXIT_FAILURE);
+        }
+        if (pthread_create(&thread, NULL, serveRequest, (void *)(intptr_t)conn) != 0)
+        {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(thread);
+    }
+}
+
+/**
+ * @brief Send a request to a server and wait for the reply.
+ * @param fd The connection (closed on return).
+ * @param head The request line.
+ * @param body The buffer following the request line (can be NULL).
+ * @param len The length of the buffer.
+ * @param reply The reply (allocated).
+ * @return 0 if the request is done, 1 otherwise (the reason is printed).
+ */
+static int sendRequest(const int fd, const char *head, const char *body, const size_t len, textBuffer *reply)
+{
+    if (writeAll(fd, head, strlen(head)) != 0 || (body && writeAll(fd, body, len) != 0)
+        || shutdown(fd, SHUT_WR) != 0 || readAll(fd, reply) != 0)
+    {
+        perror("client");
+        close(fd);
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+
+    if (!startWith(reply->data, REPLY_OK "\n"))
+    {
+        fprintf(stderr, "%s", reply->len ? reply->data : "server: no reply\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Optimize files through a server (see serveOptimizer function).
+ * Without output, the file (or stdin) is optimized to stdout, otherwise
+ * the server writes each input to its output: the output file, the file
+ * with the same name in the output directory (as in batch mode) or the
+ * input file itself.
+ * @param socketPath The path of the socket.
+ * @param inputs The input files.
+ * @param outdir The output directory (NULL if none).
+ * @param outfile The output file (NULL if none).
+ * @param inplace Rewrite the input files.
+ * @return 0 if done, 1 on error, -1 if no server is listening.
+ */
+int clientOptimize(const char *socketPath, const fileList *inputs, const char *outdir, const char *outfile,
+                   const int inplace)
+{
+    int fd = connectServer(socketPath);
+    textBuffer reply;
+
+    if (fd < 0)
+        return -1;
+
+    if (!outdir && !outfile && !inplace)
+    {
+        textBuffer text = loadText(inputs->used ? inputs->arr[0] : NULL);
+        int ret         = sendRequest(fd, REQUEST_BUFFER "\n", text.data, text.len, &reply);
+
+        if (!ret)
+            fwrite(reply.data + sizeof(REPLY_OK), 1, reply.len - sizeof(REPLY_OK), stdout);
+        freeText(text);
+        free(reply.data);
+
+        return ret;
+    }
+
+    /* The server does not share our working directory */
+    char dir[PATH_MAX];
+    if (outdir && !realpath(outdir, dir))
+    {
+        perror(outdir);
+        exit(EXIT_FAILURE);
+    }
+    if (outfile && outfile[0] != '/')
+    {
+        size_t len;
+        if (!getcwd(dir, sizeof(dir)) || (len = strlen(dir)) + strlen(outfile) + 2 > sizeof(dir))
+        {
+            perror(outfile);
+            exit(EXIT_FAILURE);
+        }
+        snprintf(dir + len, sizeof(dir) - len, "/%s", outfile);
+        outfile = dir;
+    }
+
+    for (size_t i = 0; i < inputs->used; i++)
+    {
+        char input[PATH_MAX];
+        char head[3 * PATH_MAX];
+
+        if (!realpath(inputs->arr[i], input))
+        {
+            perror(inputs->arr[i]);
+            exit(EXIT_FAILURE);
+        }
+        if (outdir)
+            snprintf(head, sizeof(head), REQUEST_FILE " %s\t%s/%s\n", input, dir, baseName(input));
+        else
+            snprintf(head, sizeof(head), REQUEST_FILE " %s\t%s\n", input, outfile ? outfile : input);
+
+        if (i > 0 && (fd = connectServer(socketPath)) < 0)
+        {
+            perror(socketPath);
+            exit(EXIT_FAILURE);
+        }
+        int ret = sendRequest(fd, head, NULL, 0, &reply);
+        free(reply.data);
+        if (ret)
+            return ret;
+    }
+
+    return 0;
+}
+
+#else
+
+void serveOptimizer(const char *socketPath, optCache *cache, const int level)
+{
+    (void)cache;
+    (void)level;
+    fprintf(stderr, "%s: the server is not supported on this platform.\n", socketPath);
+    exit(EXIT_FAILURE);
+}
+
+int clientOptimize(const char *socketPath, const fileList *inputs, const char *outdir, const char *outfile,
+                   const int inplace)
+{
+    (void)socketPath;
+    (void)inputs;
+    (void)outdir;
+    (void)outfile;
+    (void)inplace;
+
+    return -1;
+}
+
+#endif
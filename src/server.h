@@ -0,0 +1,31 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "batch.h"
+#include "cache.h"
+#include "helpers.h"
+#include "optimizer.h"
+
+/*!
+ * @brief Request: optimize the buffer following the request line,
+ * the optimized lines follow the reply line.
+ */
+#define REQUEST_BUFFER "OPTIMIZE"
+/*!
+ * @brief Request: optimize a file to another file ("FILE in\tout").
+ */
+#define REQUEST_FILE "FILE"
+/*!
+ * @brief Reply line of a request done.
+ */
+#define REPLY_OK "OK"
+/*!
+ * @brief Reply line of a request failed (followed by the reason).
+ */
+#define REPLY_ERROR "ERR"
+
+void serveOptimizer(const char *socketPath, optCache *cache, const int level);
+int clientOptimize(const char *socketPath, const fileList *inputs, const char *outdir, const char *outfile,
+                   const int inplace);
+
+#endif
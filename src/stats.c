@@ -0,0 +1,326 @@
+/*
+ * opt-65816 - Assembly code optimizer for the WDC 65816 processor.
+ *
+ * Description: Assembly code optimizer produced
+ * by the 816 Tiny C Compiler (816-tcc).
+ * This library is a C port of the 816-opt python tool.
+ *
+ * Author: kobenairb (kobenairb@gmail.com).
+ *
+ * Copyright (c) 2022.
+ *
+ * This project is released under the GNU Public License.
+ *
+ */
+
+#include "stats.h"
+
+#include <stdarg.h>
+#include <time.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+/*!
+ * @brief The names of the rules, by id (part of the report format:
+ * a name is never changed nor reused).
+ */
+static const char *const ruleNames[RULE_COUNT] = {
+    [RULE_STORE_REDUNDANT]     = "store-redundant",
+    [RULE_STXY_PUSH_CALL]      = "stxy-push-call",
+    [RULE_STXY_PUSH]           = "stxy-push",
+    [RULE_STXY_LOAD]           = "stxy-load",
+    [RULE_STA_LOAD]            = "sta-load",
+    [RULE_STA_LDXY_LOAD]       = "sta-ldxy-load",
+    [RULE_STA_PUSH_CALL]       = "sta-push-call",
+    [RULE_STA_PUSH]            = "sta-push",
+    [RULE_STA_PUSH_SWAP]       = "sta-push-swap",
+    [RULE_STA_CREMENT_2]       = "sta-crement-2",
+    [RULE_STA_CREMENT]         = "sta-crement",
+    [RULE_STA_LOAD_LOGIC]      = "sta-load-logic",
+    [RULE_STA_SEP_LOAD]        = "sta-sep-load",
+    [RULE_STA_TWICE]           = "sta-twice",
+    [RULE_STA_LOAD_XY]         = "sta-load-xy",
+    [RULE_STA_SKIP_LOAD]       = "sta-skip-load",
+    [RULE_STA_CLC_ADC]         = "sta-clc-adc",
+    [RULE_STA_ASL]             = "sta-asl",
+    [RULE_STACK_STA_LOAD]      = "stack-sta-load",
+    [RULE_LDX0_LONG]           = "ldx0-long",
+    [RULE_LDA_FAR_STORE]       = "lda-far-store",
+    [RULE_LDA0_STZ]            = "lda0-stz",
+    [RULE_LDA_SEP_STA]         = "lda-sep-sta",
+    [RULE_LDA_DEAD]            = "lda-dead",
+    [RULE_PREG_HIGH_WRITEBACK] = "preg-high-writeback",
+    [RULE_REORDER_32]          = "reorder-32",
+    [RULE_CMP_EQ_LOAD_IMM]     = "cmp-eq-load-imm",
+    [RULE_CMP_EQ_IMM]          = "cmp-eq-imm",
+    [RULE_CMP_ULT_LOAD_PREG]   = "cmp-ult-load-preg",
+    [RULE_CMP_SLT_IMM]         = "cmp-slt-imm",
+    [RULE_CMP_SLT_LOAD_PREG]   = "cmp-slt-load-preg",
+    [RULE_CMP_SLT_PREG]        = "cmp-slt-preg",
+    [RULE_REP_SEP]             = "rep-sep",
+    [RULE_SEP_PEA]             = "sep-pea",
+    [RULE_ADC_INC2]            = "adc-inc2",
+    [RULE_BRANCH_NEXT]         = "branch-next",
+    [RULE_JMP_BRA]             = "jmp-bra",
+    [RULE_BSS_WORD]            = "bss-word",
+    [RULE_CMP_ULE]             = "cmp-ule",
+    [RULE_CMP_ULE_LOAD]        = "cmp-ule-load",
+    [RULE_CMP_ULT]             = "cmp-ult",
+    [RULE_CMP_ULT_LOAD]        = "cmp-ult-load",
+    [RULE_CMP_UGE]             = "cmp-uge",
+    [RULE_CMP_UGE_LOAD]        = "cmp-uge-load",
+    [RULE_CMP_UGT]             = "cmp-ugt",
+    [RULE_CMP_UGT_LOAD]        = "cmp-ugt-load",
+    [RULE_CMP_SGT]             = "cmp-sgt",
+    [RULE_CMP_SGT_LOAD]        = "cmp-sgt-load",
+    [RULE_CMP_SLE]             = "cmp-sle",
+    [RULE_CMP_SLE_LOAD]        = "cmp-sle-load",
+    [RULE_CMP_SGE]             = "cmp-sge",
+    [RULE_CMP_SGE_LOAD]        = "cmp-sge-load",
+    [RULE_STORE_DEAD]          = "store-dead",
+    [RULE_MODE_SWITCH]         = "mode-switch",
+    [RULE_LOAD_KNOWN]          = "load-known",
+    [RULE_LOAD_TRANSFER]       = "load-transfer",
+    [RULE_STACK_DEAD]          = "stack-dead",
+    [RULE_FRAME_MERGE]         = "frame-merge",
+};
+
+/**
+ * @brief Read the monotonic clock.
+ * @return The time in nanoseconds.
+ */
+uint64_t nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * @brief Get the name of a rule.
+ * @param rule The rule.
+ * @return The name.
+ */
+const char *ruleName(const ruleId rule)
+{
+    return ruleNames[rule];
+}
+
+/**
+ * @brief Charge the time since the last rule to it, and start the
+ * clock of the next one (see ruleTry and ruleStop functions).
+ * @param clock The ruleClock structure.
+ * @param rule The next rule (-1 if none).
+ */
+void ruleTime(ruleClock *clock, const int rule)
+{
+    uint64_t now = nowNs();
+
+    if (clock->rule >= 0)
+        clock->stats->ns[clock->rule] += now - clock->last;
+    if (rule >= 0)
+        clock->stats->attempts[rule] += 1;
+    clock->rule = rule;
+    clock->last = now;
+}
+
+/**
+ * @brief Get the peak resident set size of the process.
+ * @return The size in KiB (0 if unknown).
+ */
+static size_t peakRss(void)
+{
+#ifndef _WIN32
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) == 0)
+#ifdef __APPLE__
+        return (size_t)ru.ru_maxrss / 1024; // In bytes on macOS
+#else
+        return (size_t)ru.ru_maxrss;
+#endif
+#endif
+    return 0;
+}
+
+/**
+ * @brief Add the report of a new pass.
+ * @param stats The optStats structure.
+ * @return The report of the pass (zeroed).
+ */
+passStats *statsPass(optStats *stats)
+{
+    if (stats->passes == stats->size)
+    {
+        size_t size   = stats->size ? 2 * stats->size : 8;
+        passStats *tmp = realloc(stats->pass, size * sizeof(passStats));
+        if (!tmp)
+            fatalError("realloc-stats");
+        stats->pass = tmp;
+        stats->size = size;
+    }
+    memset(&stats->pass[stats->passes], 0, sizeof(passStats));
+
+    return &stats->pass[stats->passes++];
+}
+
+/**
+ * @brief Add counters of the rules to others.
+ * @param to The counters updated.
+ * @param from The counters added.
+ */
+void statsAdd(ruleStats *to, const ruleStats *from)
+{
+    for (size_t r = 0; r < RULE_COUNT; r++)
+    {
+        to->attempts[r] += from->attempts[r];
+        to->hits[r] += from->hits[r];
+        to->ns[r] += from->ns[r];
+    }
+}
+
+/**
+ * @struct jsonBuffer
+ * @brief A report being written (see statsReport function).
+ * @var jsonBuffer::data
+ * Member 'data' contains the report.
+ * @var jsonBuffer::len
+ * Member 'len' contains the length of the report.
+ * @var jsonBuffer::size
+ * Member 'size' contains the number of bytes allocated.
+ */
+typedef struct jsonBuffer
+{
+    char *data;
+    size_t len;
+    size_t size;
+} jsonBuffer;
+
+/**
+ * @brief Append formatted text to a report.
+ * @param json The jsonBuffer structure.
+ * @param fmt The format (see printf function).
+ */
+static void jsonf(jsonBuffer *json, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    int n = vsnprintf(json->data + json->len, json->size - json->len, fmt, ap);
+    va_end(ap);
+
+    if (n >= 0 && (size_t)n >= json->size - json->len)
+    {
+        size_t size = json->size;
+        while (size - json->len <= (size_t)n)
+            size *= 2;
+        char *tmp = realloc(json->data, size);
+        if (!tmp)
+            fatalError("realloc-stats");
+        json->data = tmp;
+        json->size = size;
+
+        va_start(ap, fmt);
+        vsnprintf(json->data + json->len, json->size - json->len, fmt, ap);
+        va_end(ap);
+    }
+    if (n > 0)
+        json->len += (size_t)n;
+}
+
+/**
+ * @brief Append the counters of the rules to a report, as an array.
+ * @param json The jsonBuffer structure.
+ * @param rules The counters.
+ * @param all 0 to skip the rules never tried.
+ */
+static void jsonRules(jsonBuffer *json, const ruleStats *rules, const int all)
+{
+    const char *sep = "";
+
+    jsonf(json, "[");
+    for (size_t r = 0; r < RULE_COUNT; r++)
+    {
+        if (!all && !rules->attempts[r] && !rules->hits[r])
+            continue;
+        jsonf(json, "%s{\"id\":\"%s\",\"attempts\":%lu,\"hits\":%lu,\"ns\":%llu}", sep, ruleNames[r],
+              (unsigned long)rules->attempts[r], (unsigned long)rules->hits[r], (unsigned long long)rules->ns[r]);
+        sep = ",";
+    }
+    jsonf(json, "]");
+}
+
+/**
+ * @brief Write the report of an optimization, as one JSON object on
+ * one line (written at once, so the reports of threads are not mixed).
+ * @param fp The stream.
+ * @param name The name of the file (NULL if none).
+ * @param stats The optStats structure.
+ */
+void statsReport(FILE *fp, const char *name, const optStats *stats)
+{
+    jsonBuffer json = { malloc(4096), 0, 4096 };
+    uint64_t passes = 0;
+
+    if (!json.data)
+        fatalError("malloc-stats");
+
+    jsonf(&json, "{");
+    if (name)
+    {
+        jsonf(&json, "\"file\":\"");
+        for (const char *c = name; *c; c++)
+        {
+            if (*c == '"' || *c == '\\')
+                jsonf(&json, "\\%c", *c);
+            else if ((unsigned char)*c < 0x20)
+                jsonf(&json, "\\u%04x", (unsigned char)*c);
+            else
+                jsonf(&json, "%c", *c);
+        }
+        jsonf(&json, "\",");
+    }
+    for (size_t p = 0; p < stats->passes; p++)
+        passes += stats->pass[p].ns;
+
+    jsonf(&json, "\"lines_in\":%lu,\"lines_out\":%lu,\"cached\":%s,\"passes\":%lu,", (unsigned long)stats->linesIn,
+          (unsigned long)stats->linesOut, stats->cached ? "true" : "false", (unsigned long)stats->passes);
+    jsonf(&json, "\"time_ns\":{\"tidy\":%llu,\"bss\":%llu,\"passes\":%llu,\"emit\":%llu},",
+          (unsigned long long)stats->tidy, (unsigned long long)stats->bss, (unsigned long long)passes,
+          (unsigned long long)stats->emit);
+    jsonf(&json, "\"peak_rss_kb\":%lu,", (unsigned long)peakRss());
+    jsonf(&json, "\"rules\":");
+    jsonRules(&json, &stats->rules, 1);
+
+    jsonf(&json, ",\"pass\":[");
+    for (size_t p = 0; p < stats->passes; p++)
+    {
+        const passStats *ps = &stats->pass[p];
+
+        jsonf(&json, "%s{\"lines_in\":%lu,\"lines_out\":%lu,\"optimizations\":%lu,\"ns\":%llu,\"rules\":", p ? "," : "",
+              (unsigned long)ps->linesIn, (unsigned long)ps->linesOut, (unsigned long)ps->opted,
+              (unsigned long long)ps->ns);
+        jsonRules(&json, &ps->rules, 0);
+        jsonf(&json, "}");
+    }
+    jsonf(&json, "]}\n");
+
+    fwrite(json.data, 1, json.len, fp);
+    fflush(fp);
+    free(json.data);
+}
+
+/**
+ * @brief Free pointers.
+ * @param stats optStats structure.
+ */
+void freeStats(optStats *stats)
+{
+    free(stats->pass);
+    stats->pass   = NULL;
+    stats->passes = 0;
+    stats->size   = 0;
+}
@@ -0,0 +1,225 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "helpers.h"
+
+/**
+ * @brief The rewrite rules, with a stable id (see ruleName function).
+ * New rules are added at the end, before RULE_COUNT.
+ */
+typedef enum ruleId
+{
+    RULE_STORE_REDUNDANT,
+    RULE_STXY_PUSH_CALL,
+    RULE_STXY_PUSH,
+    RULE_STXY_LOAD,
+    RULE_STA_LOAD,
+    RULE_STA_LDXY_LOAD,
+    RULE_STA_PUSH_CALL,
+    RULE_STA_PUSH,
+    RULE_STA_PUSH_SWAP,
+    RULE_STA_CREMENT_2,
+    RULE_STA_CREMENT,
+    RULE_STA_LOAD_LOGIC,
+    RULE_STA_SEP_LOAD,
+    RULE_STA_TWICE,
+    RULE_STA_LOAD_XY,
+    RULE_STA_SKIP_LOAD,
+    RULE_STA_CLC_ADC,
+    RULE_STA_ASL,
+    RULE_STACK_STA_LOAD,
+    RULE_LDX0_LONG,
+    RULE_LDA_FAR_STORE,
+    RULE_LDA0_STZ,
+    RULE_LDA_SEP_STA,
+    RULE_LDA_DEAD,
+    RULE_PREG_HIGH_WRITEBACK,
+    RULE_REORDER_32,
+    RULE_CMP_EQ_LOAD_IMM,
+    RULE_CMP_EQ_IMM,
+    RULE_CMP_ULT_LOAD_PREG,
+    RULE_CMP_SLT_IMM,
+    RULE_CMP_SLT_LOAD_PREG,
+    RULE_CMP_SLT_PREG,
+    RULE_REP_SEP,
+    RULE_SEP_PEA,
+    RULE_ADC_INC2,
+    RULE_BRANCH_NEXT,
+    RULE_JMP_BRA,
+    RULE_BSS_WORD,
+    RULE_CMP_ULE,
+    RULE_CMP_ULE_LOAD,
+    RULE_CMP_ULT,
+    RULE_CMP_ULT_LOAD,
+    RULE_CMP_UGE,
+    RULE_CMP_UGE_LOAD,
+    RULE_CMP_UGT,
+    RULE_CMP_UGT_LOAD,
+    RULE_CMP_SGT,
+    RULE_CMP_SGT_LOAD,
+    RULE_CMP_SLE,
+    RULE_CMP_SLE_LOAD,
+    RULE_CMP_SGE,
+    RULE_CMP_SGE_LOAD,
+    RULE_STORE_DEAD,
+    RULE_MODE_SWITCH,
+    RULE_LOAD_KNOWN,
+    RULE_LOAD_TRANSFER,
+    RULE_STACK_DEAD,
+    RULE_FRAME_MERGE,
+    RULE_COUNT
+} ruleId;
+
+/**
+ * @struct ruleStats
+ * @brief The counters of the rules (see ruleClock).
+ * @var ruleStats::attempts
+ * Member 'attempts' contains the number of lines each rule has been tried on.
+ * @var ruleStats::hits
+ * Member 'hits' contains the number of rewrites of each rule.
+ * @var ruleStats::ns
+ * Member 'ns' contains the time spent in each rule (matching and rewriting).
+ */
+typedef struct ruleStats
+{
+    size_t attempts[RULE_COUNT];
+    size_t hits[RULE_COUNT];
+    uint64_t ns[RULE_COUNT];
+} ruleStats;
+
+/**
+ * @struct ruleClock
+ * @brief Time the rules tried on a line: the time between two rules is
+ * charged to the first one (see ruleTry function).
+ * @var ruleClock::stats
+ * Member 'stats' contains the counters (NULL when not measured).
+ * @var ruleClock::rule
+ * Member 'rule' contains the rule being tried (-1 if none).
+ * @var ruleClock::last
+ * Member 'last' contains the time it has been started.
+ */
+typedef struct ruleClock
+{
+    ruleStats *stats;
+    int rule;
+    uint64_t last;
+} ruleClock;
+
+/**
+ * @struct passStats
+ * @brief The report of an optimization pass.
+ * @var passStats::linesIn
+ * Member 'linesIn' contains the number of lines read by the pass.
+ * @var passStats::linesOut
+ * Member 'linesOut' contains the number of lines written by the pass.
+ * @var passStats::opted
+ * Member 'opted' contains the number of optimizations performed.
+ * @var passStats::ns
+ * Member 'ns' contains the wall time of the pass.
+ * @var passStats::rules
+ * Member 'rules' contains the counters of the rules.
+ */
+typedef struct passStats
+{
+    size_t linesIn;
+    size_t linesOut;
+    size_t opted;
+    uint64_t ns;
+    ruleStats rules;
+} passStats;
+
+/**
+ * @struct optStats
+ * @brief The report of an optimization (see statsReport function).
+ * @var optStats::linesIn
+ * Member 'linesIn' contains the number of lines once tidied.
+ * @var optStats::linesOut
+ * Member 'linesOut' contains the number of lines optimized.
+ * @var optStats::cached
+ * Member 'cached' is 1 if the output has been read from the cache.
+ * @var optStats::tidy
+ * Member 'tidy' contains the wall time of the tidying (see tidyText function).
+ * @var optStats::bss
+ * Member 'bss' contains the wall time of storeBss.
+ * @var optStats::emit
+ * Member 'emit' contains the wall time of the output.
+ * @var optStats::passes
+ * Member 'passes' contains the number of passes.
+ * @var optStats::size
+ * Member 'size' contains the number of passes allocated.
+ * @var optStats::pass
+ * Member 'pass' contains the report of each pass.
+ * @var optStats::rules
+ * Member 'rules' contains the counters of the rules of all the passes.
+ */
+typedef struct optStats
+{
+    size_t linesIn;
+    size_t linesOut;
+    int cached;
+    uint64_t tidy;
+    uint64_t bss;
+    uint64_t emit;
+    size_t passes;
+    size_t size;
+    passStats *pass;
+    ruleStats rules;
+} optStats;
+
+uint64_t nowNs(void);
+const char *ruleName(const ruleId rule);
+void ruleTime(ruleClock *clock, const int rule);
+passStats *statsPass(optStats *stats);
+void statsAdd(ruleStats *to, const ruleStats *from);
+void statsReport(FILE *fp, const char *name, const optStats *stats);
+void freeStats(optStats *stats);
+
+/**
+ * @brief Count an attempt of a rule, and start its clock (the rules
+ * are only measured with a report, the test is all they cost otherwise).
+ * @param clock The ruleClock structure.
+ * @param rule The rule.
+ */
+static inline void ruleTry(ruleClock *clock, const ruleId rule)
+{
+    if (clock->stats)
+        ruleTime(clock, (int)rule);
+}
+
+/**
+ * @brief Count an attempt of a rule tried with the previous one (their
+ * tests are shared, the time is charged to the first one).
+ * @param clock The ruleClock structure.
+ * @param rule The rule.
+ */
+static inline void ruleCount(ruleClock *clock, const ruleId rule)
+{
+    if (clock->stats)
+        clock->stats->attempts[rule] += 1;
+}
+
+/**
+ * @brief Count a rewrite of a rule.
+ * @param clock The ruleClock structure.
+ * @param rule The rule.
+ */
+static inline void ruleHit(ruleClock *clock, const ruleId rule)
+{
+    if (clock->stats)
+        clock->stats->hits[rule] += 1;
+}
+
+/**
+ * @brief Stop the clock of the rule being tried (the next line starts).
+ * @param clock The ruleClock structure.
+ */
+static inline void ruleStop(ruleClock *clock)
+{
+    if (clock->stats)
+        ruleTime(clock, -1);
+}
+
+#endif
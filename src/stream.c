@@ -0,0 +1,208 @@
+/*
+ * opt-65816 - Assembly code optimizer for the WDC 65816 processor.
+ *
+ * Description: Assembly code optimizer produced
+ * by the 816 Tiny C Compiler (816-tcc).
+ * This library is a C port of the 816-opt python tool.
+ *
+ * Author: kobenairb (kobenairb@gmail.com).
+ *
+ * Copyright (c) 2022.
+ *
+ * This project is released under the GNU Public License.
+ *
+ */
+
+#include "stream.h"
+
+/**
+ * @brief Read a line of any length (without its end of line).
+ * @param fp The stream.
+ * @param buf The buffer (grown if needed).
+ * @param size The size of the buffer.
+ * @return The line, or NULL at the end of the stream.
+ */
+static char *readLine(FILE *fp, char **buf, size_t *size)
+{
+    size_t len = 0;
+
+    if (!*buf)
+    {
+        *size = MAXLEN_LINE;
+        if ((*buf = malloc(*size)) == NULL)
+        {
+            perror("malloc-line");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    while (fgets(*buf + len, (int)(*size - len), fp))
+    {
+        len += strlen(*buf + len);
+        if (len > 0 && (*buf)[len - 1] == '\n')
+        {
+            (*buf)[len - 1] = '\0';
+            return *buf;
+        }
+        if (len + 1 < *size)
+            break; // Last line without end of line
+
+        char *tmp = realloc(*buf, *size * 2);
+        if (!tmp)
+        {
+            perror("realloc-line");
+            exit(EXIT_FAILURE);
+        }
+        *buf = tmp;
+        *size *= 2;
+    }
+    if (ferror(fp))
+    {
+        perror("stream");
+        exit(EXIT_FAILURE);
+    }
+
+    return len ? *buf : NULL;
+}
+
+/**
+ * @brief Add a line to the segment.
+ * @param seg The streamSegment structure.
+ * @param line The line.
+ */
+static void pushSegment(streamSegment *seg, const char *line)
+{
+    size_t len = strlen(line);
+
+    if (seg->text.len + len + 2 > seg->size)
+    {
+        size_t size = seg->size ? seg->size : READ_CHUNK;
+        while (seg->text.len + len + 2 > size)
+            size *= 2;
+
+        char *tmp = realloc(seg->text.data, size);
+        if (!tmp)
+        {
+            perror("realloc-segment");
+            exit(EXIT_FAILURE);
+        }
+        seg->text.data = tmp;
+        seg->size      = size;
+    }
+    memcpy(seg->text.data + seg->text.len, line, len);
+    seg->text.data[seg->text.len + len] = '\n';
+    seg->text.len += len + 1;
+    seg->lines += 1;
+}
+
+/**
+ * @brief Optimize a segment and write it. The last line of the segment
+ * can be a context line, the first line of the next segment: it is only
+ * there so the rules see the same next line as in the whole file.
+ * @param seg The streamSegment structure (emptied).
+ * @param context The context line (NULL if none).
+ * @param out The output stream.
+ * @param cache The cache (NULL if none).
+ * @param level The optimization level (see OPT_LEVEL_MAX).
+ * @return 1 if the context line has been dropped (it starts the next
+ * segment), 0 if a rule has consumed it (it is written).
+ */
+static int flushSegment(streamSegment *seg, const char *context, FILE *out, optCache *cache, const int level)
+{
+    seg->text.data[seg->text.len] = '\0';
+
+    asmFile file   = tidyText(seg->text);
+    asmFile optAsm = optimizeCached(file, cache, 0, 1, level, NULL);
+    size_t used    = optAsm.used;
+    int dropped    = 0;
+
+    if (context && used > 0 && matchStr(optAsm.arr[used - 1], context))
+    {
+        used -= 1;
+        dropped = 1;
+    }
+    optAsm.used = used;
+    fflush(out); // Nothing is buffered, the lines bypass it
+    if (emitAsm(fileno(out), &optAsm) != 0)
+    {
+        perror("stream");
+        exit(EXIT_FAILURE);
+    }
+
+    freeAsmFile(optAsm);
+    seg->text  = (textBuffer){ NULL, 0, 0 };
+    seg->size  = 0;
+    seg->lines = 0;
+
+    return dropped;
+}
+
+/**
+ * @brief Optimize a file in bounded memory, writing the output while
+ * the input is read. The file is cut in segments, after each end of
+ * section (one per function in the 816-tcc output), or at the first
+ * label once a section is longer than STREAM_WINDOW lines, and each
+ * segment is optimized on its own. The rules never see across a cut
+ * (branches to another segment, the bss symbols of another segment,
+ * preg high scans), so the output can be less optimized than in the
+ * default mode.
+ * @param path The file path, NULL for stdin.
+ * @param cache The cache (NULL if none).
+ * @param verbose The level of verbosity (see verbosity function).
+ * @param level The optimization level (see OPT_LEVEL_MAX).
+ */
+void optimizeStream(const char *path, optCache *cache, const size_t verbose, const int level)
+{
+    FILE *fp = path ? fopen(path, "rb") : stdin;
+    streamSegment seg = { { NULL, 0, 0 }, 0, 0 };
+    char *buf = NULL, *line;
+    size_t size = 0, segments = 0, peak = 0;
+    int cut     = 0; // The last line has ended a section
+
+    if (!fp)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    while ((line = readLine(fp, &buf, &size)) != NULL)
+    {
+        /* Same as tidyText: comments are removed before trimming */
+        if (startWith(line, ASM_COMMENT))
+            continue;
+        line = trimWhiteSpace(line);
+
+        asmLine ins;
+        parseLine(line, &ins);
+
+        if (cut || (seg.lines >= STREAM_WINDOW && ins.kind == LINE_LABEL))
+        {
+            pushSegment(&seg, line);
+            if (seg.lines > peak)
+                peak = seg.lines;
+            segments += 1;
+            if (!flushSegment(&seg, line, stdout, cache, level))
+            {
+                cut = 0;
+                continue; // The context line has been written
+            }
+        }
+        pushSegment(&seg, line);
+        cut = matchStr(line, SECTION_END);
+    }
+
+    if (seg.lines)
+    {
+        if (seg.lines > peak)
+            peak = seg.lines;
+        segments += 1;
+        flushSegment(&seg, NULL, stdout, cache, level);
+    }
+
+    if (verbose)
+        fprintf(stderr, "%lu segments optimized (%lu lines at most)\n", segments, peak);
+
+    free(buf);
+    if (fp != stdin)
+        fclose(fp);
+}
@@ -0,0 +1,35 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "cache.h"
+#include "helpers.h"
+#include "optimizer.h"
+#include "output.h"
+
+/*!
+ * @brief Number of lines after which a section is cut at the next label
+ * in stream mode (see optimizeStream function).
+ */
+#define STREAM_WINDOW 4096
+
+/**
+ * @struct streamSegment
+ * @brief The lines read since the last cut, tidied, one per line
+ * (see optimizeStream function).
+ * @var streamSegment::text
+ * Member 'text' contains the lines.
+ * @var streamSegment::size
+ * Member 'size' contains the number of bytes allocated.
+ * @var streamSegment::lines
+ * Member 'lines' contains the number of lines.
+ */
+typedef struct streamSegment
+{
+    textBuffer text;
+    size_t size;
+    size_t lines;
+} streamSegment;
+
+void optimizeStream(const char *path, optCache *cache, const size_t verbose, const int level);
+
+#endif
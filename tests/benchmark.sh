@@ -0,0 +1,74 @@
+#!/bin/bash
+
+# Measure the throughput of the optimizer over the samples, and over
+# units scaled up from them (see tests/scale.sh), to spot the rules
+# whose cost grows faster than the input.
+# Usage: tests/benchmark.sh [binary] [runs]
+# BENCH_SCALES: the factors of the scaled units ("10 100" by default,
+# "" for none), BENCH_CSV: the results (bench.csv by default).
+# The line scanners are then compared on the same files (tests/tidybench).
+
+BIN="${1:-./816-opt}"
+RUNS="${2:-5}"
+SCALES="${BENCH_SCALES-10 100}"
+CSV="${BENCH_CSV:-bench.csv}"
+
+export OPT816_QUIET=1
+unset OPT816_CACHE_DIR OPT816_CACHE_MAX # A cache hit runs no pass
+
+if [ ! -x "${BIN}" ]; then
+    echo "${BIN} not found, build it first (make)." >&2
+    exit 1
+fi
+
+UNITS=$(mktemp -d /tmp/bench_XXXXXX)
+trap 'rm -rf "${UNITS}"' EXIT
+
+REV=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+
+echo -e "\n==> Perform benchmark (${BIN}, ${RUNS} runs)...\n"
+
+printf "%-45s %9s %10s %12s %6s %10s\n" "file" "lines" "median us" "lines/s" "passes" "peak KiB"
+echo "rev,file,lines,runs,median_us,lines_per_s,passes,peak_rss_kb" >"${CSV}"
+
+# Median time of the runs, then the passes and the peak RSS of one more
+# run reporting them (see --stats=json, not timed: it measures the rules).
+bench() {
+    local file="$1" name="$2" lines times ns stats passes rss
+
+    lines=$(($(wc -l <"${file}")))
+    times=()
+    for ((r = 0; r < RUNS; r++)); do
+        start=$(date +%s%N)
+        "${BIN}" "${file}" >/dev/null
+        end=$(date +%s%N)
+        times+=($((end - start)))
+    done
+    ns=$(printf "%s\n" "${times[@]}" | sort -n | sed -n "$((RUNS / 2 + 1))p")
+
+    stats=$("${BIN}" --stats=json "${file}" 2>&1 >/dev/null)
+    passes=$(echo "${stats}" | sed -n 's/.*"cached":[a-z]*,"passes":\([0-9]*\).*/\1/p')
+    rss=$(echo "${stats}" | sed -n 's/.*"peak_rss_kb":\([0-9]*\).*/\1/p')
+
+    printf "%-45s %9d %10d %12d %6d %10d\n" "${name}" "${lines}" \
+        $((ns / 1000)) $((lines * 1000000000 / (ns > 0 ? ns : 1))) "${passes:-0}" "${rss:-0}"
+    echo "${REV},${name},${lines},${RUNS},$((ns / 1000)),$((lines * 1000000000 / (ns > 0 ? ns : 1))),${passes:-0},${rss:-0}" >>"${CSV}"
+}
+
+for file in tests/samples/*.ps; do
+    bench "${file}" "${file}"
+done
+
+for factor in ${SCALES}; do
+    tests/scale.sh "${factor}" "${UNITS}/scale-${factor}x.ps" || exit 1
+    bench "${UNITS}/scale-${factor}x.ps" "scale-${factor}x"
+done
+
+echo -e "\nResults written to ${CSV}"
+
+if [ -x tests/tidybench ]; then
+    echo -e "\n==> Perform tidy microbenchmark (${RUNS} runs)...\n"
+
+    shopt -s nullglob
+    tests/tidybench -n "${RUNS}" tests/samples/libc_c.ps "${UNITS}"/scale-*.ps || exit 1
+fi
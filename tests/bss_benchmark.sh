@@ -0,0 +1,53 @@
+#!/bin/bash
+
+# Measure the bss rewrite (lda.l/sta.l -> lda.w/sta.w) on a synthetic
+# unit declaring many bss symbols.
+# Usage: tests/bss_benchmark.sh [binary] [symbols] [runs]
+
+BIN="${1:-./816-opt}"
+SYMBOLS="${2:-5000}"
+RUNS="${3:-5}"
+
+export OPT816_QUIET=1
+
+if [ ! -x "${BIN}" ]; then
+    echo "${BIN} not found, build it first (make)." >&2
+    exit 1
+fi
+
+UNIT=$(mktemp /tmp/bss_XXXXXX.ps)
+trap 'rm -f "${UNIT}"' EXIT
+
+# One bss block with all the symbols, then a function accessing
+# each of them (and as many non-bss long addresses).
+awk -v n="${SYMBOLS}" 'BEGIN {
+    print ".RAMSECTION \".bss\" BANK $7e SLOT 2"
+    for (i = 0; i < n; i++)
+        printf "bss_sym%d dsb 2\n", i
+    print ".ENDS"
+    print ""
+    print ".SECTION \".text_0x0\" SUPERFREE"
+    print "bss_touch:"
+    for (i = 0; i < n; i++) {
+        printf "lda.l bss_sym%d + 0\n", i
+        printf "sta.l rom_sym%d + 0\n", i
+    }
+    print "rtl"
+    print ".ENDS"
+}' >"${UNIT}"
+
+lines=$(wc -l <"${UNIT}")
+
+echo -e "\n==> Perform bss benchmark (${BIN}, ${SYMBOLS} symbols, ${RUNS} runs)...\n"
+
+start=$(date +%s%N)
+for ((r = 0; r < RUNS; r++)); do
+    "${BIN}" "${UNIT}" >/dev/null
+done
+end=$(date +%s%N)
+
+ns=$(((end - start) / RUNS))
+
+printf "%-45s %8s %10s %12s\n" "file" "lines" "us" "lines/s"
+printf "%-45s %8d %10d %12d\n" "bss (${SYMBOLS} symbols)" "${lines}" \
+    $((ns / 1000)) $((lines * 1000000000 / (ns > 0 ? ns : 1)))
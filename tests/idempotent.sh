@@ -30,3 +30,392 @@ for file in tests/samples/*.ps; do
         exit 1
     fi
 done
+
+echo -e "\n==> Perform batch tests...\n"
+
+outdir=$(mktemp -d)
+trap 'rm -rf "${outdir}"' EXIT
+
+OPT816_QUIET=1 ./816-opt -j 4 -o "${outdir}" tests/samples/*.ps || exit 1
+
+for file in tests/samples/*.ps; do
+    echo -n "$file "
+
+    if OPT816_QUIET=1 ./816-opt "${file}" | diff - "${outdir}/$(basename "${file}")" >/dev/null 2>&1; then
+        echo "[PASS]"
+    else
+        echo "[FAIL]"
+        exit 1
+    fi
+done
+
+# A file which cannot be read or written fails the batch, not the others
+samples=(tests/samples/*.ps)
+last=$(basename "${samples[-1]}")
+mkdir -p "${outdir}/fail/$(basename "${samples[0]}")"
+echo -n "failed files "
+
+if ! OPT816_QUIET=1 ./816-opt -j 4 -o "${outdir}/fail" "${samples[@]}" "${outdir}/missing.ps" 2>/dev/null &&
+    [ "$(ls "${outdir}/fail" | wc -l)" = "${#samples[@]}" ] && diff "${outdir}/fail/${last}" "${outdir}/${last}" >/dev/null; then
+    echo "[PASS]"
+else
+    echo "[FAIL]"
+    exit 1
+fi
+
+echo -e "\n==> Perform output tests...\n"
+
+# -o writes a single file, -i rewrites a copy of the input.
+mkdir "${outdir}/inplace"
+cp tests/samples/*.ps "${outdir}/inplace"
+OPT816_QUIET=1 ./816-opt -j 4 -i "${outdir}"/inplace/*.ps || exit 1
+
+for file in tests/samples/*.ps; do
+    echo -n "$file "
+
+    name=$(basename "${file}")
+    OPT816_QUIET=1 ./816-opt "${file}" -o "${outdir}/${name}.out" || exit 1
+
+    if diff "${outdir}/${name}.out" "${outdir}/${name}" >/dev/null 2>&1 &&
+        diff "${outdir}/inplace/${name}" "${outdir}/${name}" >/dev/null 2>&1; then
+        echo "[PASS]"
+        rm -f "${outdir}/${name}.out"
+    else
+        echo "[FAIL]"
+        exit 1
+    fi
+done
+
+echo -e "\n==> Perform stats tests...\n"
+
+# The report is one line of JSON on stderr, the output is not changed.
+for file in tests/samples/*.ps; do
+    echo -n "$file "
+
+    name=$(basename "${file}")
+    ./816-opt -j 2 --stats=json "${file}" 2>"${outdir}/${name}.json" | diff - "${outdir}/${name}" >/dev/null 2>&1
+    status=$?
+
+    if [ ${status} -eq 0 ] && [ "$(wc -l <"${outdir}/${name}.json")" -eq 1 ] &&
+        grep -q '^{"lines_in":[0-9]*,.*"rules":\[{"id":"store-redundant",.*"pass":\[.*\]}$' "${outdir}/${name}.json"; then
+        echo "[PASS]"
+        rm -f "${outdir}/${name}.json"
+    else
+        echo "[FAIL]"
+        exit 1
+    fi
+done
+
+echo -e "\n==> Perform library tests...\n"
+
+# Each file is optimized from memory by several threads at once.
+mkdir "${outdir}/library"
+./tests/library "${outdir}/library" tests/samples/*.ps || exit 1
+
+for file in tests/samples/*.ps; do
+    echo -n "$file "
+
+    if diff "${outdir}/library/$(basename "${file}")" "${outdir}/$(basename "${file}")" >/dev/null 2>&1; then
+        echo "[PASS]"
+    else
+        echo "[FAIL]"
+        exit 1
+    fi
+done
+
+echo -e "\n==> Perform scanner tests...\n"
+
+# Every line scanner supported cuts the lines as the scalar one, also
+# around the white spaces, comments and NUL bytes, and across blocks.
+{
+    printf 'lda.b tcc__r0\r\n\tsta.b tcc__r1 \t\n ; indented\n;comment\n\n   \n\v\f\r\n'
+    printf 'lda #1\0 ignored \n%0100d  \n' 0
+    for ((n = 1; n <= 70; n++)); do
+        printf '%*s\n' "${n}" x
+    done
+    printf '  no newline  '
+} >"${outdir}/scan.ps"
+
+for file in tests/samples/*.ps "${outdir}/scan.ps"; do
+    echo -n "$file "
+
+    if ./tests/tidybench -n 1 "${file}" >/dev/null; then
+        echo "[PASS]"
+    else
+        echo "[FAIL]"
+        exit 1
+    fi
+done
+
+echo -e "\n==> Perform cache tests...\n"
+
+# The first run fills the cache, the second one reads it.
+for run in fill hit; do
+    for file in tests/samples/*.ps; do
+        echo -n "$file (${run}) "
+
+        if OPT816_QUIET=1 OPT816_CACHE_DIR="${outdir}/cache" ./816-opt "${file}" | diff - "${outdir}/$(basename "${file}")" >/dev/null 2>&1; then
+            echo "[PASS]"
+        else
+            echo "[FAIL]"
+            exit 1
+        fi
+    done
+done
+
+# The eviction only removes the entries: a file of the user stays.
+mkdir "${outdir}/evict"
+head -c 3000000 /dev/zero >"${outdir}/evict/user.bin"
+
+echo -n "${outdir}/evict "
+
+if OPT816_QUIET=1 OPT816_CACHE_DIR="${outdir}/evict" OPT816_CACHE_MAX=1 ./816-opt tests/samples/libc_c.ps >/dev/null &&
+    [ "$(wc -c <"${outdir}/evict/user.bin")" -eq 3000000 ] && [ "$(ls "${outdir}/evict" | wc -l)" -eq 2 ]; then
+    echo "[PASS]"
+else
+    echo "[FAIL]"
+    exit 1
+fi
+
+echo -e "\n==> Perform level tests...\n"
+
+# -O2 adds the rules not in 816-opt: its output is stable, and it is
+# cached apart from the output of the default level.
+for file in tests/samples/*.ps; do
+    echo -n "$file "
+
+    name=$(basename "${file}")
+    OPT816_QUIET=1 ./816-opt -O2 "${file}" -o "${outdir}/${name}.O2" || exit 1
+
+    if OPT816_QUIET=1 ./816-opt -O2 "${outdir}/${name}.O2" | diff - "${outdir}/${name}.O2" >/dev/null 2>&1 &&
+        OPT816_QUIET=1 OPT816_CACHE_DIR="${outdir}/cache" ./816-opt -O 2 "${file}" | diff - "${outdir}/${name}.O2" >/dev/null 2>&1; then
+        echo "[PASS]"
+        rm -f "${outdir}/${name}.O2"
+    else
+        echo "[FAIL]"
+        exit 1
+    fi
+done
+
+# The same on generated inputs: splices of the lines of the samples, a
+# reordering left by the last pass must not be taken up by the next run.
+echo -n "splices of the samples "
+
+for ((seed = 1; seed <= 500; seed++)); do
+    awk -v seed="${seed}" '{ l[NR] = $0 }
+        END {
+            srand(seed)
+            for (k = 0; k < 200; k++) {
+                from = int(rand() * NR) + 1
+                to   = from + int(rand() * 40)
+                for (n = from; n <= to && n <= NR; n++)
+                    print l[n]
+            }
+        }' tests/samples/*.ps >"${outdir}/splice.ps"
+
+    OPT816_QUIET=1 ./816-opt -O2 "${outdir}/splice.ps" -o "${outdir}/splice.O2" || exit 1
+    if ! OPT816_QUIET=1 ./816-opt -O2 "${outdir}/splice.O2" | diff - "${outdir}/splice.O2" >/dev/null 2>&1; then
+        echo "[FAIL] (seed ${seed})"
+        exit 1
+    fi
+done
+echo "[PASS]"
+
+echo -e "\n==> Perform dead store tests...\n"
+
+# -O2 removes the first store to tcc__r1, written again on both paths
+# before it is read; the stores to tcc__r2 are read by the loop (the
+# rep repeated are mode switch tests).
+printf '%s\n' 'rep #$20' 'lda.w #1' 'sta.b tcc__r1' 'lda.b tcc__r0' 'beq +' 'rep #$20' 'lda.w #2' \
+    'sta.b tcc__r1' 'bra ++' '+' 'rep #$20' 'stz.b tcc__r1' '++' 'lda.b tcc__r1' 'sta.w x + 0' 'rep #$20' \
+    'lda.w #3' 'sta.b tcc__r2' '-' 'lda.b tcc__r2' 'dec a' 'sta.b tcc__r2' 'bne -' 'rtl' >"${outdir}/dead.ps"
+
+echo -n "${outdir}/dead.ps "
+
+if OPT816_QUIET=1 ./816-opt "${outdir}/dead.ps" >"${outdir}/dead.O1" &&
+    OPT816_QUIET=1 ./816-opt -O2 "${outdir}/dead.ps" | diff "${outdir}/dead.O1" - | grep -qx '< sta.b tcc__r1' &&
+    [ "$(OPT816_QUIET=1 ./816-opt -O2 "${outdir}/dead.ps" | diff "${outdir}/dead.O1" - | grep -v 'rep #' | grep -c '^[<>]')" = 1 ]; then
+    echo "[PASS]"
+else
+    echo "[FAIL]"
+    exit 1
+fi
+
+echo -e "\n==> Perform mode switch tests...\n"
+
+# -O2 keeps the accumulator 8 bits wide across the pea.w, which do not
+# depend on it, and removes the rep already done on the path.
+printf '%s\n' '.accu 16' '.index 16' 'sep #$20' 'lda #1' 'pha' 'rep #$20' 'pea.w 0' 'sep #$20' 'lda #2' 'pha' \
+    'rep #$20' 'lda.w #3' 'beq +' 'rep #$20' 'sta.w x + 0' '+' 'rtl' >"${outdir}/mode.ps"
+
+echo -n "${outdir}/mode.ps "
+
+if OPT816_QUIET=1 ./816-opt -O2 "${outdir}/mode.ps" >"${outdir}/mode.O2" &&
+    [ "$(grep -c '^rep #\$20$' "${outdir}/mode.O2")" = 1 ] && [ "$(grep -c '^sep #\$20$' "${outdir}/mode.O2")" = 1 ] &&
+    grep -qx 'lda #2' "${outdir}/mode.O2" && grep -qx 'pea.w 0' "${outdir}/mode.O2"; then
+    echo "[PASS]"
+else
+    echo "[FAIL]"
+    exit 1
+fi
+
+echo -e "\n==> Perform value tests...\n"
+
+# -O2 turns the loads of a value already in a register into transfers,
+# and removes the one already in the accumulator whose flags are not read.
+printf '%s\n' '.accu 16' '.index 16' 'f:' 'rep #$20' 'lda.b tcc__r0' 'sta.w y + 0' 'ldx.b tcc__r0' 'lda.w #1' \
+    'sta.l z + 0' 'lda.w #1' 'sta.l z + 2' 'ldy.b tcc__r1' 'lda.b tcc__r1' 'sta.l z + 4' "lda.b tcc__r0 ; DON'T OPTIMIZE" \
+    'bne +' 'lda.w #1' 'sta.l z + 6' '+' 'rtl' >"${outdir}/value.ps"
+
+echo -n "${outdir}/value.ps "
+
+if OPT816_QUIET=1 ./816-opt -O2 "${outdir}/value.ps" >"${outdir}/value.O2" &&
+    grep -qx 'tax' "${outdir}/value.O2" && grep -qx 'tya' "${outdir}/value.O2" &&
+    [ "$(grep -c '^lda.w #1$' "${outdir}/value.O2")" = 2 ] && grep -qx "lda.b tcc__r0 ; DON'T OPTIMIZE" "${outdir}/value.O2"; then
+    echo "[PASS]"
+else
+    echo "[FAIL]"
+    exit 1
+fi
+
+# The labels are not followed: an interrupt handler may update them.
+printf '%s\n' '.accu 16' '.index 16' 'f:' 'rep #$20' 'lda.w snes_vblank_count' 'sta.b tcc__r0' \
+    'lda.w snes_vblank_count' 'sta.b tcc__r1' 'ldx.w pad_keys' 'lda.w pad_keys' 'sta.b tcc__r2' 'stz.b tcc__r3' 'rtl' >"${outdir}/global.ps"
+
+echo -n "${outdir}/global.ps "
+
+if OPT816_QUIET=1 ./816-opt -O2 "${outdir}/global.ps" >"${outdir}/global.O2" &&
+    [ "$(grep -c '^lda.w snes_vblank_count$' "${outdir}/global.O2")" = 2 ] && grep -qx 'lda.w pad_keys' "${outdir}/global.O2"; then
+    echo "[PASS]"
+else
+    echo "[FAIL]"
+    exit 1
+fi
+
+echo -e "\n==> Perform stack tests...\n"
+
+# -O2 removes the store to 3 + L + 1,s written again after the pha, and
+# the load of the same slot after the pea.w; the store read by the pla stays.
+printf '%s\n' '.accu 16' '.index 16' 'f:' 'rep #$20' 'lda.b tcc__r0' 'sta 3 + L + 1,s' 'pha' 'lda.b tcc__r1' \
+    'sta 5 + L + 1,s' 'pea.w 0' 'lda 7 + L + 1,s' 'sta.l z + 0' 'lda.b tcc__r2' 'sta 1,s' 'pla' 'sta 1,s' 'pla' 'rtl' >"${outdir}/stack.ps"
+
+echo -n "${outdir}/stack.ps "
+
+if OPT816_QUIET=1 ./816-opt -O2 "${outdir}/stack.ps" >"${outdir}/stack.O2" &&
+    ! grep -q '^sta 3 + L + 1,s$' "${outdir}/stack.O2" && ! grep -q '^lda 7 + L + 1,s$' "${outdir}/stack.O2" &&
+    grep -qx 'sta 5 + L + 1,s' "${outdir}/stack.O2" && [ "$(grep -c '^sta 1,s$' "${outdir}/stack.O2")" = 2 ]; then
+    echo "[PASS]"
+else
+    echo "[FAIL]"
+    exit 1
+fi
+
+echo -e "\n==> Perform frame tests...\n"
+
+# -O2 pulls the 2 bytes of the first call with a pla, and adds the pla
+# and the cleanup of the second one to the epilogue (__f_locals is 8).
+printf '%s\n' '.define __f_locals 8' '.accu 16' '.index 16' 'f:' '.ifgr __f_locals 0' 'tsa' 'sec' 'sbc #__f_locals' 'tas' \
+    '.endif' 'pea.w 1' 'jsr.l g' 'tsa' 'clc' 'adc #2' 'tas' 'pea.w 2' 'pea.w 3' 'jsr.l g' 'pla' 'tsa' 'clc' 'adc #2' 'tas' \
+    '.ifgr __f_locals 0' 'tsa' 'clc' 'adc #__f_locals' 'tas' '.endif' 'rtl' >"${outdir}/frame.ps"
+
+echo -n "${outdir}/frame.ps "
+
+if OPT816_QUIET=1 ./816-opt -O2 "${outdir}/frame.ps" >"${outdir}/frame.O2" &&
+    [ "$(grep -c '^pla$' "${outdir}/frame.O2")" = 1 ] && [ "$(grep -c '^tas$' "${outdir}/frame.O2")" = 2 ] &&
+    grep -qx 'sbc #__f_locals' "${outdir}/frame.O2" && grep -qx 'adc #12' "${outdir}/frame.O2"; then
+    echo "[PASS]"
+else
+    echo "[FAIL]"
+    exit 1
+fi
+
+echo -e "\n==> Perform stream tests...\n"
+
+# The bss section comes last, so the stream mode keeps the long addresses
+# of the symbols declared there (the others must be the same).
+function f_bss {
+    awk 'NR == FNR {
+            sub(/^[ \t]+/, "")
+            if ($0 ~ /^\.RAMSECTION ".bss"/)
+                bss = 1
+            else if ($0 ~ /^\.ENDS/)
+                bss = 0
+            else if (bss)
+                sym[$1] = 1
+            next
+        }
+        /^(lda|sta)\.l / && ($2 in sym) { sub(/\.l /, ".w ") }
+        { print }' "$1" -
+}
+
+for file in tests/samples/*.ps; do
+    echo -n "$file "
+
+    if diff <(OPT816_QUIET=1 ./816-opt --stream <"${file}" | f_bss "${file}") <(f_bss "${file}" <"${outdir}/$(basename "${file}")") >/dev/null 2>&1; then
+        echo "[PASS]"
+    else
+        echo "[FAIL]"
+        exit 1
+    fi
+done
+
+if [ "${OS}" != "Windows_NT" ]; then
+    echo -e "\n==> Perform server tests...\n"
+
+    socket="${outdir}/opt.sock"
+    (umask 000 && OPT816_QUIET=1 exec ./816-opt --serve "${socket}") &
+    server=$!
+    trap 'kill ${server} 2>/dev/null; rm -rf "${outdir}"' EXIT
+
+    for ((r = 0; r < 50; r++)); do
+        [ -S "${socket}" ] && break
+        sleep 0.1
+    done
+
+    for file in tests/samples/*.ps; do
+        echo -n "$file "
+
+        if OPT816_QUIET=1 ./816-opt --client "${socket}" "${file}" | diff - "${outdir}/$(basename "${file}")" >/dev/null 2>&1; then
+            echo "[PASS]"
+        else
+            echo "[FAIL]"
+            exit 1
+        fi
+    done
+
+    # Only the user of the server can connect
+    echo -n "socket mode "
+
+    if [ "$(stat -c %a "${socket}")" = 600 ]; then
+        echo "[PASS]"
+    else
+        echo "[FAIL]"
+        exit 1
+    fi
+
+    # Several inputs need an output, as without server
+    echo -n "several inputs without output "
+
+    if ! OPT816_QUIET=1 ./816-opt --client "${socket}" tests/samples/*.ps >"${outdir}/several.out" 2>/dev/null &&
+        [ ! -s "${outdir}/several.out" ]; then
+        echo "[PASS]"
+    else
+        echo "[FAIL]"
+        exit 1
+    fi
+
+    # A request failing (the input cannot be read) must not stop the server
+    if [ -e /proc/self/mem ]; then
+        file="$(ls tests/samples/*.ps | head -n 1)"
+        echo -n "failed request "
+
+        if ! OPT816_QUIET=1 ./816-opt --client "${socket}" -o "${outdir}/mem.ps" /proc/self/mem 2>/dev/null \
+            && kill -0 "${server}" 2>/dev/null \
+            && OPT816_QUIET=1 ./816-opt --client "${socket}" "${file}" | diff - "${outdir}/$(basename "${file}")" >/dev/null 2>&1; then
+            echo "[PASS]"
+        else
+            echo "[FAIL]"
+            exit 1
+        fi
+    fi
+fi
@@ -0,0 +1,165 @@
+/*
+ * opt-65816 - Assembly code optimizer for the WDC 65816 processor.
+ *
+ * Description: Check of libopt65816: each file is optimized from
+ * memory by several threads at once (one context per thread, and one
+ * context shared by all threads), the outputs must be the same.
+ * The output of each file is written with the same name in the
+ * output directory, to be compared with the command line.
+ *
+ * usage: library <outdir> <filename>...
+ *
+ * This project is released under the GNU Public License.
+ *
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "opt65816.h"
+
+/*!
+ * @brief Number of threads optimizing each file.
+ */
+#define THREADS 4
+
+/**
+ * @struct libraryRun
+ * @brief The input of a thread and its outputs.
+ */
+typedef struct libraryRun
+{
+    const char *in;
+    size_t len;
+    opt65816_ctx *shared;
+    char *out[2];
+    size_t outlen[2];
+    int ret;
+} libraryRun;
+
+/**
+ * @brief Optimize the input with a context of its own, then with the
+ * shared context.
+ * @param arg The libraryRun structure.
+ * @return NULL.
+ */
+static void *optimizeRun(void *arg)
+{
+    libraryRun *run   = arg;
+    opt65816_ctx *ctx = opt65816_new();
+
+    run->ret = opt65816_optimize(ctx, run->in, run->len, &run->out[0], &run->outlen[0]);
+    if (run->ret == OPT65816_OK)
+        run->ret = opt65816_optimize(run->shared, run->in, run->len, &run->out[1], &run->outlen[1]);
+    opt65816_free(ctx);
+
+    return NULL;
+}
+
+/**
+ * @brief Read a whole file.
+ * @param path The file path.
+ * @param len The length of the file.
+ * @return The content (allocated), or NULL on error.
+ */
+static char *readFile(const char *path, size_t *len)
+{
+    FILE *fp = fopen(path, "rb");
+    char *buf;
+
+    if (!fp)
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    *len = (size_t)ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    if ((buf = malloc(*len + 1)) != NULL && fread(buf, 1, *len, fp) != *len)
+    {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(fp);
+
+    return buf;
+}
+
+int main(int argc, char **argv)
+{
+    opt65816_ctx *shared = opt65816_new();
+    char *out;
+    size_t outlen;
+
+    if (argc < 3 || !shared)
+    {
+        fprintf(stderr, "usage: %s <outdir> <filename>...\n", argv[0]);
+        return 1;
+    }
+
+    /* Errors are return codes */
+    if (opt65816_optimize(shared, NULL, 1, &out, &outlen) != OPT65816_EINVAL
+        || opt65816_set_jobs(shared, 0) != OPT65816_EINVAL || opt65816_set_stats(NULL, stderr) != OPT65816_EINVAL
+        || opt65816_set_level(shared, OPT65816_LEVEL_MAX + 1) != OPT65816_EINVAL)
+    {
+        fprintf(stderr, "invalid arguments accepted\n");
+        return 1;
+    }
+
+    for (int i = 2; i < argc; i++)
+    {
+        libraryRun runs[THREADS];
+        pthread_t threads[THREADS];
+        size_t len;
+        char *in = readFile(argv[i], &len);
+
+        if (!in)
+        {
+            perror(argv[i]);
+            return 1;
+        }
+
+        for (int t = 0; t < THREADS; t++)
+        {
+            runs[t] = (libraryRun){ in, len, shared, { NULL, NULL }, { 0, 0 }, 0 };
+            pthread_create(&threads[t], NULL, optimizeRun, &runs[t]);
+        }
+        for (int t = 0; t < THREADS; t++)
+            pthread_join(threads[t], NULL);
+
+        for (int t = 0; t < THREADS; t++)
+        {
+            for (int k = 0; k < 2; k++)
+            {
+                if (runs[t].ret != OPT65816_OK || runs[t].outlen[k] != runs[0].outlen[0]
+                    || memcmp(runs[t].out[k], runs[0].out[0], runs[0].outlen[0]) != 0)
+                {
+                    fprintf(stderr, "%s: %s, or outputs differ\n", argv[i], opt65816_strerror(runs[t].ret));
+                    return 1;
+                }
+            }
+        }
+
+        const char *name = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1 : argv[i];
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", argv[1], name);
+
+        FILE *fp = fopen(path, "w");
+        if (!fp || fwrite(runs[0].out[0], 1, runs[0].outlen[0], fp) != runs[0].outlen[0])
+        {
+            perror(path);
+            return 1;
+        }
+        fclose(fp);
+
+        for (int t = 0; t < THREADS; t++)
+        {
+            free(runs[t].out[0]);
+            free(runs[t].out[1]);
+        }
+        free(in);
+    }
+    opt65816_free(shared);
+
+    return 0;
+}
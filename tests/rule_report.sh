@@ -0,0 +1,65 @@
+#!/bin/bash
+
+# Sum the hits of each rule over the samples, one column per
+# optimization level, to compare what the levels remove (the stores
+# removed across the blocks are "store-dead", the ones of 816-opt
+# "store-redundant", see --stats=json).
+# Usage: tests/rule_report.sh [binary] [levels]
+# levels: the optimization levels compared ("1 2" by default).
+
+BIN="${1:-./816-opt}"
+LEVELS="${2:-1 2}"
+
+export OPT816_QUIET=1
+unset OPT816_CACHE_DIR OPT816_CACHE_MAX # A cache hit runs no pass
+
+if [ ! -x "${BIN}" ]; then
+    echo "${BIN} not found, build it first (make)." >&2
+    exit 1
+fi
+
+REPORT=$(mktemp /tmp/rules_XXXXXX)
+trap 'rm -f "${REPORT}"' EXIT
+
+# One "level rule hits" line per rule and file, then "level lines in out"
+for level in ${LEVELS}; do
+    for file in tests/samples/*.ps; do
+        "${BIN}" -O "${level}" --stats=json "${file}" 2>&1 >/dev/null |
+            sed -e 's/,"pass":.*//' -e 's/},{/}\n{/g' |
+            awk -v level="${level}" '
+                /"lines_in"/ {
+                    match($0, /"lines_in":[0-9]+/); lin = substr($0, RSTART + 11, RLENGTH - 11)
+                    match($0, /"lines_out":[0-9]+/); lout = substr($0, RSTART + 12, RLENGTH - 12)
+                    print level, "lines", lin, lout
+                }
+                /"id":"/ {
+                    match($0, /"id":"[^"]*"/); id = substr($0, RSTART + 6, RLENGTH - 7)
+                    match($0, /"hits":[0-9]+/); hits = substr($0, RSTART + 7, RLENGTH - 7)
+                    print level, id, hits
+                }'
+    done
+done >"${REPORT}"
+
+awk -v levels="${LEVELS}" '
+    {
+        if ($2 == "lines") { lin[$1] += $3; lout[$1] += $4; next }
+        if (!($2 in seen)) { seen[$2] = 1; order[n++] = $2 }
+        hits[$1, $2] += $3
+    }
+    END {
+        nl = split(levels, lv, " ")
+        printf "%-22s", "rule"
+        for (l = 1; l <= nl; l++) printf " %10s", "-O" lv[l]
+        printf "\n"
+        for (r = 0; r < n; r++) {
+            any = 0
+            for (l = 1; l <= nl; l++) any += hits[lv[l], order[r]]
+            if (!any) continue
+            printf "%-22s", order[r]
+            for (l = 1; l <= nl; l++) printf " %10d", hits[lv[l], order[r]]
+            printf "\n"
+        }
+        printf "%-22s", "lines removed"
+        for (l = 1; l <= nl; l++) printf " %10d", lin[lv[l]] - lout[lv[l]]
+        printf "\n"
+    }' "${REPORT}"
@@ -0,0 +1,96 @@
+#!/bin/bash
+
+# Build a synthetic unit scaled up from real ones: the functions, data
+# and bss of each source are replicated, with every symbol they define
+# renamed in each copy (foo -> foo_c1, foo_c2, ...), so the labels stay
+# unique and the rules see a realistic unit, only larger.
+# Usage: tests/scale.sh <factor> <output> [source.ps...]
+# (sources: tests/samples/libc_c.ps and tests/samples/breakout.ps by default)
+
+FACTOR="$1"
+OUTPUT="$2"
+
+if [[ ! "${FACTOR}" =~ ^[1-9][0-9]*$ ]] || [ -z "${OUTPUT}" ]; then
+    echo "usage: $0 <factor> <output> [source.ps...]" >&2
+    exit 1
+fi
+shift 2
+
+if [ $# -eq 0 ]; then
+    set -- tests/samples/libc_c.ps tests/samples/breakout.ps
+fi
+
+# First, each source becomes a template where the symbols it defines
+# (labels, .define, ramsection entries) end with "_@"; then the template
+# is written once per copy, "@" being replaced by the copy number.
+awk -v factor="${FACTOR}" '
+function template(line,    out, word, prev, n)
+{
+    # Words are runs of symbol characters, comments are left as is
+    out = ""
+    while (line != "") {
+        if (substr(line, 1, 1) == ";") {
+            out = out line
+            break
+        }
+        if (match(line, /^[A-Za-z0-9_.$]+/)) {
+            word = substr(line, 1, RLENGTH)
+            line = substr(line, RLENGTH + 1)
+            # ",s" ",x" ",y" are addressing modes, not symbols
+            if (word in defined && !(prev == "," && word ~ /^[sxy]$/))
+                word = word "_@"
+            out = out word
+            prev = ""
+            continue
+        }
+        prev = substr(line, 1, 1)
+        out = out prev
+        line = substr(line, 2)
+    }
+    return out
+}
+
+FNR == 1 {
+    nfiles += 1
+    header = 1
+    ram = 0
+}
+
+# The header is written once, before all the copies
+header && /^\.(include|accu|index|16bit)/ {
+    if (nfiles == 1)
+        head[++nhead] = $0
+    next
+}
+
+{
+    header = 0
+    body[nfiles, ++lines[nfiles]] = $0
+}
+
+/^\.RAMSECTION/ { ram = 1; next }
+/^\.ENDS/       { ram = 0; next }
+
+ram && $2 == "dsb"                   { defined[$1] = 1 }
+/^\.define /                         { defined[$2] = 1 }
+/^[A-Za-z_.][A-Za-z0-9_.]*:/         { defined[substr($0, 1, index($0, ":") - 1)] = 1 }
+
+END {
+    for (h = 1; h <= nhead; h++)
+        print head[h]
+
+    for (f = 1; f <= nfiles; f++)
+        for (l = 1; l <= lines[f]; l++)
+            body[f, l] = template(body[f, l])
+
+    for (c = 1; c <= factor; c++) {
+        for (f = 1; f <= nfiles; f++) {
+            for (l = 1; l <= lines[f]; l++) {
+                line = body[f, l]
+                if (index(line, "_@"))
+                    gsub(/_@/, "_c" c, line)
+                print line
+            }
+        }
+    }
+}' "$@" >"${OUTPUT}"
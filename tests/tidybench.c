@@ -0,0 +1,101 @@
+/*
+ * opt-65816 - Assembly code optimizer for the WDC 65816 processor.
+ *
+ * Description: Microbenchmark of the line scanner (see scan.h): each
+ * file is tidied with every instruction set supported, the lines must
+ * be the ones of the scalar scanner (the reference). The best time of
+ * the runs is reported for each.
+ *
+ * usage: tidybench [-n runs] <filename>...
+ *
+ * This project is released under the GNU Public License.
+ *
+ */
+
+#include "optimizer.h"
+#include "scan.h"
+
+/**
+ * @brief Tidy a copy of a text.
+ * @param text The text.
+ * @param len The length of the text.
+ * @param isa The instruction set.
+ * @param ns The time of the scan, in nanoseconds.
+ * @return The asmFile structure (its copy of the text is owned).
+ */
+static asmFile tidyCopy(const char *text, const size_t len, const scanIsa isa, uint64_t *ns)
+{
+    textBuffer copy = { malloc(len + 1), len, 0 };
+
+    if (copy.data == NULL)
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(copy.data, text, len);
+
+    uint64_t start = nowNs();
+    asmFile file   = scanText(copy.data, len, isa);
+    *ns            = nowNs() - start;
+    file.text      = copy;
+
+    return file;
+}
+
+int main(int argc, char **argv)
+{
+    int runs = 10;
+    int i    = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-n") == 0)
+    {
+        runs = atoi(argv[2]);
+        i    = 3;
+    }
+    if (i >= argc || runs < 1)
+    {
+        fprintf(stderr, "usage: %s [-n runs] <filename>...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    printf("%-45s %-7s %9s %12s %10s\n", "file", "isa", "lines", "ns/line", "MB/s");
+
+    for (; i < argc; i++)
+    {
+        textBuffer text = loadText(argv[i]);
+        uint64_t ns;
+        asmFile ref = tidyCopy(text.data, text.len, SCAN_SCALAR, &ns);
+
+        for (scanIsa isa = SCAN_SCALAR; isa <= scanSupported(); isa++)
+        {
+            uint64_t best = UINT64_MAX;
+
+            for (int r = 0; r < runs; r++)
+            {
+                asmFile file = tidyCopy(text.data, text.len, isa, &ns);
+
+                if (ns < best)
+                    best = ns;
+
+                int same = file.used == ref.used;
+                for (size_t l = 0; same && l < file.used; l++)
+                    same = strcmp(file.arr[l], ref.arr[l]) == 0;
+                freeAsmFile(file);
+
+                if (!same)
+                {
+                    fprintf(stderr, "%s: the %s scanner differs from the scalar one.\n", argv[i], scanName(isa));
+                    return EXIT_FAILURE;
+                }
+            }
+
+            printf("%-45s %-7s %9lu %12.2f %10.1f\n", argv[i], scanName(isa), (unsigned long)ref.used,
+                   ref.used ? (double)best / ref.used : 0.0, best ? text.len * 1e3 / best : 0.0);
+        }
+
+        freeAsmFile(ref);
+        freeText(text);
+    }
+
+    return EXIT_SUCCESS;
+}
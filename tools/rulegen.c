@@ -0,0 +1,971 @@
+/*
+ * opt-65816 - Assembly code optimizer for the WDC 65816 processor.
+ *
+ * Description: Generator of the rule matcher. The rules of a fixed shape
+ * are described in src/rules.opt (see the format there), and compiled
+ * into a C matcher (see rules.h): the rules are dispatched on the
+ * mnemonic of their first line, then an automaton reads the next lines
+ * once for all of them. Each line is classed by its mnemonic, and each
+ * different test of a line is evaluated once, so a line costs the same
+ * whatever the number of rules reading it.
+ *
+ * usage: rulegen <rules.opt> <rules.c> [sources...]
+ * The digest of the rule file and of the sources given is written too,
+ * so the cached outputs of another build are not used (see cacheKey).
+ *
+ * Author: kobenairb (kobenairb@gmail.com).
+ *
+ * Copyright (c) 2022.
+ *
+ * This project is released under the GNU Public License.
+ *
+ */
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*!
+ * @brief Maximum length of a line of the rule file.
+ */
+#define MAXLEN_RULE 256
+
+/*!
+ * @brief Maximum number of lines of a pattern or a replacement
+ * (the lines read by a rule must fit in LOOKAHEAD_PAD).
+ */
+#define MAX_LINES 32
+
+/*!
+ * @brief Maximum number of rules.
+ */
+#define MAX_RULES 256
+
+/*!
+ * @brief Maximum number of rules starting with the same mnemonic
+ * (one bit each in the state of the automaton).
+ */
+#define MAX_GROUP 64
+
+/**
+ * @struct patternLine
+ * @brief A line of a pattern.
+ * @var patternLine::text
+ * Member 'text' contains the line, or its prefix.
+ * @var patternLine::prefix
+ * Member 'prefix' is 1 if the line only has to start with the text.
+ * @var patternLine::guard
+ * Member 'guard' is 1 if the line must not match.
+ * @var patternLine::capture
+ * Member 'capture' contains the name of the rest of the line ("" if none).
+ */
+typedef struct patternLine
+{
+    char text[MAXLEN_RULE];
+    int prefix;
+    int guard;
+    char capture[MAXLEN_RULE];
+} patternLine;
+
+/**
+ * @struct ruleDef
+ * @brief A rule of the rule file.
+ * @var ruleDef::id
+ * Member 'id' contains the id of the rule.
+ * @var ruleDef::line
+ * Member 'line' contains the line of the rule in the rule file.
+ * @var ruleDef::level
+ * Member 'level' contains the optimization level enabling the rule.
+ * @var ruleDef::pattern
+ * Member 'pattern' contains the lines matched.
+ * @var ruleDef::count
+ * Member 'count' contains the number of lines of the pattern.
+ * @var ruleDef::matched
+ * Member 'matched' contains the number of lines replaced (guards excluded).
+ * @var ruleDef::replacement
+ * Member 'replacement' contains the lines written.
+ * @var ruleDef::written
+ * Member 'written' contains the number of lines written.
+ */
+typedef struct ruleDef
+{
+    char id[MAXLEN_RULE];
+    int line;
+    int level;
+    patternLine pattern[MAX_LINES];
+    int count;
+    int matched;
+    char replacement[MAX_LINES][MAXLEN_RULE];
+    int written;
+} ruleDef;
+
+/**
+ * @struct ruleGroup
+ * @brief The rules starting with the same mnemonic, matched together by
+ * one automaton (see writeGroup function).
+ * @var ruleGroup::mnemonic
+ * Member 'mnemonic' contains the mnemonic of their first line (MN_ enum).
+ * @var ruleGroup::rules
+ * Member 'rules' contains the rules, in order (the rule k is the bit k of
+ * the state).
+ * @var ruleGroup::count
+ * Member 'count' contains the number of rules.
+ */
+typedef struct ruleGroup
+{
+    char mnemonic[MAXLEN_RULE];
+    int rules[MAX_GROUP];
+    int count;
+} ruleGroup;
+
+/**
+ * @struct lineTest
+ * @brief A test of a line, shared by the rules reading the same text there.
+ * @var lineTest::test
+ * Member 'test' contains the test (see patternLine, its guard flag ignored).
+ * @var lineTest::pass
+ * Member 'pass' contains the rules going on if the line passes the test.
+ * @var lineTest::fail
+ * Member 'fail' contains the rules stopped if the line passes the test (guards).
+ * @var lineTest::mnemonic
+ * Member 'mnemonic' contains the mnemonic of the lines which can pass the
+ * test ("" if not known).
+ */
+typedef struct lineTest
+{
+    const patternLine *test;
+    uint64_t pass;
+    uint64_t fail;
+    char mnemonic[MAXLEN_RULE];
+} lineTest;
+
+/*!
+ * @brief The rules read.
+ */
+static ruleDef rules[MAX_RULES];
+
+/*!
+ * @brief Number of rules read.
+ */
+static int nrules = 0;
+
+/*!
+ * @brief The rules, by mnemonic of their first line.
+ */
+static ruleGroup groups[MAX_RULES];
+
+/*!
+ * @brief Number of groups of rules.
+ */
+static int ngroups = 0;
+
+/*!
+ * @brief The rule file (for the messages).
+ */
+static const char *source;
+
+/*!
+ * @brief The generated file (removed on error).
+ */
+static const char *target;
+
+/*!
+ * @brief Digest of the rule file and of the sources (FNV-1a, see hashFile function).
+ */
+static uint64_t digest = 14695981039346656037ULL;
+
+/**
+ * @brief Print an error of the rule file, and exit.
+ * @param line The line of the error.
+ * @param fmt The message (see printf function).
+ */
+static void ruleError(const int line, const char *fmt, ...)
+{
+    va_list ap;
+
+    fprintf(stderr, "%s:%d: ", source, line);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+
+    if (target)
+        remove(target);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Remove the blanks around a line.
+ * @param str The line (modified).
+ * @return The line trimmed.
+ */
+static char *trim(char *str)
+{
+    size_t len;
+
+    while (isspace((unsigned char)*str))
+        str++;
+    len = strlen(str);
+    while (len && isspace((unsigned char)str[len - 1]))
+        str[--len] = '\0';
+
+    return str;
+}
+
+/**
+ * @brief Parse a line of a pattern.
+ * @param rule The rule.
+ * @param str The line.
+ * @param line The line in the rule file.
+ */
+static void parsePattern(ruleDef *rule, char *str, const int line)
+{
+    patternLine *pl;
+    char *open;
+
+    if (rule->count == MAX_LINES)
+        ruleError(line, "pattern longer than %d lines", MAX_LINES);
+    pl = &rule->pattern[rule->count++];
+
+    if (*str == '!')
+    {
+        pl->guard = 1;
+        str       = trim(str + 1);
+    }
+    else if (rule->count > 1 && rule->pattern[rule->count - 2].guard)
+        ruleError(line, "the guards come after the lines matched");
+    else
+        rule->matched = rule->count;
+
+    if ((open = strchr(str, '{')) != NULL)
+    {
+        size_t len = strlen(open);
+
+        if (open[len - 1] != '}' || strchr(open + 1, '{') || strchr(open, '}') != open + len - 1)
+            ruleError(line, "a capture ends the line: %s", str);
+        *open     = '\0';
+        pl->prefix = 1;
+        snprintf(pl->capture, sizeof(pl->capture), "%.*s", (int)(len - 2), open + 1);
+
+        for (int p = 0; *pl->capture && p < rule->count - 1; p++)
+        {
+            if (strcmp(rule->pattern[p].capture, pl->capture) == 0)
+                ruleError(line, "capture {%s} already defined", pl->capture);
+        }
+        if (*pl->capture && pl->guard)
+            ruleError(line, "a guard captures nothing");
+    }
+    snprintf(pl->text, sizeof(pl->text), "%s", str);
+}
+
+/**
+ * @brief Check a line of a replacement.
+ * @param rule The rule (its pattern complete).
+ * @param str The line.
+ * @param line The line in the rule file.
+ */
+static void checkReplacement(const ruleDef *rule, const char *str, const int line)
+{
+    if (*str == '@')
+    {
+        char *end;
+        long n = strtol(str + 1, &end, 10);
+
+        if (end == str + 1 || *end || n < 0 || n >= rule->matched)
+            ruleError(line, "no line %s in the pattern", str);
+        return;
+    }
+
+    for (const char *open = strchr(str, '{'); open; open = strchr(open + 1, '{'))
+    {
+        const char *close = strchr(open, '}');
+        int found         = 0;
+
+        if (!close || close == open + 1)
+            ruleError(line, "bad capture in %s", str);
+        for (int p = 0; p < rule->matched; p++)
+        {
+            const char *name = rule->pattern[p].capture;
+            if (strlen(name) == (size_t)(close - open - 1) && strncmp(name, open + 1, strlen(name)) == 0)
+                found = 1;
+        }
+        if (!found)
+            ruleError(line, "unknown capture in %s", str);
+    }
+}
+
+/**
+ * @brief Read the rule file.
+ * @param path The rule file.
+ */
+static void readRules(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    char buf[MAXLEN_RULE];
+    ruleDef *rule = NULL;
+    int inReplacement = 0;
+    int line          = 0;
+
+    if (!fp)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    while (fgets(buf, sizeof(buf), fp))
+    {
+        char *str = trim(buf);
+        line += 1;
+
+        if (!*str || *str == '#')
+            continue;
+
+        if (!rule)
+        {
+            char *level;
+
+            if (strncmp(str, "rule ", 5) != 0)
+                ruleError(line, "\"rule <id> [level <n>]\" expected");
+            if (nrules == MAX_RULES)
+                ruleError(line, "more than %d rules", MAX_RULES);
+
+            rule  = &rules[nrules++];
+            str   = trim(str + 5);
+            level = str + strcspn(str, " \t");
+            snprintf(rule->id, sizeof(rule->id), "%.*s", (int)(level - str), str);
+            rule->line    = line;
+            rule->level   = 1;
+            inReplacement = 0;
+
+            /* The rules not in 816-opt are enabled by a level (see OPT_LEVEL_MAX) */
+            if (*(level = trim(level)))
+            {
+                char *end;
+
+                if (strncmp(level, "level ", 6) != 0 || (rule->level = (int)strtol(level + 6, &end, 10)) < 1 ||
+                    *end || end == level + 6)
+                    ruleError(line, "\"rule <id> [level <n>]\" expected");
+            }
+
+            for (const char *c = rule->id; *c; c++)
+            {
+                if (!islower((unsigned char)*c) && !isdigit((unsigned char)*c) && *c != '-')
+                    ruleError(line, "bad rule id %s", rule->id);
+            }
+            for (int r = 0; r < nrules - 1; r++)
+            {
+                if (strcmp(rules[r].id, rule->id) == 0)
+                    ruleError(line, "rule %s already defined", rule->id);
+            }
+        }
+        else if (strcmp(str, "=>") == 0 && !inReplacement)
+        {
+            if (!rule->matched)
+                ruleError(line, "empty pattern");
+            inReplacement = 1;
+        }
+        else if (strcmp(str, "end") == 0 && inReplacement)
+            rule = NULL;
+        else if (inReplacement)
+        {
+            if (rule->written == MAX_LINES)
+                ruleError(line, "replacement longer than %d lines", MAX_LINES);
+            checkReplacement(rule, str, line);
+            snprintf(rule->replacement[rule->written++], MAXLEN_RULE, "%s", str);
+        }
+        else
+            parsePattern(rule, str, line);
+    }
+    fclose(fp);
+
+    if (rule)
+        ruleError(line, "rule %s not ended", rule->id);
+}
+
+/**
+ * @brief Get the mnemonic of the first line of a rule.
+ * @param rule The rule.
+ * @param mn The mnemonic, in upper case (MN_ enum).
+ * @param size The size of mn.
+ */
+static void ruleMnemonic(const ruleDef *rule, char *mn, const size_t size)
+{
+    const patternLine *first = &rule->pattern[0];
+    size_t len               = strcspn(first->text, ". ");
+
+    if (len == 0 || len + 4 > size || (first->prefix && first->text[len] == '\0'))
+        ruleError(rule->line, "the first line of %s starts with a mnemonic", rule->id);
+
+    snprintf(mn, size, "MN_");
+    for (size_t c = 0; c < len; c++)
+        mn[3 + c] = (char)toupper((unsigned char)first->text[c]);
+    mn[3 + len] = '\0';
+}
+
+/**
+ * @brief Check if two tests are the same.
+ * @param a A test.
+ * @param b Another test.
+ * @return 1 (true) or 0 (false).
+ */
+static int sameTest(const patternLine *a, const patternLine *b)
+{
+    return a->prefix == b->prefix && a->guard == b->guard && strcmp(a->text, b->text) == 0;
+}
+
+/**
+ * @brief Sort the rules by mnemonic of their first line (the rules of
+ * different mnemonics cannot match the same lines), and check that each
+ * rule can apply.
+ */
+static void groupRules(void)
+{
+    char mn[MAXLEN_RULE];
+
+    for (int r = 0; r < nrules; r++)
+    {
+        ruleGroup *group;
+        int g;
+
+        ruleMnemonic(&rules[r], mn, sizeof(mn));
+        for (g = 0; g < ngroups && strcmp(groups[g].mnemonic, mn) != 0; g++)
+            ;
+        if (g == ngroups)
+            snprintf(groups[ngroups++].mnemonic, MAXLEN_RULE, "%s", mn);
+        group = &groups[g];
+        if (group->count == MAX_GROUP)
+            ruleError(rules[r].line, "more than %d rules start with %s", MAX_GROUP, mn);
+
+        /* A rule matching the first lines of this one, at the same level or lower */
+        for (int k = 0; k < group->count; k++)
+        {
+            const ruleDef *first = &rules[group->rules[k]];
+            int l;
+
+            if (first->level > rules[r].level || first->count > rules[r].count)
+                continue;
+            for (l = 0; l < first->count && sameTest(&first->pattern[l], &rules[r].pattern[l]); l++)
+                ;
+            if (l == first->count)
+                ruleError(rules[r].line, "rule %s never applies (rule %s applies first)", rules[r].id, first->id);
+        }
+        group->rules[group->count++] = r;
+    }
+}
+
+/**
+ * @brief Get the mnemonic of the lines which can pass a test, the way
+ * the parser reads it (see parseLine function).
+ * @param test The test.
+ * @param mn The mnemonic, in upper case (MN_ enum).
+ * @param size The size of mn.
+ * @return 1 if found, 0 if the lines can have different mnemonics.
+ */
+static int testMnemonic(const patternLine *test, char *mn, const size_t size)
+{
+    static const char *const aliases[] = { "tas", "tsa", "tad", "tda", "swa", "dea", "ina" };
+    const char *p = test->text;
+    size_t len    = strlen(p);
+
+    /* Labels and directives */
+    if (*p == '+' || *p == '-')
+    {
+        while (*p == test->text[0])
+            p++;
+        if (!*p && test->prefix)
+            return 0;
+        if (*p != ' ')
+        {
+            snprintf(mn, size, "MN_NONE");
+            return 1;
+        }
+        p++;
+    }
+    else if (*p == '.' || (!test->prefix && len && p[len - 1] == ':'))
+    {
+        snprintf(mn, size, "MN_NONE");
+        return 1;
+    }
+
+    /* Instructions: 3 lowercase letters, a width, then a space or the end */
+    if (strlen(p) < 3 || !islower((unsigned char)p[0]) || !islower((unsigned char)p[1]) ||
+        !islower((unsigned char)p[2]))
+        return 0;
+    for (size_t a = 0; a < sizeof(aliases) / sizeof(aliases[0]); a++)
+    {
+        if (strncmp(p, aliases[a], 3) == 0)
+            return 0;
+    }
+    len = 3;
+    if (p[3] == '.' && strchr("bwl", p[4]) && p[4])
+        len = 5;
+    if ((p[len] != ' ' && p[len] != '\0') || (test->prefix && p[len] == '\0'))
+        return 0;
+
+    snprintf(mn, size, "MN_%c%c%c", toupper((unsigned char)p[0]), toupper((unsigned char)p[1]),
+             toupper((unsigned char)p[2]));
+    return 1;
+}
+
+/**
+ * @brief Write a string in a C string literal.
+ * @param fp The output.
+ * @param str The string.
+ * @param len The length of the string.
+ * @param format 1 if the literal is a printf format.
+ */
+static void writeEscaped(FILE *fp, const char *str, const size_t len, const int format)
+{
+    for (size_t c = 0; c < len; c++)
+    {
+        if (str[c] == '"' || str[c] == '\\')
+            fputc('\\', fp);
+        if (str[c] == '%' && format)
+            fputc('%', fp);
+        fputc(str[c], fp);
+    }
+}
+
+/**
+ * @brief Write the test of a line.
+ * @param fp The output.
+ * @param test The test.
+ * @param depth The index of the line after the first one.
+ */
+static void writeTest(FILE *fp, const patternLine *test, const int depth)
+{
+    fprintf(fp, "%s(file->arr[i", test->prefix ? "startWith" : "matchStr");
+    if (depth)
+        fprintf(fp, " + %d", depth);
+    fprintf(fp, "], \"");
+    writeEscaped(fp, test->text, strlen(test->text), 0);
+    fprintf(fp, "\")");
+}
+
+/**
+ * @brief Write the replacement of a rule, once matched.
+ * @param fp The output.
+ * @param rule The rule.
+ * @param indent The indentation.
+ */
+static void writeReplacement(FILE *fp, const ruleDef *rule, const int indent)
+{
+    fprintf(fp, "%*s/* %s */\n", indent, "", rule->id);
+
+    for (int l = 0; l < rule->written; l++)
+    {
+        const char *str = rule->replacement[l];
+
+        if (*str == '@')
+        {
+            if (atoi(str + 1))
+                fprintf(fp, "%*scopyLine(out, file, i + %d);\n", indent, "", atoi(str + 1));
+            else
+                fprintf(fp, "%*scopyLine(out, file, i);\n", indent, "");
+            continue;
+        }
+        if (!strchr(str, '{'))
+        {
+            fprintf(fp, "%*spushLine(out, \"", indent, "");
+            writeEscaped(fp, str, strlen(str), 0);
+            fprintf(fp, "\");\n");
+            continue;
+        }
+
+        /* The captures are the end of the lines matched */
+        fprintf(fp, "%*ssnprintf(buf, sizeof(buf), \"", indent, "");
+        for (const char *c = str; *c;)
+        {
+            size_t len = strcspn(c, "{");
+
+            writeEscaped(fp, c, len, 1);
+            c += len;
+            if (*c == '{')
+            {
+                fprintf(fp, "%%s");
+                c = strchr(c, '}') + 1;
+            }
+        }
+        fprintf(fp, "\"");
+        for (const char *open = strchr(str, '{'); open; open = strchr(open + 1, '{'))
+        {
+            size_t len = (size_t)(strchr(open, '}') - open - 1);
+
+            for (int p = 0; p < rule->matched; p++)
+            {
+                const patternLine *pl = &rule->pattern[p];
+                if (strlen(pl->capture) == len && strncmp(pl->capture, open + 1, len) == 0)
+                    fprintf(fp, ", file->arr[i + %d] + %lu", p, (unsigned long)strlen(pl->text));
+            }
+        }
+        fprintf(fp, ");\n%*spushLine(out, buf);\n", indent, "");
+    }
+
+    fprintf(fp, "%s%*sruleHit(clock, RULE_", rule->written ? "\n" : "", indent, "");
+    for (const char *c = rule->id; *c; c++)
+        fputc(*c == '-' ? '_' : toupper((unsigned char)*c), fp);
+    fprintf(fp, ");\n%*sreturn %d;\n", indent, "", rule->matched);
+}
+
+/**
+ * @brief Write the rule id of the stats (RULE_ enum).
+ * @param fp The output.
+ * @param r The index of the rule.
+ */
+static void writeRuleId(FILE *fp, const int r)
+{
+    fprintf(fp, "RULE_");
+    for (const char *c = rules[r].id; *c; c++)
+        fputc(*c == '-' ? '_' : toupper((unsigned char)*c), fp);
+}
+
+/**
+ * @brief Write the name of the rules of a mnemonic ("ldxRules").
+ * @param fp The output.
+ * @param group The rules.
+ */
+static void writeGroupName(FILE *fp, const ruleGroup *group)
+{
+    for (const char *c = group->mnemonic + 3; *c; c++)
+        fputc(tolower((unsigned char)*c), fp);
+    fprintf(fp, "Rules");
+}
+
+/**
+ * @brief Write how a line passing a test changes the rules alive.
+ * @param fp The output.
+ * @param test The test.
+ * @param all The rules of the mnemonic.
+ * @param indent The indentation.
+ */
+static void writeMasks(FILE *fp, const lineTest *test, const uint64_t all, const int indent)
+{
+    if (test->pass && test->fail)
+        fprintf(fp, "%*spass = (pass | 0x%llx) & 0x%llx;\n", indent, "", (unsigned long long)test->pass,
+                (unsigned long long)(all & ~test->fail));
+    else if (test->pass)
+        fprintf(fp, "%*spass |= 0x%llx;\n", indent, "", (unsigned long long)test->pass);
+    else
+        fprintf(fp, "%*spass &= 0x%llx;\n", indent, "", (unsigned long long)(all & ~test->fail));
+}
+
+/**
+ * @brief Write the tests of a line: each different test is evaluated
+ * once, on the lines of its mnemonic only.
+ * @param fp The output.
+ * @param group The rules.
+ * @param depth The index of the line after the first one.
+ */
+static void writeLine(FILE *fp, const ruleGroup *group, const int depth)
+{
+    lineTest tests[MAX_GROUP];
+    char classes[MAX_GROUP][MAXLEN_RULE];
+    uint64_t keep = 0, all = 0;
+    int ntests = 0, nclasses = 0;
+
+    /* The rules read further or end there, the guards pass unless tested */
+    for (int k = 0; k < group->count; k++)
+    {
+        const ruleDef *rule     = &rules[group->rules[k]];
+        const patternLine *line = &rule->pattern[depth];
+        int t;
+
+        all |= (uint64_t)1 << k;
+        if (depth >= rule->count || line->guard)
+            keep |= (uint64_t)1 << k;
+        if (depth >= rule->count)
+            continue;
+
+        for (t = 0; t < ntests; t++)
+        {
+            if (tests[t].test->prefix == line->prefix && strcmp(tests[t].test->text, line->text) == 0)
+                break;
+        }
+        if (t == ntests)
+        {
+            memset(&tests[ntests], 0, sizeof(lineTest));
+            tests[ntests].test = line;
+            if (depth == 0 || !testMnemonic(line, tests[ntests].mnemonic, MAXLEN_RULE))
+                tests[ntests].mnemonic[0] = '\0';
+            ntests += 1;
+        }
+        if (line->guard)
+            tests[t].fail |= (uint64_t)1 << k;
+        else
+            tests[t].pass |= (uint64_t)1 << k;
+    }
+    /* The tests of any line first, then a switch on the mnemonic */
+    for (int t = 0; t < ntests; t++)
+    {
+        int c;
+
+        for (c = 0; c < nclasses && strcmp(classes[c], tests[t].mnemonic) != 0; c++)
+            ;
+        if (c < nclasses)
+            continue;
+        if (!*tests[t].mnemonic && nclasses)
+        {
+            memmove(classes[1], classes[0], (size_t)nclasses * MAXLEN_RULE);
+            c = 0;
+        }
+        snprintf(classes[c], MAXLEN_RULE, "%s", tests[t].mnemonic);
+        nclasses += 1;
+    }
+
+    fprintf(fp, "\n        /* Line %d */\n        pass = 0x%llx;\n", depth, (unsigned long long)keep);
+    for (int c = 0; c < nclasses; c++)
+    {
+        int indent = 8, previous = -1;
+
+        if (*classes[c])
+        {
+            if (c == 0 || !*classes[c - 1])
+                fprintf(fp, "        switch (file->ins[i + %d].mnemonic)\n        {\n", depth);
+            fprintf(fp, "        case %s:\n", classes[c]);
+            indent = 12;
+        }
+        for (int t = 0; t < ntests; t++)
+        {
+            if (strcmp(tests[t].mnemonic, classes[c]) != 0)
+                continue;
+
+            /* A line equal to a text is not equal to another one */
+            fprintf(fp, "%*s%sif (", indent, "",
+                    previous >= 0 && !tests[previous].test->prefix && !tests[t].test->prefix ? "else " : "");
+            writeTest(fp, tests[t].test, depth);
+            fprintf(fp, ")\n");
+            writeMasks(fp, &tests[t], all, indent + 4);
+            previous = t;
+        }
+        if (indent == 12)
+            fprintf(fp, "            break;\n");
+    }
+    if (nclasses && *classes[nclasses - 1])
+        fprintf(fp, "        default:\n            break;\n        }\n");
+    fprintf(fp, "        if ((alive &= pass) == 0)\n            break;\n");
+}
+
+/**
+ * @brief Write the rules applied once a line is read: a rule matched
+ * applies if no rule before it is still alive.
+ * @param fp The output.
+ * @param group The rules.
+ * @param depth The index of the line after the first one.
+ */
+static void writeMatched(FILE *fp, const ruleGroup *group, const int depth)
+{
+    for (int k = 0; k < group->count; k++)
+    {
+        const ruleDef *rule = &rules[group->rules[k]];
+        uint64_t bit        = (uint64_t)1 << k;
+        int waiting         = 0;
+
+        /* Matched on this line, or before but a rule before it was alive */
+        for (int b = 0; b < k; b++)
+            waiting |= rules[group->rules[b]].count > depth;
+        if (rule->count > depth + 1 || (rule->count < depth + 1 && !waiting))
+            continue;
+
+        fprintf(fp, "        if ((alive & 0x%llx) == 0x%llx)\n        {\n", (unsigned long long)(bit | (bit - 1)),
+                (unsigned long long)bit);
+        writeReplacement(fp, rule, 12);
+        fprintf(fp, "        }\n");
+    }
+}
+
+/**
+ * @brief Write the automaton of the rules of a mnemonic: a set of rules
+ * alive (one bit each), the lines read one after the other until no rule
+ * is alive or the first rule alive has matched.
+ * @param fp The output.
+ * @param group The rules.
+ */
+static void writeGroup(FILE *fp, const ruleGroup *group)
+{
+    uint64_t all = 0;
+    int longest = 0, level = 1;
+
+    for (int k = 0; k < group->count; k++)
+    {
+        all |= (uint64_t)1 << k;
+        if (rules[group->rules[k]].count > longest)
+            longest = rules[group->rules[k]].count;
+    }
+
+    fprintf(fp, "    case %s:\n    {\n        uint64_t alive = 0x%llx, pass;\n", group->mnemonic,
+            (unsigned long long)all);
+
+    /* The rules of the levels not enabled are dead from the start */
+    for (int next = 0; next != INT32_MAX; level = next)
+    {
+        uint64_t enabled = 0;
+
+        next = INT32_MAX;
+        for (int k = 0; k < group->count; k++)
+        {
+            int l = rules[group->rules[k]].level;
+
+            if (l <= level)
+                enabled |= (uint64_t)1 << k;
+            else if (l < next)
+                next = l;
+        }
+        if (next != INT32_MAX)
+            fprintf(fp, "\n        if (level < %d)\n            alive &= 0x%llx;\n", next,
+                    (unsigned long long)enabled);
+    }
+
+    for (int depth = 0; depth < longest; depth++)
+    {
+        writeLine(fp, group, depth);
+        if (depth == 0)
+        {
+            /* The first line matched: the rules alive are attempted */
+            fprintf(fp, "        if (clock->stats)\n            tryRules(clock, alive, ");
+            writeGroupName(fp, group);
+            fprintf(fp, ");\n");
+        }
+        writeMatched(fp, group, depth);
+    }
+    fprintf(fp, "        break;\n    }\n\n");
+}
+
+/**
+ * @brief Add a file to the digest, with its name.
+ * @param path The path of the file.
+ */
+static void hashFile(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    int c;
+
+    if (fp == NULL)
+    {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    for (const char *p = path; *p; p++)
+        digest = (digest ^ (unsigned char)*p) * 1099511628211ULL;
+    while ((c = fgetc(fp)) != EOF)
+        digest = (digest ^ (unsigned char)c) * 1099511628211ULL;
+    fclose(fp);
+}
+
+/**
+ * @brief Write the matcher: rulesReach and matchRules functions.
+ * @param fp The output.
+ */
+static void writeMatcher(FILE *fp)
+{
+    int longest = 0, captures = 0;
+
+    for (int r = 0; r < nrules; r++)
+    {
+        if (rules[r].count - 1 > longest)
+            longest = rules[r].count - 1;
+        for (int l = 0; l < rules[r].written; l++)
+            captures |= strchr(rules[r].replacement[l], '{') != NULL;
+    }
+
+    fprintf(fp, "/*\n * Generated from %s by tools/rulegen.c, do not edit.\n */\n\n", source);
+    fprintf(fp, "#include \"rules.h\"\n\n");
+    fprintf(fp, "#if %d >= LOOKAHEAD_PAD\n#error \"a rule reads more lines than LOOKAHEAD_PAD\"\n#endif\n\n", longest);
+    fprintf(fp, "/*!\n * @brief Digest of the rules and of the optimizer sources (see cacheKey function).\n */\n");
+    fprintf(fp, "const char *const rulesDigest = \"%016llx\";\n\n", (unsigned long long)digest);
+
+    for (int g = 0; g < ngroups; g++)
+    {
+        fprintf(fp, "/*!\n * @brief The rules starting with %s, in order (bit k of the state is rule k).\n */\n",
+                groups[g].mnemonic);
+        fprintf(fp, "static const ruleId ");
+        writeGroupName(fp, &groups[g]);
+        fprintf(fp, "[] = {\n");
+        for (int k = 0; k < groups[g].count; k++)
+        {
+            fprintf(fp, "    ");
+            writeRuleId(fp, groups[g].rules[k]);
+            fprintf(fp, ",\n");
+        }
+        fprintf(fp, "};\n\n");
+    }
+
+    fprintf(fp, "/**\n * @brief Count an attempt of the rules alive once their first line matched\n"
+                " * (their tests are shared, the time is charged to the first one).\n"
+                " * @param clock The ruleClock structure.\n"
+                " * @param alive The rules alive (bit k for the rule k).\n"
+                " * @param ids The rules of the mnemonic.\n */\n");
+    fprintf(fp, "static void tryRules(ruleClock *clock, uint64_t alive, const ruleId *ids)\n{\n"
+                "    int first = 1;\n\n"
+                "    for (size_t k = 0; alive; k++, alive >>= 1)\n    {\n"
+                "        if (!(alive & 1))\n            continue;\n"
+                "        if (first)\n            ruleTry(clock, ids[k]);\n"
+                "        else\n            ruleCount(clock, ids[k]);\n"
+                "        first = 0;\n    }\n}\n\n");
+
+    fprintf(fp, "/**\n * @brief Number of lines the rules read after a line (see ruleReach function).\n"
+                " * @param mn The mnemonic of the line.\n * @return The number of lines.\n */\n");
+    fprintf(fp, "size_t rulesReach(const mnemonic mn)\n{\n    switch (mn)\n    {\n");
+    for (int g = 0; g < ngroups; g++)
+    {
+        int reach = 0;
+
+        for (int k = 0; k < groups[g].count; k++)
+        {
+            if (rules[groups[g].rules[k]].count - 1 > reach)
+                reach = rules[groups[g].rules[k]].count - 1;
+        }
+        fprintf(fp, "    case %s:\n        return %d;\n", groups[g].mnemonic, reach);
+    }
+    fprintf(fp, "    default:\n        return 0;\n    }\n}\n\n");
+
+    fprintf(fp, "/**\n * @brief Try the rules on a line, the first one matching is applied.\n"
+                " * @param file The asm file.\n * @param i The index of the line.\n"
+                " * @param level The optimization level (the rules of higher levels are not tried).\n"
+                " * @param out The asm file written (see optimizeChunk function).\n"
+                " * @param clock The ruleClock structure.\n"
+                " * @return The number of lines replaced (0 if no rule matched).\n */\n");
+    fprintf(fp, "size_t matchRules(const asmFile *file, const size_t i, const int level, asmFile *out, "
+                "ruleClock *clock)\n{\n");
+    if (captures)
+        fprintf(fp, "    char buf[MAXLEN_LINE];\n\n");
+    fprintf(fp, "    switch (file->ins[i].mnemonic)\n    {\n");
+    for (int g = 0; g < ngroups; g++)
+        writeGroup(fp, &groups[g]);
+    fprintf(fp, "    default:\n        break;\n    }\n\n    return 0;\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+    FILE *fp;
+
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s <rules.opt> <rules.c> [sources...]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    source = argv[1];
+    hashFile(source);
+    for (int k = 3; k < argc; k++)
+        hashFile(argv[k]);
+    readRules(source);
+    groupRules();
+
+    target = argv[2];
+    if ((fp = fopen(target, "w")) == NULL)
+    {
+        perror(target);
+        return EXIT_FAILURE;
+    }
+    writeMatcher(fp);
+    if (fclose(fp) != 0)
+    {
+        perror(target);
+        remove(target);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}